@@ -0,0 +1,187 @@
+//
+// Benchmark.cc
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Runs the registered scenarios and writes their results as JSON, to stdout or a file:
+//
+//     CBL_C_Benchmarks [--docs N] [--size BYTES] [--threads N] [--batch N]
+//                      [--blob-size BYTES] [--blobs N] [--listeners N] [--repeat N]
+//                      [--filter SUBSTRING] [--dir DIRECTORY] [--out FILE]
+
+#include "Benchmark.hh"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+#include <vector>
+
+using namespace std;
+
+
+namespace {
+    struct Scenario {
+        const char *name;
+        const char *api;
+        BenchmarkFunction fn;
+    };
+
+    vector<Scenario>& scenarios() {
+        static vector<Scenario> sScenarios;
+        return sScenarios;
+    }
+
+    const char* const kDatabaseName = "CBLbenchmark";
+}
+
+
+BenchmarkRegistration::BenchmarkRegistration(const char *name, const char *api,
+                                             BenchmarkFunction fn)
+{
+    scenarios().push_back({name, api, fn});
+}
+
+
+void benchmarkFailed(const char *what, const CBLError &error) {
+    char *message = CBLError_Message(&error);
+    fprintf(stderr, "FATAL: %s failed: %s (%d/%d)\n", what, message, error.domain, error.code);
+    free(message);
+    exit(1);
+}
+
+
+string benchmarkDocID(unsigned i) {
+    char docID[20];
+    snprintf(docID, sizeof(docID), "doc-%08u", i);
+    return docID;
+}
+
+
+string benchmarkDocJSON(const BenchmarkOptions &options, unsigned i) {
+    char json[200];
+    int len = snprintf(json, sizeof(json),
+                       "{\"n\":%u,\"name\":\"%s\",\"category\":%u,\"active\":%s,\"text\":\"",
+                       i, benchmarkDocID(i).c_str(), i % 100, (i % 2 ? "true" : "false"));
+    string result(json, len);
+    size_t padding = options.docSize > result.size() + 2 ? options.docSize - result.size() - 2 : 0;
+    for (size_t j = 0; j < padding; ++j)
+        result += char('a' + (i + j) % 26);
+    result += "\"}";
+    return result;
+}
+
+
+static bool parseArg(const char *flag, const char *value, BenchmarkOptions &options,
+                     string &filter, string &dir, string &out)
+{
+    if (!value)
+        return false;
+    unsigned long n = strtoul(value, nullptr, 10);
+    if      (!strcmp(flag, "--docs"))       options.docCount = unsigned(n);
+    else if (!strcmp(flag, "--size"))       options.docSize = n;
+    else if (!strcmp(flag, "--threads"))    options.threads = max(1u, unsigned(n));
+    else if (!strcmp(flag, "--batch"))      options.batchSize = max(1u, unsigned(n));
+    else if (!strcmp(flag, "--blob-size"))  options.blobSize = n;
+    else if (!strcmp(flag, "--blobs"))      options.blobCount = unsigned(n);
+    else if (!strcmp(flag, "--listeners"))  options.listeners = unsigned(n);
+    else if (!strcmp(flag, "--repeat"))     options.repeat = max(1u, unsigned(n));
+    else if (!strcmp(flag, "--filter"))     filter = value;
+    else if (!strcmp(flag, "--dir"))        dir = value;
+    else if (!strcmp(flag, "--out"))        out = value;
+    else                                    return false;
+    return true;
+}
+
+
+int main(int argc, const char *argv[]) {
+    BenchmarkOptions options;
+    string filter, dir = "/tmp/CBL_C_benchmarks", out;
+    for (int i = 1; i < argc; i += 2) {
+        if (!parseArg(argv[i], (i + 1 < argc ? argv[i+1] : nullptr), options, filter, dir, out)) {
+            fprintf(stderr, "Usage: %s [--docs N] [--size BYTES] [--threads N] [--batch N] "
+                            "[--blob-size BYTES] [--blobs N] [--listeners N] [--repeat N] "
+                            "[--filter SUBSTRING] [--dir DIRECTORY] [--out FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (mkdir(dir.c_str(), 0744) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Can't create directory %s: errno %d\n", dir.c_str(), errno);
+        return 1;
+    }
+    FILE *output = out.empty() ? stdout : fopen(out.c_str(), "w");
+    if (!output) {
+        fprintf(stderr, "Can't create %s: errno %d\n", out.c_str(), errno);
+        return 1;
+    }
+
+    CBLDatabaseConfiguration config = {dir.c_str()};
+    config.flags = kCBLDatabase_Create;
+
+    fprintf(output, "{\"options\":{\"docs\":%u,\"docSize\":%zu,\"threads\":%u,\"batch\":%u,"
+                    "\"blobSize\":%zu,\"blobs\":%u,\"listeners\":%u,\"repeat\":%u},\n"
+                    " \"results\":[",
+            options.docCount, options.docSize, options.threads, options.batchSize,
+            options.blobSize, options.blobCount, options.listeners, options.repeat);
+
+    const char *delimiter = "\n";
+    for (auto &scenario : scenarios()) {
+        string fullName = string(scenario.api) + "/" + scenario.name;
+        if (!filter.empty() && fullName.find(filter) == string::npos)
+            continue;
+        fprintf(stderr, "%-32s", fullName.c_str());
+
+        vector<double> times;
+        uint64_t ops = 0, bytes = 0;
+        for (unsigned r = 0; r < options.repeat; ++r) {
+            CBLError error;
+            if (!CBL_DeleteDatabase(kDatabaseName, config.directory, &error) && error.code != 0)
+                benchmarkFailed("deleting database", error);
+            CBLDatabase *db = CBLDatabase_Open(kDatabaseName, &config, &error);
+            check(db != nullptr, "opening database", error);
+
+            BenchmarkRun run(options, db);
+            scenario.fn(run);
+            times.push_back(run.seconds());
+            ops = run.ops();
+            bytes = run.bytes();
+
+            check(CBLDatabase_Close(db, &error), "closing database", error);
+            CBLDatabase_Release(db);
+        }
+
+        sort(times.begin(), times.end());
+        double median = times[times.size() / 2];
+        double opsPerSec = median > 0 ? ops / median : 0;
+        double mbPerSec = median > 0 ? bytes / median / 1.0e6 : 0;
+        fprintf(stderr, "%12.0f ops/sec  %10.2f us/op  %8.1f MB/sec\n",
+                opsPerSec, (ops ? median / ops * 1.0e6 : 0.0), mbPerSec);
+        fprintf(output, "%s  {\"name\":\"%s\",\"api\":\"%s\",\"ops\":%llu,\"bytes\":%llu,"
+                        "\"median_s\":%.6f,\"min_s\":%.6f,\"max_s\":%.6f,"
+                        "\"ops_per_sec\":%.1f,\"us_per_op\":%.3f,\"mb_per_sec\":%.2f}",
+                delimiter, scenario.name, scenario.api,
+                (unsigned long long)ops, (unsigned long long)bytes,
+                median, times.front(), times.back(),
+                opsPerSec, (ops ? median / ops * 1.0e6 : 0.0), mbPerSec);
+        delimiter = ",\n";
+    }
+    fprintf(output, "\n]}\n");
+    if (output != stdout)
+        fclose(output);
+
+    CBLError error;
+    CBL_DeleteDatabase(kDatabaseName, config.directory, &error);
+    return 0;
+}
@@ -0,0 +1,99 @@
+//
+// Benchmark.hh
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "CouchbaseLite.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+
+/** Parameters shared by all scenarios; set from the command line. */
+struct BenchmarkOptions {
+    unsigned docCount   {10000};        // Documents written/read per run
+    size_t   docSize    {1024};         // Approximate size of each document's JSON, in bytes
+    unsigned threads    {4};            // Threads used by the concurrent scenarios
+    unsigned batchSize  {1000};         // Documents per transaction in the batch scenarios
+    size_t   blobSize   {1 << 20};      // Size of each blob, in bytes
+    unsigned blobCount  {20};           // Blobs written/read per run
+    unsigned listeners  {100};          // Listeners registered in the notification scenarios
+    unsigned repeat     {5};            // Runs per scenario; results are the median
+};
+
+
+/** Passed to a scenario function. `db` is a new, empty database, which the scenario can fill
+    before calling `time` to run and measure the timed part. */
+class BenchmarkRun {
+public:
+    BenchmarkRun(const BenchmarkOptions &opts, CBLDatabase *database)
+    :options(opts), db(database) { }
+
+    const BenchmarkOptions& options;
+    CBLDatabase* const db;
+
+    /** Runs `fn`, recording its duration, and the number of operations and bytes it handled. */
+    template <class FN>
+    void time(uint64_t ops, uint64_t bytes, FN fn) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        _seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        _ops = ops;
+        _bytes = bytes;
+    }
+
+    double seconds() const                  {return _seconds;}
+    uint64_t ops() const                    {return _ops;}
+    uint64_t bytes() const                  {return _bytes;}
+
+private:
+    double _seconds {0};
+    uint64_t _ops {0}, _bytes {0};
+};
+
+
+using BenchmarkFunction = void (*)(BenchmarkRun&);
+
+
+/** Registers a scenario at static-initialization time; use the BENCHMARK macro. */
+struct BenchmarkRegistration {
+    BenchmarkRegistration(const char *name, const char *api, BenchmarkFunction);
+};
+
+#define BENCHMARK(ID, NAME, API) \
+    static void ID(BenchmarkRun&); \
+    static BenchmarkRegistration ID##_registration(NAME, API, ID); \
+    static void ID(BenchmarkRun &run)
+
+
+/** Aborts the benchmark, which can't produce meaningful results after an error. */
+[[noreturn]] void benchmarkFailed(const char *what, const CBLError &error);
+
+static inline void check(bool ok, const char *what, const CBLError &error) {
+    if (!ok)
+        benchmarkFailed(what, error);
+}
+
+
+/** Returns the JSON body of the `i`th test document: a few small properties plus a string
+    that pads it out to `options.docSize`. */
+std::string benchmarkDocJSON(const BenchmarkOptions&, unsigned i);
+
+/** Returns the ID of the `i`th test document. */
+std::string benchmarkDocID(unsigned i);
@@ -0,0 +1,302 @@
+//
+// CBenchmarks.cc
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Scenarios using the C API.
+
+#include "Benchmark.hh"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+
+// Creates an unsaved document with the test properties.
+static CBLDocument* newDoc(const BenchmarkOptions &options, unsigned i) {
+    CBLDocument *doc = CBLDocument_New(benchmarkDocID(i).c_str());
+    CBLError error;
+    check(CBLDocument_SetPropertiesAsJSON(doc, benchmarkDocJSON(options, i).c_str(), &error),
+          "setting properties", error);
+    return doc;
+}
+
+
+static void saveDoc(CBLDatabase *db, CBLDocument *doc) {
+    CBLError error;
+    const CBLDocument *saved = CBLDatabase_SaveDocument(db, doc,
+                                                        kCBLConcurrencyControlLastWriteWins,
+                                                        &error);
+    check(saved != nullptr, "saving document", error);
+    CBLDocument_Release(saved);
+}
+
+
+// Creates the test documents, untimed, for the scenarios that read them back.
+static void populate(const BenchmarkRun &run) {
+    CBLError error;
+    check(CBLDatabase_BeginBatch(run.db, &error), "beginning batch", error);
+    for (unsigned i = 0; i < run.options.docCount; ++i) {
+        CBLDocument *doc = newDoc(run.options, i);
+        saveDoc(run.db, doc);
+        CBLDocument_Release(doc);
+    }
+    check(CBLDatabase_EndBatch(run.db, &error), "ending batch", error);
+}
+
+
+static uint64_t totalDocBytes(const BenchmarkOptions &options) {
+    return uint64_t(options.docCount) * options.docSize;
+}
+
+
+#pragma mark - DOCUMENTS:
+
+
+// Saves each document in its own transaction.
+BENCHMARK(SaveSingle, "save-single", "C") {
+    vector<CBLDocument*> docs;
+    for (unsigned i = 0; i < run.options.docCount; ++i)
+        docs.push_back(newDoc(run.options, i));
+    run.time(docs.size(), totalDocBytes(run.options), [&]{
+        for (CBLDocument *doc : docs)
+            saveDoc(run.db, doc);
+    });
+    for (CBLDocument *doc : docs)
+        CBLDocument_Release(doc);
+}
+
+
+// Creates and saves documents in batches of `batchSize` per transaction.
+BENCHMARK(SaveBatch, "save-batch", "C") {
+    run.time(run.options.docCount, totalDocBytes(run.options), [&]{
+        CBLError error;
+        vector<CBLDocument*> docs;
+        vector<const CBLDocument*> saved;
+        for (unsigned i = 0; i < run.options.docCount; ) {
+            docs.clear();
+            for (unsigned n = 0; n < run.options.batchSize && i < run.options.docCount; ++n, ++i)
+                docs.push_back(newDoc(run.options, i));
+            saved.resize(docs.size());
+            check(CBLDatabase_SaveDocuments(run.db, docs.data(), docs.size(),
+                                            kCBLConcurrencyControlLastWriteWins,
+                                            saved.data(), &error) >= 0,
+                  "saving documents", error);
+            for (size_t j = 0; j < docs.size(); ++j) {
+                CBLDocument_Release(saved[j]);
+                CBLDocument_Release(docs[j]);
+            }
+        }
+    });
+}
+
+
+// Several threads saving documents at once, each in its own transaction.
+BENCHMARK(SaveConcurrent, "save-concurrent", "C") {
+    unsigned nThreads = run.options.threads;
+    unsigned perThread = run.options.docCount / nThreads;
+    vector<vector<CBLDocument*>> docs(nThreads);
+    for (unsigned t = 0; t < nThreads; ++t)
+        for (unsigned i = 0; i < perThread; ++i)
+            docs[t].push_back(newDoc(run.options, t * perThread + i));
+    run.time(uint64_t(perThread) * nThreads, uint64_t(perThread) * nThreads * run.options.docSize,
+             [&]{
+        vector<thread> threads;
+        for (unsigned t = 0; t < nThreads; ++t) {
+            threads.emplace_back([&, t]{
+                for (CBLDocument *doc : docs[t])
+                    saveDoc(run.db, doc);
+            });
+        }
+        for (auto &th : threads)
+            th.join();
+    });
+    for (auto &threadDocs : docs)
+        for (CBLDocument *doc : threadDocs)
+            CBLDocument_Release(doc);
+}
+
+
+// Reads each document by ID.
+BENCHMARK(Read, "read", "C") {
+    populate(run);
+    vector<string> docIDs;
+    for (unsigned i = 0; i < run.options.docCount; ++i)
+        docIDs.push_back(benchmarkDocID(i));
+    run.time(docIDs.size(), totalDocBytes(run.options), [&]{
+        for (auto &docID : docIDs) {
+            const CBLDocument *doc = CBLDatabase_GetDocument(run.db, docID.c_str());
+            if (!doc || !CBLDocument_Properties(doc))
+                abort();
+            CBLDocument_Release(doc);
+        }
+    });
+}
+
+
+// Several threads reading documents at once.
+BENCHMARK(ReadConcurrent, "read-concurrent", "C") {
+    populate(run);
+    unsigned nThreads = run.options.threads;
+    unsigned perThread = run.options.docCount / nThreads;
+    run.time(uint64_t(perThread) * nThreads, uint64_t(perThread) * nThreads * run.options.docSize,
+             [&]{
+        vector<thread> threads;
+        for (unsigned t = 0; t < nThreads; ++t) {
+            threads.emplace_back([&, t]{
+                for (unsigned i = 0; i < perThread; ++i) {
+                    string docID = benchmarkDocID(t * perThread + i);
+                    const CBLDocument *doc = CBLDatabase_GetDocument(run.db, docID.c_str());
+                    if (!doc)
+                        abort();
+                    CBLDocument_Release(doc);
+                }
+            });
+        }
+        for (auto &th : threads)
+            th.join();
+    });
+}
+
+
+#pragma mark - QUERIES:
+
+
+// Iterates all rows of a query, reading each column.
+BENCHMARK(QueryIterate, "query-iterate", "C") {
+    populate(run);
+    CBLError error;
+    CBLQuery *query = CBLQuery_New(run.db, kCBLN1QLLanguage,
+                                   "SELECT n, name, category FROM _ WHERE active = true OR "
+                                   "active = false", nullptr, &error);
+    check(query != nullptr, "compiling query", error);
+    uint64_t rows = 0;
+    run.time(run.options.docCount, 0, [&]{
+        CBLResultSet *rs = CBLQuery_Execute(query, &error);
+        check(rs != nullptr, "running query", error);
+        int64_t sum = 0;
+        while (CBLResultSet_Next(rs)) {
+            sum += FLValue_AsInt(CBLResultSet_ValueAtIndex(rs, 0));
+            sum += FLValue_AsString(CBLResultSet_ValueAtIndex(rs, 1)).size;
+            sum += FLValue_AsInt(CBLResultSet_ValueAtIndex(rs, 2));
+            ++rows;
+        }
+        CBLResultSet_Release(rs);
+        if (sum < 0)
+            abort();
+    });
+    if (rows != run.options.docCount)
+        abort();
+    CBLQuery_Release(query);
+}
+
+
+#pragma mark - BLOBS:
+
+
+static const size_t kBlobChunkSize = 64 * 1024;
+
+
+// Streams the blobs into the database, attaching each to a document.
+static void writeBlobs(const BenchmarkRun &run) {
+    vector<char> chunk(kBlobChunkSize);
+    for (unsigned b = 0; b < run.options.blobCount; ++b) {
+        CBLError error;
+        CBLBlobWriteStream *writer = CBLBlobWriter_New(run.db, &error);
+        check(writer != nullptr, "creating blob writer", error);
+        for (size_t pos = 0; pos < run.options.blobSize; pos += chunk.size()) {
+            for (size_t j = 0; j < chunk.size(); ++j)
+                chunk[j] = char(b + pos + j);           // unique content per blob
+            size_t len = min(chunk.size(), run.options.blobSize - pos);
+            check(CBLBlobWriter_Write(writer, chunk.data(), len, &error), "writing blob", error);
+        }
+        CBLBlob *blob = CBLBlob_CreateWithStream("application/octet-stream", writer);
+        CBLDocument *doc = CBLDocument_New(("blob-" + to_string(b)).c_str());
+        FLMutableDict_SetBlob(CBLDocument_MutableProperties(doc), FLStr("blob"), blob);
+        saveDoc(run.db, doc);
+        CBLDocument_Release(doc);
+        CBLBlob_Release(blob);
+    }
+}
+
+
+BENCHMARK(BlobWrite, "blob-write", "C") {
+    run.time(run.options.blobCount, uint64_t(run.options.blobCount) * run.options.blobSize, [&]{
+        writeBlobs(run);
+    });
+}
+
+
+BENCHMARK(BlobRead, "blob-read", "C") {
+    writeBlobs(run);
+    vector<char> chunk(kBlobChunkSize);
+    uint64_t total = 0;
+    run.time(run.options.blobCount, uint64_t(run.options.blobCount) * run.options.blobSize, [&]{
+        for (unsigned b = 0; b < run.options.blobCount; ++b) {
+            CBLError error;
+            const CBLDocument *doc = CBLDatabase_GetDocument(run.db,
+                                                             ("blob-" + to_string(b)).c_str());
+            const CBLBlob *blob = FLValue_GetBlob(FLDict_Get(CBLDocument_Properties(doc),
+                                                             FLStr("blob")));
+            CBLBlobReadStream *reader = CBLBlob_OpenContentStream(blob, &error);
+            check(reader != nullptr, "opening blob", error);
+            int n;
+            while ((n = CBLBlobReader_Read(reader, chunk.data(), chunk.size(), &error)) > 0)
+                total += n;
+            check(n == 0, "reading blob", error);
+            CBLBlobReader_Close(reader);
+            CBLBlob_Release(blob);
+            CBLDocument_Release(doc);
+        }
+    });
+    if (total != uint64_t(run.options.blobCount) * run.options.blobSize)
+        abort();
+}
+
+
+#pragma mark - NOTIFICATIONS:
+
+
+// Saves documents with `listeners` change listeners registered, until all have been notified.
+BENCHMARK(ListenerFanout, "listener-fanout", "C") {
+    atomic<uint64_t> notified {0};
+    auto listener = [](void *context, const CBLDatabase*, unsigned nDocs, const char**) {
+        *(atomic<uint64_t>*)context += nDocs;
+    };
+    vector<CBLListenerToken*> tokens;
+    for (unsigned l = 0; l < run.options.listeners; ++l)
+        tokens.push_back(CBLDatabase_AddChangeListener(run.db, listener, &notified));
+    uint64_t expected = uint64_t(run.options.docCount) * run.options.listeners;
+
+    vector<CBLDocument*> docs;
+    for (unsigned i = 0; i < run.options.docCount; ++i)
+        docs.push_back(newDoc(run.options, i));
+    run.time(expected, 0, [&]{
+        for (CBLDocument *doc : docs)
+            saveDoc(run.db, doc);
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(60);
+        while (notified < expected && chrono::steady_clock::now() < deadline)
+            this_thread::yield();
+    });
+    if (notified != expected)
+        abort();
+    for (CBLDocument *doc : docs)
+        CBLDocument_Release(doc);
+    for (auto token : tokens)
+        CBLListener_Remove(token);
+}
@@ -0,0 +1,171 @@
+//
+// CppBenchmarks.cc
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// The same scenarios as CBenchmarks.cc, using the cbl++ wrapper, so that comparing the two
+// shows the wrapper's overhead.
+
+#include "Benchmark.hh"
+#include "cbl++/CouchbaseLite.hh"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace fleece;
+using namespace cbl;
+
+
+static MutableDocument newDoc(const BenchmarkOptions &options, unsigned i) {
+    MutableDocument doc(benchmarkDocID(i).c_str());
+    CBLError error;
+    check(CBLDocument_SetPropertiesAsJSON(doc.ref(), benchmarkDocJSON(options, i).c_str(),
+                                          &error),
+          "setting properties", error);
+    return doc;
+}
+
+
+// Opens the run's database with the wrapper, and turns a CBLError it throws into a failure.
+template <class FN>
+static void withDatabase(BenchmarkRun &run, FN fn) {
+    try {
+        Database db(CBLDatabase_Name(run.db), CBLDatabase_Config(run.db));
+        fn(db);
+    } catch (const CBLError &error) {
+        benchmarkFailed("cbl++ call", error);
+    }
+}
+
+
+static void populate(const BenchmarkOptions &options, Database &db) {
+    CBLError error;
+    check(CBLDatabase_BeginBatch(db.ref(), &error), "beginning batch", error);
+    for (unsigned i = 0; i < options.docCount; ++i) {
+        MutableDocument doc = newDoc(options, i);
+        db.saveDocument(doc, kCBLConcurrencyControlLastWriteWins);
+    }
+    check(CBLDatabase_EndBatch(db.ref(), &error), "ending batch", error);
+}
+
+
+#pragma mark - DOCUMENTS:
+
+
+BENCHMARK(CppSaveSingle, "save-single", "C++") {
+    withDatabase(run, [&](Database &db) {
+        vector<MutableDocument> docs;
+        for (unsigned i = 0; i < run.options.docCount; ++i)
+            docs.push_back(newDoc(run.options, i));
+        run.time(docs.size(), uint64_t(docs.size()) * run.options.docSize, [&]{
+            for (MutableDocument &doc : docs)
+                db.saveDocument(doc, kCBLConcurrencyControlLastWriteWins);
+        });
+    });
+}
+
+
+BENCHMARK(CppSaveBatch, "save-batch", "C++") {
+    withDatabase(run, [&](Database &db) {
+        run.time(run.options.docCount, uint64_t(run.options.docCount) * run.options.docSize, [&]{
+            vector<MutableDocument> docs;
+            for (unsigned i = 0; i < run.options.docCount; ) {
+                docs.clear();
+                for (unsigned n = 0; n < run.options.batchSize && i < run.options.docCount;
+                        ++n, ++i)
+                    docs.push_back(newDoc(run.options, i));
+                db.saveDocuments(docs, kCBLConcurrencyControlLastWriteWins);
+            }
+        });
+    });
+}
+
+
+BENCHMARK(CppRead, "read", "C++") {
+    withDatabase(run, [&](Database &db) {
+        populate(run.options, db);
+        vector<string> docIDs;
+        for (unsigned i = 0; i < run.options.docCount; ++i)
+            docIDs.push_back(benchmarkDocID(i));
+        run.time(docIDs.size(), uint64_t(docIDs.size()) * run.options.docSize, [&]{
+            for (auto &docID : docIDs) {
+                Document doc = db.getDocument(docID.c_str());
+                if (!doc || !doc.properties())
+                    abort();
+            }
+        });
+    });
+}
+
+
+#pragma mark - QUERIES:
+
+
+BENCHMARK(CppQueryIterate, "query-iterate", "C++") {
+    withDatabase(run, [&](Database &db) {
+        populate(run.options, db);
+        Query query(db, kCBLN1QLLanguage,
+                    "SELECT n, name, category FROM _ WHERE active = true OR active = false");
+        Column n = query.column("n"), name = query.column("name"),
+               category = query.column("category");
+        uint64_t rows = 0;
+        run.time(run.options.docCount, 0, [&]{
+            int64_t sum = 0;
+            for (const Result &result : query.execute()) {
+                sum += result[n].asInt();
+                sum += result[name].asString().size;
+                sum += result[category].asInt();
+                ++rows;
+            }
+            if (sum < 0)
+                abort();
+        });
+        if (rows != run.options.docCount)
+            abort();
+    });
+}
+
+
+#pragma mark - NOTIFICATIONS:
+
+
+BENCHMARK(CppListenerFanout, "listener-fanout", "C++") {
+    withDatabase(run, [&](Database &db) {
+        atomic<uint64_t> notified {0};
+        vector<Database::Listener> listeners;
+        for (unsigned l = 0; l < run.options.listeners; ++l) {
+            listeners.push_back(db.addListener([&](Database, const vector<const char*> &docIDs) {
+                notified += docIDs.size();
+            }));
+        }
+        uint64_t expected = uint64_t(run.options.docCount) * run.options.listeners;
+
+        vector<MutableDocument> docs;
+        for (unsigned i = 0; i < run.options.docCount; ++i)
+            docs.push_back(newDoc(run.options, i));
+        run.time(expected, 0, [&]{
+            for (MutableDocument &doc : docs)
+                db.saveDocument(doc, kCBLConcurrencyControlLastWriteWins);
+            auto deadline = chrono::steady_clock::now() + chrono::seconds(60);
+            while (notified < expected && chrono::steady_clock::now() < deadline)
+                this_thread::yield();
+        });
+        if (notified != expected)
+            abort();
+    });
+}
@@ -19,6 +19,7 @@
 #pragma once
 #include "CBLBase.h"
 #include <algorithm>
+#include <cassert>
 #include <functional>
 #include <memory>
 
@@ -44,10 +45,11 @@ namespace cbl {
         }
 
         RefCounted& operator= (RefCounted &&other) noexcept {
-            if (other._ref != _ref) {
-                CBL_Release(_ref);
+            if (&other != this) {
+                CBLRefCounted *old = _ref;
                 _ref = other._ref;
                 other._ref = nullptr;
+                CBL_Release(old);
             }
             return *this;
         }
@@ -81,6 +83,7 @@ public: \
     bool valid() const                            {return _ref != nullptr;} \
     explicit operator bool() const                {return valid();} \
     bool operator==(const CLASS &other) const     {return _ref == other._ref;} \
+    bool operator!=(const CLASS &other) const     {return _ref != other._ref;} \
     C_TYPE* ref() const                           {return (C_TYPE*)_ref;}\
 protected: \
     explicit CLASS(C_TYPE* ref)                   :SUPER((CBLRefCounted*)ref) { }
@@ -102,22 +105,24 @@ protected: \
         :_callback(new Callback(cb))
         { }
 
-        ListenerToken(ListenerToken &&other)
+        ListenerToken(ListenerToken &&other) noexcept
         :_token(other._token),
         _callback(std::move(other._callback))
         {other._token = nullptr;}
 
-        ListenerToken& operator=(ListenerToken &&other) {
-            CBLListener_remove(_token);
-            _token = other._token;
-            _callback = other._callback;
-            other._token = nullptr;
+        ListenerToken& operator=(ListenerToken &&other) noexcept {
+            if (&other != this) {
+                CBLListener_Remove(_token);
+                _token = other._token;
+                _callback = std::move(other._callback);
+                other._token = nullptr;
+            }
             return *this;
         }
 
         /** Unregisters the listener early, before it leaves scope. */
         void remove() {
-            CBLListener_remove(_token);
+            CBLListener_Remove(_token);
             _token = nullptr;
             _callback = nullptr;
         }
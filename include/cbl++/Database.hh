@@ -20,7 +20,9 @@
 #include "Base.hh"
 #include "CBLDatabase.h"
 #include "CBLDocument.h"
+#include "fleece/Fleece.hh"
 #include <functional>
+#include <memory>
 #include <vector>
 
 // PLEASE NOTE: This C++ wrapper API is provided as a convenience only.
@@ -106,9 +108,46 @@ namespace cbl {
         inline Document getDocument(const char *id _cbl_nonnull) const;
         inline MutableDocument getMutableDocument(const char *id _cbl_nonnull) const;
 
+        /** Reads multiple documents at once. The returned vector has one item per ID;
+            a missing document is represented by an invalid Document. */
+        inline std::vector<Document> getDocuments(const std::vector<const char*> &ids) const;
+
+        using PropertiesCallback = std::function<void(const char *docID, fleece::Dict)>;
+
+        /** Calls the callback with a document's properties, without creating a Document object.
+            The properties are only valid during the callback.
+            Returns false (without calling the callback) if the document doesn't exist. */
+        bool withDocumentProperties(const char *id _cbl_nonnull, PropertiesCallback cb) const {
+            return CBLDatabase_WithDocumentProperties(ref(), id,
+                                        [](void *context, const char *docID, FLDict properties) {
+                                            (*(PropertiesCallback*)context)(docID, properties);
+                                        }, &cb);
+        }
+
         inline Document saveDocument(MutableDocument &doc,
                                      CBLConcurrencyControl c = kCBLConcurrencyControlFailOnConflict);
 
+        /** Saves multiple documents in a single transaction. The returned vector has one item per
+            input document; a document that had a conflict is represented by an invalid Document. */
+        inline std::vector<Document> saveDocuments(std::vector<MutableDocument> &docs,
+                                     CBLConcurrencyControl c = kCBLConcurrencyControlFailOnConflict);
+
+        /** Called with the result of `saveDocumentAsync`: the saved document, or else an
+            invalid Document and the error. */
+        using SaveCallback = std::function<void(Document saved, const CBLError *error)>;
+
+        /** Saves a document on an I/O thread, then calls the callback; see
+            \ref CBLDatabase_SaveDocumentAsync. */
+        inline void saveDocumentAsync(MutableDocument &doc, CBLConcurrencyControl c,
+                                      SaveCallback callback);
+
+        /** Called with the result of `getDocumentAsync`; an invalid Document if it's missing. */
+        using GetCallback = std::function<void(Document)>;
+
+        /** Reads a document on an I/O thread, then calls the callback; see
+            \ref CBLDatabase_GetDocumentAsync. */
+        inline void getDocumentAsync(const char *id _cbl_nonnull, GetCallback callback) const;
+
         time_t getDocumentExpiration(const char *docID) const {
             CBLError error;
             time_t exp = CBLDatabase_GetDocumentExpiration(ref(), docID, &error);
@@ -136,6 +175,29 @@ namespace cbl {
             return l;
         }
 
+        /** Registers a listener that's called less often, with changes collected over time. */
+        [[nodiscard]] Listener addCoalescedListener(const CBLChangeCoalescingOptions &options,
+                                                    Listener::Callback f)
+        {
+            auto l = Listener(f);
+            l.setToken( CBLDatabase_AddCoalescedChangeListener(ref(), &options, &_callListener,
+                                                               l.context()) );
+            return l;
+        }
+
+
+        /** A listener that's given the range of sequences that changed, and the change count. */
+        using RangeListener = cbl::ListenerToken<Database,uint64_t,uint64_t,unsigned>;
+
+        [[nodiscard]] RangeListener addRangeListener(const CBLChangeCoalescingOptions &options,
+                                                     RangeListener::Callback f)
+        {
+            auto l = RangeListener(f);
+            l.setToken( CBLDatabase_AddChangeRangeListener(ref(), &options, &_callRangeListener,
+                                                           l.context()) );
+            return l;
+        }
+
 
         using DocumentListener = cbl::ListenerToken<Database,const char*>;
 
@@ -170,6 +232,12 @@ namespace cbl {
             Listener::call(context, Database((CBLDatabase*)db), vec);
         }
 
+        static void _callRangeListener(void *context, const CBLDatabase *db,
+                                       uint64_t firstSeq, uint64_t lastSeq, unsigned nChanges)
+        {
+            RangeListener::call(context, Database((CBLDatabase*)db), firstSeq, lastSeq, nChanges);
+        }
+
         static void _callDocListener(void *context, const CBLDatabase *db, const char *docID) {
             DocumentListener::call(context, Database((CBLDatabase*)db), docID);
         }
@@ -107,12 +107,37 @@ namespace cbl {
     };
 
 
+    /** Allocates the documents created on this thread in an arena while it's in scope.
+        See \ref CBLArena_Begin. */
+    class DocumentArena {
+    public:
+        explicit DocumentArena(size_t chunkSize =0)     :_arena(CBLArena_Begin(chunkSize)) { }
+        ~DocumentArena()                                {CBLArena_End(_arena);}
+
+        DocumentArena(const DocumentArena&) =delete;
+        DocumentArena& operator=(const DocumentArena&) =delete;
+
+    private:
+        CBLArena* const _arena;
+    };
+
+
     // Database method bodies:
 
     inline Document Database::getDocument(const char *id _cbl_nonnull) const {
         return Document::adopt(CBLDatabase_GetDocument(ref(), id));
     }
 
+    inline std::vector<Document> Database::getDocuments(const std::vector<const char*> &ids) const {
+        std::vector<const CBLDocument*> docs(ids.size());
+        CBLDatabase_GetDocuments(ref(), ids.data(), ids.size(), docs.data());
+        std::vector<Document> results;
+        results.reserve(docs.size());
+        for (auto d : docs)
+            results.push_back(Document::adopt(d));
+        return results;
+    }
+
     inline MutableDocument Database::getMutableDocument(const char *id _cbl_nonnull) const {
         return MutableDocument::adopt(CBLDatabase_GetMutableDocument(ref(), id));
     }
@@ -126,6 +151,47 @@ namespace cbl {
     }
 
 
+    inline std::vector<Document> Database::saveDocuments(std::vector<MutableDocument> &docs,
+                                                         CBLConcurrencyControl c)
+    {
+        std::vector<CBLDocument*> refs;
+        refs.reserve(docs.size());
+        for (auto &doc : docs)
+            refs.push_back(doc.ref());
+        std::vector<const CBLDocument*> saved(docs.size());
+        CBLError error;
+        check(CBLDatabase_SaveDocuments(ref(), refs.data(), refs.size(), c,
+                                        saved.data(), &error) >= 0, error);
+        std::vector<Document> results;
+        results.reserve(saved.size());
+        for (auto d : saved)
+            results.push_back(Document::adopt(d));
+        return results;
+    }
+
+
+    inline void Database::saveDocumentAsync(MutableDocument &doc, CBLConcurrencyControl c,
+                                            SaveCallback callback)
+    {
+        CBLDatabase_SaveDocumentAsync(ref(), doc.ref(), c,
+                                      [](void *context, const CBLDocument *saved,
+                                         const CBLError *error) {
+            std::unique_ptr<SaveCallback> cb((SaveCallback*)context);
+            (*cb)(Document((CBLRefCounted*)saved), error);
+        }, new SaveCallback(std::move(callback)));
+    }
+
+
+    inline void Database::getDocumentAsync(const char *id _cbl_nonnull,
+                                           GetCallback callback) const
+    {
+        CBLDatabase_GetDocumentAsync(ref(), id, [](void *context, const CBLDocument *doc) {
+            std::unique_ptr<GetCallback> cb((GetCallback*)context);
+            (*cb)(Document((CBLRefCounted*)doc));
+        }, new GetCallback(std::move(callback)));
+    }
+
+
     inline MutableDocument Document::mutableCopy() const {
         return MutableDocument::adopt(CBLDocument_MutableCopy(ref()));
     }
@@ -19,6 +19,7 @@
 #pragma once
 #include "Database.hh"
 #include "CBLQuery.h"
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -29,6 +30,15 @@
 namespace cbl {
     class ResultSet;
     class ResultSetIterator;
+    class ResultBatchRange;
+
+
+    /** A result column, looked up by name once with \ref Query::column, that can then be used
+        to get that column's value from each Result without looking up the name again. */
+    struct Column {
+        unsigned index;
+    };
+
 
     /** A database query. */
     class Query : private RefCounted {
@@ -40,35 +50,78 @@ namespace cbl {
             _ref = (CBLRefCounted*)q;
         }
 
+        unsigned columnCount() const                {return CBLQuery_ColumnCount(ref());}
+        fleece::slice columnName(unsigned i) const  {return CBLQuery_ColumnName(ref(), i);}
         inline std::vector<std::string> columnNames() const;
 
+        /** Returns the column with this name; throws std::invalid_argument if there isn't one. */
+        inline Column column(const char *name _cbl_nonnull) const;
+
         void setParameters(fleece::Dict parameters) {CBLQuery_SetParameters(ref(), parameters);}
         fleece::Dict parameters() const             {return CBLQuery_Parameters(ref());}
 
+        void setParameter(const char *name _cbl_nonnull, int value) {
+            CBLQuery_SetParameterInt(ref(), name, value);}
+        void setParameter(const char *name _cbl_nonnull, int64_t value) {
+            CBLQuery_SetParameterInt(ref(), name, value);}
+        void setParameter(const char *name _cbl_nonnull, double value) {
+            CBLQuery_SetParameterDouble(ref(), name, value);}
+        void setParameter(const char *name _cbl_nonnull, fleece::slice value) {
+            CBLQuery_SetParameterString(ref(), name, value);}
+        void setParameter(const char *name _cbl_nonnull, fleece::Value value) {
+            CBLQuery_SetParameterValue(ref(), name, value);}
+
         inline ResultSet execute();
+        inline ResultSet execute(fleece::Dict parameters);
+
+        /** Called with the result of `executeAsync`: the results, or else an empty ResultSet
+            and the error. */
+        using ExecuteCallback = std::function<void(ResultSet, const CBLError *error)>;
+
+        /** Runs the query on an I/O thread, then calls the callback; see
+            \ref CBLQuery_ExecuteAsync. */
+        inline void executeAsync(ExecuteCallback callback);
+
+        /** Runs the query, passing its results as chunks of NDJSON text to the callback, which
+            returns false to stop. Returns the number of rows written. */
+        using JSONWriter = std::function<bool(fleece::slice chunk)>;
+        inline int64_t executeToJSON(JSONWriter, CBLJSONRowFormat = kCBLJSONRowArrays,
+                                     size_t chunkSize = 0);
 
         std::string explain()   {return fleece::alloc_slice(CBLQuery_Explain(ref())).asString();}
 
-        using ChangeListener = cbl::ListenerToken<CBLQuery, CBLResultSet, CBLError*>;
-        [[nodiscard]] ChangeListener addChangeListener(ChangeListener::Callback);
+        using ChangeListener = cbl::ListenerToken<Query>;
+
+        [[nodiscard]] ChangeListener addChangeListener(ChangeListener::Callback f) {
+            auto l = ChangeListener(f);
+            l.setToken( CBLQuery_AddChangeListener(ref(), &_callListener, l.context()) );
+            return l;
+        }
+
+    private:
+        static void _callListener(void *context, CBLQuery *query) {
+            ChangeListener::call(context, Query(query));
+        }
 
         CBL_REFCOUNTED_BOILERPLATE(Query, RefCounted, CBLQuery)
     };
 
 
-    /** A single query result; ResultSet::iterator iterates over these. */
+    /** A single query result; ResultSet::iterator iterates over these.
+        It's only valid until the iterator advances. */
     class Result {
     public:
-        fleece::Value valueAtIndex(unsigned i) {
+        fleece::Value valueAtIndex(unsigned i) const {
             return CBLResultSet_ValueAtIndex(_ref, i);
         }
 
-        fleece::Value valueForKey(const char *key _cbl_nonnull) {
+        fleece::Value valueForKey(const char *key _cbl_nonnull) const {
             return CBLResultSet_ValueForKey(_ref, key);
         }
 
-        fleece::Value operator[](unsigned i)                    {return valueAtIndex(i);}
-        fleece::Value operator[](const char *key _cbl_nonnull)  {return valueForKey(key);}
+        fleece::Value operator[](unsigned i) const                  {return valueAtIndex(i);}
+        fleece::Value operator[](Column col) const                  {return valueAtIndex(col.index);}
+        fleece::Value operator[](const char *key _cbl_nonnull) const {return valueForKey(key);}
 
     protected:
         explicit Result(CBLResultSet *ref)                      :_ref(ref) { }
@@ -77,13 +130,47 @@ namespace cbl {
     };
 
 
-    /** The results of a query. The only access to the individual Results is to iterate them. */
+    /** A block of consecutive query results, fetched all at once by ResultSet::nextBatch.
+        The values are valid as long as the ResultSet they came from. */
+    class ResultBatch {
+    public:
+        unsigned rowCount() const                               {return _rowCount;}
+        unsigned columnCount() const                            {return _columnCount;}
+
+        fleece::Value value(unsigned row, unsigned col) const {
+            return _cells[row * _columnCount + col];
+        }
+
+        /** The values of one row, as a C array of `columnCount` values. */
+        const FLValue* row(unsigned row) const                  {return &_cells[row * _columnCount];}
+
+    private:
+        std::vector<FLValue> _cells;
+        unsigned _rowCount {0}, _columnCount {0};
+        friend class ResultSet;
+    };
+
+
+    /** The results of a query. The only access to the individual Results is to iterate them:
+        `for (const Result &result : query.execute()) {...}`
+        The iteration doesn't allocate memory or change reference counts; the iterator uses
+        the ResultSet's reference, so the ResultSet must stay in scope while it's in use. */
     class ResultSet : private RefCounted {
     public:
         using iterator = ResultSetIterator;
+
+        /** Starts iterating the results. Can only be called once. */
         inline iterator begin();
         inline iterator end();
 
+        /** Reads up to `maxRows` results into `batch`. Returns false at the end. */
+        inline bool nextBatch(unsigned maxRows, ResultBatch &batch);
+
+        /** Returns a range that iterates the results in batches of up to `rowsPerBatch` rows:
+            `for (const ResultBatch &batch : results.batches(1000)) {...}`
+            Like `begin()`, this can only be called once. */
+        inline ResultBatchRange batches(unsigned rowsPerBatch);
+
     private:
         static ResultSet adopt(const CBLResultSet *d) {
             ResultSet rs;
@@ -91,6 +178,8 @@ namespace cbl {
             return rs;
         }
 
+        bool _iterated {false};
+
         friend class Query;
         CBL_REFCOUNTED_BOILERPLATE(ResultSet, RefCounted, CBLResultSet)
     };
@@ -99,20 +188,67 @@ namespace cbl {
     // implementation of ResultSet::iterator
     class ResultSetIterator {
     public:
-        Result operator->() const {return Result(_rs.ref());}
+        const Result& operator*() const                     {return _result;}
+        const Result* operator->() const                    {return &_result;}
 
-        bool operator== (const ResultSetIterator &i) const {return _rs == i._rs;}
+        bool operator== (const ResultSetIterator &i) const  {return _result._ref == i._result._ref;}
+        bool operator!= (const ResultSetIterator &i) const  {return !(*this == i);}
 
         ResultSetIterator& operator++() {
-            if (!CBLResultSet_Next(_rs.ref()))
-                _rs = ResultSet{};
+            if (!CBLResultSet_Next(_result._ref))
+                _result._ref = nullptr;
+            return *this;
+        }
+    protected:
+        ResultSetIterator()                                 :_result(nullptr) { }
+        explicit ResultSetIterator(CBLResultSet *rs)        :_result(rs) {++(*this);}
+
+        Result _result;                                     // Not a reference; the ResultSet owns it
+        friend class ResultSet;
+    };
+
+
+
+    // implementation of ResultSet::batches
+    class ResultBatchIterator {
+    public:
+        const ResultBatch& operator*() const                {return _batch;}
+        const ResultBatch* operator->() const               {return &_batch;}
+
+        bool operator== (const ResultBatchIterator &i) const {return _rs == i._rs;}
+        bool operator!= (const ResultBatchIterator &i) const {return !(*this == i);}
+
+        ResultBatchIterator& operator++() {
+            if (!_rs.nextBatch(_rowsPerBatch, _batch))
+                _rs = nullptr;
             return *this;
         }
     protected:
-        ResultSetIterator()                                 :_rs() { }
-        explicit ResultSetIterator(ResultSet rs)            :_rs(rs) { }
+        ResultBatchIterator()                               { }
+        ResultBatchIterator(ResultSet rs, unsigned rowsPerBatch)
+        :_rs(rs)
+        ,_rowsPerBatch(rowsPerBatch)
+        {
+            ++(*this);
+        }
+
+        ResultSet _rs;
+        unsigned _rowsPerBatch {0};
+        ResultBatch _batch;
+        friend class ResultBatchRange;
+    };
+
+
+    class ResultBatchRange {
+    public:
+        ResultBatchIterator begin()                         {return ResultBatchIterator(_rs, _rowsPerBatch);}
+        ResultBatchIterator end()                           {return ResultBatchIterator();}
+    private:
+        ResultBatchRange(ResultSet rs, unsigned rowsPerBatch)
+        :_rs(rs), _rowsPerBatch(rowsPerBatch) { }
 
         ResultSet _rs;
+        unsigned _rowsPerBatch;
         friend class ResultSet;
     };
 
@@ -133,6 +269,16 @@ namespace cbl {
     }
 
 
+    inline Column Query::column(const char *name) const {
+        unsigned n = columnCount();
+        for (unsigned i = 0; i < n ; ++i) {
+            if (columnName(i) == fleece::slice(name))
+                return Column{i};
+        }
+        throw std::invalid_argument("no such query column");
+    }
+
+
     inline ResultSet Query::execute() {
         CBLError error;
         auto rs = CBLQuery_Execute(ref(), &error);
@@ -141,15 +287,58 @@ namespace cbl {
     }
 
 
+    inline ResultSet Query::execute(fleece::Dict parameters) {
+        CBLError error;
+        auto rs = CBLQuery_ExecuteWithParameters(ref(), parameters, &error);
+        check(rs, error);
+        return ResultSet::adopt(rs);
+    }
+
+
+    inline void Query::executeAsync(ExecuteCallback callback) {
+        CBLQuery_ExecuteAsync(ref(), [](void *context, CBLQuery*, CBLResultSet *rs,
+                                        const CBLError *error) {
+            std::unique_ptr<ExecuteCallback> cb((ExecuteCallback*)context);
+            (*cb)(ResultSet::adopt(rs ? CBLResultSet_Retain(rs) : nullptr), error);
+        }, new ExecuteCallback(std::move(callback)));
+    }
+
+
+    inline int64_t Query::executeToJSON(JSONWriter writer, CBLJSONRowFormat format,
+                                        size_t chunkSize)
+    {
+        CBLJSONStreamOptions options = {format, chunkSize};
+        CBLError error;
+        auto n = CBLQuery_ExecuteToJSONStream(ref(), [](void *context, FLSlice chunk) {
+            return (*(JSONWriter*)context)(chunk);
+        }, &writer, &options, &error);
+        check(n >= 0, error);
+        return n;
+    }
+
+
     inline ResultSet::iterator ResultSet::begin()  {
-        if (!_ref) throw std::logic_error("begin() can only be called once");//FIX error class
-        auto i = iterator(*this);
-        _ref = nullptr;
-        return i;
+        if (!_ref || _iterated) throw std::logic_error("begin() can only be called once");
+        _iterated = true;
+        return iterator(ref());
     }
 
     inline ResultSet::iterator ResultSet::end() {
         return iterator();
     }
 
+    inline bool ResultSet::nextBatch(unsigned maxRows, ResultBatch &batch) {
+        batch._columnCount = CBLQuery_ColumnCount(CBLResultSet_GetQuery(ref()));
+        batch._cells.resize(size_t(maxRows) * batch._columnCount);
+        batch._rowCount = CBLResultSet_NextBatch(ref(), maxRows, false, batch._cells.data());
+        return batch._rowCount > 0;
+    }
+
+    inline ResultBatchRange ResultSet::batches(unsigned rowsPerBatch) {
+        if (!_ref) throw std::logic_error("batches() can only be called once");
+        ResultBatchRange range(*this, rowsPerBatch);
+        clear();
+        return range;
+    }
+
 }
@@ -199,6 +199,12 @@ void CBL_DumpInstances(void) CBLAPI;
      @{ */
 /** A connection to an open database. */
 typedef struct CBLDatabase   CBLDatabase;
+
+/** A set of read-only connections to a database, for running queries in parallel. */
+typedef struct CBLDatabasePool CBLDatabasePool;
+
+/** A compaction of a database, running in the background. */
+typedef struct CBLCompaction CBLCompaction;
 /** @} */
 
 /** \defgroup documents  Documents
@@ -223,12 +229,18 @@ typedef struct CBLQuery      CBLQuery;
 
 /** An iterator over the rows resulting from running a query. */
 typedef struct CBLResultSet  CBLResultSet;
+
+/** A background task that creates database indexes. */
+typedef struct CBLIndexBuild CBLIndexBuild;
 /** @} */
 
 /** \defgroup replication  Replication
      @{ */
 /** A background task that syncs a \ref CBLDatabase with a remote server or peer. */
 typedef struct CBLReplicator CBLReplicator;
+
+/** A scheduler that limits how many of a set of replicators run at once. */
+typedef struct CBLReplicatorGroup CBLReplicatorGroup;
 /** @} */
 
 
@@ -100,6 +100,27 @@ extern "C" {
         @warning  This can potentially allocate a very large heap block! */
     FLSliceResult CBLBlob_LoadContent(const CBLBlob* _cbl_nonnull, CBLError *outError) CBLAPI;
 
+    /** A read-only view of a blob's content, returned by \ref CBLBlob_MapContent. */
+    typedef struct CBLBlobMapping CBLBlobMapping;
+
+    /** Makes a blob's content available in memory without copying it, by memory-mapping the
+        blob's file. The pages can be passed directly to `writev`, `send`, etc.
+        If the blob can't be mapped -- the database is encrypted, or the blob is new and its
+        document hasn't been saved yet -- its content is read into a heap buffer instead.
+        The data remains valid until you call \ref CBLBlobMapping_Release.
+        @param blob  The blob to read.
+        @param outData  On success, the address of the content will be stored here.
+        @param outLength  On success, the length of the content will be stored here.
+        @param outError  On failure, an error will be stored here if non-NULL.
+        @return  A mapping object you must release when done with the data, or NULL on failure. */
+    CBLBlobMapping* CBLBlob_MapContent(const CBLBlob* blob _cbl_nonnull,
+                                       const void **outData _cbl_nonnull,
+                                       size_t *outLength _cbl_nonnull,
+                                       CBLError *outError) CBLAPI;
+
+    /** Releases a \ref CBLBlobMapping, unmapping or freeing its data. */
+    void CBLBlobMapping_Release(CBLBlobMapping*) CBLAPI;
+
     /** A stream for reading a blob's content. */
     typedef struct CBLBlobReadStream CBLBlobReadStream;
 
@@ -168,6 +189,35 @@ extern "C" {
     CBLBlob* CBLBlob_CreateWithStream(const char *contentType,
                                       CBLBlobWriteStream* writer _cbl_nonnull) CBLAPI;
 
+    /** Creates a new blob by copying the contents of a file into the database's blob store.
+        The file is read and digested in fixed-size chunks, so its contents are never all in
+        memory at once; this is the best way to attach large files.
+        You should then add the blob to a mutable document as a property, as with
+        \ref CBLBlob_CreateWithStream.
+        @note  You are responsible for releasing the CBLBlob reference.
+        @param db  The database the blob will be saved to.
+        @param contentType  The MIME type (optional).
+        @param path  The filesystem path of the file to copy.
+        @param outError  On failure, error info will be written here.
+        @return  A new CBLBlob instance, or NULL on failure. */
+    CBLBlob* CBLBlob_CreateWithFile(CBLDatabase *db _cbl_nonnull,
+                                    const char *contentType,
+                                    const char *path _cbl_nonnull,
+                                    CBLError *outError) CBLAPI;
+
+    /** Creates a new blob by reading an open file descriptor until EOF, as with
+        \ref CBLBlob_CreateWithFile. The descriptor is read from its current position; it is
+        not closed.
+        @param db  The database the blob will be saved to.
+        @param contentType  The MIME type (optional).
+        @param fd  A file descriptor open for reading; it may be a pipe or socket.
+        @param outError  On failure, error info will be written here.
+        @return  A new CBLBlob instance, or NULL on failure. */
+    CBLBlob* CBLBlob_CreateWithFileDescriptor(CBLDatabase *db _cbl_nonnull,
+                                              const char *contentType,
+                                              int fd,
+                                              CBLError *outError) CBLAPI;
+
 #pragma mark - FLEECE UTILITIES:
 
     /** Returns true if a value in a document is a blob reference.
@@ -18,6 +18,7 @@
 
 #pragma once
 #include "CBLBase.h"
+#include "CBLQuery.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -37,6 +38,7 @@ typedef CBL_OPTIONS(uint32_t, CBLDatabaseFlags) {
     kCBLDatabase_Create        = 1,  ///< Create the file if it doesn't exist
     kCBLDatabase_ReadOnly      = 2,  ///< Open file read-only
     kCBLDatabase_NoUpgrade     = 4,  ///< Disable upgrading an older-version database
+    kCBLDatabase_Lazy          = 8,  ///< Defer opening the file until first use; see \ref CBLDatabase_Open
 };
 
 /** Encryption algorithms (available only in the Enterprise Edition). */
@@ -113,6 +115,16 @@ bool CBL_DeleteDatabase(const char _cbl_nonnull *name,
     instance.
     It's OK to open the same database file multiple times. Each \ref CBLDatabase instance is
     independent of the others (and must be separately closed and released.)
+
+    With the \ref kCBLDatabase_Lazy flag, only the cheap checks are made now (if the flag
+    \ref kCBLDatabase_Create isn't set, that the database exists), and the file itself is opened
+    by the first call that needs it. This makes opening many databases at launch nearly free,
+    when most of them may not be used right away. If the deferred open fails, the error is logged,
+    and every call that needs the file fails with the same error, or returns an empty result
+    (such as NULL or 0) if it has no error parameter; a database closed before its first use
+    fails with \ref CBLErrorNotOpen. Call \ref CBLDatabase_EnsureOpen first to find out why, or
+    if the file might be unreadable (for example, if it's encrypted with a key that might be
+    wrong.)
     @param name  The database name (without the ".cblite2" extension.)
     @param config  The database configuration (directory and encryption option.)
     @param error  On failure, the error will be written here.
@@ -122,6 +134,32 @@ CBLDatabase* CBLDatabase_Open(const char *name _cbl_nonnull,
                               const CBLDatabaseConfiguration* config,
                               CBLError* error) CBLAPI;
 
+/** Opens a database's file if its opening was deferred by \ref kCBLDatabase_Lazy.
+    Does nothing if it's already open.
+    @param db  The database.
+    @param error  On failure, the error will be written here.
+    @return  True if the database is open, false if opening it failed. */
+bool CBLDatabase_EnsureOpen(CBLDatabase* db _cbl_nonnull, CBLError* error) CBLAPI;
+
+/** Opens many databases at once, in parallel on several threads, so that the total time scales
+    with the number of CPU cores rather than the number of databases. Every database is fully
+    opened; \ref kCBLDatabase_Lazy, if given, is ignored.
+    @param names  A C array of `count` database names.
+    @param count  The number of databases to open.
+    @param config  The configuration to open them all with.
+    @param threads  The number of threads to use, or 0 for one per CPU core.
+    @param outDBs  A C array of `count` pointers, which will be filled in with the opened
+                databases, or NULL for any that failed to open. You must release the databases.
+    @param outErrors  If non-NULL, a C array of `count` errors; the entries of the databases that
+                failed to open will be filled in.
+    @return  The number of databases opened. */
+size_t CBLDatabase_OpenMany(const char* const names[] _cbl_nonnull,
+                            size_t count,
+                            const CBLDatabaseConfiguration* config,
+                            unsigned threads,
+                            CBLDatabase* outDBs[] _cbl_nonnull,
+                            CBLError outErrors[]) CBLAPI;
+
 /** Closes an open database. */
 bool CBLDatabase_Close(CBLDatabase*, CBLError*) CBLAPI;
 
@@ -156,6 +194,296 @@ time_t CBLDatabase_NextDocExpiration(CBLDatabase* _cbl_nonnull) CBLAPI;
 int64_t CBLDatabase_PurgeExpiredDocuments(CBLDatabase* db _cbl_nonnull,
                                           CBLError* error) CBLAPI;
 
+/** Options for \ref CBLDatabase_SetAutoPurge. */
+typedef struct {
+    unsigned batchSize;         ///< Max number of docs purged per transaction; 0 means 1000
+    double pauseInterval;       ///< Seconds to pause between batches; 0 means 0.05
+} CBLAutoPurgeOptions;
+
+/** Starts or stops purging expired documents automatically, on a background thread with its
+    own connection to the database. The thread sleeps until the next document expires, then
+    purges the expired documents in batches. Each batch is a separate transaction, so change
+    listeners are notified once per batch, and other writers get a chance to run between batches.
+    Purging stops when the database is closed.
+    @param db  The database.
+    @param options  The options, or NULL to stop purging.
+    @param error  On failure to start purging, the error will be written here.
+    @return  True on success, false on failure. */
+bool CBLDatabase_SetAutoPurge(CBLDatabase* db _cbl_nonnull,
+                              const CBLAutoPurgeOptions *options,
+                              CBLError* error) CBLAPI;
+
+/** @} */
+
+
+
+#pragma mark - BACKGROUND COMPACTION
+/** \name  Background compaction
+    @{
+    Compacting a large database can take a long time, so these functions do it on a background
+    thread, on a separate connection, without blocking the caller.
+ */
+
+/** The stages of a \ref CBLCompaction. */
+typedef CBL_ENUM(uint8_t, CBLCompactionStage) {
+    kCBLCompactionWaiting,      ///< Waiting for the database's current batch to end
+    kCBLCompactionRunning,      ///< Compacting
+    kCBLCompactionFinished      ///< Finished, cancelled or failed
+};
+
+/** A callback reporting the progress of a \ref CBLCompaction. It's called when compaction
+    begins, and when it finishes.
+    @param context  The `context` value given when the compaction was started.
+    @param compaction  The compaction.
+    @param stage  The new stage.
+    @param bytesReclaimed  When finished, the number of bytes by which the database file shrank.
+    @param error  When finished, the error that stopped the compaction, or NULL on success.
+                    If it was cancelled, this is `ECANCELED` in \ref CBLPOSIXDomain. */
+typedef void (*CBLCompactionCallback)(void *context,
+                                      CBLCompaction* compaction _cbl_nonnull,
+                                      CBLCompactionStage stage,
+                                      int64_t bytesReclaimed,
+                                      const CBLError *error);
+
+/** Compacts a database on a background thread. If a batch is open on this \ref CBLDatabase,
+    compaction waits until it ends. Closing or deleting the database cancels the compaction if
+    it's still waiting, or else waits for it to finish.
+
+    The callback is called via the database's notification queue, so
+    \ref CBLDatabase_BufferNotifications applies to it.
+    @param db  The database.
+    @param callback  A callback to report progress, or NULL.
+    @param context  An opaque value that will be passed to the callback.
+    @param error  On failure to start compacting, the error will be written here.
+    @return  A new \ref CBLCompaction, which you must release when done with it,
+            or NULL on failure. */
+_cbl_warn_unused
+CBLCompaction* CBLDatabase_CompactAsync(CBLDatabase* db _cbl_nonnull,
+                                        CBLCompactionCallback callback,
+                                        void *context,
+                                        CBLError* error) CBLAPI;
+
+CBL_REFCOUNTED(CBLCompaction*, Compaction);
+
+/** Cancels a compaction, if it hasn't started compacting yet. (Once running, compaction is a
+    single atomic operation, which can't be interrupted.) */
+void CBLCompaction_Cancel(CBLCompaction* _cbl_nonnull) CBLAPI;
+
+/** Returns the current stage of a compaction. */
+CBLCompactionStage CBLCompaction_Stage(const CBLCompaction* _cbl_nonnull) CBLAPI;
+
+/** Blocks until a compaction finishes.
+    @param compaction  The compaction.
+    @param outBytesReclaimed  On return, the number of bytes by which the file shrank. May be NULL.
+    @param error  If the compaction failed or was cancelled, the error will be written here.
+    @return  True if the database was compacted, false if not. */
+bool CBLCompaction_Wait(CBLCompaction* compaction _cbl_nonnull,
+                        int64_t *outBytesReclaimed,
+                        CBLError *error) CBLAPI;
+
+/** Options for \ref CBLDatabase_SetAutoCompaction. */
+typedef struct {
+    /** Compact when the database file has grown by this fraction (e.g. 0.5 for 50%) since it
+        was last compacted. 0 disables automatic compaction. */
+    double growthRatio;
+    /** The minimum number of bytes the file must have grown by; 0 means 1MB. */
+    int64_t minGrowth;
+    /** The file size is checked after commits, but at most this often (in seconds);
+        0 means every 10 seconds. */
+    double checkInterval;
+} CBLAutoCompactionOptions;
+
+/** Makes this \ref CBLDatabase compact the database in the background (as though by
+    \ref CBLDatabase_CompactAsync) whenever its file has grown enough since the last compaction.
+    Only commits made through this \ref CBLDatabase trigger the check.
+    @param db  The database.
+    @param options  The options, or NULL to disable automatic compaction.
+    @param callback  A callback to report the progress of each compaction, or NULL.
+    @param context  An opaque value that will be passed to the callback. */
+void CBLDatabase_SetAutoCompaction(CBLDatabase* db _cbl_nonnull,
+                                   const CBLAutoCompactionOptions *options,
+                                   CBLCompactionCallback callback,
+                                   void *context) CBLAPI;
+
+/** @} */
+
+
+
+#pragma mark - CONNECTION POOL
+/** \name  Read-only connection pool
+    @{
+    A \ref CBLDatabase is a single connection, so queries and document reads made through it
+    run one at a time. A pool holds extra read-only connections to the same database file, so
+    that several threads can read at once while writes still go through the main connection.
+
+    A connection taken from a pool is an ordinary \ref CBLDatabase, which can be used to create
+    and run queries or read documents, but not to make changes. Use it on one thread at a time,
+    and hand it back with \ref CBLDatabasePool_Return when done. Each pooled connection has its
+    own query cache (see \ref CBLDatabase_SetQueryCacheCapacity), so re-creating the same
+    queries on it is cheap.
+ */
+
+/** Creates a pool of read-only connections to the same database file as `db`.
+    Connections are opened on demand, up to `maxConnections`.
+    @param db  An open database.
+    @param maxConnections  The maximum number of connections the pool will open; if 0, the
+                    number of CPU cores is used.
+    @param error  On failure, the error will be written here.
+    @return  The new pool, or NULL on failure. */
+_cbl_warn_unused
+CBLDatabasePool* CBLDatabasePool_New(CBLDatabase* db _cbl_nonnull,
+                                     unsigned maxConnections,
+                                     CBLError* error) CBLAPI;
+
+CBL_REFCOUNTED(CBLDatabasePool*, DatabasePool);
+
+/** Takes a read-only connection from the pool, opening a new one if none are idle. If the
+    pool already has its maximum number of connections in use, blocks until one is returned.
+    @param pool  The connection pool.
+    @param error  On failure, the error will be written here.
+    @return  A read-only database connection, or NULL if a connection couldn't be opened. */
+_cbl_warn_unused
+CBLDatabase* CBLDatabasePool_Acquire(CBLDatabasePool* pool _cbl_nonnull,
+                                     CBLError* error) CBLAPI;
+
+/** Like \ref CBLDatabasePool_Acquire, except that it returns NULL (with no error) instead of
+    blocking when all the connections are in use. */
+_cbl_warn_unused
+CBLDatabase* CBLDatabasePool_TryAcquire(CBLDatabasePool* pool _cbl_nonnull,
+                                        CBLError* error) CBLAPI;
+
+/** Returns a connection obtained from \ref CBLDatabasePool_Acquire to the pool. All objects
+    created from the connection, such as queries, result sets and documents, should be
+    released first.
+    @note  Connections still checked out when the pool is freed are not closed by the pool;
+            call \ref CBLDatabase_Release on them instead of returning them.
+    @warning  Returning a connection that isn't checked out of this pool (including returning one
+            twice) is a programming error: it fails an assertion in a debug build, and in a
+            release build it is logged and ignored. */
+void CBLDatabasePool_Return(CBLDatabasePool* pool _cbl_nonnull,
+                            CBLDatabase* db _cbl_nonnull) CBLAPI;
+
+/** @} */
+
+
+
+#pragma mark - EXPORT
+/** \name  Exporting
+    @{
+    Fast bulk export of a whole database, using several threads.
+ */
+
+/** Formats written by \ref CBLDatabase_Export. */
+typedef CBL_ENUM(uint8_t, CBLExportFormat) {
+    /** Newline-delimited JSON: each line is a document's properties, plus its ID as `_id`. */
+    kCBLExportNDJSON,
+    /** Each chunk is an encoded Fleece dictionary, mapping document IDs to their properties. */
+    kCBLExportFleece
+};
+
+/** Options for \ref CBLDatabase_Export. */
+typedef struct {
+    CBLExportFormat format;     ///< The output format
+    unsigned threads;           ///< Number of worker threads; 0 means the number of CPU cores
+    size_t chunkSize;           ///< Approximate size of output chunks; 0 means 1MB
+    bool includeBlobs;          ///< If true, blob contents are passed to the blob sink
+} CBLExportOptions;
+
+/** A callback that receives exported documents, in chunks containing whole documents.
+    @warning  This is called on the worker threads, concurrently: each worker exports a
+            different range of the database. Use `worker` to write each to its own output
+            (such as a file per worker), or else synchronize.
+    @param context  The value given to \ref CBLDatabase_Export.
+    @param worker  The index of the worker thread, from 0 to the thread count minus 1.
+    @param chunk  The exported data; valid only until the callback returns.
+    @return  True to continue, false to abort the export. */
+typedef bool (*CBLExportSink)(void *context, unsigned worker, FLSlice chunk);
+
+/** A callback that receives the contents of the blobs in exported documents. Each blob is
+    passed once, even if several documents refer to it. Called concurrently, like
+    \ref CBLExportSink.
+    @return  True to continue, false to abort the export. */
+typedef bool (*CBLExportBlobSink)(void *context, unsigned worker,
+                                  const char *digest, FLSlice contents);
+
+/** Exports all (non-deleted) documents in a database. The sequence range is split between
+    several worker threads, each reading through its own connection, so writers aren't
+    blocked. Every document that exists when the export starts is exported; a document
+    changed during the export is exported at its newer revision, and may appear twice.
+    This function returns when the export is complete.
+    @param db  The database to export.
+    @param options  The export options.
+    @param sink  The callback that receives the exported documents.
+    @param blobSink  The callback that receives blob contents; may be NULL if `includeBlobs`
+                    is false.
+    @param context  An arbitrary value passed to the callbacks.
+    @param outError  On failure, the error will be written here. If the export was stopped
+                    by a callback returning false, the error code is 0.
+    @return  True on success, false on failure or if a callback aborted the export. */
+bool CBLDatabase_Export(CBLDatabase* db _cbl_nonnull,
+                        const CBLExportOptions* options _cbl_nonnull,
+                        CBLExportSink sink _cbl_nonnull,
+                        CBLExportBlobSink blobSink,
+                        void *context,
+                        CBLError* outError) CBLAPI;
+
+/** @} */
+
+
+
+#pragma mark - IMPORT
+/** \name  Importing
+    @{
+    Fast bulk loading of documents, in the formats written by \ref CBLDatabase_Export.
+ */
+
+/** A callback that supplies input to \ref CBLDatabase_Import.
+    - For NDJSON, the input is a byte stream, which may be split into chunks anywhere.
+    - For Fleece, each chunk must be a complete dictionary mapping document IDs to properties,
+      as written by \ref CBLDatabase_Export.
+    @param context  The value given to \ref CBLDatabase_Import.
+    @param outChunk  Store the next chunk of input here, or an empty slice at the end of the
+                    input. The data must remain valid until the next call.
+    @return  True on success, false to abort the import. */
+typedef bool (*CBLImportReader)(void *context, FLSlice *outChunk);
+
+/** A callback reporting the progress of \ref CBLDatabase_Import, called after each commit.
+    @param context  The value given to \ref CBLDatabase_Import.
+    @param docsImported  The number of documents imported so far.
+    @return  True to continue, false to stop the import. (Batches already committed remain.) */
+typedef bool (*CBLImportProgressCallback)(void *context, uint64_t docsImported);
+
+/** Options for \ref CBLDatabase_Import. */
+typedef struct {
+    CBLExportFormat format;             ///< The input format
+    unsigned batchSize;                 ///< Number of docs per transaction; 0 means 10,000
+    /** Indexes to build after the documents are loaded, instead of updating them during the
+        import. Any of these that exist are deleted first. */
+    const CBLNamedIndexSpec *deferredIndexes;
+    unsigned deferredIndexCount;        ///< The number of `deferredIndexes`
+    CBLImportProgressCallback progress; ///< Optional progress callback
+} CBLImportOptions;
+
+/** Imports documents, parsing the input straight into the Fleece data that's stored.
+    In NDJSON input, each line is a JSON object; its `_id` property, if any, is removed and used
+    as the document ID, otherwise one is generated as for a new document (see
+    \ref CBLDatabase_SetDocumentIDStrategy); if a custom generator fails, so does the import.
+    Existing documents with the same IDs are overwritten.
+    @param db  The database to import into.
+    @param options  The import options.
+    @param reader  The callback that supplies the input.
+    @param context  An arbitrary value passed to the callbacks.
+    @param outCount  On return, the number of documents imported (and committed.) May be NULL.
+    @param outError  On failure, the error will be written here. If the import was stopped
+                    by a callback returning false, the error code is 0.
+    @return  True on success, false on failure or if a callback stopped the import. */
+bool CBLDatabase_Import(CBLDatabase* db _cbl_nonnull,
+                        const CBLImportOptions* options _cbl_nonnull,
+                        CBLImportReader reader _cbl_nonnull,
+                        void *context,
+                        uint64_t *outCount,
+                        CBLError* outError) CBLAPI;
+
 /** @} */
 
 
@@ -183,6 +511,44 @@ const CBLDatabaseConfiguration CBLDatabase_Config(const CBLDatabase* _cbl_nonnul
 
 
 
+#pragma mark - METRICS
+/** \name  Database metrics
+    @{
+    Counters of the activity on a database connection, for monitoring. They're cheap to
+    maintain, and always on. Counters only increase (until the database is closed), so
+    they can be exported directly as Prometheus-style counters.
+ */
+
+/** The number of buckets in \ref CBLDatabaseMetrics.commitLatency. */
+#define kCBLCommitLatencyBuckets 6
+
+/** A snapshot of a database's activity counters. */
+typedef struct {
+    uint64_t documentsRead;         ///< Documents read by the CBLDatabase_Get... functions
+    uint64_t documentsWritten;      ///< Documents saved or deleted
+    uint64_t commits;               ///< Transactions committed (including implicit ones)
+    /** A latency histogram of commits. Bucket `i` counts commits that took less than
+        10^(i-4) seconds, i.e. 100µs, 1ms, 10ms, 100ms, 1s; the last bucket counts the rest. */
+    uint64_t commitLatency[kCBLCommitLatencyBuckets];
+    double   commitTime;            ///< Total time spent committing, in seconds
+    uint64_t blobBytesRead;         ///< Bytes of blob content loaded by \ref CBLBlob_LoadContent
+    uint64_t blobBytesWritten;      ///< Bytes of new blob content saved
+    uint64_t notificationsQueued;   ///< Listener notifications posted
+    uint64_t notificationsDelivered;///< Listener notifications called
+    uint64_t queryExecutions;       ///< Query runs (not counting live queries' re-runs)
+    uint64_t replicatorDocsPushed;  ///< Documents pushed by replicators of this database
+    uint64_t replicatorDocsPulled;  ///< Documents pulled by replicators of this database
+    uint64_t replicatorProgress;    ///< Replicator progress units (approximately bytes) completed
+} CBLDatabaseMetrics;
+
+/** Returns a snapshot of a database's activity counters. The counters are read individually,
+    so while other threads are busy they may not be exactly consistent with one another. */
+CBLDatabaseMetrics CBLDatabase_GetMetrics(const CBLDatabase* _cbl_nonnull) CBLAPI;
+
+/** @} */
+
+
+
 #pragma mark - LISTENERS
 /** \name  Database listeners
     @{
@@ -217,6 +583,58 @@ CBLListenerToken* CBLDatabase_AddChangeListener(const CBLDatabase* db _cbl_nonnu
                                                 CBLDatabaseChangeListener listener _cbl_nonnull,
                                                 void *context) CBLAPI;
 
+
+/** Options for coalescing database change notifications, used by
+    \ref CBLDatabase_AddCoalescedChangeListener and \ref CBLDatabase_AddChangeRangeListener. */
+typedef struct {
+    /** After a change, the listener waits this many seconds for more changes before it's called,
+        and is then called with all of them. If 0, it's called as soon as possible. */
+    double interval;
+
+    /** If this many changes are waiting, the listener is called right away, without waiting
+        for the interval to end. This is also the maximum number of documents passed to a
+        single call of a \ref CBLDatabaseChangeListener. 0 means no limit. */
+    unsigned maxChanges;
+} CBLChangeCoalescingOptions;
+
+/** Registers a database change listener callback that's called less often than a regular one:
+    changes are collected over a time interval and passed to the listener together.
+    This is useful when many changes are expected, as during a bulk replication.
+    @param db  The database to observe.
+    @param options  Determines how changes are coalesced.
+    @param listener  The callback to be invoked.
+    @param context  An opaque value that will be passed to the callback.
+    @return  A token to be passed to \ref CBLListener_Remove when it's time to remove the
+            listener.*/
+_cbl_warn_unused
+CBLListenerToken* CBLDatabase_AddCoalescedChangeListener(const CBLDatabase* db _cbl_nonnull,
+                                                         const CBLChangeCoalescingOptions *options _cbl_nonnull,
+                                                         CBLDatabaseChangeListener listener _cbl_nonnull,
+                                                         void *context) CBLAPI;
+
+/** A database change listener callback that's told only which range of sequence numbers
+    changed, not the document IDs. This is cheaper than a \ref CBLDatabaseChangeListener
+    if you only need to know that _something_ changed.
+    @param context  An arbitrary value given when the callback was registered.
+    @param db  The database that changed.
+    @param firstSequence  The lowest sequence number of the changes.
+    @param lastSequence  The highest sequence number of the changes.
+    @param numChanges  The number of changes. */
+typedef void (*CBLDatabaseChangeRangeListener)(void *context,
+                                               const CBLDatabase* db _cbl_nonnull,
+                                               uint64_t firstSequence,
+                                               uint64_t lastSequence,
+                                               unsigned numChanges);
+
+/** Registers a coalesced database change listener that receives sequence ranges instead
+    of document IDs. See \ref CBLDatabase_AddCoalescedChangeListener for details; here the
+    `maxChanges` option only triggers an early call, as every call covers all pending changes.*/
+_cbl_warn_unused
+CBLListenerToken* CBLDatabase_AddChangeRangeListener(const CBLDatabase* db _cbl_nonnull,
+                                                     const CBLChangeCoalescingOptions *options _cbl_nonnull,
+                                                     CBLDatabaseChangeRangeListener listener _cbl_nonnull,
+                                                     void *context) CBLAPI;
+
 /** @} */
 /** @} */    // end of outer \defgroup
 
@@ -262,6 +680,17 @@ void CBLDatabase_BufferNotifications(CBLDatabase *db _cbl_nonnull,
 /** Immediately issues all pending notifications for this database, by calling their listener
     callbacks. */
 void CBLDatabase_SendNotifications(CBLDatabase *db _cbl_nonnull) CBLAPI;
+
+/** Issues up to `maxCount` pending notifications for this database. This lets an event loop
+    spread a burst of notifications over several iterations, instead of blocking until all of
+    them have been sent.
+    @note  The \ref CBLNotificationsReadyCallback won't be called again until all pending
+           notifications have been sent, so keep calling this until it returns false.
+    @param db  The database whose notifications are to be sent.
+    @param maxCount  The maximum number of notifications to send.
+    @return  True if there are still notifications pending, false if there are none. */
+bool CBLDatabase_SendNotificationsBounded(CBLDatabase *db _cbl_nonnull,
+                                          unsigned maxCount) CBLAPI;
                                      
 /** @} */
 /** @} */    // end of outer \defgroup
@@ -41,6 +41,29 @@ typedef CBL_ENUM(uint8_t, CBLConcurrencyControl) {
 };
 
 
+/** Statistics about a database's document cache. */
+typedef struct {
+    uint64_t hits;          ///< Number of document reads answered from the cache
+    uint64_t misses;        ///< Number of document reads that had to go to the database
+    size_t count;           ///< Number of documents currently in the cache
+    size_t size;            ///< Approximate memory used by the cached documents, in bytes
+    size_t capacity;        ///< Maximum size of the cache, in bytes
+} CBLDocumentCacheStats;
+
+/** Enables, resizes or disables the database's document cache. This is an LRU cache of recently
+    read documents, used by \ref CBLDatabase_GetDocument and \ref CBLDatabase_GetMutableDocument:
+    a cached document is returned without reading the database. Entries are removed when their
+    documents change, including changes made through other connections (e.g. by a replicator.)
+    Reads within a batch bypass the cache.
+    The cache is disabled (capacity 0) by default.
+    @param db  The database.
+    @param capacity  The maximum memory the cached documents may use, in bytes; 0 disables it. */
+void CBLDatabase_SetDocumentCacheCapacity(CBLDatabase* db _cbl_nonnull,
+                                          size_t capacity) CBLAPI;
+
+/** Returns statistics about the database's document cache. */
+CBLDocumentCacheStats CBLDatabase_DocumentCacheStats(const CBLDatabase* db _cbl_nonnull) CBLAPI;
+
 /** Reads a document from the database, creating a new (immutable) \ref CBLDocument object.
     Each call to this function creates a new object (which must later be released.)
     @note  If you are reading the document in order to make changes to it, call
@@ -52,6 +75,45 @@ _cbl_warn_unused
 const CBLDocument* CBLDatabase_GetDocument(const CBLDatabase* database _cbl_nonnull,
                                            const char* _cbl_nonnull docID) CBLAPI;
 
+/** Reads multiple documents from the database at once, creating new (immutable) \ref CBLDocument
+    objects. This is faster than calling \ref CBLDatabase_GetDocument for each ID: the lookups
+    share one call, and a large set of IDs is looked up in sorted order.
+    The lookups don't block writers, so if the database is changed meanwhile, some documents
+    may be read from before the change and some from after it.
+    @param database  The database.
+    @param docIDs  A C array of `count` document IDs.
+    @param count  The number of document IDs.
+    @param outDocs  A C array of `count` pointers, which will be filled in with the documents in
+                    the same order as their IDs, or NULL for any that don't exist. You are
+                    responsible for releasing the non-NULL documents.
+    @return  The number of documents found. */
+size_t CBLDatabase_GetDocuments(const CBLDatabase* database _cbl_nonnull,
+                                const char* const* docIDs _cbl_nonnull,
+                                size_t count,
+                                const CBLDocument** outDocs _cbl_nonnull) CBLAPI;
+
+/** A callback that's given a document's properties by \ref CBLDatabase_WithDocumentProperties.
+    @param context  The value given to \ref CBLDatabase_WithDocumentProperties.
+    @param docID  The document's ID.
+    @param properties  The document's properties. This dictionary, and every value in it, is
+                       only valid until the callback returns. */
+typedef void (*CBLDocumentPropertiesCallback)(void *context,
+                                              const char *docID _cbl_nonnull,
+                                              FLDict properties _cbl_nonnull);
+
+/** Reads a document's properties without creating a \ref CBLDocument object, and passes them
+    to a callback. The properties point directly into the stored revision's body, so this is
+    the cheapest way to read a document whose properties don't need to outlive the call.
+    @param database  The database.
+    @param docID  The ID of the document.
+    @param callback  The function to call with the document's properties.
+    @param context  An arbitrary value that will be passed to the callback.
+    @return  True if the document exists (and the callback was called), else false. */
+bool CBLDatabase_WithDocumentProperties(const CBLDatabase* database _cbl_nonnull,
+                                        const char* docID _cbl_nonnull,
+                                        CBLDocumentPropertiesCallback callback _cbl_nonnull,
+                                        void *context) CBLAPI;
+
 CBL_REFCOUNTED(CBLDocument*, Document);
 
 /** Saves a (mutable) document to the database.
@@ -66,6 +128,49 @@ const CBLDocument* CBLDatabase_SaveDocument(CBLDatabase* db _cbl_nonnull,
                                             CBLConcurrencyControl concurrency,
                                             CBLError* error) CBLAPI;
 
+/** Saves multiple (mutable) documents to the database, in a single transaction.
+    This is much faster than calling \ref CBLDatabase_SaveDocument on each document, even within
+    a batch, since the documents share one transaction and one Fleece encoder.
+    A conflict saving one document doesn't stop the others from being saved; its entry in
+    `results` is just set to NULL. Any other error aborts the transaction, and nothing is saved.
+    @param db  The database to save to.
+    @param docs  A C array of mutable documents to save.
+    @param count  The number of documents in the `docs` array.
+    @param concurrency  Conflict-handling strategy, applied to each document.
+    @param results  If non-NULL, a C array of `count` pointers that will be filled in with the
+                    updated documents, or NULL for documents that had a conflict. You are
+                    responsible for releasing the non-NULL documents.
+    @param error  On failure, the error will be written here.
+    @return  The number of documents saved, or -1 on failure. */
+int64_t CBLDatabase_SaveDocuments(CBLDatabase* db _cbl_nonnull,
+                                  CBLDocument* const* docs _cbl_nonnull,
+                                  size_t count,
+                                  CBLConcurrencyControl concurrency,
+                                  const CBLDocument* results[],
+                                  CBLError* error) CBLAPI;
+
+/** Updates a document by applying a patch to its current properties, and saves it.
+    The patch is applied like a JSON Merge Patch (RFC 7396): a property whose value is null is
+    removed, a dictionary value is merged into an existing dictionary property, and any other
+    value replaces the property. If the document doesn't exist, it's created.
+
+    Only the dictionaries along the patched paths are copied, and the new revision is (usually)
+    stored as a delta appended to the existing body, so the cost is proportional to the size of
+    the patch rather than of the document.
+    @param db  The database.
+    @param docID  The ID of the document to update.
+    @param patch  The changes to make.
+    @param concurrency  Conflict-handling strategy. With last-write-wins, if another revision
+                    is saved concurrently, the patch is re-applied to that revision.
+    @param error  On failure, the error will be written here.
+    @return  The updated document, which you must release, or NULL on failure. */
+_cbl_warn_unused
+const CBLDocument* CBLDatabase_UpdateDocument(CBLDatabase* db _cbl_nonnull,
+                                              const char* docID _cbl_nonnull,
+                                              FLDict patch _cbl_nonnull,
+                                              CBLConcurrencyControl concurrency,
+                                              CBLError* error) CBLAPI;
+
 /** Deletes a document from the database. Deletions are replicated.
     @warning  You are still responsible for releasing the CBLDocument.
     @param document  The document to delete.
@@ -122,17 +227,184 @@ CBLDocument* CBLDatabase_GetMutableDocument(CBLDatabase* database _cbl_nonnull,
                                             const char* docID _cbl_nonnull) CBLAPI;
 
 /** Creates a new, empty document in memory. It will not be added to a database until saved.
-    @param docID  The ID of the new document, or NULL to assign a new unique ID.
+    @param docID  The ID of the new document, or NULL to assign a new unique ID. The ID is
+                assigned when the document is first saved, by the database's ID strategy
+                (see \ref CBLDatabase_SetDocumentIDStrategy), or by \ref CBLDocument_ID if
+                that's called first.
     @return  The mutable document instance. */
 CBLDocument* CBLDocument_New(const char *docID) CBLAPI _cbl_warn_unused _cbl_returns_nonnull;
 
 /** Creates a new mutable CBLDocument instance that refers to the same document as the original.
     If the original document has unsaved changes, the new one will also start out with the same
     changes; but mutating one document thereafter will not affect the other.
+    (Only the collections that have been changed are copied; the rest are shared.)
     @note  You must release the new reference when you're done with it. */
 CBLDocument* CBLDocument_MutableCopy(const CBLDocument* original _cbl_nonnull) CBLAPI
     _cbl_warn_unused _cbl_returns_nonnull;
 
+/** How a database assigns IDs to new documents that were created without one. */
+typedef CBL_ENUM(uint8_t, CBLDocumentIDStrategy) {
+    kCBLDocumentIDRandom,       ///< Random IDs, like "-ZxNwQ8XgDCf7RV1nR5ndz1" (the default)
+    kCBLDocumentIDMonotonic,    ///< Time-ordered ULIDs, like "01ARZ3NDEKTSV4RRFFQ69G5FAV"
+    kCBLDocumentIDCustom,       ///< IDs returned by a \ref CBLDocumentIDGenerator callback
+};
+
+/** Maximum length of a document ID returned by a \ref CBLDocumentIDGenerator. */
+#define kCBLMaxGeneratedDocIDLength 63
+
+/** A callback that creates a new, unique document ID.
+    It may be called on any thread that saves documents, but never concurrently.
+    @param context  The `context` given to \ref CBLDatabase_SetDocumentIDStrategy.
+    @param buffer  Where to write the ID; it doesn't need to be NUL-terminated.
+    @param bufferSize  The size of the buffer, which is at least \ref kCBLMaxGeneratedDocIDLength.
+    @return  The length of the ID, or 0 on failure (in which case the save fails.) */
+typedef size_t (*CBLDocumentIDGenerator)(void *context,
+                                         char *buffer,
+                                         size_t bufferSize);
+
+/** Sets how the database assigns IDs to new documents created without one.
+    Monotonic IDs start with the current time and increase with each ID generated, so new
+    documents are added at the end of the database's index instead of at random places in it,
+    which makes bulk inserts faster.
+    @param db  The database.
+    @param strategy  The strategy to use.
+    @param generator  The callback, if the strategy is \ref kCBLDocumentIDCustom; else NULL.
+    @param context  A value passed to the callback. */
+void CBLDatabase_SetDocumentIDStrategy(CBLDatabase* db _cbl_nonnull,
+                                       CBLDocumentIDStrategy strategy,
+                                       CBLDocumentIDGenerator generator,
+                                       void *context) CBLAPI;
+
+/** @} */
+
+
+/** \name  Document arenas
+    @{
+    An arena speeds up code that creates many short-lived documents, such as an import loop,
+    by allocating the \ref CBLDocument objects created on the current thread from a block of
+    memory that's freed all at once, instead of individually from the heap.
+ */
+
+/** An opaque scope that documents are allocated in. */
+typedef struct CBLArena CBLArena;
+
+/** Begins an arena on the current thread: until \ref CBLArena_End is called, the documents
+    created on this thread (by \ref CBLDocument_New, or by reading or saving documents) are
+    allocated in it. Arenas can be nested.
+    @note  Memory isn't reused within an arena, so it's meant for a bounded batch of work.
+    @param chunkSize  The size of the blocks the arena allocates, or 0 for a default of 64KB.
+    @return  The new arena. */
+CBLArena* CBLArena_Begin(size_t chunkSize) CBLAPI _cbl_returns_nonnull;
+
+/** Ends an arena, which must be the current one on this thread. The arena's memory is freed
+    once the documents allocated in it have all been released; documents that are still in
+    use remain valid. */
+void CBLArena_End(CBLArena* _cbl_nonnull) CBLAPI;
+
+/** @} */
+
+
+
+/** \name  Group commit
+    @{
+    In group-commit mode, saves made by \ref CBLDatabase_SaveDocument on different threads are
+    queued and committed together, in one transaction, by a background writer. Each call still
+    returns only once its document has been committed (or failed), so it takes a little longer,
+    but when many threads are writing, the total throughput is much higher because they share
+    one transaction and one commit instead of waiting for each other's.
+
+    Saves made within a batch (\ref CBLDatabase_BeginBatch), deletions, and
+    \ref CBLDatabase_SaveDocuments are not grouped.
+ */
+
+/** Options for \ref CBLDatabase_SetGroupCommit. */
+typedef struct {
+    /** Maximum time in seconds that a save waits for others to join its group before the group
+        is committed; 0 means a default of 5ms. */
+    double maxDelay;
+    /** A group is committed as soon as it has this many documents; 0 means a default of 1000. */
+    unsigned maxDocs;
+} CBLGroupCommitOptions;
+
+/** Enables or disables group-commit mode. Disabling it commits any queued saves first.
+    @param db  The database.
+    @param options  The options, or NULL to disable group commit. */
+void CBLDatabase_SetGroupCommit(CBLDatabase* db _cbl_nonnull,
+                                const CBLGroupCommitOptions *options) CBLAPI;
+
+/** A callback that reports the result of \ref CBLDatabase_QueueSaveDocument.
+    It's called on the group-commit writer thread, so it should return quickly.
+    @param context  The `context` given to \ref CBLDatabase_QueueSaveDocument.
+    @param savedDoc  The saved document, or NULL on failure. To keep it, retain it.
+    @param error  NULL on success, or the error. A conflict is reported as an error with code
+                \ref CBLErrorConflict. */
+typedef void (*CBLSaveCompletion)(void *context,
+                                  const CBLDocument *savedDoc,
+                                  const CBLError *error);
+
+/** Queues a document to be saved in the next group commit, and returns without waiting.
+    The callback is called after the group is committed. If group commit isn't enabled, the
+    document is saved immediately and the callback is called before this function returns.
+    @param db  The database to save to.
+    @param doc  The mutable document to save. Don't change it until the callback is called.
+    @param concurrency  Conflict-handling strategy.
+    @param completion  The callback to call when the document has been saved, or has failed.
+    @param context  A value passed to the callback. */
+void CBLDatabase_QueueSaveDocument(CBLDatabase* db _cbl_nonnull,
+                                   CBLDocument* doc _cbl_nonnull,
+                                   CBLConcurrencyControl concurrency,
+                                   CBLSaveCompletion completion _cbl_nonnull,
+                                   void *context) CBLAPI;
+
+/** @} */
+
+
+
+/** \name  Asynchronous access
+    @{
+    These functions return immediately, without waiting for disk I/O; the work is done on an
+    internal pool of I/O threads, and the callback is called when it's finished. They're meant
+    for hosts, like event loops, whose threads mustn't block.
+
+    Each database runs its asynchronous calls (including \ref CBLQuery_ExecuteAsync) one at a
+    time, in the order they were made. \ref CBLDatabase_Close waits for them to finish.
+    With group commit enabled, consecutive asynchronous saves may be committed together, but
+    any other asynchronous call waits until the saves made before it have been committed, so a
+    get or query made after a save sees the saved document.
+
+    The callbacks are called via the database's notification queue, so
+    \ref CBLDatabase_BufferNotifications applies to them: with it, they're called on the thread
+    that calls \ref CBLDatabase_SendNotifications; without, on an I/O thread.
+ */
+
+/** Saves a document like \ref CBLDatabase_SaveDocument, but asynchronously. If group commit is
+    enabled the save joins the next group, as with \ref CBLDatabase_QueueSaveDocument.
+    @param db  The database to save to.
+    @param doc  The mutable document to save. Don't change it until the callback is called.
+    @param concurrency  Conflict-handling strategy.
+    @param completion  The callback to call when the document has been saved, or has failed.
+    @param context  A value passed to the callback. */
+void CBLDatabase_SaveDocumentAsync(CBLDatabase* db _cbl_nonnull,
+                                   CBLDocument* doc _cbl_nonnull,
+                                   CBLConcurrencyControl concurrency,
+                                   CBLSaveCompletion completion _cbl_nonnull,
+                                   void *context) CBLAPI;
+
+/** A callback that reports the result of \ref CBLDatabase_GetDocumentAsync.
+    @param context  The `context` given to \ref CBLDatabase_GetDocumentAsync.
+    @param doc  The document, or NULL if it doesn't exist. To keep it, retain it. */
+typedef void (*CBLGetDocumentCompletion)(void *context, const CBLDocument *doc);
+
+/** Reads a document like \ref CBLDatabase_GetDocument, but asynchronously.
+    @param db  The database.
+    @param docID  The ID of the document. (It's copied.)
+    @param completion  The callback to call with the document.
+    @param context  A value passed to the callback. */
+void CBLDatabase_GetDocumentAsync(CBLDatabase* db _cbl_nonnull,
+                                  const char* docID _cbl_nonnull,
+                                  CBLGetDocumentCompletion completion _cbl_nonnull,
+                                  void *context) CBLAPI;
+
 /** @} */
 
 
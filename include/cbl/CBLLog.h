@@ -24,7 +24,12 @@ extern "C" {
 #endif
 
 /** \name  Public API
-    @{ */
+    @{
+    By default, LiteCore logs to the console itself. Once a callback or a plaintext log file is
+    set, all log messages go through a background thread that writes them to the console, the
+    callback and the file, so that threads doing the actual work aren't slowed down by logging.
+    If messages are logged faster than they can be written, some are dropped (and the console
+    says so) rather than blocking. */
 
 /** An object containing properties for file logging configuration 
     @warning \ref usePlaintext results in significantly larger log files; we recommend turning
@@ -36,29 +41,42 @@ typedef struct {
     const bool usePlaintext;        ///< Whether or not to log in plaintext (as opposed to binary)
 } CBLLogFileConfiguration;
 
-/** A callback function for handling log messages
+/** A callback function for handling log messages.
+    It's called on a background thread, one message at a time.
     @param  level The level of the message being received
     @param  domain The domain of the message being received
     @param  message The message being received (UTF-8 encoded) */
 typedef void(*CBLLogCallback)(CBLLogLevel level, CBLLogDomain domain, const char* message);
 
 /** Gets the current log level for debug console logging */
-CBLLogLevel CBLLog_ConsoleLevel();
+CBLLogLevel CBLLog_ConsoleLevel(void) CBLAPI;
 
 /** Sets the debug console log level */
-void CBLLog_SetConsoleLevel(CBLLogLevel);
+void CBLLog_SetConsoleLevel(CBLLogLevel) CBLAPI;
 
-/** Gets the current file logging config */
-const CBLLogFileConfiguration* CBLLog_FileConfig();
+/** Gets the current file logging config, or NULL if file logging is off.
+    The result is a copy belonging to the calling thread, valid until that thread calls this
+    function again. */
+const CBLLogFileConfiguration* CBLLog_FileConfig(void) CBLAPI;
 
-/** Sets the file logging configuration */
-void CBLLog_SetFileConfig(CBLLogFileConfiguration);
+/** Sets the file logging configuration. Messages of level Info and higher are written to
+    the file. A NULL or empty `directory` turns file logging off.
+    Plaintext logs are written to "cbl.log" in the directory; when it reaches `maxSize` it's
+    renamed "cbl.1.log" (and any older ones renumbered) and a new file is started.
+    Binary logs are written by LiteCore, in its own format and naming scheme. */
+void CBLLog_SetFileConfig(CBLLogFileConfiguration) CBLAPI;
 
 /** Gets the current log callback */
-CBLLogCallback CBLLog_Callback();
+CBLLogCallback CBLLog_Callback(void) CBLAPI;
 
-/** Sets the callback for receiving log messages */
-void CBLLog_SetCallback(CBLLogCallback);
+/** Sets the callback for receiving log messages, or NULL to remove it.
+    The callback is called on a background thread. Messages are queued in a fixed-size
+    buffer, so a very long message is truncated, and messages logged faster than they can be
+    delivered are dropped (and counted in a console message). */
+void CBLLog_SetCallback(CBLLogCallback) CBLAPI;
+
+/** Blocks until all log messages so far have been written to the console, callback and file. */
+void CBLLog_Flush(void) CBLAPI;
 
 /** @} */
 
@@ -96,10 +96,40 @@ FLDict CBLQuery_Parameters(CBLQuery* _cbl_nonnull query) CBLAPI;
     See \ref CBLQuery_SetParameters for details.
     @param query  The query.
     @param json  The parameters in the form of a JSON-encoded object whose
-            keys are the parameter names. (You may use JSON5 syntax.) */
+            keys are the parameter names. (You may use JSON5 syntax.)
+    @return  True on success, false if the JSON is invalid; then the parameters are unchanged. */
 bool CBLQuery_SetParametersAsJSON(CBLQuery* _cbl_nonnull query,
                                   const char* _cbl_nonnull json) CBLAPI;
 
+/** Assigns a value to a single query parameter, leaving the others unchanged.
+    This is cheaper than \ref CBLQuery_SetParameters when only one or two parameters change
+    between runs: the parameters are only re-encoded when the query next runs, so setting several
+    in a row costs a single encoding.
+    @param query  The query.
+    @param name  The name of the parameter, without the `$` prefix.
+    @param value  The value to assign. */
+void CBLQuery_SetParameterInt(CBLQuery* query _cbl_nonnull,
+                              const char *name _cbl_nonnull,
+                              int64_t value) CBLAPI;
+
+/** Assigns a floating-point value to a single query parameter.
+    See \ref CBLQuery_SetParameterInt for details. */
+void CBLQuery_SetParameterDouble(CBLQuery* query _cbl_nonnull,
+                                 const char *name _cbl_nonnull,
+                                 double value) CBLAPI;
+
+/** Assigns a string value to a single query parameter.
+    See \ref CBLQuery_SetParameterInt for details. */
+void CBLQuery_SetParameterString(CBLQuery* query _cbl_nonnull,
+                                 const char *name _cbl_nonnull,
+                                 FLString value) CBLAPI;
+
+/** Assigns an arbitrary Fleece value (which is copied) to a single query parameter.
+    See \ref CBLQuery_SetParameterInt for details. */
+void CBLQuery_SetParameterValue(CBLQuery* query _cbl_nonnull,
+                                const char *name _cbl_nonnull,
+                                FLValue value _cbl_nonnull) CBLAPI;
+
 /** Runs the query, returning the results.
     To obtain the results you'll typically call \ref CBLResultSet_Next in a `while` loop,
     examining the values in the \ref CBLResultSet each time around.
@@ -107,6 +137,37 @@ bool CBLQuery_SetParametersAsJSON(CBLQuery* _cbl_nonnull query,
 _cbl_warn_unused
 CBLResultSet* CBLQuery_Execute(CBLQuery* _cbl_nonnull, CBLError*) CBLAPI;
 
+/** Runs the query with the given parameters, returning the results.
+    The parameters are used for this run only; they don't replace the ones assigned by
+    \ref CBLQuery_SetParameters, and aren't returned by \ref CBLQuery_Parameters.
+    @note  You must release the result set when you're finished with it. */
+_cbl_warn_unused
+CBLResultSet* CBLQuery_ExecuteWithParameters(CBLQuery* query _cbl_nonnull,
+                                             FLDict parameters _cbl_nonnull,
+                                             CBLError* error) CBLAPI;
+
+/** A callback that reports the result of \ref CBLQuery_ExecuteAsync.
+    @param context  The `context` given to \ref CBLQuery_ExecuteAsync.
+    @param query  The query.
+    @param results  The results, or NULL on failure. They're released after the callback
+                returns; to keep them, retain them.
+    @param error  NULL on success, or the error. */
+typedef void (*CBLQueryCompletion)(void *context,
+                                   CBLQuery *query,
+                                   CBLResultSet *results,
+                                   const CBLError *error);
+
+/** Runs the query asynchronously, on an I/O thread, and calls the callback with the results.
+    It uses the query's parameters at the time it runs, and runs in order with the database's
+    other asynchronous calls, like \ref CBLDatabase_SaveDocumentAsync. The callback is called
+    via the database's notification queue (see \ref CBLDatabase_BufferNotifications.)
+    @param query  The query to run.
+    @param completion  The callback to call with the results.
+    @param context  A value passed to the callback. */
+void CBLQuery_ExecuteAsync(CBLQuery* query _cbl_nonnull,
+                           CBLQueryCompletion completion _cbl_nonnull,
+                           void *context) CBLAPI;
+
 /** Returns information about the query, including the translated SQLite form, and the search
     strategy. You can use this to help optimize the query: the word `SCAN` in the strategy
     indicates a linear scan of the entire database, which should be avoided by adding an index.
@@ -128,6 +189,89 @@ FLSlice CBLQuery_ColumnName(CBLQuery* _cbl_nonnull,
 
 
 
+/** \name  Compiled-query cache
+    @{
+    Each database keeps a cache of recently used compiled queries, keyed by query language and
+    query string. When a \ref CBLQuery is released, its compiled form goes into the cache; a
+    later call to \ref CBLQuery_New with the same language and string takes it back out, skipping
+    the parsing and compilation steps. (Its parameters are cleared, so set them again.)
+    A compiled query is only ever used by one \ref CBLQuery object at a time.
+ */
+
+/** Statistics about a database's compiled-query cache. */
+typedef struct {
+    uint64_t hits;          ///< Number of times \ref CBLQuery_New found a cached query
+    uint64_t misses;        ///< Number of times \ref CBLQuery_New had to compile a query
+    unsigned count;         ///< Number of queries currently in the cache
+    unsigned capacity;      ///< Maximum number of queries the cache holds
+} CBLQueryCacheStats;
+
+/** Sets the maximum number of compiled queries the database's cache can hold.
+    The default is 50. Setting it to 0 disables the cache. */
+void CBLDatabase_SetQueryCacheCapacity(CBLDatabase* db _cbl_nonnull,
+                                       unsigned capacity) CBLAPI;
+
+/** Returns statistics about the database's compiled-query cache. */
+CBLQueryCacheStats CBLDatabase_QueryCacheStats(const CBLDatabase* db _cbl_nonnull) CBLAPI;
+
+/** @} */
+
+
+
+/** \name  Query statistics
+    @{
+    Optional instrumentation for finding slow queries. A query collects \ref CBLQueryStats once
+    \ref CBLQuery_SetStatsEnabled is called; a database-wide callback can also be registered to
+    hear about every query that takes longer than a threshold. When neither is enabled, queries
+    pay nothing for this.
+ */
+
+/** Performance statistics of a query. Times are in seconds. */
+typedef struct {
+    double compileTime;             ///< Time spent compiling the query (0 if it came from the cache)
+    uint64_t executionCount;        ///< Number of times the query has run since stats were enabled
+    double lastExecutionTime;       ///< Duration of the most recent run
+    double maxExecutionTime;        ///< Duration of the slowest run
+    double totalExecutionTime;      ///< Total duration of all runs
+    uint64_t lastRowCount;          ///< Number of rows returned by the most recent run
+    uint64_t totalRowCount;         ///< Total number of rows returned by all runs
+    bool usesIndex;                 ///< True if the query's strategy uses an index
+    bool fullScan;                  ///< True if the strategy includes a scan of every document
+} CBLQueryStats;
+
+/** Turns statistics collection on or off for a query. Turning it on resets the statistics. */
+void CBLQuery_SetStatsEnabled(CBLQuery* query _cbl_nonnull, bool enabled) CBLAPI;
+
+/** Returns a query's statistics. The `compileTime`, `usesIndex` and `fullScan` fields are
+    filled in even if statistics collection is not enabled. */
+CBLQueryStats CBLQuery_GetStats(CBLQuery* query _cbl_nonnull) CBLAPI;
+
+/** A callback that's told about a query that took a long time to run. It's called on the thread
+    that ran the query, so it should return quickly.
+    @param context  The `context` given to \ref CBLDatabase_SetSlowQueryCallback.
+    @param query  The query. Use \ref CBLQuery_Explain to see its strategy.
+    @param executionTime  How long the query took to run, in seconds.
+    @param rowCount  The number of rows in the result. */
+typedef void (*CBLSlowQueryCallback)(void *context,
+                                     CBLQuery* query _cbl_nonnull,
+                                     double executionTime,
+                                     uint64_t rowCount);
+
+/** Registers a callback to be called whenever a query of this database takes at least
+    `threshold` seconds to run.
+    @param db  The database.
+    @param threshold  The minimum duration of a query, in seconds, that triggers the callback.
+    @param callback  The callback, or NULL to remove the current callback.
+    @param context  An opaque value that will be passed to the callback. */
+void CBLDatabase_SetSlowQueryCallback(CBLDatabase* db _cbl_nonnull,
+                                      double threshold,
+                                      CBLSlowQueryCallback callback,
+                                      void *context) CBLAPI;
+
+/** @} */
+
+
+
 /** \name  Result sets
     @{
     A `CBLResultSet` is an iterator over the results returned by a query. It exposes one
@@ -157,12 +301,94 @@ FLValue CBLResultSet_ValueAtIndex(CBLResultSet* _cbl_nonnull,
 FLValue CBLResultSet_ValueForKey(CBLResultSet* _cbl_nonnull,
                                  const char* key _cbl_nonnull) CBLAPI;
 
+/** Moves the result-set iterator forward by up to `maxRows` results, copying the values of all
+    their columns into a caller-provided array. This has the same effect as calling
+    \ref CBLResultSet_Next and then \ref CBLResultSet_ValueAtIndex for each column, but it's
+    much faster when reading large result sets.
+    Afterwards, the result set is positioned at the last row fetched, if any.
+    @param rs  The result set.
+    @param maxRows  The maximum number of rows to fetch.
+    @param columnMajor  If false, the values are stored row by row: the value at row `r` and
+                    column `c` is at index `r * columnCount + c`. If true, they're stored
+                    column by column: the value is at index `c * maxRows + r`.
+    @param cells  An array of at least `maxRows * columnCount` values, where `columnCount` is
+                    the value of \ref CBLQuery_ColumnCount. `MISSING` values are stored as NULL.
+                    The values remain valid as long as the result set does.
+    @return  The number of rows fetched; 0 if there are no more results. */
+unsigned CBLResultSet_NextBatch(CBLResultSet* rs _cbl_nonnull,
+                                unsigned maxRows,
+                                bool columnMajor,
+                                FLValue* cells _cbl_nonnull) CBLAPI;
+
+/** Moves a result set's cursor to a specific row, so that the next call to
+    \ref CBLResultSet_Next will make that row current. Row 0 is the first row; seeking to it
+    rewinds the result set.
+    This is useful with a \ref CBLQueryDiffListener, to visit only the rows that changed.
+    @param rs  The result set.
+    @param row  The zero-based index of the row to go to.
+    @return  True on success, false if the row index is out of range. */
+bool CBLResultSet_SeekRow(CBLResultSet* rs _cbl_nonnull, uint64_t row) CBLAPI;
+
+/** Returns the query that created a result set. */
+CBLQuery* CBLResultSet_GetQuery(CBLResultSet* rs _cbl_nonnull) CBLAPI _cbl_returns_nonnull;
+
 CBL_REFCOUNTED(CBLResultSet*, ResultSet);
 
 /** @} */
 
 
 
+/** \name  Streaming results as JSON
+    @{
+    These functions run a query and write its results directly as
+    [NDJSON](http://ndjson.org) -- one JSON value per line, one line per row -- without creating
+    a \ref CBLResultSet. The output is accumulated in a buffer and handed to a callback in chunks,
+    so the memory used is bounded by the chunk size no matter how many rows there are. Rows are
+    encoded straight into the chunk, so there is one heap allocation per chunk, none per row.
+ */
+
+/** How each row is written by \ref CBLQuery_ExecuteToJSONStream. */
+typedef CBL_ENUM(uint32_t, CBLJSONRowFormat) {
+    kCBLJSONRowArrays,      ///< Each row is an array of column values; `MISSING` is written as `null`
+    kCBLJSONRowObjects      ///< Each row is an object keyed by column name; `MISSING` is omitted
+};
+
+/** Options for \ref CBLQuery_ExecuteToJSONStream. */
+typedef struct {
+    /** The format of each row. Defaults to \ref kCBLJSONRowArrays. */
+    CBLJSONRowFormat rowFormat;
+
+    /** The approximate size in bytes of each chunk passed to the callback. Rows are never split
+        across chunks, so a chunk may be larger if a single row is. Defaults to 64KB if 0. */
+    size_t chunkSize;
+} CBLJSONStreamOptions;
+
+/** A callback that receives a chunk of JSON output from \ref CBLQuery_ExecuteToJSONStream.
+    The chunk always ends with a newline. Its memory is reused after the callback returns, so
+    copy or write it out before returning.
+    @param context  The same `context` value that you passed to the function.
+    @param chunk  The JSON data: one or more complete lines.
+    @return  True to continue, false to stop the query. */
+typedef bool (*CBLJSONWriteCallback)(void *context, FLSlice chunk);
+
+/** Runs the query, writing its results as NDJSON to a callback, in chunks.
+    @param query  The query to run; its current parameters are used.
+    @param callback  The function that receives the output.
+    @param context  An opaque value that will be passed to the callback.
+    @param options  The output options, or NULL for the defaults.
+    @param error  On failure, the error will be written here.
+    @return  The number of rows written (not counting any in a chunk the callback rejected),
+             or -1 if the query failed to run. */
+int64_t CBLQuery_ExecuteToJSONStream(CBLQuery* query _cbl_nonnull,
+                                     CBLJSONWriteCallback callback _cbl_nonnull,
+                                     void *context,
+                                     const CBLJSONStreamOptions *options,
+                                     CBLError* error) CBLAPI;
+
+/** @} */
+
+
+
 /** \name  Change listener
     @{
     Adding a change listener to a query turns it into a "live query". When changes are made to
@@ -200,6 +426,41 @@ CBLListenerToken* CBLQuery_AddChangeListener(CBLQuery* query _cbl_nonnull,
                                              CBLQueryChangeListener listener _cbl_nonnull,
                                              void *context) CBLAPI;
 
+/** Priorities of query listeners; see \ref CBLQueryListenerOptions. */
+typedef CBL_ENUM(uint8_t, CBLQueryPriority) {
+    kCBLQueryPriorityNormal,        ///< Listener is notified as soon as allowed
+    kCBLQueryPriorityLow,           ///< Notifications are held while a batch is open
+};
+
+/** Options that limit how often a query listener is notified. All fields may be zero
+    (the default) to disable them. */
+typedef struct {
+    /** Minimum time in seconds between calls to the listener. If the results change sooner,
+        the listener is called once the interval has passed. */
+    double minInterval;
+    /** Maximum time in seconds that a change to the results may be held back, by
+        `minInterval` or by a batch. Zero means no limit. */
+    double maxStaleness;
+    /** If \ref kCBLQueryPriorityLow, notifications are deferred while a batch
+        (\ref CBLDatabase_BeginBatch) is open, and sent once when it ends. */
+    CBLQueryPriority priority;
+} CBLQueryListenerOptions;
+
+/** Registers a change listener callback with a query, like \ref CBLQuery_AddChangeListener,
+    but with options that throttle or defer its notifications. This is useful when many live
+    queries are open during heavy write activity.
+    @param query  The query to observe.
+    @param listener  The callback to be invoked.
+    @param context  An opaque value that will be passed to the callback.
+    @param options  Throttling options, or NULL to use the defaults.
+    @return  A token to be passed to \ref CBLListener_Remove when it's time to remove the
+            listener.*/
+_cbl_warn_unused
+CBLListenerToken* CBLQuery_AddChangeListenerWithOptions(CBLQuery* query _cbl_nonnull,
+                                                        CBLQueryChangeListener listener _cbl_nonnull,
+                                                        void *context,
+                                                        const CBLQueryListenerOptions* options) CBLAPI;
+
 /** Returns the query's _entire_ current result set, after it's been announced via a call to the
     listener's callback.
     The returned object is valid until the next call to \ref CBLQuery_CurrentResults (with the
@@ -213,6 +474,61 @@ CBLResultSet* CBLQuery_CurrentResults(CBLQuery* query _cbl_nonnull,
                                       CBLListenerToken *listener _cbl_nonnull,
                                       CBLError *error) CBLAPI;
 
+
+/** Describes how a query's result set changed, as arrays of row indices.
+    To update a copy of the old results, first remove the `removed` rows (highest index first),
+    then insert the `inserted` rows (lowest index first). The `changed` rows are ones that are
+    still present, in the same relative order, but whose column values differ.
+    Rows that moved relative to other rows are reported as removed and then inserted. */
+typedef struct {
+    unsigned oldRowCount;           ///< Number of rows in the previous result set
+    unsigned newRowCount;           ///< Number of rows in the new result set
+    unsigned removedCount;          ///< Number of items in `removed`
+    const unsigned *removed;        ///< Indices in the _old_ results of rows removed, ascending
+    unsigned insertedCount;         ///< Number of items in `inserted`
+    const unsigned *inserted;       ///< Indices in the _new_ results of rows inserted, ascending
+    unsigned changedCount;          ///< Number of items in `changed`
+    const unsigned *changed;        ///< Indices in the _new_ results of rows modified, ascending
+} CBLQueryDiff;
+
+/** A callback to be invoked after a query's results have changed, describing the differences
+    from the previous results it was given.
+    The first call describes the initial results, with all rows inserted.
+    @warning  By default, this listener may be called on arbitrary threads. If your code isn't
+                    prepared for that, you may want to use \ref CBLDatabase_BufferNotifications
+                    so that listeners will be called in a safe context.
+    @param context  The same `context` value that you passed when adding the listener.
+    @param query  The query that triggered the listener.
+    @param results  The entire new result set. It's valid only until the callback returns,
+                    unless you retain it. Use \ref CBLResultSet_SeekRow to visit individual rows.
+    @param diff  The differences from the previous result set. It, and its arrays, are valid
+                    only until the callback returns. */
+typedef void (*CBLQueryDiffListener)(void *context,
+                                     CBLQuery* query _cbl_nonnull,
+                                     CBLResultSet* results _cbl_nonnull,
+                                     const CBLQueryDiff* diff _cbl_nonnull);
+
+/** Registers a listener that's told _which rows_ of a query's results changed, so it can do
+    work proportional to the size of the change instead of the size of the result set.
+
+    Rows are matched between the old and new results by the value of a key column (such as a
+    document ID), or if there isn't one, by the entire row. The comparison uses hashes of the
+    row values.
+    If the query re-runs but its results are identical to those the listener last received,
+    the listener isn't called at all.
+    @param query  The query to observe.
+    @param keyColumn  The index of a column that uniquely identifies a row, or -1 to match
+                    rows by all their columns.
+    @param listener  The callback to be invoked.
+    @param context  An opaque value that will be passed to the callback.
+    @return  A token to be passed to \ref CBLListener_Remove when it's time to remove the
+            listener.*/
+_cbl_warn_unused
+CBLListenerToken* CBLQuery_AddDiffListener(CBLQuery* query _cbl_nonnull,
+                                           int keyColumn,
+                                           CBLQueryDiffListener listener _cbl_nonnull,
+                                           void *context) CBLAPI;
+
 /** @} */
 
 
@@ -296,6 +612,71 @@ bool CBLDatabase_DeleteIndex(CBLDatabase *db _cbl_nonnull,
     @note  You are responsible for releasing the returned Fleece array. */
 FLMutableArray CBLDatabase_IndexNames(CBLDatabase *db _cbl_nonnull) CBLAPI;
 
+
+/** A named index, for \ref CBLDatabase_CreateIndexesAsync. */
+typedef struct {
+    const char* name;           ///< The index name
+    CBLIndexSpec spec;          ///< The index specification
+} CBLNamedIndexSpec;
+
+/** A callback reporting the progress of a \ref CBLIndexBuild. It's called after each index has
+    been created, and a final time when the build stops.
+    @param context  The `context` value passed to \ref CBLDatabase_CreateIndexesAsync.
+    @param build  The index build.
+    @param completed  The number of indexes that have been created so far.
+    @param total  The total number of indexes to create.
+    @param finished  True if this is the final call.
+    @param error  On the final call, the error that stopped the build, or NULL on success.
+                    If the build was cancelled, this is `ECANCELED` in \ref CBLPOSIXDomain. */
+typedef void (*CBLIndexBuildCallback)(void *context,
+                                      CBLIndexBuild* build _cbl_nonnull,
+                                      unsigned completed,
+                                      unsigned total,
+                                      bool finished,
+                                      const CBLError *error);
+
+/** Creates indexes in the background, on a separate connection to the database, so that the
+    calling thread isn't blocked. Each index is created in its own transaction, so other
+    connections can write to the database between indexes.
+
+    A build is resumable: if it's cancelled, or the process exits, just start it again with the
+    same specs. Indexes that already exist with identical specs are skipped quickly.
+
+    The callback is called via the database's notification queue, so
+    \ref CBLDatabase_BufferNotifications applies to it.
+    Closing or deleting the database cancels the build, and waits for the index currently
+    being created.
+    @param db  The database.
+    @param specs  An array of index names and specs. It's copied, so it needn't remain valid.
+    @param count  The number of items in `specs`.
+    @param callback  A callback to report progress, or NULL.
+    @param context  An opaque value that will be passed to the callback.
+    @param error  On failure to start the build, the error will be written here.
+    @return  A new \ref CBLIndexBuild, which you must release when done with it,
+            or NULL on failure. */
+_cbl_warn_unused
+CBLIndexBuild* CBLDatabase_CreateIndexesAsync(CBLDatabase *db _cbl_nonnull,
+                                              const CBLNamedIndexSpec specs[],
+                                              unsigned count,
+                                              CBLIndexBuildCallback callback,
+                                              void *context,
+                                              CBLError *error) CBLAPI;
+
+CBL_REFCOUNTED(CBLIndexBuild*, IndexBuild);
+
+/** Asks an index build to stop. The index currently being created (if any) is completed, but
+    no more are started. */
+void CBLIndexBuild_Cancel(CBLIndexBuild* _cbl_nonnull) CBLAPI;
+
+/** Returns the number of indexes created so far, and optionally the total number. */
+unsigned CBLIndexBuild_Progress(CBLIndexBuild* _cbl_nonnull, unsigned *outTotal) CBLAPI;
+
+/** Blocks until an index build finishes.
+    @param build  The index build.
+    @param error  If the build failed or was cancelled, the error will be written here.
+    @return  True if all the indexes were created, false if not. */
+bool CBLIndexBuild_Wait(CBLIndexBuild* build _cbl_nonnull, CBLError *error) CBLAPI;
+
 /** @} */
 /** @} */
 
@@ -18,6 +18,7 @@
 
 #pragma once
 #include "CBLBase.h"
+#include "CBLDatabase.h"
 #include "fleece/Fleece.h"
 
 #ifdef __cplusplus
@@ -47,7 +48,9 @@ CBLEndpoint* CBLEndpoint_NewWithURL(const char *url _cbl_nonnull) CBLAPI;
 
 
 #ifdef COUCHBASE_ENTERPRISE
-/** Creates a new endpoint representing another local database. (Enterprise Edition only.) */
+/** Creates a new endpoint representing another local database. Replicating with it runs
+    entirely in-process, without any networking. The endpoint retains the database.
+    (Enterprise Edition only.) */
 CBLEndpoint* CBLEndpoint_NewWithLocalDB(CBLDatabase* _cbl_nonnull) CBLAPI;
 #endif
 
@@ -84,8 +87,38 @@ typedef CBL_ENUM(uint8_t, CBLReplicatorType) {
                 or it will slow down the replicator. */
 typedef bool (*CBLReplicationFilter)(void *context, CBLDocument* document, bool isDeleted);
 
+/** Flags describing a replicated document. */
+typedef CBL_ENUM(unsigned, CBLDocumentFlags) {
+    kCBLDocumentFlagsDeleted        = 1 << 0,   ///< The document has been deleted.
+    kCBLDocumentFlagsAccessRemoved  = 1 << 1    ///< Lost access to the document on the server.
+};
 
-/** The configuration of a replicator. */
+/** A lighter-weight alternative to \ref CBLReplicationFilter that's given the document's ID,
+    flags and body directly, instead of a \ref CBLDocument. No objects are allocated to call
+    it, so it's much cheaper when replicating large numbers of documents.
+    @warning  This callback will be called on a background thread managed by the replicator.
+                The `docID` and `body` are only valid until it returns.
+    @param context  The replicator configuration's `filterContext`.
+    @param docID  The document's ID.
+    @param flags  Indicates whether the document is deleted or its access was removed.
+    @param body  The document's properties.
+    @return  True to replicate the document, false to skip it. */
+typedef bool (*CBLReplicationBodyFilter)(void *context,
+                                         FLString docID,
+                                         CBLDocumentFlags flags,
+                                         FLDict body);
+
+
+/** The configuration of a replicator.
+
+    Besides callbacks, documents can be filtered by a predicate expression in the JSON query
+    syntax, such as `["AND", ["=", [".type"], "order"], ["=", [".region"], ["$region"]]]`.
+    The expression is compiled when the replicator is created and evaluated directly against
+    each revision's body, without calling back into the application. It supports properties,
+    `$` parameters, the metadata properties `._id` and `._deleted`, `["[]", ...]` array
+    literals, and the operators `=`, `!=`, `<`, `<=`, `>`, `>=`, `AND`, `OR`, `NOT`,
+    `EXISTS` and `IN`. If a filter callback is also given, it's only called for documents
+    that match the expression. */
 typedef struct {
     CBLDatabase* database;              ///< The database to replicate
     CBLEndpoint* endpoint;              ///< The address of the other database to replicate with
@@ -99,6 +132,16 @@ typedef struct {
     CBLReplicationFilter pushFilter;    ///< Optional callback to filter which docs are pushed
     CBLReplicationFilter pullFilter;    ///< Optional callback to validate incoming docs
     void* filterContext;                ///< Arbitrary value passed to filter callbacks
+    CBLReplicationBodyFilter pushBodyFilter; ///< Faster alternative to `pushFilter`
+    CBLReplicationBodyFilter pullBodyFilter; ///< Faster alternative to `pullFilter`
+    FLString pushFilterExpression;      ///< JSON predicate that pushed docs must match
+    FLString pullFilterExpression;      ///< JSON predicate that pulled docs must match
+    FLDict filterParameters;            ///< Values of `$` parameters in filter expressions
+
+    // Performance tuning. Zero values use LiteCore's defaults.
+    double checkpointInterval;          ///< Minimum seconds between saving checkpoints
+    double heartbeatInterval;           ///< Seconds between WebSocket heartbeat pings
+    int compressionLevel;               ///< zlib level (1-9) for messages; -1 disables compression
 } CBLReplicatorConfiguration;
 
 /** @} */
@@ -136,9 +179,7 @@ void CBLReplicator_Stop(CBLReplicator* _cbl_nonnull) CBLAPI;
 
 
 /** \name  Status and Progress
-    @{
-    **WARNING::** Replicator listeners/notifications are not yet implemented.
- */
+    @{ */
 
 /** The possible states a replicator can be in during its lifecycle. */
 typedef CBL_ENUM(uint8_t, CBLReplicatorActivityLevel) {
@@ -167,6 +208,27 @@ typedef struct {
 CBLReplicatorStatus CBLReplicator_Status(CBLReplicator* _cbl_nonnull) CBLAPI;
 
 
+/** Cumulative statistics of a replicator, since it was created. */
+typedef struct {
+    CBLReplicatorActivityLevel activity;    ///< Current state
+    CBLReplicatorProgress progress;         ///< Approximate fraction complete
+    uint64_t documentsPushed;               ///< Documents successfully pushed
+    uint64_t documentsPulled;               ///< Documents successfully pulled
+    uint64_t documentsFailed;               ///< Documents that failed to push or pull
+    uint64_t conflicts;                     ///< Documents that failed because of a conflict
+    uint64_t pushFiltered;                  ///< Revisions not pushed because of a filter
+    uint64_t pullFiltered;                  ///< Revisions rejected by a pull filter
+    uint64_t filterCalls;                   ///< Number of filter evaluations
+    double   filterTime;                    ///< Total seconds spent evaluating filters
+    uint64_t statusChanges;                 ///< Number of status updates from the replicator
+} CBLReplicatorStats;
+
+/** Returns a replicator's statistics. This doesn't take any locks, so it's cheap enough to
+    poll frequently; but since the counters are updated independently, the values may not be
+    exactly consistent with each other. */
+CBLReplicatorStats CBLReplicator_Stats(const CBLReplicator* _cbl_nonnull) CBLAPI;
+
+
 /** A callback that notifies you when the replicator's status changes.
     @warning  This callback will be called on a background thread managed by the replicator.
                 It must pay attention to thread-safety. It should not take a long time to return,
@@ -178,20 +240,12 @@ typedef void (*CBLReplicatorChangeListener)(void *context,
                                             CBLReplicator *replicator _cbl_nonnull,
                                             const CBLReplicatorStatus *status _cbl_nonnull);
 
-/** Adds a listener that will be called when the replicator's status changes.
-    @warning UNIMPLEMENTED! */
+/** Adds a listener that will be called when the replicator's status changes. */
 CBLListenerToken* CBLReplicator_AddChangeListener(CBLReplicator* _cbl_nonnull,
                                                   CBLReplicatorChangeListener _cbl_nonnull, 
                                                   void *context) CBLAPI;
 
 
-/** Flags describing a replicated document. */
-typedef CBL_ENUM(unsigned, CBLDocumentFlags) {
-    kCBLDocumentFlagsDeleted        = 1 << 0,   ///< The document has been deleted.
-    kCBLDocumentFlagsAccessRemoved  = 1 << 1    ///< Lost access to the document on the server.
-};
-
-
 /** Information about a document that's been pushed or pulled. */
 typedef struct {
     const char *ID;             ///< The document ID
@@ -200,9 +254,9 @@ typedef struct {
 } CBLReplicatedDocument;
 
 /** A callback that notifies you when documents are replicated.
-    @warning  This callback will be called on a background thread managed by the replicator.
-                It must pay attention to thread-safety. It should not take a long time to return,
-                or it will slow down the replicator.
+    It's called through the database's notification queue, like a database change listener;
+    so if you've called \ref CBLDatabase_BufferNotifications, it's called by
+    \ref CBLDatabase_SendNotifications, otherwise on a background thread.
     @param context  The value given when the listener was added.
     @param replicator  The replicator.
     @param isPush  True if the document(s) were pushed, false if pulled.
@@ -214,12 +268,81 @@ typedef void (*CBLReplicatedDocumentListener)(void *context,
                                               unsigned numDocuments,
                                               const CBLReplicatedDocument* documents);
 
-/** Adds a listener that will be called when documents are replicated.
-    @warning UNIMPLEMENTED! */
+/** Adds a listener that will be called when documents are replicated. Each call reports a
+    batch of documents as they're reported by the replicator. */
 CBLListenerToken* CBLReplicator_AddDocumentListener(CBLReplicator* _cbl_nonnull,
                                                     CBLReplicatedDocumentListener _cbl_nonnull,
                                                     void *context) CBLAPI;
 
+/** Adds a listener that will be called when documents are replicated, with documents collected
+    into larger batches, as by \ref CBLDatabase_AddCoalescedChangeListener. This is much more
+    efficient when many documents are replicated, as during an initial sync.
+    @param replicator  The replicator.
+    @param options  Determines how long documents are collected, and the maximum batch size.
+                    (`maxChanges` applies to pushed and pulled documents combined.)
+    @param listener  The callback to be invoked.
+    @param context  An opaque value that will be passed to the callback.
+    @return  A token to be passed to \ref CBLListener_Remove when it's time to remove the
+            listener. */
+CBLListenerToken* CBLReplicator_AddCoalescedDocumentListener(CBLReplicator* replicator _cbl_nonnull,
+                                                             const CBLChangeCoalescingOptions *options _cbl_nonnull,
+                                                             CBLReplicatedDocumentListener listener _cbl_nonnull,
+                                                             void *context) CBLAPI;
+
+/** @} */
+
+
+
+/** \name  Replicator Groups
+    @{
+    A replicator group runs a set of replicators while limiting how many are active at once,
+    so that a process with many databases doesn't have all their replicators running (with
+    their threads and connections) concurrently. Waiting replicators are started in order of
+    priority, and round-robin among equal priorities, as active ones finish.
+    A continuous replicator only finishes when it's stopped or fails; if a `timeSlice` is
+    given, the group instead stops it after that long whenever others are waiting, and puts
+    it back in line. */
+
+/** Options for a \ref CBLReplicatorGroup. */
+typedef struct {
+    unsigned maxActive;         ///< Maximum number of replicators running at once (0 = no limit)
+    double timeSlice;           ///< Seconds a continuous replicator runs while others wait
+                                ///<   (0 = until it stops)
+} CBLReplicatorGroupOptions;
+
+CBL_REFCOUNTED(CBLReplicatorGroup*, ReplicatorGroup);
+
+/** Creates a new, empty replicator group. */
+_cbl_warn_unused
+CBLReplicatorGroup* CBLReplicatorGroup_New(const CBLReplicatorGroupOptions* _cbl_nonnull) CBLAPI;
+
+/** Adds a replicator to a group. The group retains it, and will start it when its turn comes
+    (if the group has been started.) You should not start or stop the replicator yourself.
+    @param group  The group.
+    @param replicator  The replicator to add.
+    @param priority  Replicators with higher priorities are started first.
+    @return  True if added, false if it was already in the group. */
+bool CBLReplicatorGroup_Add(CBLReplicatorGroup* group _cbl_nonnull,
+                            CBLReplicator* replicator _cbl_nonnull,
+                            int priority) CBLAPI;
+
+/** Removes a replicator from a group. If it's running, it keeps running. */
+void CBLReplicatorGroup_Remove(CBLReplicatorGroup* _cbl_nonnull,
+                               CBLReplicator* _cbl_nonnull) CBLAPI;
+
+/** Starts scheduling the group's replicators. */
+void CBLReplicatorGroup_Start(CBLReplicatorGroup* _cbl_nonnull) CBLAPI;
+
+/** Stops all of the group's running replicators, asynchronously. They'll be run again, where
+    they left off, if the group is restarted. You should stop a group before releasing it. */
+void CBLReplicatorGroup_Stop(CBLReplicatorGroup* _cbl_nonnull) CBLAPI;
+
+/** Returns the number of the group's replicators that are currently running. */
+unsigned CBLReplicatorGroup_ActiveCount(CBLReplicatorGroup* _cbl_nonnull) CBLAPI;
+
+/** Returns the number of the group's replicators that are waiting for a turn to run. */
+unsigned CBLReplicatorGroup_WaitingCount(CBLReplicatorGroup* _cbl_nonnull) CBLAPI;
+
 /** @} */
 /** @} */
 
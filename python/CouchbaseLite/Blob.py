@@ -1,8 +1,9 @@
 from ._PyCBL import ffi, lib
 from .common import *
 
-class Blob (object):
+class Blob (CBLObject):
     def __init__(self, data =None, *, db =None, dict =None):
+        self._ref = None
         if dict != None:
             self._db = db
             self._dict = dict
@@ -16,7 +17,22 @@ class Blob (object):
             self.length = 0
         if data != None:
             self._data = data
-    
+            self.length = len(data)
+
+    @staticmethod
+    def _get(document, key):
+        ref = lib.PyCBL_DocumentBlob(document._ref, cstr(key))
+        if not ref:
+            return None
+        blob = Blob()
+        blob._ref = lib.CBL_Retain(ref)  # (the document owns `ref`; CBLObject releases ours)
+        blob._document = document       # the blob's metadata belongs to the document
+        contentType = lib.CBLBlob_ContentType(ref)
+        blob.contentType = pystr(contentType) if contentType else None
+        blob.digest = pystr(lib.CBLBlob_Digest(ref))
+        blob.length = lib.CBLBlob_Length(ref)
+        return blob
+
     def __repr__(self):
         r = "Blob["
         if self.contentType != None:
@@ -24,14 +40,30 @@ class Blob (object):
         if self.length != None:
             if self.contentType != None:
                 r += ", "
-                r += self.length + " bytes"
+            r += str(self.length) + " bytes"
         return r + "]"
-    
+
     @property
     def data(self):
+        """The blob's contents, as a memoryview. The contents of a saved blob are memory-mapped
+           (or read) by Couchbase Lite and shared with the view, not copied into `bytes`; they
+           stay valid as long as the memoryview does."""
         if "_data" in self.__dict__:
-            return self._data
-        if self.digest != None:
-            lib.cbl_blob
-    
+            return memoryview(self._data)
+        if not self._ref:
+            return None
+        c_data = ffi.new("const void**")
+        c_length = ffi.new("size_t*")
+        mapping = lib.CBLBlob_MapContent(self._ref, c_data, c_length, gError)
+        if not mapping:
+            raise CBLException("Couldn't read blob", gError)
+        if c_length[0] == 0:
+            lib.CBLBlobMapping_Release(mapping)
+            return memoryview(b"")
+        # The buffer keeps `owner` alive, which keeps the mapping until it's collected:
+        owner = ffi.gc(ffi.cast("char*", c_data[0]),
+                       lambda _: lib.CBLBlobMapping_Release(mapping))
+        return memoryview(ffi.buffer(owner, c_length[0]))
+
     def _asDict(self):
+        return self._dict
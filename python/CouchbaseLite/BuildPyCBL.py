@@ -33,6 +33,77 @@ ffibuilder.set_source("_PyCBL",
    r""" // passed to the real C compiler,
         // contains implementation of things declared in cdef()
         #include <cbl/CouchbaseLite.h>
+        #include <errno.h>
+        #include <stdlib.h>
+        #include <string.h>
+
+        // Fast paths for the Python classes, so that they cross into C once per many values
+        // instead of once per value.
+
+        // Returns the blob in a document property, or NULL. The blob belongs to the document:
+        // this doesn't retain it, so the caller must retain it to keep it.
+        static const CBLBlob* PyCBL_DocumentBlob(const CBLDocument *doc, const char *key) {
+            return FLValue_GetBlob(FLDict_Get(CBLDocument_Properties(doc), FLStr(key)));
+        }
+
+        typedef struct {
+            char *buf;
+            size_t length, capacity;
+            bool failed;
+        } PyCBL_Buffer;
+
+        static bool PyCBL_AppendRows(void *context, FLSlice chunk) {
+            PyCBL_Buffer *out = (PyCBL_Buffer*)context;
+            size_t needed = out->length + chunk.size + 1;    // leave room for the final ']'
+            if (needed > out->capacity) {
+                size_t capacity = 2 * needed;
+                char *buf = (char*)realloc(out->buf, capacity);
+                if (!buf) {
+                    out->failed = true;
+                    return false;
+                }
+                out->buf = buf;
+                out->capacity = capacity;
+            }
+            // Each NDJSON line is one row. No newlines appear inside JSON values, so turning
+            // every newline into a comma makes the rows the items of one array:
+            char *dst = out->buf + out->length;
+            memcpy(dst, chunk.buf, chunk.size);
+            for (size_t i = 0; i < chunk.size; ++i) {
+                if (dst[i] == '\n')
+                    dst[i] = ',';
+            }
+            out->length += chunk.size;
+            return true;
+        }
+
+        // Runs a query and returns all its rows as one JSON array, or NULL on failure.
+        // The caller must free() the result.
+        static char* PyCBL_QueryToJSONArray(CBLQuery *query, CBLJSONRowFormat format,
+                                            size_t *outLength, CBLError *outError) {
+            PyCBL_Buffer out = {(char*)malloc(64 * 1024), 1, 64 * 1024, false};
+            if (!out.buf)
+                out.failed = true;
+            else
+                out.buf[0] = '[';
+            CBLJSONStreamOptions options = {format, 0};
+            if (out.failed
+                    || CBLQuery_ExecuteToJSONStream(query, PyCBL_AppendRows, &out, &options,
+                                                    outError) < 0
+                    || out.failed) {
+                if (out.failed) {
+                    outError->domain = CBLPOSIXDomain;
+                    outError->code = ENOMEM;
+                }
+                free(out.buf);
+                return NULL;
+            }
+            if (out.length > 1)
+                --out.length;                   // remove the last row's comma
+            out.buf[out.length++] = ']';
+            *outLength = out.length;
+            return out.buf;
+        }
     """,
     libraries=[LibraryName],
     include_dirs=["../../include", "../../vendor/couchbase-lite-core/vendor/fleece/API"],
@@ -135,6 +206,8 @@ typedef ... CBLQuery;
 typedef ... CBLResultSet;
 typedef ... CBLReplicator;
 typedef ... CBLListenerToken;
+typedef ... CBLBlob;
+typedef ... CBLBlobMapping;
 
 typedef enum {
     kCBLDatabase_Create        = 1,  ///< Create the file if it doesn't exist
@@ -188,10 +261,20 @@ CBLListenerToken* CBLDatabase_AddChangeListener(const CBLDatabase* db,
 typedef uint8_t CBLConcurrencyControl;
 const CBLDocument* CBLDatabase_GetDocument(const CBLDatabase* database,
                                       const char* docID);
+size_t CBLDatabase_GetDocuments(const CBLDatabase* database,
+                                 const char* const docIDs[],
+                                 size_t count,
+                                 const CBLDocument* outDocs[]);
 const CBLDocument* CBLDatabase_SaveDocument(CBLDatabase* db,
                                        CBLDocument* doc,
                                        CBLConcurrencyControl concurrency,
                                        CBLError* error);
+int64_t CBLDatabase_SaveDocuments(CBLDatabase* db,
+                                  CBLDocument* const docs[],
+                                  size_t count,
+                                  CBLConcurrencyControl concurrency,
+                                  const CBLDocument* results[],
+                                  CBLError* error);
 bool CBLDocument_Delete(const CBLDocument* document,
                     CBLConcurrencyControl concurrency,
                     CBLError* error);
@@ -227,6 +310,16 @@ CBLListenerToken* CBLDatabase_AddDocumentChangeListener(const CBLDatabase* db,
                                                         void *context);
 extern "Python" void documentListenerCallback(void *context, const CBLDatabase*, const char *docID);
 
+//////// CBLBlob.h
+uint64_t CBLBlob_Length(const CBLBlob*);
+const char* CBLBlob_Digest(const CBLBlob*);
+const char* CBLBlob_ContentType(const CBLBlob*);
+CBLBlobMapping* CBLBlob_MapContent(const CBLBlob* blob,
+                                   const void **outData,
+                                   size_t *outLength,
+                                   CBLError *outError);
+void CBLBlobMapping_Release(CBLBlobMapping*);
+
 //////// CBLQuery.h
 typedef enum {
     kCBLJSONLanguage,
@@ -257,6 +350,16 @@ extern "Python" void queryListenerCallback(void *context, const CBLQuery *query)
 CBLListenerToken* CBLQuery_AddChangeListener(CBLQuery* query,
                                         CBLQueryChangeListener listener,
                                         void *context);
+
+typedef enum {
+    kCBLJSONRowArrays,
+    kCBLJSONRowObjects
+} CBLJSONRowFormat;
+
+//////// Fast paths (defined above, in the set_source code)
+const CBLBlob* PyCBL_DocumentBlob(const CBLDocument *doc, const char *key);
+char* PyCBL_QueryToJSONArray(CBLQuery *query, CBLJSONRowFormat format,
+                             size_t *outLength, CBLError *outError);
 """)
 
 if __name__ == "__main__":
@@ -106,6 +106,46 @@ class Database (CBLObject):
         savedDoc._ref = savedDocRef
         return savedDoc
 
+    def getMany(self, ids):
+        """Reads several documents at once, in one call into Couchbase Lite. Returns a list
+           with a Document for each ID, or None for a missing one."""
+        c_ids = [cstr(id) for id in ids]      # kept in a list so they aren't GC'd
+        c_docs = ffi.new("const CBLDocument*[]", len(c_ids))
+        lib.CBLDatabase_GetDocuments(self._ref, ffi.new("const char*[]", c_ids), len(c_ids),
+                                     c_docs)
+        docs = []
+        for id, ref in zip(ids, c_docs):
+            if ref:
+                doc = Document(id)
+                doc.database = self
+                doc._ref = ref
+                docs.append(doc)
+            else:
+                docs.append(None)
+        return docs
+
+    def saveMany(self, docs, concurrency = FailOnConflict):
+        """Saves several MutableDocuments in a single transaction, in one call into Couchbase
+           Lite. Returns a list with the saved Document for each, or None for one that had a
+           conflict. Any other error raises an exception, and nothing is saved."""
+        for doc in docs:
+            doc._prepareToSave()
+        c_results = ffi.new("const CBLDocument*[]", len(docs))
+        c_docs = ffi.new("CBLDocument*[]", [doc._ref for doc in docs])
+        if lib.CBLDatabase_SaveDocuments(self._ref, c_docs, len(docs),
+                                         concurrency, c_results, gError) < 0:
+            raise CBLException("Couldn't save documents", gError)
+        savedDocs = []
+        for doc, ref in zip(docs, c_results):
+            if ref:
+                savedDoc = Document(doc.id)
+                savedDoc.database = self
+                savedDoc._ref = ref
+                savedDocs.append(savedDoc)
+            else:
+                savedDocs.append(None)
+        return savedDocs
+
     def deleteDocument(self, id):
         if not lib.CBLDatabase_DeleteDocument(self._ref, cstr(id), gError):
             raise CBLException("Couldn't delete document", gError)
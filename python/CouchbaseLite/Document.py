@@ -17,6 +17,7 @@
 from ._PyCBL import ffi, lib
 from .common import *
 from .Collections import *
+from .Blob import Blob
 import json
 
 # Concurrency control:
@@ -66,8 +67,13 @@ class Document (CBLObject):
     def getProperties(self):
         if not "_properties" in self.__dict__:
             if self._ref:
-                fleeceProps = lib.CBLDocument_Properties(self._ref)
-                self._properties = decodeFleeceDict(fleeceProps)
+                # Decoding JSON in one call is much faster than walking the Fleece values
+                # one cffi call at a time:
+                jsonStr = lib.CBLDocument_PropertiesAsJSON(self._ref)
+                try:
+                    self._properties = json.loads(ffi.string(jsonStr))
+                finally:
+                    lib.free(jsonStr)
             else:
                 self._properties = {}
         return self._properties
@@ -80,6 +86,11 @@ class Document (CBLObject):
     def __contains__(self, key):
         return key in self.properties
 
+    def getBlob(self, key):
+        """Returns the Blob stored in the property `key`, or None if it isn't a blob."""
+        assert(self._ref)
+        return Blob._get(self, key)
+
     def addListener(self, listener):
         self.database.addDocumentListener(listener)
 
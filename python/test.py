@@ -20,6 +20,7 @@
 from CouchbaseLite.Database import Database, DatabaseConfiguration
 from CouchbaseLite.Document import Document, MutableDocument
 from CouchbaseLite.Query import JSONQuery
+import gc
 
 Database.deleteFile("db", "/tmp")
 
@@ -88,4 +89,46 @@ print ("Columns: ", q.columnNames)
 for row in q.execute():
     print ("row: ", row.asArray(), "  ...or...  ", row.asDictionary())
 
+rows = q.fetchall()
+print ("fetchall: ", rows)
+assert(len(rows) == 2)
+assert(["cardamom", [1, 0, 3.125]] in rows)
+assert({"flavor": "pumpkin spice"} in q.fetchall(asDictionaries = True))
+
+# Batch operations:
+
+newDocs = []
+for i in range(100):
+    doc = MutableDocument("batch-" + str(i))
+    doc["n"] = i
+    newDocs.append(doc)
+saved = db.saveMany(newDocs)
+assert(len(saved) == 100 and all(saved))
+assert(db.count == 102)
+
+got = db.getMany(["batch-0", "missing", "batch-99"])
+assert(got[0]["n"] == 0)
+assert(got[1] == None)
+assert(got[2]["n"] == 99)
+
+# Blobs: a Blob retains its C blob, which the document owns, so dropping it leaves the
+# document's blob intact:
+
+doc = MutableDocument("blob")
+doc["attachment"] = {"@type": "blob", "digest": "sha1-qZk+NkcGgWq6PiVxeFDCbJzQ2J0=",
+                     "length": 3, "content_type": "text/plain"}
+db.saveDocument(doc)
+doc = db.getDocument("blob")
+blob = doc.getBlob("attachment")
+assert(blob.length == 3)
+assert(blob.contentType == "text/plain")
+del blob
+gc.collect()
+blob = doc.getBlob("attachment")
+assert(blob.digest == "sha1-qZk+NkcGgWq6PiVxeFDCbJzQ2J0=")
+assert(doc["attachment"]["length"] == 3)
+del blob
+del doc
+gc.collect()
+
 db.close()
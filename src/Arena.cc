@@ -0,0 +1,103 @@
+//
+// Arena.cc
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Arena.hh"
+#include "Internal.hh"
+#include <algorithm>
+#include <new>
+
+using namespace std;
+
+
+thread_local CBLArena* CBLArena::sCurrent = nullptr;
+
+
+CBLArena::CBLArena(size_t chunkSize)
+:_chunkSize(chunkSize ? chunkSize : kDefaultChunkSize)
+,_previous(sCurrent)
+{ }
+
+
+CBLArena* CBLArena::begin(size_t chunkSize) {
+    auto arena = new CBLArena(chunkSize);
+    sCurrent = arena;
+    return arena;
+}
+
+
+void CBLArena::end() {
+    if (sCurrent == this)
+        sCurrent = _previous;
+    release();
+}
+
+
+void* CBLArena::allocate(size_t size) {
+    size += sizeof(Header);
+    Header *header;
+    if (sCurrent)
+        header = (Header*)sCurrent->allocateHere(size);
+    else
+        header = (Header*)::operator new(size);
+    header->arena = sCurrent;
+    return header + 1;
+}
+
+
+void CBLArena::free(void *block) noexcept {
+    if (!block)
+        return;
+    Header *header = (Header*)block - 1;
+    if (header->arena)
+        header->arena->release();
+    else
+        ::operator delete(header);
+}
+
+
+void* CBLArena::allocateHere(size_t size) {
+    size = (size + alignof(Header) - 1) & ~(alignof(Header) - 1);
+    if (size > size_t(_end - _next)) {
+        size_t chunkSize = max(size, _chunkSize);
+        _chunks.emplace_back(new uint8_t[chunkSize]);
+        _next = _chunks.back().get();
+        _end = _next + chunkSize;
+    }
+    void *block = _next;
+    _next += size;
+    ++_refCount;
+    return block;
+}
+
+
+void CBLArena::release() noexcept {
+    if (--_refCount == 0)
+        delete this;
+}
+
+
+#pragma mark - PUBLIC API:
+
+
+CBLArena* CBLArena_Begin(size_t chunkSize) CBLAPI {
+    return CBLArena::begin(chunkSize);
+}
+
+void CBLArena_End(CBLArena* arena) CBLAPI {
+    arena->end();
+}
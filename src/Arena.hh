@@ -0,0 +1,65 @@
+//
+// Arena.hh
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "CBLDocument.h"
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+
+/** A bump allocator for objects created on one thread during a scope; see CBLArena_Begin.
+    Classes opt in by declaring `operator new` and `operator delete` that call `allocate` and
+    `free`. Every block, including those allocated from the heap when no arena is current,
+    starts with a header pointing to its arena, so blocks can be freed on any thread.
+    An arena deletes itself when it's been ended and all its blocks have been freed. */
+struct CBLArena {
+    static constexpr size_t kDefaultChunkSize = 64 * 1024;
+
+    /** Creates an arena and makes it current on this thread. */
+    static CBLArena* begin(size_t chunkSize);
+
+    /** Makes the previous arena current. */
+    void end();
+
+    /** Allocates from the thread's current arena, or else the heap. */
+    static void* allocate(size_t size);
+
+    /** Frees a block returned by `allocate`. */
+    static void free(void *block) noexcept;
+
+private:
+    struct alignas(std::max_align_t) Header {
+        CBLArena* arena;
+    };
+
+    explicit CBLArena(size_t chunkSize);
+    ~CBLArena() =default;
+    void* allocateHere(size_t size);
+    void release() noexcept;
+
+    size_t const                            _chunkSize;
+    std::vector<std::unique_ptr<uint8_t[]>> _chunks;
+    uint8_t*                                _next {nullptr};    // Free space in last chunk
+    uint8_t*                                _end {nullptr};
+    std::atomic<size_t>                     _refCount {1};      // Live blocks, +1 until ended
+    CBLArena*                               _previous;          // Arena that was current
+
+    static thread_local CBLArena* sCurrent;
+};
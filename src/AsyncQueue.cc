@@ -0,0 +1,112 @@
+//
+// AsyncQueue.cc
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "AsyncQueue.hh"
+#include <algorithm>
+
+using namespace std;
+using namespace fleece;
+
+
+namespace cbl_internal {
+
+    namespace {
+
+        // A fixed set of threads, shared by all databases, that run queued jobs. It's never
+        // destroyed, so its threads live as long as the process.
+        class IOThreadPool {
+        public:
+            static IOThreadPool& shared() {
+                static IOThreadPool* sPool = new IOThreadPool;
+                return *sPool;
+            }
+
+            void enqueue(function<void()> job) {
+                {
+                    lock_guard<mutex> lock(_mutex);
+                    _jobs.push_back(move(job));
+                }
+                _cond.notify_one();
+            }
+
+        private:
+            IOThreadPool() {
+                unsigned nThreads = min(max(thread::hardware_concurrency(), 2u), 8u);
+                for (unsigned i = 0; i < nThreads; ++i)
+                    thread([this]() { run(); }).detach();
+            }
+
+            void run() {
+                unique_lock<mutex> lock(_mutex);
+                while (true) {
+                    _cond.wait(lock, [this] {return !_jobs.empty();});
+                    function<void()> job = move(_jobs.front());
+                    _jobs.pop_front();
+                    lock.unlock();
+                    job();
+                    job = nullptr;
+                    lock.lock();
+                }
+            }
+
+            mutex _mutex;
+            condition_variable _cond;
+            deque<function<void()>> _jobs;
+        };
+
+    }
+
+
+    void AsyncQueue::async(Task task) {
+        {
+            lock_guard<mutex> lock(_mutex);
+            _tasks.push_back(move(task));
+            if (_draining)
+                return;             // The running drain() will get to it
+            _draining = true;
+        }
+        Retained<AsyncQueue> self = this;
+        IOThreadPool::shared().enqueue([self]() { self->drain(); });
+    }
+
+
+    void AsyncQueue::drain() {
+        unique_lock<mutex> lock(_mutex);
+        _drainingThread = this_thread::get_id();
+        while (!_tasks.empty()) {
+            Task task = move(_tasks.front());
+            _tasks.pop_front();
+            lock.unlock();
+            task();
+            task = nullptr;         // Release its captures (perhaps the database) outside the lock
+            lock.lock();
+        }
+        _draining = false;
+        _drainingThread = thread::id();
+        _idleCond.notify_all();
+    }
+
+
+    void AsyncQueue::waitIdle() {
+        unique_lock<mutex> lock(_mutex);
+        if (_drainingThread == this_thread::get_id())
+            return;                 // Called from a task; waiting would deadlock
+        _idleCond.wait(lock, [this] {return !_draining;});
+    }
+
+}
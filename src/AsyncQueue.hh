@@ -0,0 +1,54 @@
+//
+// AsyncQueue.hh
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "RefCounted.hh"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+
+namespace cbl_internal {
+
+    /** Runs tasks in the order they're queued, one at a time, on a shared pool of I/O threads.
+        Each CBLDatabase has one, which runs its async calls (CBLDatabase_SaveDocumentAsync etc.)
+        Ref-counted so that a task that releases the last reference to the database can't
+        destroy the queue while it's still running. */
+    class AsyncQueue : public fleece::RefCounted {
+    public:
+        using Task = std::function<void()>;
+
+        /** Queues a task; returns immediately. */
+        void async(Task);
+
+        /** Blocks until every queued task has run. Returns immediately if called from a task. */
+        void waitIdle();
+
+    private:
+        void drain();
+
+        std::mutex                  _mutex;
+        std::condition_variable     _idleCond;
+        std::deque<Task>            _tasks;
+        bool                        _draining {false};  // True while a pool thread runs tasks
+        std::thread::id             _drainingThread;    // The thread running tasks, if any
+    };
+
+}
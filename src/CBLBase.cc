@@ -22,32 +22,6 @@
 #include "Util.hh"
 
 
-static const C4LogDomain kC4Domains[5] = {
-    kC4DefaultLog, kC4DatabaseLog, kC4QueryLog, kC4SyncLog, kC4WebSocketLog};
-
-
-void CBL_SetLogLevel(CBLLogLevel level, CBLLogDomain domain) CBLAPI {
-    if (domain == kCBLLogDomainAll) {
-        c4log_setCallbackLevel(C4LogLevel(level));
-        for (int i = 0; i < 5; ++i)
-            c4log_setLevel(kC4Domains[i], C4LogLevel(level));
-    } else {
-        c4log_setLevel(kC4Domains[domain], C4LogLevel(level));
-    }
-}
-
-
-void CBL_Log(CBLLogDomain domain, CBLLogLevel level, const char *format _cbl_nonnull, ...) CBLAPI {
-    char *message = nullptr;
-    va_list args;
-    va_start(args, format);
-    vasprintf(&message, format, args);
-    va_end(args);
-    C4LogToAt(kC4Domains[domain], C4LogLevel(level), "%s", message);
-    free(message);
-}
-
-
 char* CBLError_Message(const CBLError* error _cbl_nonnull) CBLAPI {
     return allocCString(c4error_getMessage(*internal(error)));
 }
@@ -17,6 +17,17 @@
 //
 
 #include "CBLBlob_Internal.hh"
+#include <cerrno>
+#include <fcntl.h>
+#include <memory>
+
+#ifdef _MSC_VER
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 using namespace fleece;
@@ -35,12 +46,12 @@ bool CBL_IsBlob(FLDict dict) CBLAPI {
 }
 
 const CBLBlob* CBLBlob_Get(FLDict blobDict) CBLAPI {
-    auto doc = CBLDocument::containing(Dict(blobDict));
-    if (!doc) {
+    auto body = cbl_internal::DocumentBody::containing(Dict(blobDict));
+    if (!body) {
         C4Warn("cbl_doc_getBlob: Dict at %p does not belong to any CBLDocument", blobDict);
         return nullptr;
     }
-    return doc->getBlob(blobDict);
+    return body->getBlob(blobDict);
 }
 
 FLDict CBLBlob_Properties(const CBLBlob* blob) CBLAPI {
@@ -63,6 +74,68 @@ FLSliceResult CBLBlob_LoadContent(const CBLBlob* blob, CBLError *outError) CBLAP
     return blob->getContents(internal(outError));
 }
 
+struct CBLBlobMapping {
+    void*           mappedAddress {nullptr};    // Address of mmap'd file, if any
+    size_t          mappedLength {0};
+    FLSliceResult   buffer {};                  // Heap copy, if the file couldn't be mapped
+
+    ~CBLBlobMapping() {
+#ifndef _MSC_VER
+        if (mappedAddress)
+            munmap(mappedAddress, mappedLength);
+#endif
+        FLSliceResult_Release(buffer);
+    }
+
+    // Maps the file read-only. Blob files are immutable, so a shared mapping is safe; and the
+    // mapping stays valid even if the file is deleted by a compaction.
+    bool map(slice path) {
+#ifndef _MSC_VER
+        int fd = open(string(path).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *addr = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED) {
+                mappedAddress = addr;
+                mappedLength = size_t(st.st_size);
+            }
+        }
+        close(fd);
+#endif
+        return mappedAddress != nullptr;
+    }
+};
+
+CBLBlobMapping* CBLBlob_MapContent(const CBLBlob* blob,
+                                   const void **outData,
+                                   size_t *outLength,
+                                   CBLError *outError) CBLAPI
+{
+    unique_ptr<CBLBlobMapping> mapping(new CBLBlobMapping);
+    alloc_slice path = blob->filePath();
+    if (path && mapping->map(path)) {
+        *outData = mapping->mappedAddress;
+        *outLength = mapping->mappedLength;
+    } else {
+        C4Error error {};
+        mapping->buffer = blob->getContents(&error);
+        if (!mapping->buffer.buf && error.code != 0) {
+            if (outError)
+                *internal(outError) = error;
+            return nullptr;
+        }
+        *outData = mapping->buffer.buf;
+        *outLength = mapping->buffer.size;
+    }
+    return mapping.release();
+}
+
+void CBLBlobMapping_Release(CBLBlobMapping *mapping) CBLAPI {
+    delete mapping;
+}
+
 CBLBlobReadStream* CBLBlob_OpenContentStream(const CBLBlob* blob, CBLError *outError) CBLAPI {
     return (CBLBlobReadStream*)blob->openStream(internal(outError));
 }
@@ -104,6 +177,8 @@ CBLBlob* CBLBlob_CreateWithStream(const char *contentType,
 
 
 CBLBlobWriteStream* CBLBlobWriter_New(CBLDatabase *db, CBLError *outError) CBLAPI {
+    if (!db->ensureOpen(internal(outError)))
+        return nullptr;
     return (CBLBlobWriteStream*) c4blob_openWriteStream(db->blobStore(),
                                                         internal(outError));
 }
@@ -121,6 +196,70 @@ bool CBLBlobWriter_Write(CBLBlobWriteStream* writer,
 }
 
 
+// Size of the buffer used to copy a file into the blob store.
+static constexpr size_t kFileCopyChunkSize = 256 * 1024;
+
+
+// Copies the rest of a file into a new blob write stream; the stream computes the digest as
+// it goes. (The write stream may encrypt the data, so it can't be copied by the kernel with
+// `copy_file_range` or `sendfile`; but reading sequentially in large chunks comes close.)
+static C4WriteStream* copyFileToBlobStore(CBLDatabase *db, int fd, C4Error *outError) {
+#ifdef POSIX_FADV_SEQUENTIAL
+    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    if (!db->ensureOpen(outError))
+        return nullptr;
+    C4WriteStream *writer = c4blob_openWriteStream(db->blobStore(), outError);
+    if (!writer)
+        return nullptr;
+    unique_ptr<uint8_t[]> buffer(new uint8_t[kFileCopyChunkSize]);
+    while (true) {
+        auto bytesRead = read(fd, buffer.get(), unsigned(kFileCopyChunkSize));
+        if (bytesRead > 0) {
+            if (!c4stream_write(writer, buffer.get(), size_t(bytesRead), outError))
+                break;
+        } else if (bytesRead == 0) {
+            return writer;
+        } else if (errno != EINTR) {
+            setError(outError, POSIXDomain, errno, "Couldn't read file for blob"_sl);
+            break;
+        }
+    }
+    c4stream_closeWriter(writer);
+    return nullptr;
+}
+
+CBLBlob* CBLBlob_CreateWithFileDescriptor(CBLDatabase *db,
+                                          const char *contentType,
+                                          int fd,
+                                          CBLError *outError) CBLAPI
+{
+    C4WriteStream *writer = copyFileToBlobStore(db, fd, internal(outError));
+    return writer ? createNewBlob(contentType, nullslice, (CBLBlobWriteStream*)writer) : nullptr;
+}
+
+CBLBlob* CBLBlob_CreateWithFile(CBLDatabase *db,
+                                const char *contentType,
+                                const char *path,
+                                CBLError *outError) CBLAPI
+{
+#ifdef O_CLOEXEC
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+#elif defined(_MSC_VER)
+    int fd = _open(path, _O_RDONLY | _O_BINARY);
+#else
+    int fd = open(path, O_RDONLY);
+#endif
+    if (fd < 0) {
+        setError(internal(outError), POSIXDomain, errno, "Couldn't open file for blob"_sl);
+        return nullptr;
+    }
+    CBLBlob *blob = CBLBlob_CreateWithFileDescriptor(db, contentType, fd, outError);
+    close(fd);
+    return blob;
+}
+
+
 #pragma mark - FLEECE UTILITIES:
 
 
@@ -38,9 +38,9 @@ static inline C4WriteStream* internal(CBLBlobWriteStream *writer) {return (C4Wri
 
 class CBLBlob : public CBLRefCounted {
 public:
-    // Constructor for existing blobs -- called by CBLDocument::getBlob()
-    CBLBlob(CBLDocument *doc, Dict properties)
-    :_db(doc->database())
+    // Constructor for existing blobs -- called by DocumentBody::getBlob()
+    CBLBlob(CBLDatabase *db, Dict properties)
+    :_db(db)
     {
         if (_db && c4doc_dictIsBlob(properties, &_key)) {
             _properties = properties;
@@ -76,13 +76,22 @@ public:
     }
 
     virtual FLSliceResult getContents(C4Error *outError) const {
-        return c4blob_getContents(store(), _key, outError);
+        FLSliceResult contents = c4blob_getContents(store(), _key, outError);
+        DatabaseMetrics::add(_db->metrics.blobBytesRead, contents.size);
+        return contents;
     }
 
     virtual C4ReadStream* openStream(C4Error *outError) const {
         return c4blob_openReadStream(store(), _key, outError);
     }
 
+    // Returns the path of the file holding the blob's contents, or null if there is none or it
+    // isn't readable as-is (i.e. the database is encrypted.)
+    virtual alloc_slice filePath() const {
+        C4Error error;
+        return alloc_slice(c4blob_getFilePath(store(), _key, &error));
+    }
+
     virtual bool install(CBLDatabase *db _cbl_nonnull, C4Error *outError) {
         return true;
     }
@@ -110,9 +119,9 @@ protected:
 private:
     bool findDatabase() {
         assert(!_db);
-        const CBLDocument* doc = CBLDocument::containing(_properties);
-        if (doc)
-            _db = doc->database();
+        auto body = cbl_internal::DocumentBody::containing(_properties);
+        if (body)
+            _db = body->database();
         return (_db != nullptr);
     }
 
@@ -177,6 +186,10 @@ public:
         }
     }
 
+    virtual alloc_slice filePath() const override {
+        return database() ? CBLBlob::filePath() : alloc_slice();
+    }
+
     virtual bool install(CBLDatabase *db _cbl_nonnull, C4Error *outError) override {
         CBL_Log(kCBLLogDomainDatabase, CBLLogInfo, "Saving new blob '%s'", digest());
         assert(database() == nullptr || database() == db);
@@ -194,6 +207,7 @@ public:
         }
         setDatabase(db);
         CBLDocument::unregisterNewBlob(this);
+        DatabaseMetrics::add(db->metrics.blobBytesWritten, contentLength());
         return true;
     }
 
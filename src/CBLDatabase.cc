@@ -19,9 +19,30 @@
 #include "CBLDatabase_Internal.hh"
 #include "CBLPrivate.h"
 #include "Internal.hh"
+#include "Timer.hh"
 #include "Util.hh"
 #include "PlatformCompat.hh"
+#include "c4.hh"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
 #include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <io.h>
+#else
+#include <dirent.h>
+#endif
 
 #ifndef CMAKE
 #include <unistd.h>
@@ -94,48 +115,1253 @@ bool CBL_DeleteDatabase(const char *name,
 #pragma mark - LIFECYCLE & OPERATIONS:
 
 
+// The path LiteCore gives a database: its directory plus "NAME.cblite2/".
+static string databasePath(const string &name, slice dir) {
+    string path(dir);
+    if (!path.empty() && path.back() != '/' && path.back() != '\\')
+        path += '/';
+    return path + name + ".cblite2/";
+}
+
+
+CBLDatabase::CBLDatabase(const string &name_, const C4DatabaseConfig2 &config,
+                         CBLDatabaseFlags flags_)
+:name(name_)
+,path(databasePath(name_, config.parentDirectory))
+,dir(config.parentDirectory)
+,flags(flags_)
+,_notificationQueue(this)
+,_deferredConfig(config)
+{
+    _deferredConfig.parentDirectory = slice(dir);   // (the caller's copy may not outlive us)
+}
+
+
+bool CBLDatabase::ensureOpen(C4Error *outError) const {
+    if (isOpen())
+        return true;
+    lock_guard<mutex> lock(_openMutex);
+    if (!isOpen() && _openError.code == 0) {         // (a failed open isn't retried)
+        if (_closed) {
+            setError(&_openError, LiteCoreDomain, kC4ErrorNotOpen, "Database is closed"_sl);
+        } else {
+            C4Database *db = c4db_openNamed(slice(name), &_deferredConfig, &_openError);
+            if (db) {
+                _c4db.store(db, memory_order_release);
+            } else {
+                alloc_slice message(c4error_getMessage(_openError));
+                C4Warn("Couldn't open database '%s' on first use: %.*s (%d/%d)",
+                       name.c_str(), int(message.size), (const char*)message.buf,
+                       _openError.domain, _openError.code);
+            }
+        }
+    }
+    if (isOpen())
+        return true;
+    if (outError)
+        *outError = _openError;
+    return false;
+}
+
+
+C4Database* CBLDatabase::openDeferred() const {
+    if (!ensureOpen(nullptr))
+        return nullptr;
+    return _c4db.load(memory_order_acquire);
+}
+
+
+bool CBLDatabase::closeUnopened() {
+    lock_guard<mutex> lock(_openMutex);
+    if (isOpen())
+        return false;
+    _closed = true;
+    return true;
+}
+
+
 CBLDatabase* CBLDatabase_Open(const char *name,
                          const CBLDatabaseConfiguration *config,
                          CBLError *outError) CBLAPI
 {
     C4DatabaseConfig2 c4config = asC4Config(config);
+    CBLDatabaseFlags flags = (config ? config->flags : kDefaultFlags);
+    if (flags & kCBLDatabase_Lazy) {
+        // Only check that the database exists; opening it waits till it's first used.
+        if (!(flags & kCBLDatabase_Create) && !c4db_exists(slice(name), c4config.parentDirectory)) {
+            setError(internal(outError), LiteCoreDomain, kC4ErrorNotFound,
+                     "Database does not exist"_sl);
+            return nullptr;
+        }
+        return retain(new CBLDatabase(name, c4config, flags));
+    }
     C4Database *c4db = c4db_openNamed(slice(name), &c4config, internal(outError));
     if (!c4db)
         return nullptr;
-    return retain(new CBLDatabase(c4db, name,
-                                  c4config.parentDirectory,
-                                  (config ? config->flags : kDefaultFlags)));
+    return retain(new CBLDatabase(c4db, name, c4config.parentDirectory, flags));
+}
+
+
+bool CBLDatabase_EnsureOpen(CBLDatabase* db, CBLError* outError) CBLAPI {
+    return db->ensureOpen(internal(outError));
+}
+
+
+size_t CBLDatabase_OpenMany(const char* const names[],
+                            size_t count,
+                            const CBLDatabaseConfiguration* config,
+                            unsigned threads,
+                            CBLDatabase* outDBs[],
+                            CBLError outErrors[]) CBLAPI
+{
+    CBLDatabaseConfiguration eagerConfig = {};
+    if (config)
+        eagerConfig = *config;
+    else
+        eagerConfig.flags = kDefaultFlags;
+    eagerConfig.flags &= ~kCBLDatabase_Lazy;
+
+    if (threads == 0)
+        threads = max(thread::hardware_concurrency(), 1u);
+    threads = unsigned(min(size_t(threads), count));
+
+    // Each worker opens the next unclaimed database until there are none left:
+    atomic<size_t> next {0}, opened {0};
+    auto work = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            CBLError error;
+            outDBs[i] = CBLDatabase_Open(names[i], &eagerConfig, &error);
+            if (outDBs[i])
+                ++opened;
+            else if (outErrors)
+                outErrors[i] = error;
+        }
+    };
+    vector<thread> workers;
+    for (unsigned t = 1; t < threads; ++t)
+        workers.emplace_back(work);
+    work();                             // The calling thread is one of the workers
+    for (auto &worker : workers)
+        worker.join();
+    return opened;
 }
 
 
 bool CBLDatabase_Close(CBLDatabase* db, CBLError* outError) CBLAPI {
-    return !db || c4db_close(internal(db), internal(outError));
+    if (!db)
+        return true;
+    db->waitForAsync();                 // let queued async calls finish first
+    db->stopBackgroundJobs();           // and cancel index builds, etc.
+    if (db->closeUnopened()) {          // opened lazily and never used: nothing to close
+        db->setGroupCommit(nullptr);
+        return true;
+    }
+    db->queryCache.setCapacity(0);      // queries can't be reused after closing
+    db->docCache.setCapacity(internal(db), 0);
+    db->setGroupCommit(nullptr);
+    db->setAutoPurge(nullptr, nullptr);
+    return c4db_close(internal(db), internal(outError));
+}
+
+bool CBLDatabase::beginBatch(C4Error *outError) {
+    if (!ensureOpen(outError) || !c4db_beginTransaction(c4db(), outError))
+        return false;
+    lock_guard<mutex> lock(_batchMutex);
+    ++_batchDepth;
+    return true;
+}
+
+bool CBLDatabase::endBatch(C4Error *outError) {
+    if (!ensureOpen(outError))
+        return false;
+    bool ok = timedCommit([&]{return c4db_endTransaction(c4db(), true, outError);});
+    // (Even if the commit failed, the transaction has ended.)
+    vector<DeferredNotification> deferred;
+    {
+        lock_guard<mutex> lock(_batchMutex);
+        if (_batchDepth > 0 && --_batchDepth == 0) {
+            swap(deferred, _afterBatch);
+            _batchEnded.notify_all();
+        }
+    }
+    for (auto &n : deferred)
+        notify(n.first, n.second);
+    if (!inBatch()) {
+        lock_guard<mutex> lock(_purgerMutex);
+        if (_purger && _batchExpiration > 0)
+            _purger->expirationChanged(_batchExpiration);
+        _batchExpiration = 0;
+    }
+    return ok;
+}
+
+void CBLDatabase::waitForBatch(function<bool()> stop) const {
+    unique_lock<mutex> lock(_batchMutex);
+    _batchEnded.wait(lock, [&] {return _batchDepth == 0 || stop();});
+}
+
+void CBLDatabase::wakeBatchWaiters() const {
+    lock_guard<mutex> lock(_batchMutex);
+    _batchEnded.notify_all();
 }
 
 bool CBLDatabase_BeginBatch(CBLDatabase* db, CBLError* outError) CBLAPI {
-    return c4db_beginTransaction(internal(db), internal(outError));
+    return db->beginBatch(internal(outError));
 }
 
 bool CBLDatabase_EndBatch(CBLDatabase* db, CBLError* outError) CBLAPI {
-    return c4db_endTransaction(internal(db), true, internal(outError));
+    return db->endBatch(internal(outError));
 }
 
 bool CBLDatabase_Compact(CBLDatabase* db, CBLError* outError) CBLAPI {
-    return c4db_compact(internal(db), internal(outError));
+    if (!db->ensureOpen(internal(outError)) || !c4db_compact(internal(db), internal(outError)))
+        return false;
+    db->compactionFinished();
+    return true;
 }
 
 bool CBLDatabase_Delete(CBLDatabase* db, CBLError* outError) CBLAPI {
+    db->waitForAsync();                 // let queued async calls finish first
+    db->stopBackgroundJobs();
+    if (db->closeUnopened()) {
+        db->setGroupCommit(nullptr);
+        return c4db_deleteNamed(slice(db->name), slice(db->dir), internal(outError));
+    }
+    db->queryCache.setCapacity(0);
+    db->docCache.setCapacity(internal(db), 0);
+    db->setGroupCommit(nullptr);
+    db->setAutoPurge(nullptr, nullptr);
     return c4db_delete(internal(db), internal(outError));
 }
 
 time_t CBLDatabase_NextDocExpiration(CBLDatabase* db) CBLAPI {
+    if (!db->ensureOpen(nullptr))
+        return 0;
     return c4db_nextDocExpiration(internal(db));
 }
 
 int64_t CBLDatabase_PurgeExpiredDocuments(CBLDatabase* db, CBLError* outError) CBLAPI {
+    if (!db->ensureOpen(internal(outError)))
+        return -1;
     return c4db_purgeExpiredDocs(internal(db), internal(outError));
 }
 
+bool CBLDatabase::setAutoPurge(const CBLAutoPurgeOptions *options, C4Error *outError) {
+    unique_ptr<ExpirationPurger> purger;
+    if (options) {
+        if (!ensureOpen(outError))
+            return false;
+        C4Database *connection = c4db_openAgain(c4db(), outError);
+        if (!connection)
+            return false;
+        purger.reset(new ExpirationPurger(connection, *options));
+    }
+    lock_guard<mutex> lock(_purgerMutex);
+    swap(_purger, purger);
+    return true;        // (the old purger, if any, stops as `purger` goes out of scope)
+}
+
+void CBLDatabase::expirationChanged(time_t expiration) {
+    lock_guard<mutex> lock(_purgerMutex);
+    if (!_purger || expiration <= 0)
+        return;
+    if (inBatch()) {
+        // The purger can't see the change until the batch is committed; tell it then.
+        if (_batchExpiration == 0 || expiration < _batchExpiration)
+            _batchExpiration = expiration;
+    } else {
+        _purger->expirationChanged(expiration);
+    }
+}
+
+bool CBLDatabase_SetAutoPurge(CBLDatabase* db,
+                              const CBLAutoPurgeOptions *options,
+                              CBLError* outError) CBLAPI
+{
+    return db->setAutoPurge(options, internal(outError));
+}
+
+
+#pragma mark - GROUP COMMIT:
+
+
+void CBLDatabase::setGroupCommit(const CBLGroupCommitOptions *options) {
+    unique_ptr<GroupCommitter> committer;
+    if (options)
+        committer.reset(new GroupCommitter(this, *options));
+    lock_guard<mutex> lock(_groupCommitMutex);
+    swap(_groupCommitter, committer);
+    // (the old committer, if any, commits its queue and stops as `committer` goes out of scope)
+}
+
+bool CBLDatabase::queueSave(CBLDocument *doc,
+                            CBLConcurrencyControl concurrency,
+                            GroupCommitter::Completion completion)
+{
+    if (GroupCommitter::onWriterThread() || inBatch())
+        return false;
+    lock_guard<mutex> lock(_groupCommitMutex);
+    return _groupCommitter && _groupCommitter->enqueue(doc, concurrency, move(completion));
+}
+
+void CBLDatabase_SetGroupCommit(CBLDatabase* db, const CBLGroupCommitOptions *options) CBLAPI {
+    db->setGroupCommit(options);
+}
+
+
+#pragma mark - ASYNC CALLS:
+
+
+void CBLDatabase::async(AsyncQueue::Task task) const {
+    _asyncQueue->async([this, task]() {
+        // A queued save returns before it's committed, so wait for any before this task:
+        {
+            unique_lock<mutex> lock(_asyncSavesMutex);
+            _asyncSavesCond.wait(lock, [this] {return _asyncSaves == 0;});
+        }
+        task();
+    });
+}
+
+void CBLDatabase::asyncSaveBegan() const {
+    lock_guard<mutex> lock(_asyncSavesMutex);
+    ++_asyncSaves;
+}
+
+void CBLDatabase::asyncSaveEnded() const {
+    {
+        lock_guard<mutex> lock(_asyncSavesMutex);
+        if (--_asyncSaves > 0)
+            return;
+    }
+    _asyncSavesCond.notify_all();
+}
+
+
+#pragma mark - BACKGROUND JOBS:
+
+
+bool CBLDatabase::runInBackground(function<void()> job, function<void()> cancel,
+                                  C4Error *outError)
+{
+    lock_guard<mutex> lock(_backgroundMutex);
+    if (_backgroundStopped) {
+        setError(outError, LiteCoreDomain, kC4ErrorNotOpen, "Database is closed"_sl);
+        return false;
+    }
+    // Join the threads of jobs that have finished:
+    for (auto i = _backgroundJobs.begin(); i != _backgroundJobs.end(); ) {
+        if (*i->finished) {
+            i->thread.join();
+            i = _backgroundJobs.erase(i);
+        } else {
+            ++i;
+        }
+    }
+
+    BackgroundJob bg;
+    bg.cancel = move(cancel);
+    bg.finished = make_shared<atomic<bool>>(false);
+    auto finished = bg.finished;
+    try {
+        bg.thread = thread([job, finished]() {
+            job();
+            *finished = true;
+        });
+    } catch (const system_error &x) {
+        setError(outError, POSIXDomain, x.code().value(), slice(x.what()));
+        return false;
+    }
+    _backgroundJobs.push_back(move(bg));
+    return true;
+}
+
+
+void CBLDatabase::stopBackgroundJobs() {
+    vector<BackgroundJob> jobs;
+    {
+        lock_guard<mutex> lock(_backgroundMutex);
+        _backgroundStopped = true;
+        swap(jobs, _backgroundJobs);
+    }
+    for (auto &bg : jobs)
+        bg.cancel();
+    for (auto &bg : jobs) {
+        if (bg.thread.get_id() == this_thread::get_id())
+            bg.thread.detach();     // A job's callback closed or freed me; it's about to exit
+        else
+            bg.thread.join();
+    }
+}
+
+
+#pragma mark - BACKGROUND COMPACTION:
+
+
+// Returns the total size of the files in the database's directory (as given by LiteCore): its
+// data file and write-ahead log, whatever the storage engine names them. Blobs are in a
+// subdirectory, so they aren't counted.
+static int64_t databaseFileSize(const string &dbPath) {
+    string dir = dbPath;
+    if (!dir.empty() && dir.back() != '/' && dir.back() != '\\')
+        dir += '/';
+    int64_t size = 0;
+#ifdef _MSC_VER
+    _finddata64_t info;
+    intptr_t handle = _findfirst64((dir + "*").c_str(), &info);
+    if (handle != -1) {
+        do {
+            if (!(info.attrib & _A_SUBDIR))
+                size += info.size;
+        } while (_findnext64(handle, &info) == 0);
+        _findclose(handle);
+    }
+#else
+    if (DIR *d = opendir(dir.c_str())) {
+        while (struct dirent *entry = readdir(d)) {
+            struct stat st;
+            if (stat((dir + entry->d_name).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+                size += st.st_size;
+        }
+        closedir(d);
+    }
+#endif
+    return size;
+}
+
+
+struct CBLCompaction : public CBLRefCounted {
+public:
+    CBLCompaction(CBLDatabase *db, CBLCompactionCallback callback, void *context)
+    :_db(db)
+    ,_callback(callback)
+    ,_context(context)
+    { }
+
+    // Runs the compaction on a thread owned by the database, which cancels it if it's closed.
+    bool start(C4Error *outError) {
+        if (!_db->ensureOpen(outError))
+            return false;
+        Retained<CBLCompaction> self = this;
+        return _db->runInBackground([self]() { self->run(); },
+                                    [self]() { self->cancel(); },
+                                    outError);
+    }
+
+    void cancel() {
+        _cancelled = true;
+        // (Holding the lock keeps run() from finishing, so the database can't go away yet.)
+        lock_guard<mutex> lock(_mutex);
+        if (_stage != kCBLCompactionFinished)
+            _db->wakeBatchWaiters();
+    }
+
+    CBLCompactionStage stage() const {
+        return _stage;
+    }
+
+    bool wait(int64_t *outBytesReclaimed, C4Error *outError) {
+        unique_lock<mutex> lock(_mutex);
+        _cond.wait(lock, [this] {return _stage == kCBLCompactionFinished;});
+        if (outBytesReclaimed)
+            *outBytesReclaimed = _bytesReclaimed;
+        if (outError)
+            *outError = _error;
+        return _error.code == 0;
+    }
+
+private:
+    // Runs on a background thread.
+    void run() {
+        C4Error error = {};
+        int64_t bytesReclaimed = 0;
+        // Wait for an open batch to end, rather than contend with its transaction:
+        _db->waitForBatch([this] {return _cancelled.load();});
+        if (_cancelled) {
+            error = c4error_make(POSIXDomain, ECANCELED, "Compaction was cancelled"_sl);
+        } else {
+            _stage = kCBLCompactionRunning;
+            report(kCBLCompactionRunning, 0, error);
+            int64_t sizeBefore = databaseFileSize(_db->path);
+            C4Database *connection = c4db_openAgain(internal(_db), &error);
+            if (connection) {
+                if (c4db_compact(connection, &error)) {
+                    error = {};
+                    bytesReclaimed = max(sizeBefore - databaseFileSize(_db->path), int64_t(0));
+                }
+                c4db_close(connection, nullptr);
+                c4db_release(connection);
+            }
+        }
+        _db->compactionFinished();
+        {
+            lock_guard<mutex> lock(_mutex);
+            _error = error;
+            _bytesReclaimed = bytesReclaimed;
+            _stage = kCBLCompactionFinished;
+        }
+        _cond.notify_all();
+        report(kCBLCompactionFinished, bytesReclaimed, error);
+    }
+
+    void report(CBLCompactionStage stage, int64_t bytesReclaimed, C4Error error) {
+        if (!_callback)
+            return;
+        Retained<CBLCompaction> self = this;
+        _db->notify(Notification([=]() {
+            self->_callback(self->_context, self, stage, bytesReclaimed,
+                            (error.code ? external(&error) : nullptr));
+        }));
+    }
+
+    CBLDatabase* const _db;                     // (Joins my thread before it's freed)
+    CBLCompactionCallback const _callback;
+    void* const _context;
+
+    atomic<CBLCompactionStage> _stage {kCBLCompactionWaiting};
+    atomic<bool> _cancelled {false};
+    mutex _mutex;
+    condition_variable _cond;
+    int64_t _bytesReclaimed {0};
+    C4Error _error {};
+};
+
+
+void CBLDatabase::setAutoCompaction(const CBLAutoCompactionOptions *options,
+                                    CBLCompactionCallback callback,
+                                    void *context)
+{
+    lock_guard<mutex> lock(_autoCompactMutex);
+    _autoCompactOptions = options ? *options : CBLAutoCompactionOptions{};
+    if (_autoCompactOptions.minGrowth == 0)
+        _autoCompactOptions.minGrowth = 1024*1024;
+    if (_autoCompactOptions.checkInterval == 0)
+        _autoCompactOptions.checkInterval = 10.0;
+    _autoCompactCallback = callback;
+    _autoCompactContext = context;
+    _autoCompactBaseline = databaseFileSize(path);
+    _autoCompactLastCheck = chrono::steady_clock::now();
+    _autoCompactEnabled = (_autoCompactOptions.growthRatio > 0);
+}
+
+
+void CBLDatabase::checkAutoCompaction() const {
+    auto now = chrono::steady_clock::now();
+    CBLAutoCompactionOptions options;
+    int64_t baseline;
+    {
+        lock_guard<mutex> lock(_autoCompactMutex);
+        if (_autoCompacting || _autoCompactOptions.growthRatio <= 0
+                || chrono::duration<double>(now - _autoCompactLastCheck).count()
+                        < _autoCompactOptions.checkInterval)
+            return;
+        _autoCompactLastCheck = now;
+        options = _autoCompactOptions;
+        baseline = _autoCompactBaseline;
+    }
+
+    int64_t size = databaseFileSize(path);
+    int64_t growth = size - baseline;
+    if (growth < options.minGrowth || growth < baseline * options.growthRatio)
+        return;
+
+    Retained<CBLCompaction> compaction;
+    {
+        lock_guard<mutex> lock(_autoCompactMutex);
+        if (_autoCompacting)
+            return;
+        _autoCompacting = true;
+        compaction = new CBLCompaction(const_cast<CBLDatabase*>(this),
+                                       _autoCompactCallback, _autoCompactContext);
+    }
+    C4Error error;
+    if (!compaction->start(&error)) {
+        C4Warn("Couldn't start auto-compaction: %d/%d", error.domain, error.code);
+        lock_guard<mutex> lock(_autoCompactMutex);
+        _autoCompacting = false;
+    }
+}
+
+
+void CBLDatabase::compactionFinished() const {
+    int64_t size = databaseFileSize(path);
+    lock_guard<mutex> lock(_autoCompactMutex);
+    _autoCompacting = false;
+    _autoCompactBaseline = size;
+}
+
+
+CBLCompaction* CBLDatabase_CompactAsync(CBLDatabase* db,
+                                        CBLCompactionCallback callback,
+                                        void *context,
+                                        CBLError* outError) CBLAPI
+{
+    Retained<CBLCompaction> compaction = new CBLCompaction(db, callback, context);
+    if (!compaction->start(internal(outError)))
+        return nullptr;
+    return retain(compaction.get());
+}
+
+void CBLCompaction_Cancel(CBLCompaction* compaction) CBLAPI {
+    compaction->cancel();
+}
+
+CBLCompactionStage CBLCompaction_Stage(const CBLCompaction* compaction) CBLAPI {
+    return compaction->stage();
+}
+
+bool CBLCompaction_Wait(CBLCompaction* compaction,
+                        int64_t *outBytesReclaimed,
+                        CBLError *outError) CBLAPI
+{
+    return compaction->wait(outBytesReclaimed, internal(outError));
+}
+
+void CBLDatabase_SetAutoCompaction(CBLDatabase* db,
+                                   const CBLAutoCompactionOptions *options,
+                                   CBLCompactionCallback callback,
+                                   void *context) CBLAPI
+{
+    db->setAutoCompaction(options, callback, context);
+}
+
+
+#pragma mark - CONNECTION POOL:
+
+
+struct CBLDatabasePool : public CBLRefCounted {
+public:
+    CBLDatabasePool(CBLDatabase *db, unsigned maxConnections)
+    :_name(db->name)
+    ,_config(*c4db_getConfig2(internal(db)))
+    ,_dir(_config.parentDirectory)
+    ,_maxConnections(maxConnections)
+    {
+        _config.parentDirectory = _dir;
+        _config.flags = (_config.flags & ~kC4DB_Create) | kC4DB_ReadOnly;
+    }
+
+    ~CBLDatabasePool() {
+        for (CBLDatabase *db : _idle) {
+            c4db_close(internal(db), nullptr);
+            release(db);
+        }
+    }
+
+    CBLDatabase* acquire(bool wait, C4Error *outError) {
+        unique_lock<mutex> lock(_mutex);
+        while (_idle.empty() && _openCount >= _maxConnections) {
+            if (!wait) {
+                if (outError)
+                    *outError = {};
+                return nullptr;
+            }
+            _cond.wait(lock);
+        }
+        if (!_idle.empty()) {
+            CBLDatabase *db = _idle.back();
+            _idle.pop_back();
+            _inUse.insert(db);
+            return db;
+        }
+
+        // Open a new connection, without holding the lock:
+        ++_openCount;
+        lock.unlock();
+        C4Database *c4db = c4db_openNamed(slice(_name), &_config, outError);
+        lock.lock();
+        if (!c4db) {
+            --_openCount;
+            _cond.notify_one();
+            return nullptr;
+        }
+        CBLDatabase *db = retain(new CBLDatabase(c4db, _name, _dir, kCBLDatabase_ReadOnly));
+        _inUse.insert(db);
+        return db;
+    }
+
+    void giveBack(CBLDatabase *db) {
+        {
+            lock_guard<mutex> lock(_mutex);
+            bool checkedOut = _inUse.erase(db) > 0;
+            assert(checkedOut);             // not from this pool, or returned twice
+            if (!checkedOut) {
+                C4Warn("CBLDatabasePool_Return: %p is not a connection checked out of pool %p",
+                       (void*)db, (void*)this);
+                return;
+            }
+            _idle.push_back(db);
+        }
+        _cond.notify_one();
+    }
+
+private:
+    string const _name;
+    C4DatabaseConfig2 _config;
+    alloc_slice const _dir;                 // Backing store of _config.parentDirectory
+    unsigned const _maxConnections;
+
+    mutex _mutex;
+    condition_variable _cond;
+    vector<CBLDatabase*> _idle;             // Open connections not in use
+    unordered_set<CBLDatabase*> _inUse;     // Connections checked out by Acquire
+    unsigned _openCount {0};                // Connections opened, idle or not
+};
+
+
+CBLDatabasePool* CBLDatabasePool_New(CBLDatabase* db,
+                                     unsigned maxConnections,
+                                     CBLError* outError) CBLAPI
+{
+    if (!db->ensureOpen(internal(outError)))
+        return nullptr;
+    if (maxConnections == 0)
+        maxConnections = max(thread::hardware_concurrency(), 1u);
+    return retain(new CBLDatabasePool(db, maxConnections));
+}
+
+CBLDatabase* CBLDatabasePool_Acquire(CBLDatabasePool* pool, CBLError* outError) CBLAPI {
+    return pool->acquire(true, internal(outError));
+}
+
+CBLDatabase* CBLDatabasePool_TryAcquire(CBLDatabasePool* pool, CBLError* outError) CBLAPI {
+    return pool->acquire(false, internal(outError));
+}
+
+void CBLDatabasePool_Return(CBLDatabasePool* pool, CBLDatabase* db) CBLAPI {
+    pool->giveBack(db);
+}
+
+
+#pragma mark - EXPORT:
+
+
+namespace {
+
+    // Runs a CBLDatabase_Export call. The sequence range is split evenly between the worker
+    // threads, each of which reads through its own connection.
+    class Exporter {
+    public:
+        Exporter(CBLDatabase *db, const CBLExportOptions &options,
+                 CBLExportSink sink, CBLExportBlobSink blobSink, void *context)
+        :_db(db)
+        ,_options(options)
+        ,_sink(sink)
+        ,_blobSink(options.includeBlobs ? blobSink : nullptr)
+        ,_context(context)
+        ,_chunkSize(options.chunkSize ? options.chunkSize : 1024*1024)
+        { }
+
+        bool run(C4Error *outError) {
+            // Every document that exists now has a sequence at most `lastSeq`:
+            C4SequenceNumber lastSeq = c4db_getLastSequence(internal(_db));
+            uint64_t nThreads = _options.threads;
+            if (nThreads == 0)
+                nThreads = max(thread::hardware_concurrency(), 1u);
+            nThreads = min(nThreads, max(lastSeq, C4SequenceNumber(1)));
+
+            vector<thread> workers;
+            C4SequenceNumber perThread = (lastSeq + nThreads - 1) / nThreads;
+            for (unsigned i = 0; i < nThreads; ++i) {
+                C4SequenceNumber since = i * perThread;
+                C4SequenceNumber last = min(since + perThread, lastSeq);
+                workers.emplace_back([=]() { exportRange(i, since, last); });
+            }
+            for (auto &worker : workers)
+                worker.join();
+
+            // Documents updated during the export now have sequences after `lastSeq`, so the
+            // workers skipped them. Pick them up (and any new docs) in one more pass:
+            if (!_failed)
+                exportRange(0, lastSeq, UINT64_MAX);
+
+            if (_failed) {
+                if (outError)
+                    *outError = _error;
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        void fail(C4Error error) {
+            lock_guard<mutex> lock(_mutex);
+            if (!_failed) {
+                _error = error;
+                _failed = true;
+            }
+        }
+
+        void exportRange(unsigned worker, C4SequenceNumber since, C4SequenceNumber last) {
+            C4Error error = {};
+            C4Database *connection = c4db_openAgain(internal(_db), &error);
+            if (!connection)
+                return fail(error);
+            if (!exportRange(connection, worker, since, last, &error))
+                fail(error);
+            c4db_close(connection, nullptr);
+            c4db_release(connection);
+        }
+
+        // Exports the docs with sequences in (since, last].
+        bool exportRange(C4Database *connection, unsigned worker,
+                         C4SequenceNumber since, C4SequenceNumber last,
+                         C4Error *outError)
+        {
+            C4EnumeratorOptions options = kC4DefaultEnumeratorOptions;     // includes bodies
+            c4::ref<C4DocEnumerator> e = c4db_enumerateChanges(connection, since, &options,
+                                                               outError);
+            if (!e)
+                return false;
+            C4BlobStore *blobStore = _blobSink ? c4db_getBlobStore(connection, outError)
+                                               : nullptr;
+            if (_blobSink && !blobStore)
+                return false;
+
+            Chunk chunk(_options.format);
+            uint64_t docCount = 0;
+            while (!_failed) {
+                if (!c4enum_next(e, outError)) {
+                    if (outError->code)
+                        return false;
+                    break;
+                }
+                C4DocumentInfo info;
+                if (!c4enum_getDocumentInfo(e, &info) || info.sequence > last)
+                    break;
+                c4::ref<C4Document> doc = c4enum_getDocument(e, outError);
+                if (!doc)
+                    return false;
+                Dict body = Value::fromData(doc->selectedRev.body, kFLTrusted).asDict();
+                if (!body)
+                    body = Dict::emptyDict();
+                ++docCount;
+                chunk.add(doc->docID, body);
+                if (blobStore && !exportBlobs(blobStore, worker, body, outError))
+                    return false;
+                if (chunk.size() >= _chunkSize && !emit(worker, chunk, outError))
+                    return false;
+            }
+            DatabaseMetrics::add(_db->metrics.documentsRead, docCount);
+            return _failed || emit(worker, chunk, outError);
+        }
+
+        bool exportBlobs(C4BlobStore *blobStore, unsigned worker, Dict body, C4Error *outError) {
+            for (DeepIterator i(body); i; ++i) {
+                Dict dict = i.value().asDict();
+                C4BlobKey key;
+                if (!dict || !c4doc_dictIsBlob(dict, &key))
+                    continue;
+                i.skipChildren();
+                alloc_slice digest(c4blob_keyToString(key));
+                {
+                    lock_guard<mutex> lock(_mutex);
+                    if (!_exportedBlobs.insert(string(digest)).second)
+                        continue;       // another doc already exported it
+                }
+                alloc_slice contents(c4blob_getContents(blobStore, key, outError));
+                if (!contents) {
+                    if (outError->domain == LiteCoreDomain && outError->code == kC4ErrorNotFound)
+                        continue;       // Blob isn't stored locally (yet); not an error
+                    return false;
+                }
+                DatabaseMetrics::add(_db->metrics.blobBytesRead, contents.size);
+                if (!_blobSink(_context, worker, string(digest).c_str(), contents))
+                    return abort(outError);
+            }
+            return true;
+        }
+
+        // Accumulates exported docs in the requested format.
+        class Chunk {
+        public:
+            explicit Chunk(CBLExportFormat format)
+            :_format(format)
+            ,_encoder(format == kCBLExportNDJSON ? kFLEncodeJSON : kFLEncodeFleece)
+            { }
+
+            void add(slice docID, Dict body) {
+                if (_format == kCBLExportNDJSON) {
+                    _encoder.beginDict();
+                    _encoder.writeKey("_id"_sl);
+                    _encoder.writeString(docID);
+                    for (Dict::iterator i(body); i; ++i) {
+                        _encoder.writeKey(i.keyString());
+                        _encoder.writeValue(i.value());
+                    }
+                    _encoder.endDict();
+                    alloc_slice json = _encoder.finish();
+                    _encoder.reset();
+                    _output.append((const char*)json.buf, json.size);
+                    _output.push_back('\n');
+                } else {
+                    if (_count == 0)
+                        _encoder.beginDict();
+                    _encoder.writeKey(docID);
+                    _encoder.writeValue(body);
+                    _size += docID.size + FLValue_GetData(body).size;
+                }
+                ++_count;
+            }
+
+            size_t count() const    {return _count;}
+            size_t size() const     {return _format == kCBLExportNDJSON ? _output.size() : _size;}
+
+            // Returns the accumulated data and clears the chunk.
+            alloc_slice take() {
+                alloc_slice result;
+                if (_format == kCBLExportNDJSON) {
+                    result = alloc_slice(_output.data(), _output.size());
+                    _output.clear();
+                } else {
+                    _encoder.endDict();
+                    result = _encoder.finish();
+                    _encoder.reset();
+                    _size = 0;
+                }
+                _count = 0;
+                return result;
+            }
+
+        private:
+            CBLExportFormat const _format;
+            Encoder _encoder;
+            string _output;             // NDJSON lines
+            size_t _size {0};           // Approximate size of Fleece data
+            size_t _count {0};
+        };
+
+        bool emit(unsigned worker, Chunk &chunk, C4Error *outError) {
+            if (chunk.count() == 0)
+                return true;
+            alloc_slice data = chunk.take();
+            if (!data) {
+                setError(outError, FleeceDomain, kFLEncodeError, "Couldn't encode export"_sl);
+                return false;
+            }
+            return _sink(_context, worker, data) || abort(outError);
+        }
+
+        // Called when a callback returns false; stops the export with an error code of 0.
+        bool abort(C4Error *outError) {
+            *outError = {};
+            return false;
+        }
+
+        CBLDatabase* const _db;
+        CBLExportOptions const _options;
+        CBLExportSink const _sink;
+        CBLExportBlobSink const _blobSink;
+        void* const _context;
+        size_t const _chunkSize;
+
+        atomic<bool> _failed {false};
+        mutex _mutex;                       // Guards _error and _exportedBlobs
+        C4Error _error {};
+        unordered_set<string> _exportedBlobs;
+    };
+
+}
+
+
+bool CBLDatabase_Export(CBLDatabase* db,
+                        const CBLExportOptions* options,
+                        CBLExportSink sink,
+                        CBLExportBlobSink blobSink,
+                        void *context,
+                        CBLError* outError) CBLAPI
+{
+    if (options->includeBlobs && !blobSink) {
+        setError(internal(outError), LiteCoreDomain, kC4ErrorInvalidParameter,
+                 "Exporting blobs requires a blob sink"_sl);
+        return false;
+    }
+    if (!db->ensureOpen(internal(outError)))
+        return false;
+    return Exporter(db, *options, sink, blobSink, context).run(internal(outError));
+}
+
+
+#pragma mark - IMPORT:
+
+
+namespace {
+
+    // Runs a CBLDatabase_Import call. Input is converted right into the database's shared
+    // Fleece encoder, so each document body is only encoded once.
+    class Importer {
+    public:
+        Importer(CBLDatabase *db, const CBLImportOptions &options,
+                 CBLImportReader reader, void *context)
+        :_db(db)
+        ,_c4db(internal(db))
+        ,_options(options)
+        ,_reader(reader)
+        ,_context(context)
+        ,_batchSize(options.batchSize ? options.batchSize : 10000)
+        ,_encoder(c4db_getSharedFleeceEncoder(_c4db))
+        { }
+
+        ~Importer() {
+            _encoder.detach();
+        }
+
+        uint64_t imported() const   {return _imported;}
+
+        bool run(C4Error *outError) {
+            // Indexes are much faster to build all at once than to update per document:
+            for (unsigned i = 0; i < _options.deferredIndexCount; ++i)
+                c4db_deleteIndex(_c4db, slice(_options.deferredIndexes[i].name), nullptr);
+
+            bool ok = (_options.format == kCBLExportNDJSON) ? importNDJSON(outError)
+                                                            : importFleece(outError);
+            ok = ok && commit(outError);
+            _transaction.reset();           // aborts an unfinished batch
+
+            for (unsigned i = 0; i < _options.deferredIndexCount; ++i) {
+                const CBLNamedIndexSpec &index = _options.deferredIndexes[i];
+                C4IndexOptions indexOptions = {};
+                indexOptions.language = index.spec.language;
+                indexOptions.ignoreDiacritics = index.spec.ignoreAccents;
+                C4Error indexError;
+                if (!c4db_createIndex(_c4db, slice(index.name),
+                                      slice(index.spec.keyExpressionsJSON),
+                                      (C4IndexType)index.spec.type, &indexOptions, &indexError)
+                        && ok) {
+                    if (outError)
+                        *outError = indexError;
+                    ok = false;
+                }
+            }
+            return ok;
+        }
+
+    private:
+        bool importNDJSON(C4Error *outError) {
+            string pending;         // Incomplete line left over from the previous chunk
+            slice input;
+            while (read(input, outError)) {
+                if (!input)
+                    return pending.empty() || importLine(slice(pending), outError);
+                auto begin = (const char*)input.buf, end = (const char*)input.end();
+                while (begin < end) {
+                    auto eol = (const char*)memchr(begin, '\n', end - begin);
+                    if (!eol) {
+                        pending.append(begin, end);
+                        break;
+                    }
+                    bool ok;
+                    if (pending.empty()) {
+                        ok = importLine(slice(begin, eol), outError);
+                    } else {
+                        pending.append(begin, eol);
+                        ok = importLine(slice(pending), outError);
+                        pending.clear();
+                    }
+                    if (!ok)
+                        return false;
+                    begin = eol + 1;
+                }
+            }
+            return false;
+        }
+
+        // Imports one NDJSON line. Lines written by CBLDatabase_Export start with the `_id`
+        // property; that's cut out of the JSON, so the rest converts directly into the body.
+        bool importLine(slice line, C4Error *outError) {
+            auto begin = (const char*)line.buf, end = (const char*)line.end();
+            while (begin < end && isspace((unsigned char)*begin))
+                ++begin;
+            while (end > begin && isspace((unsigned char)end[-1]))
+                --end;
+            if (begin == end)
+                return true;
+
+            static const slice kIDPrefix = "{\"_id\":\""_sl;
+            if (slice(begin, end).hasPrefix(kIDPrefix)) {
+                auto idStart = begin + kIDPrefix.size;
+                auto idEnd = (const char*)memchr(idStart, '"', end - idStart);
+                if (idEnd && end - idEnd > 1 && (idEnd[1] == ',' || idEnd[1] == '}')
+                          && !memchr(idStart, '\\', idEnd - idStart)) {
+                    // Replace `{"_id":"...",` with `{`, or `{"_id":"..."}` with `{}`:
+                    _line.assign(idEnd + (idEnd[1] == ','), end);
+                    _line[0] = '{';
+                    alloc_slice body = convertJSON(slice(_line), outError);
+                    return body && put(slice(idStart, idEnd), body, outError);
+                }
+            }
+
+            // General case: convert the whole object, then re-encode it without the `_id`:
+            alloc_slice data = convertJSON(slice(begin, end), outError);
+            if (!data)
+                return false;
+            Dict root = Value::fromData(data, kFLTrusted).asDict();
+            Value docID = root["_id"];
+            if (!docID)
+                return put(nullslice, data, outError);
+            if (!docID.asString()) {
+                setError(outError, LiteCoreDomain, kC4ErrorBadDocID,
+                         "Imported document's _id is not a string"_sl);
+                return false;
+            }
+            _encoder.beginDict(root.count() - 1);
+            for (Dict::iterator i(root); i; ++i) {
+                if (i.keyString() != "_id"_sl) {
+                    _encoder.writeKey(i.keyString());
+                    _encoder.writeValue(i.value());
+                }
+            }
+            _encoder.endDict();
+            return put(docID.asString(), finish(outError), outError);
+        }
+
+        bool importFleece(C4Error *outError) {
+            slice input;
+            while (read(input, outError)) {
+                if (!input)
+                    return true;
+                Dict docs = Value::fromData(input, kFLUntrusted).asDict();
+                if (!docs) {
+                    setError(outError, FleeceDomain, kFLInvalidData,
+                             "Invalid Fleece data in import"_sl);
+                    return false;
+                }
+                for (Dict::iterator i(docs); i; ++i) {
+                    Dict body = i.value().asDict();
+                    if (!body) {
+                        setError(outError, FleeceDomain, kFLInvalidData,
+                                 "Imported document is not a dictionary"_sl);
+                        return false;
+                    }
+                    _encoder.writeValue(body);
+                    if (!put(i.keyString(), finish(outError), outError))
+                        return false;
+                }
+            }
+            return false;
+        }
+
+        bool read(slice &outInput, C4Error *outError) {
+            FLSlice input = {};
+            if (!_reader(_context, &input))
+                return stopped(outError);
+            outInput = input;
+            return true;
+        }
+
+        alloc_slice convertJSON(slice json, C4Error *outError) {
+            if (json[0] != '{' || !_encoder.convertJSON(json)) {
+                _encoder.reset();
+                setError(outError, FleeceDomain, kFLJSONError,
+                         "Imported document is not a JSON object"_sl);
+                return nullslice;
+            }
+            return finish(outError);
+        }
+
+        alloc_slice finish(C4Error *outError) {
+            alloc_slice result = _encoder.finish();
+            _encoder.reset();
+            if (!result)
+                setError(outError, FleeceDomain, kFLEncodeError,
+                         "Couldn't encode imported document"_sl);
+            return result;
+        }
+
+        // Saves a document, overwriting any existing revision. Commits when the batch is full.
+        bool put(slice docID, alloc_slice body, C4Error *outError) {
+            if (!body)
+                return false;
+            if (!_transaction) {
+                _transaction.reset(new c4::Transaction(_c4db));
+                if (!_transaction->begin(outError))
+                    return false;
+            }
+            DocumentID newID;
+            if (!docID) {
+                // (With the monotonic strategy, the new docs are appended to the B-tree.)
+                if (!_db->docIDGenerator.generate(newID, outError))
+                    return false;
+                docID = newID;
+            }
+
+            C4DocPutRequest rq = {};
+            rq.allocedBody = {body.buf, body.size};
+            rq.docID = docID;
+            rq.save = true;
+            C4Error c4err;
+            c4::ref<C4Document> doc = c4doc_put(_c4db, &rq, nullptr, &c4err);
+            if (!doc && c4err == C4Error{LiteCoreDomain, kC4ErrorConflict}) {
+                c4::ref<C4Document> existing = c4doc_getSingleRevision(_c4db, docID, nullslice,
+                                                                       false, &c4err);
+                if (existing)
+                    doc = c4doc_update(existing, body, 0, &c4err);
+            }
+            if (!doc) {
+                if (outError)
+                    *outError = c4err;
+                return false;
+            }
+            return ++_inBatch < _batchSize || commit(outError);
+        }
+
+        bool commit(C4Error *outError) {
+            if (!_transaction)
+                return true;
+            bool ok = _db->timedCommit([&]{return _transaction->commit(outError);});
+            _transaction.reset();
+            if (!ok)
+                return false;
+            DatabaseMetrics::add(_db->metrics.documentsWritten, _inBatch);
+            _imported += _inBatch;
+            _inBatch = 0;
+            if (_options.progress && !_options.progress(_context, _imported))
+                return stopped(outError);
+            return true;
+        }
+
+        // Called when a callback returns false; stops the import with an error code of 0.
+        bool stopped(C4Error *outError) {
+            if (outError)
+                *outError = {};
+            return false;
+        }
+
+        CBLDatabase* const _db;
+        C4Database* const _c4db;
+        CBLImportOptions const _options;
+        CBLImportReader const _reader;
+        void* const _context;
+        unsigned const _batchSize;
+
+        Encoder _encoder;                           // The database's shared encoder
+        unique_ptr<c4::Transaction> _transaction;   // The current batch's transaction
+        string _line;                               // Scratch buffer for a JSON line
+        unsigned _inBatch {0};                      // Docs saved in the current batch
+        uint64_t _imported {0};                     // Docs committed
+    };
+
+}
+
+
+bool CBLDatabase_Import(CBLDatabase* db,
+                        const CBLImportOptions* options,
+                        CBLImportReader reader,
+                        void *context,
+                        uint64_t *outCount,
+                        CBLError* outError) CBLAPI
+{
+    if (outCount)
+        *outCount = 0;
+    if (!db->ensureOpen(internal(outError)))
+        return false;
+    Importer importer(db, *options, reader, context);
+    bool ok = importer.run(internal(outError));
+    if (outCount)
+        *outCount = importer.imported();
+    return ok;
+}
+
 
 #pragma mark - ACCESSORS:
 
@@ -154,17 +1380,38 @@ const CBLDatabaseConfiguration CBLDatabase_Config(const CBLDatabase* db) CBLAPI
 }
 
 uint64_t CBLDatabase_Count(const CBLDatabase* db) CBLAPI {
+    if (!db->ensureOpen(nullptr))
+        return 0;
     return c4db_getDocumentCount(internal(db));
 }
 
 uint64_t CBLDatabase_LastSequence(const CBLDatabase* db) CBLAPI {
+    if (!db->ensureOpen(nullptr))
+        return 0;
     return c4db_getLastSequence(internal(db));
 }
 
 
+CBLDatabaseMetrics CBLDatabase_GetMetrics(const CBLDatabase* db) CBLAPI {
+    return db->getMetrics();
+}
+
+
 #pragma mark - NOTIFICATIONS:
 
 
+void CBLDatabase::notifyAfterBatch(NotificationRecord::Function fn, RefCounted *target) const {
+    {
+        lock_guard<mutex> lock(_batchMutex);
+        if (_batchDepth > 0) {
+            _afterBatch.emplace_back(fn, target);
+            return;
+        }
+    }
+    notify(fn, target);
+}
+
+
 void CBLDatabase_BufferNotifications(CBLDatabase *db,
                                      CBLNotificationsReadyCallback callback,
                                      void *context) CBLAPI
@@ -176,14 +1423,18 @@ void CBLDatabase_SendNotifications(CBLDatabase *db) CBLAPI {
     db->sendNotifications();
 }
 
+bool CBLDatabase_SendNotificationsBounded(CBLDatabase *db, unsigned maxCount) CBLAPI {
+    return db->sendNotifications(maxCount);
+}
+
 
 #pragma mark - DATABASE CHANGE LISTENERS:
 
 
 CBLListenerToken* CBLDatabase::addListener(CBLDatabaseChangeListener listener, void *context) {
     auto token = _listeners.add(listener, context);
-    if (!_observer) {
-        _observer = c4dbobs_create(c4db,
+    if (!_observer && ensureOpen(nullptr)) {     // (a db that failed to open never changes)
+        _observer = c4dbobs_create(c4db(),
                                    [](C4DatabaseObserver* observer, void *context) {
                                        ((CBLDatabase*)context)->databaseChanged();
                                    },
@@ -194,12 +1445,15 @@ CBLListenerToken* CBLDatabase::addListener(CBLDatabaseChangeListener listener, v
 
 
 void CBLDatabase::databaseChanged() {
-    notify(bind(&CBLDatabase::callDBListeners, this));
+    notify([](CBLDatabase *db, RefCounted*) {
+        db->callDBListeners();
+    }, nullptr);
 }
 
 
 void CBLDatabase::callDBListeners() {
     static const uint32_t kMaxChanges = 100;
+    vector<char> buf;       // reused by every chunk
     while (true) {
         C4DatabaseChange c4changes[kMaxChanges];
         bool external;
@@ -211,17 +1465,17 @@ void CBLDatabase::callDBListeners() {
         size_t bufSize = 0;
         for (uint32_t i = 0; i < nChanges; ++i)
             bufSize += c4changes[i].docID.size + 1;
-        char *buf = new char[bufSize], *next = buf;
+        buf.resize(bufSize);
+        char *next = buf.data();
         for (uint32_t i = 0; i < nChanges; ++i) {
             docIDs[i] = next;
             memcpy(next, (const char*)c4changes[i].docID.buf, c4changes[i].docID.size);
             next += c4changes[i].docID.size;
             *(next++) = '\0';
         }
-        assert(next - buf == bufSize);
+        assert(next - buf.data() == bufSize);
         // Call the listener(s):
         _listeners.call(this, nChanges, docIDs);
-        delete [] buf;
     }
 }
 
@@ -234,6 +1488,227 @@ CBLListenerToken* CBLDatabase_AddChangeListener(const CBLDatabase* constdb _cbl_
 }
 
 
+#pragma mark - COALESCED CHANGE LISTENERS:
+
+
+namespace cbl_internal {
+
+    // Listener token for coalesced database listeners. Each has its own C4DatabaseObserver,
+    // which it drains into a buffer whenever changes arrive. The buffered changes are delivered
+    // when `maxChanges` of them are waiting, or when `interval` has passed since the first one.
+    class CoalescedListenerToken : public CBLListenerToken {
+    public:
+        CoalescedListenerToken(CBLDatabase *db,
+                               const CBLChangeCoalescingOptions &options,
+                               const void *callback,
+                               bool ranges,
+                               void *context)
+        :CBLListenerToken(callback, context)
+        ,_db(db)
+        ,_options(options)
+        ,_ranges(ranges)
+        ,_c4obs( !db->ensureOpen(nullptr) ? nullptr
+                    : c4dbobs_create(internal(db),
+                                     [](C4DatabaseObserver* observer, void *context) {
+                                         ((CoalescedListenerToken*)context)->changesAvailable();
+                                     },
+                                     this) )
+        { }
+
+        ~CoalescedListenerToken() {
+            c4dbobs_free(_c4obs);
+        }
+
+    private:
+        // The changes collected since the last delivery.
+        struct Changes {
+            vector<char> docIDs;            // NUL-terminated docIDs, back to back
+            vector<size_t> offsets;         // start of each docID in `docIDs`
+            unsigned count {0};
+            uint64_t firstSequence {0}, lastSequence {0};
+
+            void clear() {
+                docIDs.clear();             // (keeps the allocated capacity, for reuse)
+                offsets.clear();
+                count = 0;
+            }
+        };
+
+        // Called by the C4DatabaseObserver, on an arbitrary thread.
+        void changesAvailable() {
+            bool deliverNow = false, startTimer = false;
+            {
+                lock_guard<mutex> lock(_mutex);
+                readChanges();
+                if (_deliveryQueued || _pending.count == 0)
+                    return;
+                if (_options.interval <= 0.0
+                        || (_options.maxChanges > 0 && _pending.count >= _options.maxChanges)) {
+                    _deliveryQueued = deliverNow = true;
+                } else if (!_timerRunning) {
+                    _timerRunning = startTimer = true;
+                }
+            }
+            if (deliverNow)
+                queueDelivery();
+            else if (startTimer)
+                startDeliveryTimer();
+        }
+
+        // Drains the observer into `_pending`. Must be called with the mutex locked.
+        void readChanges() {
+            static const uint32_t kMaxChanges = 100;
+            C4DatabaseChange c4changes[kMaxChanges];
+            bool external;
+            uint32_t nChanges;
+            while ((nChanges = c4dbobs_getChanges(_c4obs, c4changes, kMaxChanges, &external)) > 0) {
+                for (uint32_t i = 0; i < nChanges; ++i) {
+                    C4SequenceNumber seq = c4changes[i].sequence;
+                    if (_pending.count == 0 || seq < _pending.firstSequence)
+                        _pending.firstSequence = seq;
+                    if (_pending.count == 0 || seq > _pending.lastSequence)
+                        _pending.lastSequence = seq;
+                    ++_pending.count;
+                    if (!_ranges) {
+                        slice docID = c4changes[i].docID;
+                        _pending.offsets.push_back(_pending.docIDs.size());
+                        _pending.docIDs.insert(_pending.docIDs.end(),
+                                               (const char*)docID.buf, (const char*)docID.end());
+                        _pending.docIDs.push_back('\0');
+                    }
+                }
+            }
+        }
+
+        // Deliver after the interval, unless `maxChanges` triggers an earlier delivery.
+        void startDeliveryTimer() {
+            Retained<CoalescedListenerToken> self = this;
+            Retained<CBLDatabase> db = _db;     // keeps the database open till the timer fires
+            _timer.fireAfter(_options.interval, [self, db]() {
+                self->timerFired();
+            });
+        }
+
+        // Cancels the delivery timer, releasing the database, when the listener is removed.
+        void removed() override {
+            _timer.stop();
+        }
+
+        void timerFired() {
+            {
+                lock_guard<mutex> lock(_mutex);
+                _timerRunning = false;
+                if (_deliveryQueued || _pending.count == 0)
+                    return;
+                _deliveryQueued = true;
+            }
+            queueDelivery();
+        }
+
+        void queueDelivery() {
+            _db->notify([](CBLDatabase*, RefCounted *self) {
+                static_cast<CoalescedListenerToken*>(self)->deliver();
+            }, this);
+        }
+
+        // Calls the listener with the pending changes. Called via the database's notification
+        // queue, so in buffered mode this is called by CBLDatabase_SendNotifications.
+        void deliver() {
+            unique_lock<mutex> lock(_mutex);
+            _deliveryQueued = false;
+            if (_delivering) {
+                // Called re-entrantly by a listener that changed the database:
+                _deliverAgain = true;
+                return;
+            }
+            _delivering = true;
+            do {
+                _deliverAgain = false;
+                swap(_pending, _delivered);
+                lock.unlock();
+                if (_delivered.count > 0)
+                    callListener();
+                _delivered.clear();
+                lock.lock();
+            } while (_deliverAgain);
+            _delivering = false;
+        }
+
+        // Calls the listener callback with the changes in `_delivered`.
+        void callListener() {
+            const void *callback = _callback.load();
+            if (!callback)
+                return;
+            if (_ranges) {
+                ((CBLDatabaseChangeRangeListener)callback)(_context, _db,
+                                                           _delivered.firstSequence,
+                                                           _delivered.lastSequence,
+                                                           _delivered.count);
+            } else {
+                _docIDPtrs.resize(_delivered.count);
+                for (unsigned i = 0; i < _delivered.count; ++i)
+                    _docIDPtrs[i] = &_delivered.docIDs[_delivered.offsets[i]];
+                unsigned chunk = _options.maxChanges ? _options.maxChanges : _delivered.count;
+                for (unsigned start = 0; start < _delivered.count; start += chunk) {
+                    callback = _callback.load();
+                    if (!callback)
+                        break;
+                    unsigned n = std::min(chunk, _delivered.count - start);
+                    ((CBLDatabaseChangeListener)callback)(_context, _db, n, &_docIDPtrs[start]);
+                }
+            }
+        }
+
+        CBLDatabase* const _db;
+        CBLChangeCoalescingOptions const _options;
+        bool const _ranges;
+        C4DatabaseObserver* _c4obs {nullptr};
+
+        mutex _mutex;
+        Changes _pending;                   // Changes not yet delivered (guarded by _mutex)
+        Changes _delivered;                 // Changes being delivered (only used by deliver())
+        vector<const char*> _docIDPtrs;     // C string pointers into `_delivered.docIDs`
+        Timer _timer;                       // Fires the delivery after the interval
+        bool _timerRunning {false};         // True while the delivery timer is scheduled
+        bool _deliveryQueued {false};       // True if deliver() has been scheduled
+        bool _delivering {false};           // True while deliver() is calling the listener
+        bool _deliverAgain {false};         // deliver() was re-entered; loop again
+    };
+
+}
+
+
+CBLListenerToken* CBLDatabase::addCoalescedListener(const CBLChangeCoalescingOptions &options,
+                                                    const void *listener,
+                                                    bool ranges,
+                                                    void *context)
+{
+    auto token = new CoalescedListenerToken(this, options, listener, ranges, context);
+    _coalescedListeners.add(token);
+    return token;
+}
+
+
+CBLListenerToken* CBLDatabase_AddCoalescedChangeListener(const CBLDatabase* db _cbl_nonnull,
+                                                         const CBLChangeCoalescingOptions *options _cbl_nonnull,
+                                                         CBLDatabaseChangeListener listener _cbl_nonnull,
+                                                         void *context) CBLAPI
+{
+    return const_cast<CBLDatabase*>(db)->addCoalescedListener(*options, (const void*)listener,
+                                                              false, context);
+}
+
+
+CBLListenerToken* CBLDatabase_AddChangeRangeListener(const CBLDatabase* db _cbl_nonnull,
+                                                     const CBLChangeCoalescingOptions *options _cbl_nonnull,
+                                                     CBLDatabaseChangeRangeListener listener _cbl_nonnull,
+                                                     void *context) CBLAPI
+{
+    return const_cast<CBLDatabase*>(db)->addCoalescedListener(*options, (const void*)listener,
+                                                              true, context);
+}
+
+
 #pragma mark - DOCUMENT LISTENERS:
 
 
@@ -241,6 +1716,8 @@ namespace cbl_internal {
 
     // Custom subclass of CBLListenerToken for document listeners.
     // (It implements the ListenerToken<> template so that it will work with Listeners<>.)
+    // These don't have their own LiteCore observers; instead CBLDatabase has a single observer
+    // for all of them, and looks up the listeners of each changed document in DocListeners.
     template<>
     class ListenerToken<CBLDocumentChangeListener> : public CBLListenerToken {
     public:
@@ -248,24 +1725,14 @@ namespace cbl_internal {
         :CBLListenerToken((const void*)callback, context)
         ,_db(db)
         ,_docID(docID)
-        ,_c4obs( c4docobs_create(internal(db),
-                                 slice(docID),
-                                 [](C4DocumentObserver* observer, C4String docID,
-                                    C4SequenceNumber sequence, void *context)
-                                 {
-                                     ((ListenerToken*)context)->docChanged();
-                                 },
-                                 this) )
         { }
 
-        ~ListenerToken() {
-            c4docobs_free(_c4obs);
-        }
-
         CBLDocumentChangeListener callback() const {
             return (CBLDocumentChangeListener)_callback.load();
         }
 
+        const string& docID() const                 {return _docID;}
+
         // this is called indirectly by CBLDatabase::sendNotifications
         void call(const CBLDatabase*, const char*) {
             auto cb = callback();
@@ -274,27 +1741,99 @@ namespace cbl_internal {
         }
 
     private:
-        void docChanged() {
-            _db->notify(this, nullptr, nullptr);
-        }
-
         CBLDatabase* _db;
         string _docID;
-        C4DocumentObserver* _c4obs {nullptr};
     };
 
+    using DocListenerToken = ListenerToken<CBLDocumentChangeListener>;
+
+
+    void DocListeners::add(CBLListenerToken *token, slice docID) {
+        lock_guard<mutex> lock(_mutex);
+        auto i = _entries.find(docID);
+        if (i == _entries.end()) {
+            auto entry = new Entry{docID.asString(), {}};
+            i = _entries.emplace(slice(entry->docID), unique_ptr<Entry>(entry)).first;
+        }
+        i->second->tokens.emplace_back(token);
+        token->addedTo(this);
+    }
+
+
+    void DocListeners::remove(CBLListenerToken *token) {
+        lock_guard<mutex> lock(_mutex);
+        auto i = _entries.find(slice(((DocListenerToken*)token)->docID()));
+        assert(i != _entries.end());
+        auto &tokens = i->second->tokens;
+        for (auto t = tokens.begin(); t != tokens.end(); ++t) {
+            if (t->get() == token) {
+                tokens.erase(t);
+                break;
+            }
+        }
+        if (tokens.empty())
+            _entries.erase(i);
+    }
+
+
+    void DocListeners::clear() {
+        lock_guard<mutex> lock(_mutex);
+        _entries.clear();
+    }
+
+
+    void DocListeners::find(slice docID, vector<Retained<CBLListenerToken>> &tokens) const {
+        lock_guard<mutex> lock(_mutex);
+        auto i = _entries.find(docID);
+        if (i != _entries.end())
+            tokens.insert(tokens.end(), i->second->tokens.begin(), i->second->tokens.end());
+    }
+
 }
 
 
 CBLListenerToken* CBLDatabase::addDocListener(const char* docID _cbl_nonnull,
                                               CBLDocumentChangeListener listener, void *context)
 {
-    auto token = new ListenerToken<CBLDocumentChangeListener>(this, docID, listener, context);
-    _docListeners.add(token);
+    auto token = new DocListenerToken(this, docID, listener, context);
+    _docListeners.add(token, slice(docID));
+    if (!_docObserver && ensureOpen(nullptr)) {
+        _docObserver = c4dbobs_create(c4db(),
+                                      [](C4DatabaseObserver* observer, void *context) {
+                                          ((CBLDatabase*)context)->docsChanged();
+                                      },
+                                      this);
+    }
     return token;
 }
 
 
+void CBLDatabase::docsChanged() {
+    notify([](CBLDatabase *db, RefCounted*) {
+        db->callDocListeners();
+    }, nullptr);
+}
+
+
+void CBLDatabase::callDocListeners() {
+    static const uint32_t kMaxChanges = 100;
+    vector<Retained<CBLListenerToken>> tokens;
+    while (true) {
+        C4DatabaseChange c4changes[kMaxChanges];
+        bool external;
+        uint32_t nChanges = c4dbobs_getChanges(_docObserver, c4changes, kMaxChanges, &external);
+        if (nChanges == 0)
+            break;
+        for (uint32_t i = 0; i < nChanges; ++i)
+            _docListeners.find(c4changes[i].docID, tokens);
+        // Call the listeners outside the lock, since they may add or remove listeners:
+        for (auto &token : tokens)
+            ((DocListenerToken*)token.get())->call(this, nullptr);
+        tokens.clear();
+    }
+}
+
+
 CBLListenerToken* CBLDatabase_AddDocumentChangeListener(const CBLDatabase* db _cbl_nonnull,
                                              const char* docID _cbl_nonnull,
                                              CBLDocumentChangeListener listener _cbl_nonnull,
@@ -19,9 +19,100 @@
 #pragma once
 #include "CBLDatabase.h"
 #include "CBLDocument.h"
+#include "CBLQuery.h"
+#include "AsyncQueue.hh"
+#include "DocumentCache.hh"
+#include "DocumentID.hh"
+#include "ExpirationPurger.hh"
+#include "GroupCommitter.hh"
 #include "Internal.hh"
 #include "Listener.hh"
+#include "QueryCache.hh"
 #include "access_lock.hh"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+namespace cbl_internal {
+
+    /** Manages a database's document listeners, indexed by docID, so that adding, removing and
+        finding the listeners of a document take constant time. Thread-safe. */
+    class DocListeners : public ListenersBase {
+    public:
+        void add(CBLListenerToken* _cbl_nonnull, fleece::slice docID);
+        void remove(CBLListenerToken* _cbl_nonnull) override;
+        void clear();
+
+        /** Appends the listeners of a document to `tokens`. */
+        void find(fleece::slice docID,
+                  std::vector<fleece::Retained<CBLListenerToken>> &tokens) const;
+
+    private:
+        struct Entry {
+            std::string docID;
+            std::vector<fleece::Retained<CBLListenerToken>> tokens;
+        };
+
+        mutable std::mutex _mutex;
+        std::unordered_map<fleece::slice, std::unique_ptr<Entry>> _entries;  // keys point into Entry
+    };
+
+
+
+    /** Activity counters of a database, reported by CBLDatabase_GetMetrics. They're updated with
+        relaxed atomic operations, which are cheap enough for hot paths. */
+    class DatabaseMetrics {
+    public:
+        using Counter = std::atomic<uint64_t>;
+
+        static void add(Counter &counter, uint64_t n =1) {
+            counter.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        void addCommit(double seconds) {
+            add(commits);
+            add(commitMicros, uint64_t(seconds * 1e6));
+            unsigned bucket = 0;
+            for (double limit = 1e-4; bucket < kCBLCommitLatencyBuckets - 1 && seconds >= limit;
+                    limit *= 10)
+                ++bucket;
+            add(commitLatency[bucket]);
+        }
+
+        CBLDatabaseMetrics snapshot() const {
+            CBLDatabaseMetrics m = {};
+            m.documentsRead = documentsRead.load(std::memory_order_relaxed);
+            m.documentsWritten = documentsWritten.load(std::memory_order_relaxed);
+            m.commits = commits.load(std::memory_order_relaxed);
+            for (unsigned i = 0; i < kCBLCommitLatencyBuckets; ++i)
+                m.commitLatency[i] = commitLatency[i].load(std::memory_order_relaxed);
+            m.commitTime = commitMicros.load(std::memory_order_relaxed) / 1e6;
+            m.blobBytesRead = blobBytesRead.load(std::memory_order_relaxed);
+            m.blobBytesWritten = blobBytesWritten.load(std::memory_order_relaxed);
+            m.queryExecutions = queryExecutions.load(std::memory_order_relaxed);
+            m.replicatorDocsPushed = replicatorDocsPushed.load(std::memory_order_relaxed);
+            m.replicatorDocsPulled = replicatorDocsPulled.load(std::memory_order_relaxed);
+            m.replicatorProgress = replicatorProgress.load(std::memory_order_relaxed);
+            return m;
+        }
+
+        Counter documentsRead {0}, documentsWritten {0};
+        Counter commits {0}, commitMicros {0};
+        Counter commitLatency[kCBLCommitLatencyBuckets] = {};
+        Counter blobBytesRead {0}, blobBytesWritten {0};
+        Counter queryExecutions {0};
+        Counter replicatorDocsPushed {0}, replicatorDocsPulled {0}, replicatorProgress {0};
+    };
+
+}
 
 
 struct CBLDatabase : public CBLRefCounted {
@@ -30,37 +121,133 @@ struct CBLDatabase : public CBLRefCounted {
                 const std::string &name_,
                 fleece::slice dir_,
                 CBLDatabaseFlags flags_)
-    :c4db(db)
-    ,name(name_)
-    ,path(fleece::alloc_slice(c4db_getPath(c4db)))
+    :name(name_)
+    ,path(fleece::alloc_slice(c4db_getPath(db)))
     ,dir(dir_)
     ,flags(flags_)
     ,_notificationQueue(this)
+    ,_c4db(db)
     { }
 
+    /** Creates a database whose file isn't opened until it's first needed (kCBLDatabase_Lazy.)
+        `config` is copied. */
+    CBLDatabase(const std::string &name_,
+                const C4DatabaseConfig2 &config,
+                CBLDatabaseFlags flags_);
+
     virtual ~CBLDatabase() {
+        stopBackgroundJobs();
+        _groupCommitter.reset();
+        _purger.reset();
         c4dbobs_free(_observer);
+        c4dbobs_free(_docObserver);
         _docListeners.clear();
-        c4db_release(c4db);
+        _coalescedListeners.clear();
+        queryCache.clear();
+        if (C4Database *db = _c4db.load()) {
+            docCache.setCapacity(db, 0);
+            c4db_release(db);
+        }
+    }
+
+    /** The LiteCore database. If its opening was deferred, this opens it; if that fails, returns
+        NULL, so callers that can't be sure the database is open call `ensureOpen` first. */
+    C4Database* c4db() const {
+        C4Database *db = _c4db.load(std::memory_order_acquire);
+        return db ? db : openDeferred();
     }
 
-    C4Database* const c4db;
+    /** True if the LiteCore database has been opened. */
+    bool isOpen() const                 {return _c4db.load(std::memory_order_acquire) != nullptr;}
+
+    /** Opens the LiteCore database now if its opening was deferred. */
+    bool ensureOpen(C4Error*) const;
+
+    /** Called by CBLDatabase_Close and _Delete. If the database hasn't been opened, ensures it
+        never will be and returns true; else returns false and it must be closed normally. */
+    bool closeUnopened();
+
     std::string const name;         // Cached copy so API can return a C string
     std::string const path;         // Cached copy so API can return a C string
     std::string const dir;          // Cached copy so API can return a C string
     CBLDatabaseFlags const flags;
 
+    mutable cbl_internal::QueryCache queryCache;    // Compiled queries not currently in use
+    mutable cbl_internal::DocumentCache docCache;   // Recently read documents
+    cbl_internal::DocumentIDGenerator docIDGenerator; // Assigns IDs to new documents
+    mutable cbl_internal::DatabaseMetrics metrics;  // Activity counters
+
+    CBLDatabaseMetrics getMetrics() const {
+        CBLDatabaseMetrics m = metrics.snapshot();
+        m.notificationsQueued = _notificationQueue.addedCount();
+        m.notificationsDelivered = _notificationQueue.calledCount();
+        return m;
+    }
+
+    /** Calls `commit`, a function that commits a transaction and returns a bool, and if it
+        succeeds and it ended the outermost transaction, records the time it took. */
+    template <class FN>
+    bool timedCommit(FN commit) const {
+        auto start = std::chrono::steady_clock::now();
+        if (!commit())
+            return false;
+        if (!c4db_isInTransaction(c4db())) {
+            metrics.addCommit(std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                                            - start).count());
+            if (_autoCompactEnabled.load(std::memory_order_relaxed))
+                checkAutoCompaction();
+        }
+        return true;
+    }
+
     CBLListenerToken* addListener(CBLDatabaseChangeListener listener _cbl_nonnull, void *context);
+    CBLListenerToken* addCoalescedListener(const CBLChangeCoalescingOptions&,
+                                           const void *listener _cbl_nonnull,
+                                           bool ranges,
+                                           void *context);
     CBLListenerToken* addDocListener(const char *docID _cbl_nonnull,
                                      CBLDocumentChangeListener listener _cbl_nonnull, void *context);
 
     void notify(Notification n) const   {const_cast<CBLDatabase*>(this)->_notificationQueue.add(n);}
+
+    /** Queues a call to `fn`, passing it this database and `target` (which will be retained
+        until then.) Unlike a `Notification`, this doesn't allocate memory. */
+    void notify(NotificationRecord::Function fn, fleece::RefCounted *target) const {
+        const_cast<CBLDatabase*>(this)->_notificationQueue.add(fn, target);
+    }
+
+    /** Queues a call like `notify`, except that if a batch is open it's held until the
+        outermost batch ends. */
+    void notifyAfterBatch(NotificationRecord::Function fn, fleece::RefCounted *target) const;
+
+    bool beginBatch(C4Error*);
+    bool endBatch(C4Error*);
+
+    /** True while a batch (CBLDatabase_BeginBatch) is open. */
+    bool inBatch() const {
+        std::lock_guard<std::mutex> lock(_batchMutex);
+        return _batchDepth > 0;
+    }
+
+    /** Blocks until no batch is open, or until `stop` returns true. (`stop` is called with the
+        batch lock held; after changing its result, call `wakeBatchWaiters`.) */
+    void waitForBatch(std::function<bool()> stop) const;
+    void wakeBatchWaiters() const;
+
     void sendNotifications()            {_notificationQueue.notifyAll();}
+    bool sendNotifications(unsigned maxCount) {return _notificationQueue.notify(maxCount);}
 
     void bufferNotifications(CBLNotificationsReadyCallback callback, void *context) {
         _notificationQueue.setCallback(callback, context);
     }
 
+    template <class LISTENER>
+    void notify(ListenerToken<LISTENER> *listener) const {
+        notify([](CBLDatabase*, fleece::RefCounted *token) {
+            static_cast<ListenerToken<LISTENER>*>(token)->call();
+        }, listener);
+    }
+
     template <class LISTENER, class... Args>
     void notify(ListenerToken<LISTENER> *listener, Args... args) const {
         fleece::Retained<ListenerToken<LISTENER>> retained = listener;
@@ -69,20 +256,138 @@ struct CBLDatabase : public CBLRefCounted {
         });
     }
 
-    C4BlobStore* blobStore() const                      {return c4db_getBlobStore(c4db, nullptr);}
+    /** Runs `task` on the I/O thread pool, after any async calls queued before it. If async
+        saves before it are still waiting for their group commit, it waits for them too. */
+    void async(cbl_internal::AsyncQueue::Task task) const;
+
+    /** Like `async`, but for a task that saves with `queueSave`; it doesn't wait for earlier
+        queued saves, so that consecutive async saves can share a group. The task must call
+        `asyncSaveBegan` before queueing its save, and `asyncSaveEnded` when it completes. */
+    void asyncSave(cbl_internal::AsyncQueue::Task task) const {_asyncQueue->async(std::move(task));}
+    void asyncSaveBegan() const;
+    void asyncSaveEnded() const;
+
+    /** Blocks until all queued async calls have run. */
+    void waitForAsync() const                               {_asyncQueue->waitIdle();}
+
+    /** Runs `job` on a new thread owned by the database, for a long-running task like building
+        indexes. When the database is closed, deleted or freed it calls `cancel`, then waits for
+        the thread to exit, so the job may use the database without retaining it.
+        Returns false if the database is closed or the thread can't be started. */
+    bool runInBackground(std::function<void()> job, std::function<void()> cancel, C4Error*);
+
+    /** Cancels the background jobs and waits for them to exit; no more can be started.
+        Called by CBLDatabase_Close and _Delete. */
+    void stopBackgroundJobs();
+
+    C4BlobStore* blobStore() const                      {return c4db_getBlobStore(c4db(), nullptr);}
+
+    bool setAutoPurge(const CBLAutoPurgeOptions*, C4Error*);
+
+    /** Called when a document's expiration time is set. */
+    void expirationChanged(time_t expiration);
+
+    /** Turns group commit on, or off if `options` is NULL; turning it off (or changing the
+        options) first commits the saves already queued. */
+    void setGroupCommit(const CBLGroupCommitOptions *options);
+
+    /** Queues a save with the group committer. Returns false, without calling `completion`, if
+        group commit is off, a batch is open, or this is the writer thread. */
+    bool queueSave(CBLDocument* _cbl_nonnull, CBLConcurrencyControl,
+                   cbl_internal::GroupCommitter::Completion completion);
+
+    void setAutoCompaction(const CBLAutoCompactionOptions*, CBLCompactionCallback, void *context);
+
+    /** Called when a compaction finishes; records the file size for auto-compaction. */
+    void compactionFinished() const;
+
+    void setSlowQueryCallback(double threshold, CBLSlowQueryCallback callback, void *context) {
+        std::lock_guard<std::mutex> lock(_slowQueryMutex);
+        _slowQueryCallback = callback;
+        _slowQueryContext = context;
+        _slowQueryThreshold = callback ? std::max(threshold, 1e-9) : 0.0;   // 0 means disabled
+    }
+
+    /** The minimum time for a query to be reported as slow, or 0 if there's no callback. */
+    double slowQueryThreshold() const   {return _slowQueryThreshold.load(std::memory_order_relaxed);}
+
+    void reportSlowQuery(CBLQuery *query, double time, uint64_t rowCount) const {
+        CBLSlowQueryCallback callback;
+        void *context;
+        {
+            std::lock_guard<std::mutex> lock(_slowQueryMutex);
+            callback = _slowQueryCallback;
+            context = _slowQueryContext;
+        }
+        if (callback)
+            callback(context, query, time, rowCount);
+    }
 
 private:
     void databaseChanged();
     void callDBListeners();
+    void docsChanged();
     void callDocListeners();
+    void checkAutoCompaction() const;
 
     C4DatabaseObserver* _observer {nullptr};
+    C4DatabaseObserver* _docObserver {nullptr};    // Shared by all document listeners
     cbl_internal::Listeners<CBLDatabaseChangeListener> _listeners;
-    cbl_internal::Listeners<CBLDocumentChangeListener> _docListeners;
+    cbl_internal::DocListeners _docListeners;
+    cbl_internal::ListenersBase _coalescedListeners;
     NotificationQueue _notificationQueue;
+    fleece::Retained<cbl_internal::AsyncQueue> const _asyncQueue {new cbl_internal::AsyncQueue};
+
+    C4Database* openDeferred() const;
+
+    mutable std::atomic<C4Database*> _c4db {nullptr};
+    mutable std::mutex _openMutex;
+    C4DatabaseConfig2 _deferredConfig {};           // How to open the db, if it was deferred
+    mutable C4Error _openError {};                  // Why the deferred open failed
+    bool _closed {false};                           // Closed before the deferred open
+
+    using DeferredNotification = std::pair<NotificationRecord::Function,
+                                           fleece::Retained<fleece::RefCounted>>;
+    mutable std::mutex _batchMutex;
+    unsigned _batchDepth {0};                                   // Nesting level of batches
+    mutable std::condition_variable _batchEnded;                // Signaled when it's 0 again
+    mutable std::vector<DeferredNotification> _afterBatch;      // Sent when the batch ends
+
+    mutable std::mutex _slowQueryMutex;
+    std::atomic<double> _slowQueryThreshold {0.0};
+    CBLSlowQueryCallback _slowQueryCallback {nullptr};
+    void* _slowQueryContext {nullptr};
+
+    std::mutex _purgerMutex;
+    std::unique_ptr<cbl_internal::ExpirationPurger> _purger;    // Auto-purges expired docs
+    time_t _batchExpiration {0};        // Earliest expiration set during the current batch
+
+    std::mutex _groupCommitMutex;
+    mutable std::mutex _asyncSavesMutex;
+    mutable std::condition_variable _asyncSavesCond;
+    mutable unsigned _asyncSaves {0};                   // Async saves not yet committed
+    std::unique_ptr<cbl_internal::GroupCommitter> _groupCommitter;  // Saves docs in groups
+
+    struct BackgroundJob {
+        std::thread thread;
+        std::function<void()> cancel;
+        std::shared_ptr<std::atomic<bool>> finished;    // Set when the job returns
+    };
+    std::mutex _backgroundMutex;
+    std::vector<BackgroundJob> _backgroundJobs;
+    bool _backgroundStopped {false};                    // Set by stopBackgroundJobs
+
+    std::atomic<bool> _autoCompactEnabled {false};
+    mutable std::mutex _autoCompactMutex;
+    CBLAutoCompactionOptions _autoCompactOptions {};
+    CBLCompactionCallback _autoCompactCallback {nullptr};
+    void* _autoCompactContext {nullptr};
+    mutable int64_t _autoCompactBaseline {0};           // File size after last compaction
+    mutable std::chrono::steady_clock::time_point _autoCompactLastCheck;
+    mutable bool _autoCompacting {false};
 };
 
 
 namespace cbl_internal {
-    static inline C4Database* internal(const CBLDatabase *db)    {return db->c4db;}
+    static inline C4Database* internal(const CBLDatabase *db)    {return db->c4db();}
 }
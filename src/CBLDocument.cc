@@ -21,6 +21,10 @@
 #include "CBLDocument_Internal.hh"
 #include "CBLBlob_Internal.hh"
 #include "Util.hh"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <future>
 #include <mutex>
 
 using namespace std;
@@ -28,23 +32,44 @@ using namespace fleece;
 
 
 // Core constructor
-CBLDocument::CBLDocument(const string &docID,
+CBLDocument::CBLDocument(slice docID,
                          CBLDatabase *db,
                          C4Document *d,          // must be a +1 ref
                          bool isMutable)
 :_docID(docID)
+,_docIDAssigned(docID.size > 0)
 ,_db(db)
 ,_c4doc(d)
 ,_mutable(isMutable)
 {
     if (_c4doc)
-        _c4doc->extraInfo = {this, nullptr};
+        _body = DocumentBody::attach(_c4doc, db);
 }
 
 
-// Construct a new document (not in any database yet)
+bool CBLDocument::assignDocID(CBLDatabase *db, C4Error *outError) const {
+    // Generate the ID outside the lock, since a custom generator is a client callback:
+    cbl_internal::DocumentID newID;
+    if (db) {
+        if (!db->docIDGenerator.generate(newID, outError))
+            return false;
+    } else {
+        cbl_internal::DocumentIDGenerator::generateRandom(newID);
+    }
+    static mutex sDocIDMutex;
+    lock_guard<mutex> lock(sDocIDMutex);
+    if (!_docIDAssigned.load(memory_order_relaxed)) {
+        _docID.assign(newID);
+        _docIDAssigned.store(true, memory_order_release);
+    }
+    return true;
+}
+
+
+// Construct a new document (not in any database yet). If `docID` is null, the ID is
+// assigned when it's saved, or when docID() is first called.
 CBLDocument::CBLDocument(const char *docID, bool isMutable)
-:CBLDocument(ensureDocID(docID), nullptr, nullptr, isMutable)
+:CBLDocument(slice(docID), nullptr, nullptr, isMutable)
 { }
 
 
@@ -58,13 +83,15 @@ CBLDocument::CBLDocument(CBLDatabase *db, const string &docID, bool isMutable)
 
 // Mutable copy of another CBLDocument
 CBLDocument::CBLDocument(const CBLDocument* otherDoc)
-:CBLDocument(otherDoc->_docID,
+:CBLDocument(slice(otherDoc->docID()),
              otherDoc->_db,
              c4doc_retain(otherDoc->_c4doc),
              true)
 {
+    // Only the mutable (changed) containers need copying; unchanged values still point into
+    // the revision body, which this doc retains too.
     if (otherDoc->isMutable() && otherDoc->_properties)
-        _properties = otherDoc->_properties.asDict().mutableCopy(kFLDeepCopyImmutables);
+        _properties = otherDoc->_properties.asDict().mutableCopy(kFLDeepCopy);
 }
 
 
@@ -79,7 +106,22 @@ CBLDocument::CBLDocument(CBLDatabase *db,
 }
 
 
-CBLDocument::~CBLDocument() {
+CBLDocument::~CBLDocument() = default;
+
+
+// Looks up a document in the database's document cache, or reads and caches it
+Retained<CBLDocument> CBLDocument::getCached(CBLDatabase *db, const char *docID, bool isMutable) {
+    uint64_t token;
+    C4Document *c4doc = db->docCache.get(slice(docID), &token);
+    if (!c4doc) {
+        c4doc = c4doc_getSingleRevision(internal(db), slice(docID), nullslice, true, nullptr);
+        if (!c4doc)
+            return nullptr;
+        db->docCache.put(c4doc, token);
+    }
+    Retained<CBLDocument> doc = new CBLDocument(docID, db, c4doc, isMutable);
+    doc->_body->setShared();
+    return doc;
 }
 
 
@@ -91,31 +133,93 @@ bool CBLDocument::checkMutable(C4Error *outError) const {
 }
 
 
-string CBLDocument::ensureDocID(const char *docID) {
-    char docIDBuf[32];
-    if (!docID)
-        docID = c4doc_generateID(docIDBuf, sizeof(docIDBuf));
-    return string(docID);
+bool CBLDocument::checkSaveable(CBLDatabase *db, C4Error *outError) const {
+    if (!checkMutable(outError))
+        return false;
+    if (_db && _db != db) {
+        setError(outError, LiteCoreDomain, kC4ErrorInvalidParameter,
+                 "Saving doc to wrong database"_sl);
+        return false;
+    }
+    return db->ensureOpen(outError);
 }
 
 
 RetainedConst<CBLDocument> CBLDocument::save(CBLDatabase* db _cbl_nonnull,
                                              bool deleting,
                                              CBLConcurrencyControl concurrency,
-                                             C4Error* outError)
+                                             C4Error* outError,
+                                             slice expectedRevID)
 {
-    if (!checkMutable(outError))
+    if (!checkSaveable(db, outError))
         return nullptr;
-    if (_db && _db != db) {
-        setError(outError, LiteCoreDomain, kC4ErrorInvalidParameter,
-                 "Saving doc to wrong database"_sl);
-        return nullptr;
-    }
 
     c4::Transaction t(internal(db));
     if (!t.begin(outError))
         return nullptr;
 
+    Encoder enc(c4db_getSharedFleeceEncoder(internal(db)));
+    RetainedConst<CBLDocument> savedDoc = saveInTransaction(db, deleting, concurrency, enc,
+                                                            outError, expectedRevID);
+    enc.detach();
+
+    if (savedDoc && !db->timedCommit([&]{return t.commit(outError);}))
+        savedDoc = nullptr;
+    if (savedDoc)
+        DatabaseMetrics::add(db->metrics.documentsWritten);
+    return savedDoc;
+}
+
+
+RetainedConst<CBLDocument> CBLDocument::saveGrouped(CBLDatabase* db _cbl_nonnull,
+                                                    CBLConcurrencyControl concurrency,
+                                                    C4Error* outError)
+{
+    if (!checkSaveable(db, outError))
+        return nullptr;
+    RetainedConst<CBLDocument> savedDoc;
+    C4Error error {};
+    promise<void> done;
+    future<void> doneFuture = done.get_future();
+    bool queued = db->queueSave(this, concurrency, [&](const CBLDocument *saved, C4Error err) {
+        savedDoc = saved;
+        error = err;
+        done.set_value();
+    });
+    if (!queued)
+        return save(db, false, concurrency, outError);
+    doneFuture.wait();
+    if (!savedDoc && outError)
+        *outError = error;
+    return savedDoc;
+}
+
+
+void CBLDocument::queueSave(CBLDatabase* db _cbl_nonnull,
+                            CBLConcurrencyControl concurrency,
+                            GroupCommitter::Completion completion)
+{
+    C4Error error {};
+    if (!checkSaveable(db, &error))
+        return completion(nullptr, error);
+    if (db->queueSave(this, concurrency, completion))
+        return;
+    RetainedConst<CBLDocument> savedDoc = save(db, false, concurrency, &error);
+    completion(savedDoc.get(), error);
+}
+
+
+RetainedConst<CBLDocument> CBLDocument::saveInTransaction(CBLDatabase* db _cbl_nonnull,
+                                                          bool deleting,
+                                                          CBLConcurrencyControl concurrency,
+                                                          Encoder &enc,
+                                                          C4Error* outError,
+                                                          slice expectedRevID)
+{
+    // Assign an ID to a new doc created without one:
+    if (!_docIDAssigned.load(memory_order_acquire) && !assignDocID(db, outError))
+        return nullptr;
+
     // Save new blobs:
     if (!saveBlobs(db, outError))
         return nullptr;
@@ -123,10 +227,12 @@ RetainedConst<CBLDocument> CBLDocument::save(CBLDatabase* db _cbl_nonnull,
     // Encode properties:
     alloc_slice body;
     if (!deleting) {
-        Encoder enc(c4db_getSharedFleeceEncoder(internal(db)));
-        enc.writeValue(properties());
-        body = enc.finish();
-        enc.detach();
+        body = encodeDelta(db);
+        if (!body) {
+            enc.writeValue(properties());
+            body = enc.finish();
+            enc.reset();
+        }
     }
 
     // Save:
@@ -134,6 +240,25 @@ RetainedConst<CBLDocument> CBLDocument::save(CBLDatabase* db _cbl_nonnull,
     c4::ref<C4Document> newDoc = nullptr;
     C4Error c4err;
 
+    if (savingDoc && (expectedRevID || _body->isShared())) {
+        // c4doc_update changes the C4Document in place, but this one is shared with the document
+        // cache and the instances it created (or is stale), so update a fresh copy instead:
+        savingDoc = c4doc_getSingleRevision(internal(db), slice(_docID), nullslice, true,
+                                            &c4err);
+        if (!savingDoc && c4err != C4Error{LiteCoreDomain, kC4ErrorNotFound}) {
+            if (outError)
+                *outError = c4err;
+            return nullptr;
+        }
+        slice currentRevID = expectedRevID ? expectedRevID : slice(_c4doc->revID);
+        if (!savingDoc || slice(savingDoc->revID) != currentRevID) {
+            if (concurrency != kCBLConcurrencyControlLastWriteWins) {
+                setError(outError, LiteCoreDomain, kC4ErrorConflict, nullslice);
+                return nullptr;
+            }
+        }
+    }
+
     bool retrying = false;
     do {
         C4RevisionFlags flags = (deleting ? kRevDeleted : 0);
@@ -160,15 +285,143 @@ RetainedConst<CBLDocument> CBLDocument::save(CBLDatabase* db _cbl_nonnull,
         }
     } while (retrying);
 
-    if (newDoc && t.commit(&c4err)) {
-        // Success!
-        return new CBLDocument(_docID, db, c4doc_retain(newDoc), false);
-    } else {
-        // Failure:
+    if (!newDoc) {
         if (outError)
             *outError = c4err;
         return nullptr;
     }
+    return new CBLDocument(_docID, db, c4doc_retain(newDoc), false);
+}
+
+
+// If the properties are a mutable copy of the current revision's, encodes them as a delta
+// appended to that revision's body: unchanged values are written as pointers back into it,
+// so the cost depends on the size of the change, not of the document. Returns null if that's
+// not possible or not worthwhile, in which case the caller encodes the properties normally.
+alloc_slice CBLDocument::encodeDelta(CBLDatabase *db) const {
+    if (!_c4doc || !_properties)
+        return nullslice;
+    slice base = _c4doc->selectedRev.body;
+    MutableDict props = _properties.asDict().asMutable();
+    if (!base || !props || !props.source() || !base.containsAddress(props.source()))
+        return nullslice;
+    // Each delta leaves the values it replaced in the body as garbage, so periodically (and
+    // whenever the change is large) write a fresh, compact body instead:
+    if (c4rev_getGeneration(_c4doc->selectedRev.revID) % kFullEncodeInterval == 0)
+        return nullslice;
+
+    Encoder enc;
+    enc.setSharedKeys(c4db_getFLSharedKeys(internal(db)));
+    enc.amend(base);
+    enc.writeValue(props);
+    alloc_slice delta = enc.finish();
+    if (!delta || delta.size > base.size / kMaxDeltaFraction)
+        return nullslice;
+
+    alloc_slice body(base.size + delta.size);
+    memcpy((void*)body.buf, base.buf, base.size);
+    memcpy((uint8_t*)body.buf + base.size, delta.buf, delta.size);
+    return body;
+}
+
+
+// Applies a patch in the style of JSON Merge Patch (RFC 7396): a null value removes the
+// property, a dictionary is merged into an existing dictionary (or into an empty one, so its
+// nulls are dropped), and anything else replaces it.
+// Only the dictionaries along the patched paths are copied.
+static void applyPatch(MutableDict target, Dict patch) {
+    for (Dict::iterator i(patch); i; ++i) {
+        slice key = i.keyString();
+        Value value = i.value();
+        if (value.type() == kFLNull) {
+            target.remove(key);
+        } else if (value.type() == kFLDict) {
+            if (target.get(key).type() != kFLDict)
+                target.set(key, MutableDict::newDict());
+            applyPatch(target.getMutableDict(key), value.asDict());
+        } else {
+            target.set(key, value);
+        }
+    }
+}
+
+
+RetainedConst<CBLDocument> CBLDocument::update(CBLDatabase* db _cbl_nonnull,
+                                               const char *docID _cbl_nonnull,
+                                               Dict patch,
+                                               CBLConcurrencyControl concurrency,
+                                               C4Error* outError)
+{
+    if (!db->ensureOpen(outError))
+        return nullptr;
+    C4Error c4err;
+    for (unsigned attempt = 0; attempt < kMaxUpdateAttempts; ++attempt) {
+        Retained<CBLDocument> doc = new CBLDocument(db, docID, true);
+        applyPatch(doc->mutableProperties(), patch);
+        RetainedConst<CBLDocument> saved = doc->save(db, false,
+                                                     kCBLConcurrencyControlFailOnConflict,
+                                                     &c4err);
+        if (saved)
+            return saved;
+        if (concurrency != kCBLConcurrencyControlLastWriteWins
+                || !(c4err == C4Error{LiteCoreDomain, kC4ErrorConflict}))
+            break;
+        // Another revision was saved after this one was read; patch that one instead.
+    }
+    if (outError)
+        *outError = c4err;
+    return nullptr;
+}
+
+
+int64_t CBLDocument::saveDocuments(CBLDatabase* db _cbl_nonnull,
+                                   CBLDocument* const docs[],
+                                   size_t count,
+                                   CBLConcurrencyControl concurrency,
+                                   const CBLDocument* results[],
+                                   C4Error* outError)
+{
+    if (results)
+        fill(&results[0], &results[count], nullptr);
+    for (size_t i = 0; i < count; ++i) {
+        if (!docs[i]->checkSaveable(db, outError))
+            return -1;
+    }
+    if (!db->ensureOpen(outError))
+        return -1;
+
+    c4::Transaction t(internal(db));
+    if (!t.begin(outError))
+        return -1;
+
+    // All the docs share one transaction and one encoder. A conflict only skips that doc;
+    // any other error aborts the whole batch.
+    vector<RetainedConst<CBLDocument>> savedDocs(count);
+    int64_t nSaved = 0;
+    bool ok = true;
+    Encoder enc(c4db_getSharedFleeceEncoder(internal(db)));
+    for (size_t i = 0; i < count; ++i) {
+        C4Error c4err;
+        savedDocs[i] = docs[i]->saveInTransaction(db, false, concurrency, enc, &c4err);
+        if (savedDocs[i]) {
+            ++nSaved;
+        } else if (!(c4err == C4Error{LiteCoreDomain, kC4ErrorConflict})) {
+            if (outError)
+                *outError = c4err;
+            ok = false;
+            break;
+        }
+    }
+    enc.detach();
+
+    if (!ok || !db->timedCommit([&]{return t.commit(outError);}))
+        return -1;
+    DatabaseMetrics::add(db->metrics.documentsWritten, nSaved);
+    if (results) {
+        for (size_t i = 0; i < count; ++i)
+            results[i] = retain(savedDocs[i].get());
+    }
+    return nSaved;
 }
 
 
@@ -186,6 +439,8 @@ bool CBLDocument::deleteDoc(CBLDatabase* db _cbl_nonnull,
                             const char* docID _cbl_nonnull,
                             C4Error* outError)
 {
+    if (!db->ensureOpen(outError))
+        return false;
     c4::Transaction t(internal(db));
     if (!t.begin(outError))
         return false;
@@ -193,7 +448,52 @@ bool CBLDocument::deleteDoc(CBLDatabase* db _cbl_nonnull,
                                                         false, outError);
     if (c4doc)
         c4doc = c4doc_update(c4doc, nullslice, kRevDeleted, outError);
-    return c4doc && t.commit(outError);
+    if (!c4doc || !db->timedCommit([&]{return t.commit(outError);}))
+        return false;
+    DatabaseMetrics::add(db->metrics.documentsWritten);
+    return true;
+}
+
+
+size_t CBLDocument::getDocuments(CBLDatabase *db _cbl_nonnull,
+                                 const char* const docIDs[],
+                                 size_t count,
+                                 const CBLDocument* outDocs[])
+{
+    if (!db->ensureOpen(nullptr)) {
+        fill(&outDocs[0], &outDocs[count], nullptr);
+        return 0;
+    }
+    size_t nFound = 0;
+    auto lookup = [&](size_t i) {
+        C4Document *c4doc = c4doc_getSingleRevision(internal(db), slice(docIDs[i]), nullslice,
+                                                    true, nullptr);
+        if (c4doc) {
+            outDocs[i] = retain(new CBLDocument(docIDs[i], db, c4doc, false));
+            ++nFound;
+        } else {
+            outDocs[i] = nullptr;
+        }
+    };
+
+    auto less = [](const char *a, const char *b) {return strcmp(a, b) < 0;};
+    if (count < kMinSortedLookups || is_sorted(&docIDs[0], &docIDs[count], less)) {
+        for (size_t i = 0; i < count; ++i)
+            lookup(i);
+    } else {
+        // Look up the docs in sorted order, for better locality in the B-tree:
+        vector<size_t> order(count);
+        for (size_t i = 0; i < count; ++i)
+            order[i] = i;
+        sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return less(docIDs[a], docIDs[b]);
+        });
+        for (size_t i : order)
+            lookup(i);
+    }
+
+    DatabaseMetrics::add(db->metrics.documentsRead, nFound);
+    return nFound;
 }
 
 
@@ -253,58 +553,135 @@ bool CBLDocument::setPropertiesAsJSON(const char *json, C4Error* outError) {
 #pragma mark - BLOBS:
 
 
-CBLDocument::UnretainedValueToBlobMap* CBLDocument::sNewBlobs = nullptr;
-mutex sNewBlobsMutex;
+namespace {
+
+    // Registry of CBLNewBlobs that haven't been saved yet, keyed by their properties Dict.
+    // It's split into independently-locked shards so that threads creating and saving blobs
+    // concurrently rarely contend; and it keeps a count so that saving a document can skip
+    // looking for new blobs entirely when there aren't any.
+    class NewBlobRegistry {
+    public:
+        void add(FLDict dict, CBLNewBlob *blob) {
+            Shard &shard = shardFor(dict);
+            lock_guard<mutex> lock(shard.blobsMutex);
+            if (shard.blobs.insert({dict, blob}).second)
+                ++_count;
+        }
+
+        void remove(FLDict dict) {
+            Shard &shard = shardFor(dict);
+            lock_guard<mutex> lock(shard.blobsMutex);
+            if (shard.blobs.erase(dict) > 0)
+                --_count;
+        }
+
+        CBLNewBlob* find(FLDict dict) {
+            if (empty())
+                return nullptr;
+            Shard &shard = shardFor(dict);
+            lock_guard<mutex> lock(shard.blobsMutex);
+            auto i = shard.blobs.find(dict);
+            return (i != shard.blobs.end()) ? i->second : nullptr;
+        }
+
+        bool empty() const          {return _count.load(memory_order_acquire) == 0;}
 
+    private:
+        static constexpr size_t kNumShards = 16;
 
-CBLBlob* CBLDocument::getBlob(FLDict dict) {
-    // Is it already registered by a previous call to getBlob?
-    auto i = _blobs.find(dict);
-    if (i != _blobs.end())
-        return i->second;
-    // Is it a NewBlob?
-    if (Dict(dict).asMutable()) {
-        CBLNewBlob *newBlob = findNewBlob(dict);
-        if (newBlob)
-            return newBlob;
+        struct Shard {
+            mutex blobsMutex;
+            unordered_map<FLDict, CBLNewBlob*> blobs;
+        };
+
+        Shard& shardFor(FLDict dict) {
+            // Heap pointers are aligned, so skip the low bits:
+            return _shards[(uintptr_t(dict) >> 4) % kNumShards];
+        }
+
+        Shard _shards[kNumShards];
+        atomic<size_t> _count {0};
+    };
+
+    // Allocated on first use and never freed, since blobs may be released during static
+    // destruction.
+    NewBlobRegistry& newBlobs() {
+        static NewBlobRegistry *sRegistry = new NewBlobRegistry;
+        return *sRegistry;
     }
-    // Not found; create a new blob and remember it:
-    auto blob = retained(new CBLBlob(this, dict));
-    if (!blob->valid())
-        return nullptr;
-    _blobs.insert({dict, blob});
-    return blob;
+
+}
+
+
+namespace cbl_internal {
+
+    // Guards the C4Documents' `extraInfo`, which is only ever set once
+    static mutex sBodyMutex;
+
+
+    DocumentBody* DocumentBody::attach(C4Document *c4doc, CBLDatabase *db) {
+        lock_guard<mutex> lock(sBodyMutex);
+        if (!c4doc->extraInfo.pointer)
+            c4doc->extraInfo = {new DocumentBody(db), &destroy};
+        return (DocumentBody*)c4doc->extraInfo.pointer;
+    }
+
+
+    DocumentBody* DocumentBody::containing(Value value) {
+        C4Document* c4doc = c4doc_containingValue(value);
+        if (!c4doc)
+            return nullptr;
+        lock_guard<mutex> lock(sBodyMutex);
+        return (DocumentBody*)c4doc->extraInfo.pointer;
+    }
+
+
+    DocumentBody::~DocumentBody() = default;
+
+
+    CBLBlob* DocumentBody::getBlob(FLDict dict) {
+        lock_guard<mutex> lock(_mutex);
+        // Is it already registered by a previous call to getBlob?
+        auto i = _blobs.find(dict);
+        if (i != _blobs.end())
+            return i->second;
+        // Is it a NewBlob?
+        if (Dict(dict).asMutable()) {
+            CBLNewBlob *newBlob = CBLDocument::findNewBlob(dict);
+            if (newBlob)
+                return newBlob;
+        }
+        // Not found; create a new blob and remember it:
+        auto blob = retained(new CBLBlob(_db, dict));
+        if (!blob->valid())
+            return nullptr;
+        _blobs.insert({dict, blob});
+        return blob;
+    }
+
 }
 
 
 void CBLDocument::registerNewBlob(CBLNewBlob* blob) {
-    lock_guard<mutex> lock(sNewBlobsMutex);
-    if (!sNewBlobs)
-        sNewBlobs = new UnretainedValueToBlobMap;
-    sNewBlobs->insert({blob->properties(), blob});
+    newBlobs().add(blob->properties(), blob);
 }
 
 
 void CBLDocument::unregisterNewBlob(CBLNewBlob* blob) {
-    lock_guard<mutex> lock(sNewBlobsMutex);
-    if (sNewBlobs)
-        sNewBlobs->erase(blob->properties());
+    newBlobs().remove(blob->properties());
 }
 
 
 CBLNewBlob* CBLDocument::findNewBlob(FLDict dict) {
-    lock_guard<mutex> lock(sNewBlobsMutex);
-    auto i = sNewBlobs->find(dict);
-    if (i == sNewBlobs->end())
-        return nullptr;
-    return i->second;
+    return newBlobs().find(dict);
 }
 
 
 bool CBLDocument::saveBlobs(CBLDatabase *db, C4Error *outError) {
     // Walk through the Fleece object tree, looking for mutable blob Dicts to install.
     // We can skip any immutable collections (they can't contain new blobs.)
-    if (!isMutable())
+    // And if there are no unsaved blobs anywhere, there's nothing to look for.
+    if (!isMutable() || newBlobs().empty())
         return true;
     for (DeepIterator i(properties()); i; ++i) {
         Dict dict = i.value().asDict();
@@ -327,20 +704,190 @@ bool CBLDocument::saveBlobs(CBLDatabase *db, C4Error *outError) {
 }
 
 
+#pragma mark - DOCUMENT CACHE:
+
+
+namespace cbl_internal {
+
+    void DocumentCache::setCapacity(C4Database *db, size_t capacity) {
+        C4DatabaseObserver *oldObserver = nullptr;
+        {
+            lock_guard<mutex> lock(_mutex);
+            _capacity = capacity;
+            trim(capacity);
+            if (capacity > 0 && !_observer) {
+                _observer = c4dbobs_create(db,
+                                           [](C4DatabaseObserver*, void *context) {
+                                               auto cache = (DocumentCache*)context;
+                                               ++cache->_changeCount;
+                                               cache->_changed = true;
+                                           },
+                                           this);
+            } else if (capacity == 0) {
+                swap(oldObserver, _observer);
+            }
+        }
+        c4dbobs_free(oldObserver);
+    }
+
+
+    C4Document* DocumentCache::get(slice docID, uint64_t *outToken) {
+        lock_guard<mutex> lock(_mutex);
+        if (_changed)
+            removeChanged();
+        auto i = _map.find(docID);
+        if (i == _map.end()) {
+            ++_misses;
+            *outToken = _changeCount;
+            return nullptr;
+        }
+        ++_hits;
+        _lru.splice(_lru.begin(), _lru, i->second);
+        return c4doc_retain(i->second->doc);
+    }
+
+
+    void DocumentCache::put(C4Document *doc, uint64_t token) {
+        lock_guard<mutex> lock(_mutex);
+        size_t capacity = _capacity;
+        if (token != _changeCount)
+            return;     // A change was committed since the doc was read, so it may be stale
+        slice docID = doc->docID;
+        size_t size = docID.size + doc->selectedRev.body.size + kEntryOverhead;
+        if (size > capacity || _map.find(docID) != _map.end())
+            return;
+        _lru.push_front({string(docID), c4doc_retain(doc), size});
+        _map.emplace(slice(_lru.front().docID), _lru.begin());
+        _size += size;
+        trim(capacity);
+        // The doc may have been read after a change whose observer callback hasn't come yet;
+        // if so that change is pending, and removing it now takes care of it:
+        if (_changed)
+            removeChanged();
+    }
+
+
+    CBLDocumentCacheStats DocumentCache::stats() const {
+        lock_guard<mutex> lock(_mutex);
+        return {_hits, _misses, _lru.size(), _size, _capacity};
+    }
+
+
+    // Removes the docs reported by the observer. Must be called with the mutex locked.
+    void DocumentCache::removeChanged() {
+        static const uint32_t kMaxChanges = 100;
+        _changed = false;
+        if (!_observer)
+            return;
+        C4DatabaseChange changes[kMaxChanges];
+        bool external;
+        uint32_t nChanges;
+        while ((nChanges = c4dbobs_getChanges(_observer, changes, kMaxChanges, &external)) > 0) {
+            for (uint32_t i = 0; i < nChanges; ++i) {
+                auto entry = _map.find(changes[i].docID);
+                if (entry != _map.end()) {
+                    _size -= entry->second->size;
+                    c4doc_release(entry->second->doc);
+                    _lru.erase(entry->second);
+                    _map.erase(entry);
+                }
+            }
+        }
+    }
+
+
+    // Must be called with the mutex locked.
+    void DocumentCache::trim(size_t capacity) {
+        while (_size > capacity) {
+            Entry &entry = _lru.back();
+            _map.erase(slice(entry.docID));
+            _size -= entry.size;
+            c4doc_release(entry.doc);
+            _lru.pop_back();
+        }
+    }
+
+}
+
+
 #pragma mark - PUBLIC API:
 
 
-static CBLDocument* getDocument(CBLDatabase* db, const char* docID, bool isMutable) CBLAPI {
-    auto doc = retained(new CBLDocument(db, docID, isMutable));
-    return doc->exists() ? retain(doc.get()) : nullptr;
+static Retained<CBLDocument> getDocument(CBLDatabase* db, const char* docID, bool isMutable) {
+    if (!db->ensureOpen(nullptr))
+        return nullptr;
+    Retained<CBLDocument> doc;
+    if (db->docCache.enabled() && !c4db_isInTransaction(internal(db))) {
+        doc = CBLDocument::getCached(db, docID, isMutable);
+        if (!doc)
+            return nullptr;
+    } else {
+        doc = new CBLDocument(db, docID, isMutable);
+        if (!doc->exists())
+            return nullptr;
+    }
+    DatabaseMetrics::add(db->metrics.documentsRead);
+    return doc;
 }
 
 const CBLDocument* CBLDatabase_GetDocument(const CBLDatabase* db, const char* docID) CBLAPI {
-    return getDocument((CBLDatabase*)db, docID, false);
+    return retain(getDocument((CBLDatabase*)db, docID, false).get());
+}
+
+size_t CBLDatabase_GetDocuments(const CBLDatabase* db,
+                                 const char* const docIDs[],
+                                 size_t count,
+                                 const CBLDocument* outDocs[]) CBLAPI
+{
+    return CBLDocument::getDocuments((CBLDatabase*)db, docIDs, count, outDocs);
+}
+
+bool CBLDatabase_WithDocumentProperties(const CBLDatabase* db,
+                                        const char* docID,
+                                        CBLDocumentPropertiesCallback callback,
+                                        void *context) CBLAPI
+{
+    if (!db->ensureOpen(nullptr))
+        return false;
+    c4::ref<C4Document> c4doc = c4doc_getSingleRevision(internal(db), slice(docID), nullslice,
+                                                        true, nullptr);
+    if (!c4doc)
+        return false;
+    DatabaseMetrics::add(db->metrics.documentsRead);
+    Dict properties = Value::fromData(c4doc->selectedRev.body, kFLTrusted).asDict();
+    callback(context, docID, properties ? properties : Dict::emptyDict());
+    return true;
+}
+
+const CBLDocument* CBLDatabase_UpdateDocument(CBLDatabase* db,
+                                              const char* docID,
+                                              FLDict patch,
+                                              CBLConcurrencyControl concurrency,
+                                              CBLError* outError) CBLAPI
+{
+    return retain(CBLDocument::update(db, docID, patch, concurrency, internal(outError)).get());
+}
+
+void CBLDatabase_SetDocumentCacheCapacity(CBLDatabase* db, size_t capacity) CBLAPI {
+    if (!db->ensureOpen(nullptr))
+        return;
+    db->docCache.setCapacity(internal(db), capacity);
+}
+
+void CBLDatabase_SetDocumentIDStrategy(CBLDatabase* db,
+                                       CBLDocumentIDStrategy strategy,
+                                       CBLDocumentIDGenerator generator,
+                                       void *context) CBLAPI
+{
+    db->docIDGenerator.setStrategy(strategy, generator, context);
+}
+
+CBLDocumentCacheStats CBLDatabase_DocumentCacheStats(const CBLDatabase* db) CBLAPI {
+    return db->docCache.stats();
 }
 
 CBLDocument* CBLDatabase_GetMutableDocument(CBLDatabase* db, const char* docID) CBLAPI {
-    return getDocument(db, docID, true);
+    return retain(getDocument(db, docID, true).get());
 }
 
 CBLDocument* CBLDocument_New(const char *docID) CBLAPI {
@@ -372,7 +919,64 @@ const CBLDocument* CBLDatabase_SaveDocument(CBLDatabase* db,
                                        CBLConcurrencyControl concurrency,
                                        CBLError* outError) CBLAPI
 {
-    return retain(doc->save(db, false, concurrency, internal(outError)).get());
+    return retain(doc->saveGrouped(db, concurrency, internal(outError)).get());
+}
+
+void CBLDatabase_QueueSaveDocument(CBLDatabase* db,
+                                   CBLDocument* doc,
+                                   CBLConcurrencyControl concurrency,
+                                   CBLSaveCompletion completion,
+                                   void *context) CBLAPI
+{
+    doc->queueSave(db, concurrency, [=](const CBLDocument *savedDoc, C4Error error) {
+        completion(context, savedDoc, (savedDoc ? nullptr : external(&error)));
+    });
+}
+
+void CBLDatabase_SaveDocumentAsync(CBLDatabase* db,
+                                   CBLDocument* doc,
+                                   CBLConcurrencyControl concurrency,
+                                   CBLSaveCompletion completion,
+                                   void *context) CBLAPI
+{
+    Retained<CBLDatabase> retainedDB = db;
+    Retained<CBLDocument> retainedDoc = doc;
+    db->asyncSave([=]() {
+        retainedDB->asyncSaveBegan();
+        retainedDoc->queueSave(retainedDB, concurrency,
+                               [=](const CBLDocument *savedDoc, C4Error error) {
+            RetainedConst<CBLDocument> saved = savedDoc;
+            retainedDB->notify(Notification([=]() {
+                completion(context, saved, (saved ? nullptr : external(&error)));
+            }));
+            retainedDB->asyncSaveEnded();       // (after notifying, to keep completions in order)
+        });
+    });
+}
+
+void CBLDatabase_GetDocumentAsync(CBLDatabase* db,
+                                  const char* docID,
+                                  CBLGetDocumentCompletion completion,
+                                  void *context) CBLAPI
+{
+    Retained<CBLDatabase> retainedDB = db;
+    string id = docID;
+    db->async([=]() {
+        RetainedConst<CBLDocument> doc = getDocument(retainedDB, id.c_str(), false);
+        retainedDB->notify(Notification([=]() {
+            completion(context, doc);
+        }));
+    });
+}
+
+int64_t CBLDatabase_SaveDocuments(CBLDatabase* db,
+                                  CBLDocument* const docs[],
+                                  size_t count,
+                                  CBLConcurrencyControl concurrency,
+                                  const CBLDocument* results[],
+                                  CBLError* outError) CBLAPI
+{
+    return CBLDocument::saveDocuments(db, docs, count, concurrency, results, internal(outError));
 }
 
 bool CBLDocument_Delete(const CBLDocument* doc _cbl_nonnull,
@@ -399,6 +1003,8 @@ bool CBLDatabase_PurgeDocumentByID(CBLDatabase* db _cbl_nonnull,
                               const char* docID _cbl_nonnull,
                               CBLError* outError) CBLAPI
 {
+    if (!db->ensureOpen(internal(outError)))
+        return false;
     return c4db_purgeDoc(internal(db), slice(docID), internal(outError));
 }
 
@@ -406,6 +1012,8 @@ time_t CBLDatabase_GetDocumentExpiration(CBLDatabase* db _cbl_nonnull,
                                          const char *docID _cbl_nonnull,
                                          CBLError* error) CBLAPI
 {
+    if (!db->ensureOpen(internal(error)))
+        return -1;
     return c4doc_getExpiration(internal(db), slice(docID), internal(error));
 }
 
@@ -414,5 +1022,10 @@ bool CBLDatabase_SetDocumentExpiration(CBLDatabase* db _cbl_nonnull,
                                        time_t expiration,
                                        CBLError* error) CBLAPI
 {
-    return c4doc_setExpiration(internal(db), slice(docID), expiration, internal(error));
+    if (!db->ensureOpen(internal(error)))
+        return false;
+    if (!c4doc_setExpiration(internal(db), slice(docID), expiration, internal(error)))
+        return false;
+    db->expirationChanged(expiration);
+    return true;
 }
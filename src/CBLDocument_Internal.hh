@@ -18,12 +18,16 @@
 
 #pragma once
 #include "CBLDocument.h"
+#include "Arena.hh"
 #include "Internal.hh"
 #include "CBLDatabase_Internal.hh"
+#include "DocumentID.hh"
 #include "c4.hh"
 #include "c4Document+Fleece.h"
 #include "fleece/Fleece.hh"
 #include "fleece/Mutable.hh"
+#include <atomic>
+#include <mutex>
 #include <unordered_map>
 
 using namespace std;
@@ -33,6 +37,46 @@ class CBLBlob;
 class CBLNewBlob;
 
 
+namespace cbl_internal {
+
+    /** The state shared by all the CBLDocuments on one C4Document, which the document cache
+        shares between instances and threads: mainly the blobs created from its body, which must
+        live as long as the body does. Attached to the C4Document's `extraInfo` by the first
+        CBLDocument created on it, and freed along with the C4Document. Thread-safe. */
+    class DocumentBody {
+    public:
+        /** Returns the C4Document's DocumentBody, attaching a new one if necessary. */
+        static DocumentBody* attach(C4Document* _cbl_nonnull, CBLDatabase*);
+
+        /** Returns the DocumentBody of the C4Document whose body contains `value`, if any. */
+        static DocumentBody* containing(Value value);
+
+        /** The database the document was read from. (Not retained: the C4Document is only kept
+            alive by CBLDocuments, which retain it, and by its document cache.) */
+        CBLDatabase* database() const               {return _db;}
+
+        /** Marks the C4Document as shared by the document cache, so it mustn't be modified. */
+        void setShared()                            {_shared = true;}
+        bool isShared() const                       {return _shared;}
+
+        /** Returns the blob for a blob dictionary in the body, or a new blob's properties;
+            the result is owned by this object (or the new-blob registry), not retained. */
+        CBLBlob* getBlob(FLDict _cbl_nonnull);
+
+    private:
+        explicit DocumentBody(CBLDatabase *db)      :_db(db) { }
+        ~DocumentBody();
+        static void destroy(void *body)             {delete (DocumentBody*)body;}
+
+        CBLDatabase* const _db;
+        std::atomic<bool> _shared {false};
+        std::mutex _mutex;
+        std::unordered_map<FLDict, Retained<CBLBlob>> _blobs;
+    };
+
+}
+
+
 class CBLDocument : public CBLRefCounted {
 public:
     // Construct a new document (not in any database yet)
@@ -50,13 +94,27 @@ public:
                 C4RevisionFlags revFlags,
                 Dict body);
 
-    static CBLDocument* containing(Value value) {
-        C4Document* doc = c4doc_containingValue(value);
-        return doc ? (CBLDocument*)doc->extraInfo.pointer : nullptr;
-    }
+    // Allocated in the current thread's arena, if any (see CBLArena_Begin)
+    static void* operator new(size_t size)      {return CBLArena::allocate(size);}
+    static void operator delete(void *ptr)      {CBLArena::free(ptr);}
+
+    // Looks up a document in the database's document cache, or reads and caches it
+    static Retained<CBLDocument> getCached(CBLDatabase *db _cbl_nonnull,
+                                           const char *docID _cbl_nonnull,
+                                           bool isMutable);
+
+    // Looks up multiple documents at once; returns the number found
+    static size_t getDocuments(CBLDatabase *db _cbl_nonnull,
+                               const char* const docIDs[],
+                               size_t count,
+                               const CBLDocument* outDocs[]);
 
     CBLDatabase* database() const               {return _db;}
-    const char* docID() const                   {return _docID.c_str();}
+    const char* docID() const {
+        if (_usuallyFalse(!_docIDAssigned.load(std::memory_order_acquire)))
+            assignDocID(nullptr, nullptr);      // ID not assigned yet; make up a random one
+        return _docID.c_str();
+    }
     bool exists() const                         {return _c4doc != nullptr;}
     uint64_t sequence() const                   {return _c4doc ? _c4doc->sequence : 0;}
     bool isMutable() const                      {return _mutable;}
@@ -72,7 +130,32 @@ public:
     RetainedConst<CBLDocument> save(CBLDatabase* db _cbl_nonnull,
                                     bool deleting,
                                     CBLConcurrencyControl concurrency,
-                                    C4Error* outError);
+                                    C4Error* outError,
+                                    slice expectedRevID = nullslice);
+
+    /** Like `save`, but if group commit is on, saves the doc in the next group and waits. */
+    RetainedConst<CBLDocument> saveGrouped(CBLDatabase* db _cbl_nonnull,
+                                           CBLConcurrencyControl concurrency,
+                                           C4Error* outError);
+
+    /** Queues the doc to be saved in the next group, or saves it now if group commit is off,
+        then calls `completion`. */
+    void queueSave(CBLDatabase* db _cbl_nonnull,
+                   CBLConcurrencyControl concurrency,
+                   cbl_internal::GroupCommitter::Completion completion);
+
+    static int64_t saveDocuments(CBLDatabase* db _cbl_nonnull,
+                                 CBLDocument* const docs[],
+                                 size_t count,
+                                 CBLConcurrencyControl concurrency,
+                                 const CBLDocument* results[],
+                                 C4Error* outError);
+
+    static RetainedConst<CBLDocument> update(CBLDatabase* db _cbl_nonnull,
+                                             const char *docID _cbl_nonnull,
+                                             Dict patch,
+                                             CBLConcurrencyControl concurrency,
+                                             C4Error* outError);
 
     bool deleteDoc(CBLConcurrencyControl concurrency,
                    C4Error* outError);
@@ -81,32 +164,49 @@ public:
                           const char* docID _cbl_nonnull,
                           C4Error* outError);
 
-    CBLBlob* getBlob(FLDict _cbl_nonnull);
-
     static void registerNewBlob(CBLNewBlob* _cbl_nonnull);
     static void unregisterNewBlob(CBLNewBlob* _cbl_nonnull);
 
 private:
-    CBLDocument(const string &docID, CBLDatabase *db, C4Document *d, bool isMutable);
+    friend class cbl_internal::GroupCommitter;
+    friend class cbl_internal::DocumentBody;
+
+    static constexpr unsigned kFullEncodeInterval = 8;  // Every 8th revision isn't a delta
+    static constexpr size_t kMaxDeltaFraction = 8;      // Max delta size is 1/8 of the body
+    static constexpr unsigned kMaxUpdateAttempts = 10;  // Conflict retries in update()
+    static constexpr size_t kMinSortedLookups = 32;     // Fewest IDs getDocuments() sorts
+
+    CBLDocument(slice docID, CBLDatabase *db, C4Document *d, bool isMutable);
     virtual ~CBLDocument();
 
+    // Assigns the doc an ID, from `db`'s generator or else a random one, unless another
+    // thread just did. Thread-safe.
+    bool assignDocID(CBLDatabase *db, C4Error *outError) const;
+
     void initProperties();
     bool checkMutable(C4Error *outError) const;
+    bool checkSaveable(CBLDatabase *db, C4Error *outError) const;
+
+    // Saves the doc; must be called within a transaction. `enc` is the db's shared encoder.
+    // If `expectedRevID` is given, the doc's C4Document is known to be stale (a save of it was
+    // rolled back), so a fresh copy of the revision is saved instead, if its ID is that.
+    RetainedConst<CBLDocument> saveInTransaction(CBLDatabase* db _cbl_nonnull,
+                                                 bool deleting,
+                                                 CBLConcurrencyControl concurrency,
+                                                 Encoder &enc,
+                                                 C4Error* outError,
+                                                 slice expectedRevID = nullslice);
 
-    static string ensureDocID(const char *docID);
+    alloc_slice encodeDelta(CBLDatabase *db) const;
 
     static CBLNewBlob* findNewBlob(FLDict dict _cbl_nonnull);
     bool saveBlobs(CBLDatabase *db, C4Error *outError);
 
-    using ValueToBlobMap = std::unordered_map<FLDict, Retained<CBLBlob>>;
-    using UnretainedValueToBlobMap = std::unordered_map<FLDict, CBLNewBlob*>;
-
-    static UnretainedValueToBlobMap* sNewBlobs;
-
-    string const                _docID;                 // Document ID (never empty)
+    mutable cbl_internal::DocumentID _docID;            // Document ID (empty until assigned)
+    mutable std::atomic<bool>   _docIDAssigned;         // Set once _docID is non-empty
     Retained<CBLDatabase> const _db;                    // Database (null for new doc)
     c4::ref<C4Document> const   _c4doc;                 // LiteCore doc (null for new doc)
+    cbl_internal::DocumentBody* _body {nullptr};        // _c4doc's shared state
     RetainedValue               _properties;            // Properties, initialized lazily
-    ValueToBlobMap              _blobs;
     bool const                  _mutable {false};       // True iff I am mutable
 };
@@ -17,34 +17,504 @@
 //
 
 #include "CBLLog.h"
+#include "Internal.hh"
+#include "Util.hh"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 
-CBLLogLevel CBLLog_ConsoleLevel()
-{
-    abort();
+using namespace std;
+using namespace fleece;
+
+
+static const C4LogDomain kC4Domains[5] = {
+    kC4DefaultLog, kC4DatabaseLog, kC4QueryLog, kC4SyncLog, kC4WebSocketLog};
+
+static const char* const kLevelNames[] = {"Debug", "Verbose", "Info", "WARNING", "ERROR"};
+
+static const char* const kDomainNames[] = {"", "DB", "Query", "Sync", "Network"};
+
+// The level of messages that go to the log file.
+static constexpr CBLLogLevel kFileLogLevel = CBLLogInfo;
+
+// The log queue is a ring of this many fixed-size slots, and an entry uses as many slots as its
+// message needs. Messages that don't fit are dropped, rather than using unbounded memory or
+// blocking the thread that logged them.
+static constexpr size_t kLogRingSlots = 2048;           // Must be a power of 2
+static constexpr size_t kLogSlotTextSize = 224;         // Bytes of message text per slot
+static constexpr size_t kMaxLogEntrySlots = kLogRingSlots / 8;  // Longer messages are truncated
+
+// The most entries the writer handles at once, before releasing their slots.
+static constexpr size_t kMaxLogBatch = 256;
+
+
+static CBLLogDomain externalDomain(C4LogDomain c4Domain) {
+    for (int i = 1; i < 5; ++i) {
+        if (kC4Domains[i] == c4Domain)
+            return CBLLogDomain(i);
+    }
+    return kCBLLogDomainAll;
 }
 
-void CBLLog_SetConsoleLevel(CBLLogLevel)
-{
-    abort();
+
+namespace {
+
+    // Receives log messages from LiteCore and passes them, on a background thread, to the console,
+    // the client's callback, and a plaintext log file. Logging threads copy each message into a
+    // preallocated lock-free ring (Dmitry Vyukov's bounded queue, with entries spanning
+    // consecutive slots), so logging neither allocates nor takes a lock; the mutex is only used
+    // to wake the writer thread when it's idle. The writer handles the entries in place, writing
+    // each batch with a single `fwrite` per destination.
+    class LogWriter {
+    public:
+        // Never destroyed, since other threads may log during process exit.
+        static LogWriter& instance() {
+            static LogWriter* sInstance = new LogWriter;
+            return *sInstance;
+        }
+
+        // Starts the writer thread, the first time a callback or log file is configured.
+        void start() {
+            call_once(_started, [this] {
+                thread([this] {run();}).detach();
+                atexit([] {LogWriter::instance().flush();});
+                _running = true;
+            });
+        }
+
+        void post(CBLLogLevel level, CBLLogDomain domain, const char *message) {
+            size_t length = strlen(message);
+            size_t nSlots = length / kLogSlotTextSize + 1;          // (room for the NUL)
+            if (nSlots > kMaxLogEntrySlots) {
+                nSlots = kMaxLogEntrySlots;
+                length = nSlots * kLogSlotTextSize - 1;
+                while (length > 0 && (uint8_t(message[length]) & 0xC0) == 0x80)
+                    --length;                                       // don't split a UTF-8 char
+            }
+
+            // Claim `nSlots` consecutive slots. They're free if the last one is, since the writer
+            // frees them in order:
+            size_t pos = _enqueuePos.load(memory_order_relaxed);
+            while (true) {
+                size_t last = pos + nSlots - 1;
+                size_t seq = slot(last).sequence.load(memory_order_acquire);
+                intptr_t diff = intptr_t(seq) - intptr_t(last);
+                if (diff == 0) {
+                    if (_enqueuePos.compare_exchange_weak(pos, pos + nSlots,
+                                                          memory_order_relaxed))
+                        break;
+                } else if (diff < 0) {
+                    _dropped.fetch_add(1, memory_order_relaxed);    // The ring is full
+                    return;
+                } else {
+                    pos = _enqueuePos.load(memory_order_relaxed);
+                }
+            }
+
+            Slot &head = slot(pos);
+            head.time = chrono::system_clock::now();
+            head.level = level;
+            head.domain = domain;
+            head.length = uint32_t(length);
+            head.slots = uint32_t(nSlots);
+            for (size_t i = 0, offset = 0; i < nSlots; ++i, offset += kLogSlotTextSize) {
+                size_t n = min(kLogSlotTextSize, length - min(offset, length));
+                memcpy(slot(pos + i).text, message + offset, n);
+            }
+            slot(pos + length / kLogSlotTextSize).text[length % kLogSlotTextSize] = '\0';
+
+            // Publish the other slots first, so the writer sees them all once it sees the head:
+            for (size_t i = 1; i < nSlots; ++i)
+                slot(pos + i).sequence.store(pos + i + 1, memory_order_release);
+            head.sequence.store(pos + 1, memory_order_release);
+            wakeWriter();
+        }
+
+        // Blocks until all messages posted so far have been written.
+        void flush() {
+            if (!_running)
+                return;
+            size_t target = _enqueuePos.load();
+            unique_lock<mutex> lock(_mutex);
+            _cond.notify_one();
+            _drained.wait(lock, [&] {return _written >= target;});
+        }
+
+        void setFileConfig(const CBLLogFileConfiguration *config) {
+            flush();
+            lock_guard<mutex> lock(_fileMutex);
+            closeFile();
+            if (config) {
+                _fileDir = config->directory;
+                _fileConfig.reset(new CBLLogFileConfiguration{_fileDir.c_str(),
+                                                              config->maxRotateCount,
+                                                              config->maxSize,
+                                                              config->usePlaintext});
+            } else {
+                _fileConfig.reset();
+            }
+        }
+
+        // Returns a copy of the file config whose directory points to `dir`, or null.
+        unique_ptr<CBLLogFileConfiguration> copyFileConfig(string &dir) const {
+            lock_guard<mutex> lock(_fileMutex);
+            if (!_fileConfig)
+                return nullptr;
+            dir = _fileDir;
+            return unique_ptr<CBLLogFileConfiguration>(
+                        new CBLLogFileConfiguration{dir.c_str(),
+                                                    _fileConfig->maxRotateCount,
+                                                    _fileConfig->maxSize,
+                                                    _fileConfig->usePlaintext});
+        }
+
+        atomic<CBLLogLevel> consoleLevel {CBLLogWarning};
+        atomic<CBLLogCallback> callback {nullptr};
+        atomic<bool> writingFile {false};           // True if writing a plaintext log file
+
+    private:
+        struct Slot {
+            atomic<size_t> sequence;
+            // These are only set in an entry's first slot:
+            chrono::system_clock::time_point time;
+            uint32_t length;                        // Length of the message
+            uint32_t slots;                         // Number of slots the entry uses
+            CBLLogLevel level;
+            CBLLogDomain domain;
+            // The message, continued in the following slots; NUL-terminated:
+            char text[kLogSlotTextSize];
+        };
+
+        LogWriter()
+        :_slots(new Slot[kLogRingSlots])
+        {
+            for (size_t i = 0; i < kLogRingSlots; ++i)
+                _slots[i].sequence.store(i, memory_order_relaxed);
+        }
+
+        Slot& slot(size_t pos) const                {return _slots[pos & (kLogRingSlots - 1)];}
+
+        // Wakes the writer thread if it's waiting for messages.
+        void wakeWriter() {
+            atomic_thread_fence(memory_order_seq_cst);
+            if (_writerIdle.load(memory_order_relaxed) && _writerIdle.exchange(false)) {
+                lock_guard<mutex> lock(_mutex);
+                _cond.notify_one();
+            }
+        }
+
+        // True if the entry at `pos` has been published.
+        bool available(size_t pos) const {
+            return slot(pos).sequence.load(memory_order_acquire) == pos + 1;
+        }
+
+        void run() {
+            string consoleText, fileText, message;
+            size_t pos = 0;
+            while (true) {
+                if (!available(pos)) {
+                    if (_enqueuePos.load() != pos) {
+                        this_thread::yield();           // An entry is still being written
+                        continue;
+                    }
+                    unique_lock<mutex> lock(_mutex);
+                    _writerIdle = true;
+                    atomic_thread_fence(memory_order_seq_cst);
+                    if (!available(pos) && _enqueuePos.load() == pos)
+                        _cond.wait(lock);
+                    _writerIdle = false;
+                    continue;
+                }
+
+                // Write a batch of entries, in place:
+                size_t batchStart = pos;
+                CBLLogLevel console = consoleLevel.load();
+                CBLLogCallback cb = callback.load();
+                bool toFile = writingFile.load();
+                consoleText.clear();
+                fileText.clear();
+                for (size_t n = 0; n < kMaxLogBatch && available(pos); ++n) {
+                    const Slot &head = slot(pos);
+                    const char *text = entryText(pos, message);
+                    if (head.level >= console)
+                        appendLine(consoleText, head, text);
+                    if (cb)
+                        cb(head.level, head.domain, text);
+                    if (toFile && head.level >= kFileLogLevel)
+                        appendLine(fileText, head, text);
+                    pos += head.slots;
+                }
+                size_t dropped = _dropped.exchange(0);
+                if (dropped > 0)
+                    consoleText += "(" + to_string(dropped) + " log messages were dropped)\n";
+                if (!consoleText.empty())
+                    fwrite(consoleText.data(), 1, consoleText.size(), stderr);
+                if (!fileText.empty())
+                    writeToFile(fileText);
+
+                // Free the slots for reuse:
+                for (size_t p = batchStart; p < pos; ++p)
+                    slot(p).sequence.store(p + kLogRingSlots, memory_order_release);
+                {
+                    lock_guard<mutex> lock(_mutex);
+                    _written = pos;
+                    _drained.notify_all();
+                }
+            }
+        }
+
+        // Returns the message of the entry starting at `pos`; if it spans more than one slot,
+        // it's reassembled in `buffer`.
+        const char* entryText(size_t pos, string &buffer) const {
+            const Slot &head = slot(pos);
+            if (head.slots == 1)
+                return head.text;
+            buffer.clear();
+            for (uint32_t i = 0; i < head.slots; ++i) {
+                size_t n = min(kLogSlotTextSize, head.length - buffer.size());
+                buffer.append(slot(pos + i).text, n);
+            }
+            return buffer.c_str();
+        }
+
+        static void appendLine(string &text, const Slot &e, const char *message) {
+            time_t secs = chrono::system_clock::to_time_t(e.time);
+            auto micros = chrono::duration_cast<chrono::microseconds>(e.time.time_since_epoch())
+                          .count() % 1000000;
+            struct tm tm;
+#ifdef _MSC_VER
+            gmtime_s(&tm, &secs);
+#else
+            gmtime_r(&secs, &tm);
+#endif
+            char prefix[64];
+            snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%06dZ ",
+                     tm.tm_hour, tm.tm_min, tm.tm_sec, int(micros));
+            text += prefix;
+            if (e.domain != kCBLLogDomainAll) {
+                text += kDomainNames[e.domain];
+                text += ' ';
+            }
+            text += kLevelNames[min(int(e.level), int(CBLLogError))];
+            text += ": ";
+            text += message;
+            text += '\n';
+        }
+
+        void writeToFile(const string &text) {
+            lock_guard<mutex> lock(_fileMutex);
+            if (!_fileConfig || !_fileConfig->usePlaintext)
+                return;
+            if (!_file && !openFile())
+                return;
+            fwrite(text.data(), 1, text.size(), _file);
+            fflush(_file);
+            _fileSize += text.size();
+            if (_fileConfig->maxSize > 0 && _fileSize >= _fileConfig->maxSize)
+                rotate();
+        }
+
+        string logPath(unsigned generation) const {
+            string path = _fileDir + "/cbl";
+            if (generation > 0)
+                path += "." + to_string(generation);
+            return path + ".log";
+        }
+
+        bool openFile() {
+            _file = fopen(logPath(0).c_str(), "a");
+            if (!_file)
+                return false;
+            fseek(_file, 0, SEEK_END);
+            _fileSize = size_t(max(ftell(_file), 0L));
+            return true;
+        }
+
+        void closeFile() {
+            if (_file) {
+                fclose(_file);
+                _file = nullptr;
+            }
+        }
+
+        // Renames "cbl.log" to "cbl.1.log", "cbl.1.log" to "cbl.2.log", etc., deleting the
+        // oldest, then starts a new "cbl.log".
+        void rotate() {
+            closeFile();
+            unsigned maxRotate = _fileConfig->maxRotateCount;
+            remove(logPath(maxRotate).c_str());
+            for (unsigned gen = maxRotate; gen > 0; --gen)
+                rename(logPath(gen - 1).c_str(), logPath(gen).c_str());
+            if (maxRotate == 0)
+                remove(logPath(0).c_str());
+            openFile();
+        }
+
+        unique_ptr<Slot[]> const _slots;
+        atomic<size_t> _enqueuePos {0};
+        atomic<size_t> _dropped {0};
+        atomic<bool> _writerIdle {false};       // True while the writer waits for messages
+        once_flag _started;
+        atomic<bool> _running {false};
+
+        mutex _mutex;
+        condition_variable _cond;               // Wakes the writer when it's idle
+        condition_variable _drained;            // Signaled when the writer has caught up
+        size_t _written {0};                    // Position the writer has caught up to
+
+        mutable mutex _fileMutex;
+        unique_ptr<CBLLogFileConfiguration> _fileConfig;
+        string _fileDir;                        // Backing store of _fileConfig->directory
+        FILE* _file {nullptr};
+        size_t _fileSize {0};
+    };
+
+
+    atomic<bool> sWriterInstalled {false};
+
+    // The C4LogCallback that feeds LiteCore's (preformatted) messages to the LogWriter.
+    void logCallback(C4LogDomain domain, C4LogLevel level, const char *message, va_list) {
+        LogWriter::instance().post(CBLLogLevel(level), externalDomain(domain), message);
+    }
+
+    // Tells LiteCore the lowest level of messages to send to the callback.
+    void updateCallbackLevel() {
+        LogWriter &writer = LogWriter::instance();
+        CBLLogLevel level = writer.consoleLevel.load();
+        if (writer.callback.load())
+            level = CBLLogDebug;     // (LiteCore's per-domain levels still apply)
+        if (writer.writingFile.load())
+            level = min(level, kFileLogLevel);
+        c4log_writeToCallback(C4LogLevel(level), &logCallback, true);
+    }
+
+    // Starts routing LiteCore's log callback through the LogWriter, the first time a
+    // callback or plaintext log file is set up. (Until then, LiteCore's own console logging
+    // is left alone.)
+    void installWriter() {
+        if (!sWriterInstalled.exchange(true)) {
+            LogWriter::instance().consoleLevel = CBLLogLevel(c4log_callbackLevel());
+            LogWriter::instance().start();
+        }
+        updateCallbackLevel();
+    }
+
+}
+
+
+#pragma mark - LOGGING:
+
+
+void CBL_SetLogLevel(CBLLogLevel level, CBLLogDomain domain) CBLAPI {
+    if (domain == kCBLLogDomainAll) {
+        CBLLog_SetConsoleLevel(level);
+        for (int i = 0; i < 5; ++i)
+            c4log_setLevel(kC4Domains[i], C4LogLevel(level));
+    } else {
+        c4log_setLevel(kC4Domains[domain], C4LogLevel(level));
+    }
 }
 
-const CBLLogFileConfiguration* CBLLog_FileConfig()
-{
-    abort();
+
+void CBL_Log(CBLLogDomain domain, CBLLogLevel level, const char *format _cbl_nonnull, ...) CBLAPI {
+    C4LogDomain c4Domain = kC4Domains[domain];
+    if (!c4log_willLog(c4Domain, C4LogLevel(level)))
+        return;                             // Don't bother formatting a message nobody sees
+
+    // Format into a per-thread buffer, only allocating if the message doesn't fit:
+    static thread_local char tBuffer[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(tBuffer, sizeof(tBuffer), format, args);
+    va_end(args);
+    if (length < 0)
+        return;
+    if (size_t(length) < sizeof(tBuffer)) {
+        c4slog(c4Domain, C4LogLevel(level), slice(tBuffer, length));
+    } else {
+        char *message = nullptr;
+        va_start(args, format);
+        length = vasprintf(&message, format, args);
+        va_end(args);
+        if (length >= 0)
+            c4slog(c4Domain, C4LogLevel(level), slice(message, length));
+        free(message);
+    }
+}
+
+
+#pragma mark - LOG CONFIGURATION:
+
+
+CBLLogLevel CBLLog_ConsoleLevel() CBLAPI {
+    if (sWriterInstalled)
+        return LogWriter::instance().consoleLevel;
+    return CBLLogLevel(c4log_callbackLevel());
+}
+
+void CBLLog_SetConsoleLevel(CBLLogLevel level) CBLAPI {
+    if (sWriterInstalled) {
+        LogWriter::instance().consoleLevel = level;
+        updateCallbackLevel();
+    } else {
+        c4log_setCallbackLevel(C4LogLevel(level));
+    }
+}
+
+const CBLLogFileConfiguration* CBLLog_FileConfig() CBLAPI {
+    // Returns a copy owned by the calling thread, which another thread can't change or free:
+    static thread_local string tDirectory;
+    static thread_local unique_ptr<CBLLogFileConfiguration> tConfig;
+    tConfig = LogWriter::instance().copyFileConfig(tDirectory);
+    return tConfig.get();
+}
+
+void CBLLog_SetFileConfig(CBLLogFileConfiguration config) CBLAPI {
+    LogWriter &writer = LogWriter::instance();
+    bool enabled = (config.directory && *config.directory);
+    writer.setFileConfig(enabled ? &config : nullptr);
+
+    // Binary logs are written by LiteCore itself; plaintext ones by the LogWriter:
+    C4LogFileOptions options = {};
+    if (enabled && !config.usePlaintext) {
+        options.log_level = C4LogLevel(kFileLogLevel);
+        options.base_path = slice(config.directory);
+        options.max_size_bytes = int64_t(config.maxSize);
+        options.max_rotate_count = int32_t(config.maxRotateCount);
+        options.use_plaintext = false;
+    }
+    C4Error error;
+    if (!c4log_writeToBinaryFile(options, &error)) {
+        C4LogToAt(kC4DefaultLog, kC4LogError,
+                  "CBLLog_SetFileConfig: couldn't open log file: %d/%d", error.domain, error.code);
+    }
+
+    writer.writingFile = (enabled && config.usePlaintext);
+    if (writer.writingFile || sWriterInstalled)
+        installWriter();
 }
 
-void CBLLog_SetFileConfig(CBLLogFileConfiguration)
-{
-    abort();
+CBLLogCallback CBLLog_Callback() CBLAPI {
+    return LogWriter::instance().callback;
 }
 
-CBLLogCallback CBLLog_Callback()
-{
-    abort();
+void CBLLog_SetCallback(CBLLogCallback callback) CBLAPI {
+    LogWriter::instance().callback = callback;
+    if (callback || sWriterInstalled)
+        installWriter();
 }
 
-void CBLLog_SetCallback(CBLLogCallback)
-{
-    abort();
-}
\ No newline at end of file
+void CBLLog_Flush() CBLAPI {
+    if (sWriterInstalled)
+        LogWriter::instance().flush();
+}
@@ -39,6 +39,33 @@ uint64_t CBLDatabase_LastSequence(const CBLDatabase* _cbl_nonnull) CBLAPI;
                                         const char* docID _cbl_nonnull,
                                         CBLError* error) CBLAPI;
 
+/** Compiles a replication filter expression (as in `pushFilterExpression`) and evaluates it
+    against a document, without replicating. Used by tests of the expression evaluator.
+    @param expression  The expression, as JSON.
+    @param parameters  Values for parameters in the expression, or NULL.
+    @param docID  The document's ID.
+    @param deleted  True if the document is deleted.
+    @param body  The document's properties.
+    @param error  If the expression is invalid, the error will be written here.
+    @return  1 if the document matches, 0 if not, or -1 if the expression is invalid. */
+    int CBLReplicator_TestFilterExpression(FLString expression,
+                                           FLDict parameters,
+                                           FLString docID,
+                                           bool deleted,
+                                           FLDict body,
+                                           CBLError* error) CBLAPI;
+
+/** Calls a replicator's document listeners as though it had just replicated these documents,
+    without errors. Used by tests of the listeners' batching.
+    @param replicator  The replicator.
+    @param isPush  True if the documents were pushed, false if pulled.
+    @param numDocuments  The number of document IDs.
+    @param docIDs  The IDs of the documents. */
+    void CBLReplicator_SimulateDocumentsEnded(CBLReplicator* replicator _cbl_nonnull,
+                                              bool isPush,
+                                              unsigned numDocuments,
+                                              const char* const docIDs[]) CBLAPI;
+
 
 
 #ifdef __cplusplus
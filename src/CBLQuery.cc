@@ -20,12 +20,23 @@
 #include "CBLDatabase_Internal.hh"
 #include "Internal.hh"
 #include "Listener.hh"
+#include "QueryCache.hh"
+#include "Timer.hh"
 #include "Util.hh"
 #include "c4.hh"
 #include "c4Query.h"
 #include "fleece/Fleece.hh"
 #include "fleece/Mutable.hh"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 using namespace std;
 using namespace fleece;
@@ -43,7 +54,12 @@ public:
              int *outErrPos,
              C4Error* outError)
     :_database(db)
+    ,_cacheKey(QueryCache::key(language, queryCString))
     {
+        _c4query = db->queryCache.take(slice(_cacheKey));
+        if (_c4query)
+            return;
+        auto start = chrono::steady_clock::now();
         slice queryString;
         alloc_slice json;
         if (language == kCBLJSONLanguage) {
@@ -56,6 +72,15 @@ public:
         }
         _c4query = c4query_new2(internal(db), (C4QueryLanguage)language, queryString,
                                 outErrPos, outError);
+        _compileTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    ~CBLQuery() {
+        if (_c4query) {
+            // Return the compiled query to the database's cache for reuse:
+            c4query_setParameters(_c4query, nullslice);
+            _database->queryCache.put(_cacheKey, c4query_retain(_c4query));
+        }
     }
 
     bool valid() const                              {return _c4query != nullptr;}
@@ -65,22 +90,47 @@ public:
     slice columnName(unsigned col) const            {return c4query_columnTitle(_c4query, col);}
 
     void setParameters(Dict parameters) {
-        Encoder enc;
-        enc.writeValue(parameters);
-        _encodeParameters(enc);
+        _paramDict = MutableDict();
+        _paramsChanged = false;
+        _encoder.writeValue(parameters);
+        _encodeParameters();
     }
 
     bool setParametersAsJSON(const char* json5) {
-        alloc_slice json = convertJSON5(json5, nullptr);
-        if (!json)
-            return false;
-        Encoder enc;
-        enc.convertJSON(json);
-        return _encodeParameters(enc);
+        // Most input is plain JSON, so try that before paying for the JSON5 conversion:
+        if (!_encoder.convertJSON(slice(json5))) {
+            _encoder.reset();
+            alloc_slice json = convertJSON5(json5, nullptr);
+            if (!json || !_encoder.convertJSON(json)) {
+                _encoder.reset();
+                return false;                   // (the parameters are left unchanged)
+            }
+        }
+        _paramDict = MutableDict();
+        _paramsChanged = false;
+        return _encodeParameters();
+    }
+
+    // Sets a single parameter. The parameters aren't re-encoded until the query next runs,
+    // so setting several in a row only costs one encoding.
+    template <class T>
+    void setParameter(slice name, T value) {
+        if (!_paramDict) {
+            Dict current = encodedParameters();
+            _paramDict = current ? current.mutableCopy(kFLDeepCopyImmutables)
+                                 : MutableDict::newDict();
+        }
+        _paramDict.set(name, value);
+        _paramsChanged = true;
     }
 
     Retained<CBLResultSet> execute(C4Error* outError);
 
+    Retained<CBLResultSet> execute(Dict parameters, C4Error* outError);
+
+    int64_t executeToJSONStream(CBLJSONWriteCallback callback, void *context,
+                                const CBLJSONStreamOptions &options, C4Error* outError);
+
     int columnNamed(slice name) {
         if (!_columnNames) {
             _columnNames.reset(new std::unordered_map<slice, uint32_t>);
@@ -94,20 +144,46 @@ public:
     }
 
     Dict parameters() {
-        if (!_parameters)
-            return nullptr;
-        return Value::fromData(_parameters, kFLTrusted).asDict();
+        flushParameters();
+        return encodedParameters();
+    }
+
+    void setStatsEnabled(bool enabled) {
+        _stats.reset(enabled ? new CBLQueryStats() : nullptr);
     }
 
-    CBLListenerToken* addChangeListener(CBLQueryChangeListener listener, void *context);
+    CBLQueryStats stats() const;
+
+    CBLListenerToken* addChangeListener(CBLQueryChangeListener listener, void *context,
+                                        const CBLQueryListenerOptions *options =nullptr);
+
+    CBLListenerToken* addDiffListener(int keyColumn, CBLQueryDiffListener listener, void *context);
 
     ListenerToken<CBLQueryChangeListener>* getChangeListener(CBLListenerToken *token) {
         return _listeners.find(token);
     }
 
 private:
-    bool _encodeParameters(Encoder &enc) {
-        alloc_slice encodedParameters = enc.finish();
+    C4QueryEnumerator* run(slice encodedParameters, C4Error* outError);
+
+    Dict encodedParameters() const {
+        if (!_parameters)
+            return nullptr;
+        return Value::fromData(_parameters, kFLTrusted).asDict();
+    }
+
+    // Encodes parameters changed by `setParameter` and gives them to the C4Query.
+    void flushParameters() {
+        if (_paramsChanged) {
+            _paramsChanged = false;
+            _encoder.writeValue(_paramDict);
+            _encodeParameters();
+        }
+    }
+
+    bool _encodeParameters() {
+        alloc_slice encodedParameters = _encoder.finish();
+        _encoder.reset();
         if (!encodedParameters)
             return false;
         _parameters = encodedParameters;
@@ -117,9 +193,16 @@ private:
 
     c4::ref<C4Query> _c4query;
     RetainedConst<CBLDatabase> _database;
+    std::string const _cacheKey;
     alloc_slice _parameters;
+    MutableDict _paramDict;                 // Parameters being changed by setParameter
+    bool _paramsChanged {false};            // True if _paramDict has changes not in _parameters
+    Encoder _encoder;                       // Reused for encoding parameters
     unique_ptr<std::unordered_map<slice, unsigned>> _columnNames;
     Listeners<CBLQueryChangeListener> _listeners;
+    Listeners<CBLQueryDiffListener> _diffListeners;
+    double _compileTime {0.0};
+    unique_ptr<CBLQueryStats> _stats;       // Only allocated while stats are enabled
 };
 
 
@@ -131,8 +214,21 @@ public:
     CBLResultSet(CBLQuery* query, C4QueryEnumerator* qe _cbl_nonnull)
     :_query(query)
     ,_enum(qe)
+    ,_columnCount(query->columnCount())
     { }
 
+    CBLQuery* query() const                         {return _query;}
+
+    bool seek(int64_t row) {
+        C4Error error;
+        if (!c4queryenum_seek(_enum, row, &error)) {
+            C4LogToAt(kC4QueryLog, kC4LogWarning,
+                      "CBLResultSet_SeekRow: got error %d/%d", error.domain, error.code);
+            return false;
+        }
+        return true;
+    }
+
     bool next() {
         C4Error error;
         bool more = c4queryenum_next(_enum, &error);
@@ -153,18 +249,307 @@ public:
         return FLArrayIterator_GetValueAt(&_enum->columns, uint32_t(col));
     }
 
+    unsigned nextBatch(unsigned maxRows, bool columnMajor, FLValue cells[]) {
+        // Row-major: the cells of one row are adjacent. Column-major: the cells of one column
+        // are adjacent, and each column takes up `maxRows` cells.
+        const size_t rowStride = columnMajor ? 1 : _columnCount;
+        const size_t colStride = columnMajor ? maxRows : 1;
+        unsigned row;
+        for (row = 0; row < maxRows && next(); ++row) {
+            FLValue *rowCells = &cells[row * rowStride];
+            uint64_t missing = _enum->missingColumns;
+            for (unsigned col = 0; col < _columnCount; ++col) {
+                FLValue value = nullptr;
+                if (col >= 64 || !(missing & (1ULL<<col)))
+                    value = FLArrayIterator_GetValueAt(&_enum->columns, uint32_t(col));
+                rowCells[col * colStride] = value;
+            }
+        }
+        return row;
+    }
+
 private:
     Retained<CBLQuery> const _query;
     c4::ref<C4QueryEnumerator> const _enum;
+    unsigned const _columnCount;
 };
 
 
+C4QueryEnumerator* CBLQuery::run(slice encodedParameters, C4Error* outError) {
+    DatabaseMetrics::add(_database->metrics.queryExecutions);
+    double slowThreshold = _database->slowQueryThreshold();
+    if (!_stats && slowThreshold <= 0.0)
+        return c4query_run(_c4query, nullptr, encodedParameters, outError);
+
+    auto start = chrono::steady_clock::now();
+    C4QueryEnumerator *e = c4query_run(_c4query, nullptr, encodedParameters, outError);
+    double time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (!e)
+        return nullptr;
+    int64_t rowCount = max(c4queryenum_getRowCount(e, nullptr), int64_t(0));
+    if (_stats) {
+        ++_stats->executionCount;
+        _stats->lastExecutionTime = time;
+        _stats->maxExecutionTime = max(_stats->maxExecutionTime, time);
+        _stats->totalExecutionTime += time;
+        _stats->lastRowCount = rowCount;
+        _stats->totalRowCount += rowCount;
+    }
+    if (slowThreshold > 0.0 && time >= slowThreshold)
+        _database->reportSlowQuery(this, time, rowCount);
+    return e;
+}
+
+
+CBLQueryStats CBLQuery::stats() const {
+    CBLQueryStats result = _stats ? *_stats : CBLQueryStats{};
+    result.compileTime = _compileTime;
+    // Look at the SQLite query plan lines, which look like "3|0|0| SCAN TABLE kv_default":
+    alloc_slice plan = explain();
+    const char *line = (const char*)plan.buf, *end = (const char*)plan.end();
+    while (line < end) {
+        const char *eol = (const char*)memchr(line, '\n', end - line);
+        if (!eol)
+            eol = end;
+        string text(line, eol);
+        if (text.find('|') != string::npos) {
+            bool index = text.find(" INDEX ") != string::npos
+                      || text.find("VIRTUAL TABLE") != string::npos;
+            if (index)
+                result.usesIndex = true;
+            else if (text.find("SCAN ") != string::npos)
+                result.fullScan = true;
+        }
+        line = eol + 1;
+    }
+    return result;
+}
+
+
 Retained<CBLResultSet> CBLQuery::execute(C4Error* outError) {
-    auto qe = c4query_run(_c4query, nullptr, nullslice, outError);
+    flushParameters();
+    auto qe = run(nullslice, outError);
     return qe ? retained(new CBLResultSet(this, qe)) : nullptr;
 }
 
 
+Retained<CBLResultSet> CBLQuery::execute(Dict parameters, C4Error* outError) {
+    // These parameters apply to this run only, so they're not saved in `_parameters`:
+    _encoder.writeValue(parameters);
+    alloc_slice encodedParameters = _encoder.finish();
+    _encoder.reset();
+    auto qe = run(encodedParameters, outError);
+    return qe ? retained(new CBLResultSet(this, qe)) : nullptr;
+}
+
+
+#pragma mark - JSON STREAMING:
+
+
+static constexpr size_t kDefaultJSONChunkSize = 64 * 1024;
+
+
+namespace {
+
+    // Encodes rows as NDJSON, and passes them to a callback in chunks of about the chunk size.
+    // A chunk's rows are written by one reused JSON Encoder as the items of an array, which is
+    // finished once per chunk; then the commas between the rows and the closing bracket are
+    // overwritten with newlines, and the result (minus the opening bracket) is the chunk. So
+    // the only heap allocation is one buffer per chunk; nothing is allocated or copied per row.
+    class JSONStreamWriter {
+    public:
+        JSONStreamWriter(CBLJSONWriteCallback callback, void *context, size_t chunkSize)
+        :_callback(callback)
+        ,_context(context)
+        ,_chunkSize(chunkSize)
+        ,_encoder(kFLEncodeJSON)
+        { }
+
+        int64_t rowsWritten() const                 {return _rowsWritten;}
+        bool failed() const                         {return _failed;}
+
+        // The encoder to write the next row to, as a single array or dict.
+        Encoder& row() {
+            if (_rowEnds.empty())
+                _encoder.beginArray();
+            return _encoder;
+        }
+
+        // Ends the row written to `row()`, and flushes the chunk if it's full. Returns false if
+        // the callback said to stop, or if encoding failed.
+        bool endRow() {
+            size_t end = _encoder.bytesWritten();
+            _rowEnds.push_back(end);
+            return end < _chunkSize || flush();
+        }
+
+        bool flush() {
+            if (_rowEnds.empty())
+                return true;
+            _encoder.endArray();
+            alloc_slice json = _encoder.finish();
+            _encoder.reset();
+            auto nRows = int64_t(_rowEnds.size());
+            if (!json) {
+                _rowEnds.clear();
+                _failed = true;
+                return false;
+            }
+            // `json` is "[row,row,...,row]"; the byte after each row becomes its newline:
+            char *out = (char*)json.buf;
+            for (size_t end : _rowEnds)
+                out[end] = '\n';
+            _rowEnds.clear();
+            bool ok = _callback(_context, slice(out + 1, json.size - 1));
+            if (ok)
+                _rowsWritten += nRows;
+            return ok;
+        }
+
+    private:
+        CBLJSONWriteCallback const _callback;
+        void* const _context;
+        size_t const _chunkSize;
+        Encoder _encoder;
+        std::vector<size_t> _rowEnds;           // Offset in the output of the end of each row
+        int64_t _rowsWritten {0};
+        bool _failed {false};
+    };
+
+}
+
+
+int64_t CBLQuery::executeToJSONStream(CBLJSONWriteCallback callback, void *context,
+                                      const CBLJSONStreamOptions &options, C4Error* outError)
+{
+    flushParameters();
+    c4::ref<C4QueryEnumerator> e = run(nullslice, outError);
+    if (!e)
+        return -1;
+    const unsigned nCols = columnCount();
+    const bool asObjects = (options.rowFormat == kCBLJSONRowObjects);
+    JSONStreamWriter writer(callback, context,
+                            options.chunkSize ? options.chunkSize : kDefaultJSONChunkSize);
+    C4Error error;
+    bool more = true;
+    while (more && c4queryenum_next(e, &error)) {
+        Encoder &enc = writer.row();
+        if (asObjects)
+            enc.beginDict(nCols);
+        else
+            enc.beginArray(nCols);
+        uint64_t missing = e->missingColumns;
+        for (unsigned col = 0; col < nCols; ++col) {
+            Value value;
+            if (col >= 64 || !(missing & (1ULL<<col)))
+                value = FLArrayIterator_GetValueAt(&e->columns, uint32_t(col));
+            if (asObjects) {
+                if (!value)
+                    continue;
+                enc.writeKey(columnName(col));
+            }
+            if (value)
+                enc.writeValue(value);
+            else
+                enc.writeNull();
+        }
+        if (asObjects)
+            enc.endDict();
+        else
+            enc.endArray();
+        more = writer.endRow();
+    }
+    if (more) {
+        if (error.code != 0) {
+            if (outError)
+                *outError = error;
+            return -1;
+        }
+        writer.flush();
+    }
+    if (writer.failed()) {
+        setError(outError, FleeceDomain, kFLEncodeError, "Couldn't encode query rows"_sl);
+        return -1;
+    }
+    return writer.rowsWritten();
+}
+
+
+#pragma mark - QUERY CACHE:
+
+
+namespace cbl_internal {
+
+    string QueryCache::key(CBLQueryLanguage language, const char *queryString) {
+        string key;
+        key.reserve(1 + strlen(queryString));
+        key += char('0' + language);
+        key += queryString;
+        return key;
+    }
+
+
+    C4Query* QueryCache::take(slice key) {
+        lock_guard<mutex> lock(_mutex);
+        auto i = _map.find(key);
+        if (i == _map.end()) {
+            ++_misses;
+            return nullptr;
+        }
+        ++_hits;
+        C4Query *query = i->second->second;
+        _lru.erase(i->second);
+        _map.erase(i);
+        return query;
+    }
+
+
+    void QueryCache::put(const string &key, C4Query *query) {
+        unique_lock<mutex> lock(_mutex);
+        if (_capacity == 0 || _map.find(slice(key)) != _map.end()) {
+            // Cache is disabled, or already has an unused copy of this query:
+            lock.unlock();
+            c4query_release(query);
+            return;
+        }
+        _lru.emplace_front(key, query);
+        _map.emplace(slice(_lru.front().first), _lru.begin());
+        trim(_capacity);
+    }
+
+
+    void QueryCache::setCapacity(unsigned capacity) {
+        lock_guard<mutex> lock(_mutex);
+        _capacity = capacity;
+        trim(capacity);
+    }
+
+
+    CBLQueryCacheStats QueryCache::stats() const {
+        lock_guard<mutex> lock(_mutex);
+        return {_hits, _misses, unsigned(_lru.size()), _capacity};
+    }
+
+
+    void QueryCache::clear() {
+        lock_guard<mutex> lock(_mutex);
+        trim(0);
+    }
+
+
+    // Must be called with the mutex locked.
+    void QueryCache::trim(unsigned capacity) {
+        while (_lru.size() > capacity) {
+            Entry &entry = _lru.back();
+            _map.erase(slice(entry.first));
+            c4query_release(entry.second);
+            _lru.pop_back();
+        }
+    }
+
+}
+
+
 #pragma mark - QUERY LISTENER:
 
 
@@ -176,9 +561,12 @@ namespace cbl_internal {
     class ListenerToken<CBLQueryChangeListener> : public CBLListenerToken {
     public:
         ListenerToken(CBLQuery *query, C4Query *c4query,
-                      CBLQueryChangeListener callback, void *context)
+                      CBLQueryChangeListener callback, void *context,
+                      const CBLQueryListenerOptions *options =nullptr)
         :CBLListenerToken((const void*)callback, context)
         ,_query(query)
+        ,_options(options ? *options : CBLQueryListenerOptions{})
+        ,_scheduled(_options.minInterval > 0 || _options.priority == kCBLQueryPriorityLow)
         ,_c4obs( c4queryobs_create(c4query,
                                    [](C4QueryObserver*, C4Query*, void *context)
                                         { ((ListenerToken*)context)->queryChanged(); },
@@ -192,6 +580,11 @@ namespace cbl_internal {
         CBLQueryChangeListener callback() const           {return (CBLQueryChangeListener)_callback.load();}
 
         void call() {
+            if (_scheduled) {
+                lock_guard<mutex> lock(_mutex);
+                _pending = _deliveryQueued = false;
+                _lastDelivery = clock::now();
+            }
             CBLQueryChangeListener cb = callback();
             if (cb)
                 cb(_context, _query);
@@ -204,25 +597,427 @@ namespace cbl_internal {
         }
 
     private:
+        using clock = chrono::steady_clock;
+
+        // Called by the C4QueryObserver on a background thread.
         void queryChanged() {
-            _query->database()->notify(this);
+            if (!_scheduled) {
+                _query->database()->notify(this);
+                return;
+            }
+            unique_lock<mutex> lock(_mutex);
+            if (_pending)
+                return;         // a delivery is already scheduled, and will see the new results
+            _pending = true;
+            _firstPending = clock::now();
+            schedule(lock);
+        }
+
+        // Decides when to call the listener: now, after a delay, or when the current batch
+        // ends. Must be called with the mutex locked; unlocks it, since the database may call
+        // back into this object immediately.
+        void schedule(unique_lock<mutex> &lock) {
+            if (_deliveryQueued)
+                return;
+            auto now = clock::now();
+            bool hasDeadline = (_options.maxStaleness > 0);
+            auto deadline = _firstPending + toDuration(_options.maxStaleness);
+            auto due = now;
+            bool waitForBatch = false;
+            if (_options.priority == kCBLQueryPriorityLow && _query->database()->inBatch()) {
+                waitForBatch = !_waitingForBatch;
+                _waitingForBatch = true;
+                due = hasDeadline ? deadline : clock::time_point::max();
+            } else if (_options.minInterval > 0) {
+                due = max(now, _lastDelivery + toDuration(_options.minInterval));
+                if (hasDeadline)
+                    due = min(due, deadline);
+            }
+
+            bool deliverNow = (due <= now);
+            if (deliverNow)
+                _deliveryQueued = true;
+            else if (due != clock::time_point::max() && (!_timerRunning || due < _timerDue))
+                startTimer(due);
+            lock.unlock();
+
+            if (waitForBatch) {
+                _query->database()->notifyAfterBatch([](CBLDatabase*, RefCounted *self) {
+                    static_cast<ListenerToken*>(self)->batchEnded();
+                }, this);
+            }
+            if (deliverNow)
+                _query->database()->notify(this);
+        }
+
+        // Schedules (or reschedules) the timer. Must be called with the mutex locked.
+        void startTimer(clock::time_point due) {
+            _timerRunning = true;
+            _timerDue = due;
+            Retained<ListenerToken> self = this;
+            _timer.fireAt(due, [self, due]() {
+                self->timerFired(due);
+            });
+        }
+
+        void timerFired(clock::time_point due) {
+            unique_lock<mutex> lock(_mutex);
+            if (!_timerRunning || due != _timerDue)
+                return;                             // rescheduled since this one fired
+            _timerRunning = false;
+            if (_pending)
+                schedule(lock);
+        }
+
+        // Cancels the timer when the listener is removed.
+        void removed() override {
+            _timer.stop();
+        }
+
+        // Called via CBLDatabase::notifyAfterBatch.
+        void batchEnded() {
+            unique_lock<mutex> lock(_mutex);
+            _waitingForBatch = false;
+            if (_pending)
+                schedule(lock);
+        }
+
+        static clock::duration toDuration(double secs) {
+            return chrono::duration_cast<clock::duration>(chrono::duration<double>(secs));
         }
 
         Retained<CBLQuery> _query;
+        CBLQueryListenerOptions const _options;
+        bool const _scheduled;                      // False if no options apply
         C4QueryObserver* _c4obs {nullptr};
         Retained<CBLResultSet> _resultSet;
+
+        mutex _mutex;
+        bool _pending {false};                      // Results changed since last delivery
+        bool _deliveryQueued {false};               // A call() is in the notification queue
+        Timer _timer;                               // Reruns schedule() when a delay ends
+        bool _timerRunning {false};
+        bool _waitingForBatch {false};
+        clock::time_point _firstPending;            // When _pending was set
+        clock::time_point _lastDelivery;            // When call() was last called
+        clock::time_point _timerDue;
     };
 
 }
 
 
-CBLListenerToken* CBLQuery::addChangeListener(CBLQueryChangeListener listener, void *context) {
-    auto token = new ListenerToken<CBLQueryChangeListener>(this, _c4query, listener, context);
+CBLListenerToken* CBLQuery::addChangeListener(CBLQueryChangeListener listener, void *context,
+                                              const CBLQueryListenerOptions *options)
+{
+    flushParameters();
+    auto token = new ListenerToken<CBLQueryChangeListener>(this, _c4query, listener, context,
+                                                           options);
     _listeners.add(token);
     return token;
 }
 
 
+#pragma mark - QUERY DIFF LISTENER:
+
+
+namespace cbl_internal {
+
+    // Summary of a query result row, used to compare results: a hash of all its columns, and
+    // a hash of its key column (or the whole row, if there's no key column.)
+    struct RowFingerprint {
+        uint64_t key;
+        uint64_t hash;
+        bool operator== (const RowFingerprint &r) const {return key == r.key && hash == r.hash;}
+    };
+
+
+    static constexpr uint64_t kFNVOffset = 14695981039346656037ULL;
+
+    static inline uint64_t hashBytes(const void *bytes, size_t size, uint64_t h) {
+        // 64-bit FNV-1a
+        auto p = (const uint8_t*)bytes;
+        for (size_t i = 0; i < size; ++i) {
+            h ^= p[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    template <class T>
+    static inline uint64_t hashScalar(T value, uint64_t h) {
+        return hashBytes(&value, sizeof(value), h);
+    }
+
+    static uint64_t hashValue(Value v, uint64_t h) {
+        FLValueType type = v.type();
+        h = hashScalar(int8_t(type), h);
+        switch (type) {
+            case kFLBoolean:
+                h = hashScalar(uint8_t(v.asBool()), h);
+                break;
+            case kFLNumber:
+                if (!v.isInteger())
+                    h = hashScalar(v.asDouble(), h);
+                else if (v.isUnsigned())
+                    h = hashScalar(v.asUnsigned(), h);
+                else
+                    h = hashScalar(v.asInt(), h);
+                break;
+            case kFLString:
+            case kFLData: {
+                slice bytes = (type == kFLString) ? v.asString() : v.asData();
+                h = hashScalar(uint64_t(bytes.size), h);
+                h = hashBytes(bytes.buf, bytes.size, h);
+                break;
+            }
+            case kFLArray: {
+                Array array = v.asArray();
+                h = hashScalar(uint32_t(array.count()), h);
+                for (Array::iterator i(array); i; ++i)
+                    h = hashValue(i.value(), h);
+                break;
+            }
+            case kFLDict: {
+                Dict dict = v.asDict();
+                h = hashScalar(uint32_t(dict.count()), h);
+                for (Dict::iterator i(dict); i; ++i) {
+                    slice key = i.keyString();
+                    h = hashScalar(uint64_t(key.size), h);
+                    h = hashBytes(key.buf, key.size, h);
+                    h = hashValue(i.value(), h);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        return h;
+    }
+
+    static RowFingerprint fingerprint(C4QueryEnumerator *e, unsigned nCols, int keyColumn) {
+        uint64_t h = hashScalar(e->missingColumns, kFNVOffset), key = 0;
+        for (unsigned col = 0; col < nCols; ++col) {
+            Value value;
+            if (col >= 64 || !(e->missingColumns & (1ULL<<col)))
+                value = FLArrayIterator_GetValueAt(&e->columns, uint32_t(col));
+            uint64_t colHash = hashValue(value, kFNVOffset);
+            h = hashScalar(colHash, h);
+            if (int(col) == keyColumn)
+                key = colHash;
+        }
+        return {(keyColumn >= 0 ? key : h), h};
+    }
+
+
+    // Computes the differences between two query results, as sets of row indices.
+    class QueryDiff {
+    public:
+        bool empty() const {
+            return _removed.empty() && _inserted.empty() && _changed.empty();
+        }
+
+        CBLQueryDiff asCBL() const {
+            return {_oldCount, _newCount,
+                    unsigned(_removed.size()),  _removed.data(),
+                    unsigned(_inserted.size()), _inserted.data(),
+                    unsigned(_changed.size()),  _changed.data()};
+        }
+
+        void compute(const vector<RowFingerprint> &oldRows, const vector<RowFingerprint> &newRows) {
+            _oldCount = unsigned(oldRows.size());
+            _newCount = unsigned(newRows.size());
+            _removed.clear();
+            _inserted.clear();
+            _changed.clear();
+            if (oldRows == newRows)
+                return;                                 // Shortcut: no change
+
+            // Index the old rows by key:
+            vector<pair<uint64_t,unsigned>> oldKeys;
+            oldKeys.reserve(_oldCount);
+            for (unsigned i = 0; i < _oldCount; ++i)
+                oldKeys.emplace_back(oldRows[i].key, i);
+            sort(oldKeys.begin(), oldKeys.end());
+            vector<unsigned> consumed(_oldCount, 0);    // # of rows used at each key's 1st index
+
+            // Match each new row with an old row having the same key:
+            vector<unsigned> matchedNew, matchedOld;
+            vector<bool> oldMatched(_oldCount, false);
+            for (unsigned i = 0; i < _newCount; ++i) {
+                uint64_t key = newRows[i].key;
+                auto start = lower_bound(oldKeys.begin(), oldKeys.end(), make_pair(key, 0u));
+                size_t pos = start - oldKeys.begin();
+                size_t candidate = pos + (pos < _oldCount ? consumed[pos] : 0);
+                if (candidate < _oldCount && oldKeys[candidate].first == key) {
+                    ++consumed[pos];
+                    unsigned oldIndex = oldKeys[candidate].second;
+                    oldMatched[oldIndex] = true;
+                    matchedNew.push_back(i);
+                    matchedOld.push_back(oldIndex);
+                } else {
+                    _inserted.push_back(i);
+                }
+            }
+
+            // Matched rows that aren't in the same relative order are treated as moved, i.e.
+            // removed and re-inserted; the rest are reported if their contents changed.
+            vector<bool> inOrder = longestIncreasing(matchedOld);
+            for (size_t k = 0; k < matchedNew.size(); ++k) {
+                if (!inOrder[k]) {
+                    oldMatched[matchedOld[k]] = false;
+                    _inserted.push_back(matchedNew[k]);
+                } else if (oldRows[matchedOld[k]].hash != newRows[matchedNew[k]].hash) {
+                    _changed.push_back(matchedNew[k]);
+                }
+            }
+            sort(_inserted.begin(), _inserted.end());
+            for (unsigned i = 0; i < _oldCount; ++i) {
+                if (!oldMatched[i])
+                    _removed.push_back(i);
+            }
+        }
+
+    private:
+        // Returns flags marking the items of a longest increasing subsequence of `seq`.
+        static vector<bool> longestIncreasing(const vector<unsigned> &seq) {
+            vector<size_t> tails;                       // index of smallest tail of each length
+            vector<ptrdiff_t> prev(seq.size(), -1);     // predecessor of each item in its chain
+            for (size_t i = 0; i < seq.size(); ++i) {
+                auto t = lower_bound(tails.begin(), tails.end(), seq[i],
+                                     [&](size_t tail, unsigned value) {return seq[tail] < value;});
+                if (t != tails.begin())
+                    prev[i] = ptrdiff_t(*(t - 1));
+                if (t == tails.end())
+                    tails.push_back(i);
+                else
+                    *t = i;
+            }
+            vector<bool> result(seq.size(), false);
+            for (ptrdiff_t i = tails.empty() ? -1 : ptrdiff_t(tails.back()); i >= 0; i = prev[i])
+                result[i] = true;
+            return result;
+        }
+
+        unsigned _oldCount {0}, _newCount {0};
+        vector<unsigned> _removed, _inserted, _changed;
+    };
+
+
+    // Listener token for query diff listeners. Each time the query observer reports new results,
+    // it fingerprints the rows and diffs them against the rows most recently delivered to the
+    // listener. This happens on the observer's thread, so the listener only sees the diff.
+    template<>
+    class ListenerToken<CBLQueryDiffListener> : public CBLListenerToken {
+    public:
+        ListenerToken(CBLQuery *query, C4Query *c4query, int keyColumn,
+                      CBLQueryDiffListener callback, void *context)
+        :CBLListenerToken((const void*)callback, context)
+        ,_query(query)
+        ,_keyColumn(keyColumn)
+        ,_c4obs( c4queryobs_create(c4query,
+                                   [](C4QueryObserver*, C4Query*, void *context)
+                                        { ((ListenerToken*)context)->queryChanged(); },
+                                   this) )
+        { }
+
+        ~ListenerToken() {
+            c4queryobs_free(_c4obs);
+        }
+
+        CBLQueryDiffListener callback() const           {return (CBLQueryDiffListener)_callback.load();}
+
+        // Called via the database's notification queue.
+        void call() {
+            Retained<CBLResultSet> results;
+            {
+                lock_guard<mutex> lock(_mutex);
+                _notifyQueued = false;
+                if (!_pendingResults)
+                    return;                             // A later change cancelled this one
+                results = move(_pendingResults);
+                _pendingResults = nullptr;
+                swap(_diff, _pendingDiff);
+                swap(_deliveredRows, _pendingRows);
+                _delivered = true;
+            }
+            CBLQueryDiffListener cb = callback();
+            if (cb) {
+                CBLQueryDiff diff = _diff.asCBL();
+                cb(_context, _query, results, &diff);
+            }
+        }
+
+    private:
+        // Called by the C4QueryObserver on a background thread.
+        void queryChanged() {
+            C4Error error;
+            C4QueryEnumerator *e = c4queryobs_getEnumerator(_c4obs, &error);
+            if (!e) {
+                C4LogToAt(kC4QueryLog, kC4LogWarning,
+                          "Query diff listener: got error %d/%d", error.domain, error.code);
+                return;
+            }
+            Retained<CBLResultSet> results = new CBLResultSet(_query, e);   // adopts `e`
+
+            _newRows.clear();
+            unsigned nCols = _query->columnCount();
+            while (c4queryenum_next(e, &error))
+                _newRows.push_back(fingerprint(e, nCols, _keyColumn));
+            if (error.code == 0)
+                c4queryenum_restart(e, &error);
+            if (error.code != 0) {
+                C4LogToAt(kC4QueryLog, kC4LogWarning,
+                          "Query diff listener: got error %d/%d", error.domain, error.code);
+                return;
+            }
+
+            bool notify;
+            {
+                lock_guard<mutex> lock(_mutex);
+                _pendingDiff.compute(_deliveredRows, _newRows);
+                if (_pendingDiff.empty() && _delivered) {
+                    // No effective change from what the listener's already seen:
+                    _pendingResults = nullptr;
+                    return;
+                }
+                _pendingResults = results;
+                swap(_pendingRows, _newRows);
+                notify = !_notifyQueued;
+                _notifyQueued = true;
+            }
+            if (notify)
+                _query->database()->notify(this);
+        }
+
+        Retained<CBLQuery> _query;
+        int const _keyColumn;
+        C4QueryObserver* _c4obs {nullptr};
+        vector<RowFingerprint> _newRows;            // Only used by queryChanged()
+
+        mutex _mutex;
+        vector<RowFingerprint> _deliveredRows;      // Rows last passed to the listener
+        vector<RowFingerprint> _pendingRows;        // Rows of _pendingResults
+        Retained<CBLResultSet> _pendingResults;     // Results waiting to be delivered
+        QueryDiff _pendingDiff;                     // Diff from _deliveredRows to _pendingRows
+        QueryDiff _diff;                            // Diff being passed to the listener
+        bool _delivered {false};                    // True once the listener's been called
+        bool _notifyQueued {false};                 // True while a call() is queued
+    };
+
+}
+
+
+CBLListenerToken* CBLQuery::addDiffListener(int keyColumn, CBLQueryDiffListener listener,
+                                            void *context)
+{
+    flushParameters();
+    auto token = new ListenerToken<CBLQueryDiffListener>(this, _c4query, keyColumn,
+                                                         listener, context);
+    _diffListeners.add(token);
+    return token;
+}
+
+
 #pragma mark - PUBLIC API:
 
 
@@ -232,6 +1027,8 @@ CBLQuery* CBLQuery_New(const CBLDatabase* db _cbl_nonnull,
                        int *outErrorPos,
                        CBLError* outError) CBLAPI
 {
+    if (!db->ensureOpen(internal(outError)))
+        return nullptr;
     auto query = retained(new CBLQuery(db, language, queryString, outErrorPos, internal(outError)));
     return query->valid() ? retain(query.get()) : nullptr;
 }
@@ -245,14 +1042,70 @@ void CBLQuery_SetParameters(CBLQuery* query _cbl_nonnull, FLDict parameters) CBL
 }
 
 bool CBLQuery_SetParametersAsJSON(CBLQuery* query, const char* json5) CBLAPI {
-    query->setParametersAsJSON(json5);
-    return true;
+    return query->setParametersAsJSON(json5);
+}
+
+void CBLQuery_SetParameterInt(CBLQuery* query _cbl_nonnull,
+                              const char *name _cbl_nonnull, int64_t value) CBLAPI
+{
+    query->setParameter(slice(name), value);
+}
+
+void CBLQuery_SetParameterDouble(CBLQuery* query _cbl_nonnull,
+                                 const char *name _cbl_nonnull, double value) CBLAPI
+{
+    query->setParameter(slice(name), value);
+}
+
+void CBLQuery_SetParameterString(CBLQuery* query _cbl_nonnull,
+                                 const char *name _cbl_nonnull, FLString value) CBLAPI
+{
+    query->setParameter(slice(name), slice(value));
+}
+
+void CBLQuery_SetParameterValue(CBLQuery* query _cbl_nonnull,
+                                const char *name _cbl_nonnull, FLValue value _cbl_nonnull) CBLAPI
+{
+    query->setParameter(slice(name), Value(value));
 }
 
 CBLResultSet* CBLQuery_Execute(CBLQuery* query _cbl_nonnull, CBLError* outError) CBLAPI {
     return retain(query->execute(internal(outError)).get());
 }
 
+CBLResultSet* CBLQuery_ExecuteWithParameters(CBLQuery* query _cbl_nonnull,
+                                             FLDict parameters _cbl_nonnull,
+                                             CBLError* outError) CBLAPI
+{
+    return retain(query->execute(parameters, internal(outError)).get());
+}
+
+void CBLQuery_ExecuteAsync(CBLQuery* query _cbl_nonnull,
+                           CBLQueryCompletion completion,
+                           void *context) CBLAPI
+{
+    Retained<CBLQuery> retainedQuery = query;
+    query->database()->async([=]() {
+        C4Error error {};
+        Retained<CBLResultSet> results = retainedQuery->execute(&error);
+        retainedQuery->database()->notify(Notification([=]() {
+            completion(context, retainedQuery, results, (results ? nullptr : external(&error)));
+        }));
+    });
+}
+
+int64_t CBLQuery_ExecuteToJSONStream(CBLQuery* query _cbl_nonnull,
+                                     CBLJSONWriteCallback callback _cbl_nonnull,
+                                     void *context,
+                                     const CBLJSONStreamOptions *options,
+                                     CBLError* outError) CBLAPI
+{
+    CBLJSONStreamOptions opts = {};
+    if (options)
+        opts = *options;
+    return query->executeToJSONStream(callback, context, opts, internal(outError));
+}
+
 FLSliceResult CBLQuery_Explain(CBLQuery* query _cbl_nonnull) CBLAPI {
     return FLSliceResult(query->explain());
 }
@@ -272,6 +1125,22 @@ CBLListenerToken* CBLQuery_AddChangeListener(CBLQuery* query _cbl_nonnull,
     return query->addChangeListener(listener, context);
 }
 
+CBLListenerToken* CBLQuery_AddChangeListenerWithOptions(CBLQuery* query _cbl_nonnull,
+                                                        CBLQueryChangeListener listener _cbl_nonnull,
+                                                        void *context,
+                                                        const CBLQueryListenerOptions* options) CBLAPI
+{
+    return query->addChangeListener(listener, context, options);
+}
+
+CBLListenerToken* CBLQuery_AddDiffListener(CBLQuery* query _cbl_nonnull,
+                                           int keyColumn,
+                                           CBLQueryDiffListener listener _cbl_nonnull,
+                                           void *context) CBLAPI
+{
+    return query->addDiffListener(keyColumn, listener, context);
+}
+
 CBLResultSet* CBLQuery_CurrentResults(CBLQuery* query,
                                       CBLListenerToken *token,
                                       CBLError *outError) CBLAPI
@@ -297,6 +1166,48 @@ FLValue CBLResultSet_ValueAtIndex(CBLResultSet* rs _cbl_nonnull, unsigned column
     return rs->column(column);
 }
 
+unsigned CBLResultSet_NextBatch(CBLResultSet* rs _cbl_nonnull,
+                                unsigned maxRows,
+                                bool columnMajor,
+                                FLValue cells[]) CBLAPI
+{
+    return rs->nextBatch(maxRows, columnMajor, cells);
+}
+
+bool CBLResultSet_SeekRow(CBLResultSet* rs _cbl_nonnull, uint64_t row) CBLAPI {
+    return rs->seek(int64_t(row));
+}
+
+CBLQuery* CBLResultSet_GetQuery(CBLResultSet* rs _cbl_nonnull) CBLAPI {
+    return rs->query();
+}
+
+
+void CBLDatabase_SetQueryCacheCapacity(CBLDatabase* db _cbl_nonnull, unsigned capacity) CBLAPI {
+    db->queryCache.setCapacity(capacity);
+}
+
+CBLQueryCacheStats CBLDatabase_QueryCacheStats(const CBLDatabase* db _cbl_nonnull) CBLAPI {
+    return db->queryCache.stats();
+}
+
+
+void CBLQuery_SetStatsEnabled(CBLQuery* query _cbl_nonnull, bool enabled) CBLAPI {
+    query->setStatsEnabled(enabled);
+}
+
+CBLQueryStats CBLQuery_GetStats(CBLQuery* query _cbl_nonnull) CBLAPI {
+    return query->stats();
+}
+
+void CBLDatabase_SetSlowQueryCallback(CBLDatabase* db _cbl_nonnull,
+                                      double threshold,
+                                      CBLSlowQueryCallback callback,
+                                      void *context) CBLAPI
+{
+    db->setSlowQueryCallback(threshold, callback, context);
+}
+
 
 #pragma mark - INDEXES:
 
@@ -306,6 +1217,8 @@ bool CBLDatabase_CreateIndex(CBLDatabase *db _cbl_nonnull,
                         CBLIndexSpec spec,
                         CBLError *outError) CBLAPI
 {
+    if (!db->ensureOpen(internal(outError)))
+        return false;
     C4IndexOptions options = {};
     options.language = spec.language;
     options.ignoreDiacritics = spec.ignoreAccents;
@@ -321,12 +1234,166 @@ bool CBLDatabase_DeleteIndex(CBLDatabase *db _cbl_nonnull,
                         const char *name _cbl_nonnull,
                         CBLError *outError) CBLAPI
 {
+    if (!db->ensureOpen(internal(outError)))
+        return false;
     return c4db_deleteIndex(internal(db), slice(name), internal(outError));
 }
 
 FLMutableArray CBLDatabase_IndexNames(CBLDatabase *db _cbl_nonnull) CBLAPI {
+    if (!db->ensureOpen(nullptr))
+        return FLMutableArray_New();
     Doc doc(alloc_slice(c4db_getIndexes(internal(db), nullptr)));
     MutableArray indexes = doc.root().asArray().mutableCopy(kFLDeepCopyImmutables);
     return FLMutableArray_Retain(indexes);
 }
 
+
+#pragma mark - ASYNC INDEX BUILD:
+
+
+struct CBLIndexBuild : public CBLRefCounted {
+public:
+    CBLIndexBuild(CBLDatabase *db, C4Database *connection,
+                  const CBLNamedIndexSpec specs[], unsigned count,
+                  CBLIndexBuildCallback callback, void *context)
+    :_db(db)
+    ,_connection(connection)
+    ,_callback(callback)
+    ,_context(context)
+    {
+        for (unsigned i = 0; i < count; ++i) {
+            const CBLIndexSpec &spec = specs[i].spec;
+            _specs.push_back({specs[i].name,
+                              spec.type,
+                              spec.keyExpressionsJSON,
+                              spec.ignoreAccents,
+                              (spec.language ? spec.language : ""),
+                              (spec.language != nullptr)});
+        }
+    }
+
+    ~CBLIndexBuild() {
+        c4db_release(_connection);
+    }
+
+    // Runs the build on a thread owned by the database, which cancels it if it's closed.
+    bool start(C4Error *outError) {
+        Retained<CBLIndexBuild> self = this;
+        return _db->runInBackground([self]() { self->run(); },
+                                    [self]() { self->cancel(); },
+                                    outError);
+    }
+
+    void cancel() {
+        _cancelled = true;
+    }
+
+    unsigned progress(unsigned *outTotal) const {
+        if (outTotal)
+            *outTotal = unsigned(_specs.size());
+        return _completed;
+    }
+
+    bool wait(C4Error *outError) {
+        unique_lock<mutex> lock(_mutex);
+        _cond.wait(lock, [this] {return _finished;});
+        if (outError)
+            *outError = _error;
+        return _error.code == 0;
+    }
+
+private:
+    struct Spec {
+        string name;
+        CBLIndexType type;
+        string keyExpressionsJSON;
+        bool ignoreAccents;
+        string language;
+        bool hasLanguage;
+    };
+
+    // Runs on a background thread.
+    void run() {
+        C4Error error = {};
+        for (const Spec &spec : _specs) {
+            if (_cancelled) {
+                error = c4error_make(POSIXDomain, ECANCELED, "Index build was cancelled"_sl);
+                break;
+            }
+            C4IndexOptions options = {};
+            options.language = spec.hasLanguage ? spec.language.c_str() : nullptr;
+            options.ignoreDiacritics = spec.ignoreAccents;
+            if (!c4db_createIndex(_connection, slice(spec.name), slice(spec.keyExpressionsJSON),
+                                  (C4IndexType)spec.type, &options, &error))
+                break;
+            error = {};
+            unsigned completed = ++_completed;
+            if (completed < _specs.size())
+                report(completed, false, error);
+        }
+        c4db_close(_connection, nullptr);
+        {
+            lock_guard<mutex> lock(_mutex);
+            _error = error;
+            _finished = true;
+        }
+        _cond.notify_all();
+        report(_completed, true, error);
+    }
+
+    void report(unsigned completed, bool finished, C4Error error) {
+        if (!_callback)
+            return;
+        Retained<CBLIndexBuild> self = this;
+        _db->notify(Notification([=]() {
+            self->_callback(self->_context, self, completed, unsigned(self->_specs.size()),
+                            finished, (error.code ? external(&error) : nullptr));
+        }));
+    }
+
+    CBLDatabase* const _db;                     // (Joins my thread before it's freed)
+    C4Database* const _connection;              // Separate connection used to build indexes
+    vector<Spec> _specs;
+    CBLIndexBuildCallback const _callback;
+    void* const _context;
+
+    atomic<unsigned> _completed {0};
+    atomic<bool> _cancelled {false};
+    mutex _mutex;
+    condition_variable _cond;
+    bool _finished {false};
+    C4Error _error {};
+};
+
+
+CBLIndexBuild* CBLDatabase_CreateIndexesAsync(CBLDatabase *db _cbl_nonnull,
+                                              const CBLNamedIndexSpec specs[],
+                                              unsigned count,
+                                              CBLIndexBuildCallback callback,
+                                              void *context,
+                                              CBLError *outError) CBLAPI
+{
+    if (!db->ensureOpen(internal(outError)))
+        return nullptr;
+    C4Database *connection = c4db_openAgain(internal(db), internal(outError));
+    if (!connection)
+        return nullptr;
+    Retained<CBLIndexBuild> build = new CBLIndexBuild(db, connection, specs, count,
+                                                      callback, context);
+    if (!build->start(internal(outError)))
+        return nullptr;
+    return retain(build.get());
+}
+
+void CBLIndexBuild_Cancel(CBLIndexBuild* build) CBLAPI {
+    build->cancel();
+}
+
+unsigned CBLIndexBuild_Progress(CBLIndexBuild* build, unsigned *outTotal) CBLAPI {
+    return build->progress(outTotal);
+}
+
+bool CBLIndexBuild_Wait(CBLIndexBuild* build, CBLError *outError) CBLAPI {
+    return build->wait(internal(outError));
+}
+
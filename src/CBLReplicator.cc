@@ -19,13 +19,19 @@
 #include "CBLReplicator.h"
 #include "CBLReplicatorConfig.hh"
 #include "CBLDocument_Internal.hh"
+#include "FilterExpression.hh"
 #include "Internal.hh"
+#include "Timer.hh"
 #include "c4.hh"
 #include "c4Replicator.h"
 #include "c4Private.h"
 #include "fleece/Fleece.hh"
 #include "fleece/Mutable.hh"
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <mutex>
+#include <thread>
 
 using namespace std;
 using namespace fleece;
@@ -36,16 +42,260 @@ static inline const CBLReplicatorStatus& external(const C4ReplicatorStatus &stat
     return (const CBLReplicatorStatus&)status;
 }
 
+static inline const CBLError& external(const C4Error &error) {
+    return (const CBLError&)error;
+}
+
+static CBLDocumentFlags documentFlags(C4RevisionFlags flags) {
+    unsigned docFlags = 0;
+    if (flags & kRevDeleted)
+        docFlags |= kCBLDocumentFlagsDeleted;
+    if (flags & kRevPurged)
+        docFlags |= kCBLDocumentFlagsAccessRemoved;
+    return CBLDocumentFlags(docFlags);
+}
+
+
+namespace cbl_internal {
+
+    /** A replicator's listener tokens. Thread-safe: listeners can be added and removed while
+        the replicator calls them, on its own threads. */
+    class ReplicatorListeners : public ListenersBase {
+    public:
+        void add(CBLListenerToken* t _cbl_nonnull) {
+            lock_guard<mutex> lock(_mutex);
+            ListenersBase::add(t);
+        }
+
+        void remove(CBLListenerToken* t _cbl_nonnull) override {
+            lock_guard<mutex> lock(_mutex);
+            ListenersBase::remove(t);
+        }
+
+        /** Returns a copy of the tokens, so they can be called without holding the lock. */
+        vector<Retained<CBLListenerToken>> tokens() const {
+            lock_guard<mutex> lock(_mutex);
+            return _tokens;
+        }
+
+    private:
+        mutable mutex _mutex;
+    };
+
+
+    /** A replicator's statistics, updated with relaxed atomic operations so they can be read
+        without locking. */
+    struct ReplicatorStats {
+        using Counter = atomic<uint64_t>;
+
+        static void add(Counter &counter, uint64_t n =1) {
+            counter.fetch_add(n, memory_order_relaxed);
+        }
+
+        CBLReplicatorStats snapshot() const {
+            CBLReplicatorStats s;
+            s.activity            = CBLReplicatorActivityLevel(activity.load(memory_order_relaxed));
+            s.progress.completed  = completed.load(memory_order_relaxed);
+            s.progress.total      = total.load(memory_order_relaxed);
+            s.documentsPushed     = documentsPushed.load(memory_order_relaxed);
+            s.documentsPulled     = documentsPulled.load(memory_order_relaxed);
+            s.documentsFailed     = documentsFailed.load(memory_order_relaxed);
+            s.conflicts           = conflicts.load(memory_order_relaxed);
+            s.pushFiltered        = pushFiltered.load(memory_order_relaxed);
+            s.pullFiltered        = pullFiltered.load(memory_order_relaxed);
+            s.filterCalls         = filterCalls.load(memory_order_relaxed);
+            s.filterTime          = filterNanos.load(memory_order_relaxed) / 1e9;
+            s.statusChanges       = statusChanges.load(memory_order_relaxed);
+            return s;
+        }
+
+        atomic<uint8_t> activity {kCBLReplicatorStopped};
+        Counter completed {0}, total {0};
+        Counter documentsPushed {0}, documentsPulled {0}, documentsFailed {0}, conflicts {0};
+        Counter pushFiltered {0}, pullFiltered {0};
+        Counter filterCalls {0}, filterNanos {0};
+        Counter statusChanges {0};
+    };
+
+
+    // Listener token for replicated-document listeners. The documents reported by LiteCore are
+    // collected into batches, which are delivered through the database's notification queue
+    // when `maxChanges` of them are waiting, or when `interval` has passed since the first one.
+    class ReplicatedDocListenerToken : public CBLListenerToken {
+    public:
+        ReplicatedDocListenerToken(CBLDatabase *db,
+                                   const CBLChangeCoalescingOptions &options,
+                                   CBLReplicatedDocumentListener callback,
+                                   void *context)
+        :CBLListenerToken((const void*)callback, context)
+        ,_db(db)
+        ,_options(options)
+        { }
+
+        // Called by the replicator, on a LiteCore thread.
+        void documentsEnded(CBLReplicator *repl, bool pushing,
+                            size_t numDocs, const C4DocumentEnded* docs[])
+        {
+            bool deliverNow = false, startTimer = false;
+            {
+                lock_guard<mutex> lock(_mutex);
+                Batch &batch = _pending[pushing];
+                for (size_t i = 0; i < numDocs; ++i) {
+                    slice docID = docs[i]->docID;
+                    batch.offsets.push_back(batch.docIDs.size());
+                    batch.docIDs.insert(batch.docIDs.end(),
+                                        (const char*)docID.buf, (const char*)docID.end());
+                    batch.docIDs.push_back('\0');
+                    batch.docs.push_back({nullptr,
+                                          documentFlags(docs[i]->flags),
+                                          external(docs[i]->error)});
+                }
+                _pendingCount += numDocs;
+                if (_deliveryQueued || _pendingCount == 0)
+                    return;
+                if (_options.interval <= 0.0
+                        || (_options.maxChanges > 0 && _pendingCount >= _options.maxChanges)) {
+                    _deliveryQueued = deliverNow = true;
+                } else if (!_timerRunning) {
+                    _timerRunning = startTimer = true;
+                }
+            }
+            if (deliverNow)
+                queueDelivery(repl);
+            else if (startTimer)
+                startDeliveryTimer(repl);
+        }
+
+        // Delivers any pending documents now; called when the replicator stops.
+        void flush(CBLReplicator *repl) {
+            {
+                lock_guard<mutex> lock(_mutex);
+                if (_deliveryQueued || _pendingCount == 0)
+                    return;
+                _deliveryQueued = true;
+            }
+            queueDelivery(repl);
+        }
+
+    private:
+        // Documents collected since the last delivery, in one direction.
+        struct Batch {
+            vector<char> docIDs;                    // NUL-terminated docIDs, back to back
+            vector<size_t> offsets;                 // start of each docID in `docIDs`
+            vector<CBLReplicatedDocument> docs;     // `ID`s are set just before delivery
+
+            void clear() {
+                docIDs.clear();                     // (keeps the allocated capacity, for reuse)
+                offsets.clear();
+                docs.clear();
+            }
+        };
+
+        void startDeliveryTimer(CBLReplicator*);
+        void queueDelivery(CBLReplicator*);
+
+        // Cancels the delivery timer, releasing the replicator, when the listener is removed.
+        void removed() override {
+            _timer.stop();
+        }
+
+        void timerFired(CBLReplicator *repl) {
+            {
+                lock_guard<mutex> lock(_mutex);
+                _timerRunning = false;
+                if (_deliveryQueued || _pendingCount == 0)
+                    return;
+                _deliveryQueued = true;
+            }
+            queueDelivery(repl);
+        }
+
+        // Calls the listener with the pending documents. Called via the database's notification
+        // queue, so in buffered mode this is called by CBLDatabase_SendNotifications.
+        void deliver(CBLReplicator *repl) {
+            unique_lock<mutex> lock(_mutex);
+            _deliveryQueued = false;
+            if (_delivering) {
+                _deliverAgain = true;
+                return;
+            }
+            _delivering = true;
+            do {
+                _deliverAgain = false;
+                swap(_pending[0], _delivered[0]);
+                swap(_pending[1], _delivered[1]);
+                _pendingCount = 0;
+                lock.unlock();
+                for (int pushing = 1; pushing >= 0; --pushing) {
+                    if (!_delivered[pushing].docs.empty())
+                        callListener(repl, pushing != 0, _delivered[pushing]);
+                    _delivered[pushing].clear();
+                }
+                lock.lock();
+            } while (_deliverAgain);
+            _delivering = false;
+        }
+
+        void callListener(CBLReplicator *repl, bool pushing, Batch &batch) {
+            auto count = unsigned(batch.docs.size());
+            for (unsigned i = 0; i < count; ++i)
+                batch.docs[i].ID = &batch.docIDs[batch.offsets[i]];
+            unsigned chunk = _options.maxChanges ? _options.maxChanges : count;
+            for (unsigned start = 0; start < count; start += chunk) {
+                auto callback = (CBLReplicatedDocumentListener)_callback.load();
+                if (!callback)
+                    break;
+                unsigned n = std::min(chunk, count - start);
+                callback(_context, repl, pushing, n, &batch.docs[start]);
+            }
+        }
+
+        CBLDatabase* const _db;
+        CBLChangeCoalescingOptions const _options;
+
+        mutex _mutex;
+        Batch _pending[2];                  // Docs not yet delivered, by direction (guarded)
+        Batch _delivered[2];                // Docs being delivered (only used by deliver())
+        size_t _pendingCount {0};           // Total docs in `_pending`
+        Timer _timer;                       // Fires the delivery after the interval
+        bool _timerRunning {false};         // True while the delivery timer is scheduled
+        bool _deliveryQueued {false};       // True if deliver() has been scheduled
+        bool _delivering {false};           // True while deliver() is calling the listener
+        bool _deliverAgain {false};         // deliver() was re-entered; loop again
+    };
+
+}
+
 
 class CBLReplicator : public CBLRefCounted {
 public:
     CBLReplicator(const CBLReplicatorConfiguration *conf _cbl_nonnull)
     :_conf(*conf)
-    { }
+    ,_otherLocalDB(conf->endpoint ? conf->endpoint->otherLocalDB() : nullptr)
+    {
+        if (_conf.pushFilterExpression.buf)
+            _pushExpression = FilterExpression::compile(_conf.pushFilterExpression,
+                                                        _conf.filterParameters, &_configError);
+        if (_conf.pullFilterExpression.buf && !_configError.code)
+            _pullExpression = FilterExpression::compile(_conf.pullFilterExpression,
+                                                        _conf.filterParameters, &_configError);
+    }
 
 
     const ReplicatorConfiguration* configuration() const        {return &_conf;}
-    bool validate(CBLError *err) const                          {return _conf.validate(err);}
+
+    bool validate(CBLError *err) const {
+        if (_configError.code) {
+            if (err)
+                *internal(err) = _configError;
+            return false;
+        }
+        if (!_conf.validate(err))
+            return false;
+        // A lazily-opened database has to be opened now, while there's a way to report failure:
+        return _conf.database->ensureOpen(internal(err))
+            && (!_otherLocalDB || _otherLocalDB->ensureOpen(internal(err)));
+    }
 
 
     void start() {
@@ -67,6 +317,9 @@ public:
     }
 
 
+    CBLReplicatorStats stats() const                            {return _stats.snapshot();}
+
+
     CBLReplicatorStatus status() {
         lock_guard<mutex> lock(_mutex);
         if (!_c4repl)
@@ -75,10 +328,39 @@ public:
     }
 
 
-    void setListener(CBLReplicatorChangeListener listener, void *context) {
-        lock_guard<mutex> lock(_mutex);
-        _listener = listener;
-        _listenerContext = context;
+    CBLListenerToken* addChangeListener(CBLReplicatorChangeListener listener, void *context) {
+        auto token = new ListenerToken<CBLReplicatorChangeListener>(listener, context);
+        addChangeListener(token);
+        return token;
+    }
+
+
+    void addChangeListener(ListenerToken<CBLReplicatorChangeListener> *token) {
+        _changeListeners.add(token);
+    }
+
+
+    CBLListenerToken* addDocumentListener(const CBLChangeCoalescingOptions &options,
+                                          CBLReplicatedDocumentListener listener,
+                                          void *context)
+    {
+        auto token = new ReplicatedDocListenerToken(_conf.database, options, listener, context);
+        _docListeners.add(token);
+        return token;
+    }
+
+
+    // Reports documents to the document listeners as though LiteCore had replicated them.
+    // (Only used by CBLReplicator_SimulateDocumentsEnded, for testing.)
+    void simulateDocumentsEnded(bool pushing, size_t numDocs, const char* const docIDs[]) {
+        vector<C4DocumentEnded> docs(numDocs);
+        vector<const C4DocumentEnded*> docPtrs(numDocs);
+        for (size_t i = 0; i < numDocs; ++i) {
+            docs[i] = {};
+            docs[i].docID = slice(docIDs[i]);
+            docPtrs[i] = &docs[i];
+        }
+        _documentsEnded(nullptr, pushing, numDocs, docPtrs.data());
     }
 
 private:
@@ -98,23 +380,30 @@ private:
         params.onStatusChanged = [](C4Replicator* c4repl, C4ReplicatorStatus status, void *ctx) {
             ((CBLReplicator*)ctx)->_statusChanged(c4repl, status);
         };
+        params.onDocumentsEnded = [](C4Replicator* c4repl,
+                                     bool pushing,
+                                     size_t numDocs,
+                                     const C4DocumentEnded* docs[],
+                                     void *ctx) {
+            ((CBLReplicator*)ctx)->_documentsEnded(c4repl, pushing, numDocs, docs);
+        };
 
-        if (_conf.pushFilter) {
+        if (_pushExpression || _conf.pushBodyFilter || _conf.pushFilter) {
             params.pushFilter = [](C4String docID,
                                    C4RevisionFlags flags,
                                    FLDict body,
                                    void* ctx)
             {
-                return ((CBLReplicator*)ctx)->_filter(docID, flags, body, true);
+                return ((CBLReplicator*)ctx)->_shouldReplicate(docID, flags, body, true);
             };
         }
-        if (_conf.pullFilter) {
+        if (_pullExpression || _conf.pullBodyFilter || _conf.pullFilter) {
             params.validationFunc = [](C4String docID,
                                        C4RevisionFlags flags,
                                        FLDict body,
                                        void* ctx)
             {
-                return ((CBLReplicator*)ctx)->_filter(docID, flags, body, false);
+                return ((CBLReplicator*)ctx)->_shouldReplicate(docID, flags, body, false);
             };
         }
 
@@ -123,6 +412,8 @@ private:
             Encoder enc;
             enc.beginDict();
             _conf.writeOptions(enc);
+            // LiteCore only reports replicated documents (to listeners and stats) at level 1:
+            enc[slice(kC4ReplicatorOptionProgressLevel)] = 1;
             if (_resetCheckpoint) {
                 enc[slice(kC4ReplicatorResetCheckpoint)] = true;
                 _resetCheckpoint = false;
@@ -137,12 +428,13 @@ private:
         _c4repl = c4repl_new(internal(_conf.database),
                              _conf.endpoint->remoteAddress(),
                              _conf.endpoint->remoteDatabaseName(),
-                             internal(_conf.endpoint->otherLocalDB()),
+                             _otherLocalDB ? internal(_otherLocalDB.get()) : nullptr,
                              params,
                              internal(&error));
         if (!_c4repl)
             throw error;
         _stopping = false;
+        _progressReported = 0;
         retain(this);
     }
 
@@ -157,23 +449,94 @@ private:
 
 
     void _statusChanged(C4Replicator* c4repl, C4ReplicatorStatus status) {
+        if (status.level == kC4Stopped) {
+            for (auto &token : _docListeners.tokens())
+                static_cast<ReplicatedDocListenerToken*>(token.get())->flush(this);
+        }
+
         unique_lock<mutex> lock(_mutex);
         if (c4repl != _c4repl)
             return;
 
-        if (_listener) {
-            lock.unlock();
-            _listener(_listenerContext, this, &external(status));
-            if (status.level == kC4Stopped)
-                lock.lock();
+        _stats.activity.store(uint8_t(status.level), memory_order_relaxed);
+        _stats.completed.store(status.progress.unitsCompleted, memory_order_relaxed);
+        _stats.total.store(status.progress.unitsTotal, memory_order_relaxed);
+        ReplicatorStats::add(_stats.statusChanges);
+
+        uint64_t progress = status.progress.unitsCompleted;
+        if (progress > _progressReported) {
+            DatabaseMetrics::add(_conf.database->metrics.replicatorProgress,
+                                 progress - _progressReported);
+            _progressReported = progress;
         }
 
+        // When stopped, clean up before calling the listeners, so they can restart me:
+        Retained<CBLReplicator> retainSelf = this;
         if (status.level == kC4Stopped) {
             c4repl_free(_c4repl);
             _c4repl = nullptr;
             _stopping = false;
-            release(this);
+            release(this);          // balances the retain in _start()
+        }
+
+        auto listeners = _changeListeners.tokens();
+        lock.unlock();
+        for (auto &token : listeners) {
+            auto t = static_cast<ListenerToken<CBLReplicatorChangeListener>*>(token.get());
+            t->call(this, &external(status));
+        }
+    }
+
+
+    void _documentsEnded(C4Replicator*, bool pushing, size_t numDocs,
+                         const C4DocumentEnded* docs[])
+    {
+        uint64_t n = 0, conflicts = 0;
+        for (size_t i = 0; i < numDocs; ++i) {
+            const C4Error &error = docs[i]->error;
+            if (error.code == 0)
+                ++n;
+            else if (error.domain == LiteCoreDomain && error.code == kC4ErrorConflict)
+                ++conflicts;
         }
+        auto &metrics = _conf.database->metrics;
+        DatabaseMetrics::add(pushing ? metrics.replicatorDocsPushed : metrics.replicatorDocsPulled,
+                             n);
+        ReplicatorStats::add(pushing ? _stats.documentsPushed : _stats.documentsPulled, n);
+        ReplicatorStats::add(_stats.documentsFailed, numDocs - n);
+        ReplicatorStats::add(_stats.conflicts, conflicts);
+
+        for (auto &token : _docListeners.tokens()) {
+            static_cast<ReplicatedDocListenerToken*>(token.get())->documentsEnded(this, pushing,
+                                                                                  numDocs, docs);
+        }
+    }
+
+
+    // Applies the filters to a revision, recording the time taken in the stats.
+    bool _shouldReplicate(slice docID, C4RevisionFlags flags, FLDict body, bool pushing) {
+        auto start = chrono::steady_clock::now();
+        bool result = _applyFilters(docID, flags, body, pushing);
+        auto elapsed = chrono::steady_clock::now() - start;
+        ReplicatorStats::add(_stats.filterCalls);
+        ReplicatorStats::add(_stats.filterNanos,
+                             chrono::duration_cast<chrono::nanoseconds>(elapsed).count());
+        if (!result)
+            ReplicatorStats::add(pushing ? _stats.pushFiltered : _stats.pullFiltered);
+        return result;
+    }
+
+
+    // Applies the filter expression, then the filter callback, if any.
+    bool _applyFilters(slice docID, C4RevisionFlags flags, FLDict body, bool pushing) {
+        auto &expression = pushing ? _pushExpression : _pullExpression;
+        if (expression && !expression->matches(docID, (flags & kRevDeleted) != 0, Dict(body)))
+            return false;
+        if (pushing ? _conf.pushBodyFilter : _conf.pullBodyFilter)
+            return _bodyFilter(docID, flags, body, pushing);
+        if (pushing ? _conf.pushFilter : _conf.pullFilter)
+            return _filter(docID, flags, Dict(body), pushing);
+        return true;
     }
 
 
@@ -184,14 +547,328 @@ private:
     }
 
 
+    // Calls a CBLReplicationBodyFilter; unlike _filter, this doesn't allocate anything.
+    bool _bodyFilter(slice docID, C4RevisionFlags flags, FLDict body, bool pushing) {
+        CBLReplicationBodyFilter filter = pushing ? _conf.pushBodyFilter : _conf.pullBodyFilter;
+        return filter(_conf.filterContext, docID, documentFlags(flags), body);
+    }
+
+
     ReplicatorConfiguration const _conf;
+    unique_ptr<FilterExpression> _pushExpression, _pullExpression;
+    C4Error _configError {};
     Retained<CBLDatabase> const _otherLocalDB;
     std::mutex _mutex;
     c4::ref<C4Replicator> _c4repl;
-    CBLReplicatorChangeListener _listener {nullptr};
-    void* _listenerContext {nullptr};
+    ReplicatorListeners _changeListeners;
+    ReplicatorListeners _docListeners;
     bool _resetCheckpoint {false};
     bool _stopping {false};
+    uint64_t _progressReported {0};     // Progress units already added to the db's metrics
+    ReplicatorStats _stats;
+};
+
+
+void cbl_internal::ReplicatedDocListenerToken::startDeliveryTimer(CBLReplicator *repl) {
+    Retained<ReplicatedDocListenerToken> self = this;
+    Retained<CBLReplicator> replRef = repl;       // keeps the replicator alive till it fires
+    _timer.fireAfter(_options.interval, [self, replRef]() {
+        self->timerFired(replRef);
+    });
+}
+
+
+void cbl_internal::ReplicatedDocListenerToken::queueDelivery(CBLReplicator *repl) {
+    Retained<ReplicatedDocListenerToken> self = this;
+    Retained<CBLReplicator> replRef = repl;
+    _db->notify(Notification([self, replRef]() {
+        self->deliver(replRef);
+    }));
+}
+
+
+#pragma mark - REPLICATOR GROUP:
+
+
+struct CBLReplicatorGroup : public CBLRefCounted {
+public:
+    CBLReplicatorGroup(const CBLReplicatorGroupOptions &options)
+    :_options(options)
+    ,_listenerContext(new ListenerContext(this))
+    { }
+
+
+    bool add(CBLReplicator *repl, int priority) {
+        {
+            lock_guard<mutex> lock(_mutex);
+            if (find(repl))
+                return false;
+            unique_ptr<Entry> entry(new Entry);
+            entry->replicator = repl;
+            entry->priority = priority;
+            entry->running = (repl->status().activity != kCBLReplicatorStopped);
+            if (entry->running)
+                ++_running;
+            auto token = new ChangeListenerToken(_listenerContext);
+            repl->addChangeListener(token);
+            entry->token = token;
+            _entries.push_back(move(entry));
+        }
+        schedule();
+        return true;
+    }
+
+
+    void remove(CBLReplicator *repl) {
+        {
+            lock_guard<mutex> lock(_mutex);
+            for (auto i = _entries.begin(); i != _entries.end(); ++i) {
+                if ((*i)->replicator == repl) {
+                    (*i)->token->remove();
+                    if ((*i)->running)
+                        --_running;
+                    _entries.erase(i);
+                    break;
+                }
+            }
+        }
+        schedule();
+    }
+
+
+    void start() {
+        {
+            lock_guard<mutex> lock(_mutex);
+            if (_started)
+                return;
+            _started = true;
+            for (auto &entry : _entries) {
+                if (!entry->running)
+                    entry->finished = entry->preempted = false;
+            }
+            startTimeSliceTimer();
+        }
+        schedule();
+    }
+
+
+    void stop() {
+        vector<Retained<CBLReplicator>> toStop;
+        {
+            lock_guard<mutex> lock(_mutex);
+            if (!_started)
+                return;
+            _started = false;           // (keeps the time-slice timer from rescheduling)
+            for (auto &entry : _entries) {
+                if (entry->running) {
+                    entry->preempted = true;
+                    toStop.push_back(entry->replicator);
+                }
+            }
+        }
+        _timeSliceTimer.stop();
+        for (auto &repl : toStop)
+            repl->stop();
+    }
+
+
+    unsigned activeCount() const {
+        lock_guard<mutex> lock(_mutex);
+        return _running;
+    }
+
+
+    unsigned waitingCount() const {
+        lock_guard<mutex> lock(_mutex);
+        unsigned n = 0;
+        for (auto &entry : _entries) {
+            if (entry->waiting())
+                ++n;
+        }
+        return n;
+    }
+
+protected:
+    ~CBLReplicatorGroup() {
+        {
+            lock_guard<mutex> lock(_mutex);
+            _started = false;
+        }
+        _timeSliceTimer.stop();
+        _listenerContext->clear();
+        for (auto &entry : _entries)
+            entry->token->remove();
+    }
+
+private:
+    // The context of my change listeners. Each listener token retains it, and my destructor
+    // clears its pointer to me, so a listener already being called on a replicator's thread
+    // can't call into me once I'm being destroyed.
+    class ListenerContext : public RefCounted {
+    public:
+        explicit ListenerContext(CBLReplicatorGroup *group)     :_group(group) { }
+
+        void replicatorStopped(CBLReplicator *repl, const CBLError &error) {
+            lock_guard<recursive_mutex> lock(_mutex);   // (starting a replicator may recurse)
+            if (_group)
+                _group->replicatorStopped(repl, error);
+        }
+
+        void clear() {
+            lock_guard<recursive_mutex> lock(_mutex);   // waits for a call in progress
+            _group = nullptr;
+        }
+
+    private:
+        recursive_mutex _mutex;
+        CBLReplicatorGroup* _group;
+    };
+
+    // My change listener on each of my replicators.
+    class ChangeListenerToken : public ListenerToken<CBLReplicatorChangeListener> {
+    public:
+        explicit ChangeListenerToken(ListenerContext *context)
+        :ListenerToken<CBLReplicatorChangeListener>(&statusChanged, context)
+        ,_retainedContext(context)
+        { }
+
+    private:
+        static void statusChanged(void *context, CBLReplicator *repl,
+                                  const CBLReplicatorStatus *status)
+        {
+            if (status->activity == kCBLReplicatorStopped)
+                ((ListenerContext*)context)->replicatorStopped(repl, status->error);
+        }
+
+        Retained<ListenerContext> const _retainedContext;
+    };
+
+    struct Entry {
+        Retained<CBLReplicator> replicator;
+        CBLListenerToken* token {nullptr};      // My change listener on the replicator
+        int priority {0};
+        bool running {false};                   // Started by me, or already running when added
+        bool preempted {false};                 // Stopped by me; run it again later
+        bool finished {false};                  // Stopped on its own; don't run it again
+        uint64_t turn {0};                      // When it was last started (for round-robin)
+        chrono::steady_clock::time_point startTime;
+
+        bool waiting() const                    {return !running && !finished;}
+    };
+
+
+    Entry* find(CBLReplicator *repl) const {
+        for (auto &entry : _entries) {
+            if (entry->replicator == repl)
+                return entry.get();
+        }
+        return nullptr;
+    }
+
+
+    // Returns the waiting entry that should run next, or null. Must be called with the lock.
+    Entry* nextToRun() const {
+        Entry *best = nullptr;
+        for (auto &entry : _entries) {
+            if (entry->waiting() && (!best || entry->priority > best->priority
+                                           || (entry->priority == best->priority
+                                               && entry->turn < best->turn)))
+                best = entry.get();
+        }
+        return best;
+    }
+
+
+    // Starts waiting replicators, as long as there's room for them.
+    void schedule() {
+        while (true) {
+            Retained<CBLReplicator> repl;
+            {
+                lock_guard<mutex> lock(_mutex);
+                if (!_started || (_options.maxActive > 0 && _running >= _options.maxActive))
+                    return;
+                Entry *entry = nextToRun();
+                if (!entry)
+                    return;
+                entry->running = true;
+                entry->turn = ++_turns;
+                entry->startTime = chrono::steady_clock::now();
+                ++_running;
+                repl = entry->replicator;
+            }
+            try {
+                repl->start();
+            } catch (CBLError &error) {
+                C4Warn("CBLReplicatorGroup: replicator %p failed to start: %d/%d",
+                       (void*)repl.get(), error.domain, error.code);
+                replicatorStopped(repl, error);
+            }
+        }
+    }
+
+
+    // Called by my change listener when one of my replicators stops.
+    void replicatorStopped(CBLReplicator *repl, const CBLError &error) {
+        {
+            lock_guard<mutex> lock(_mutex);
+            Entry *entry = find(repl);
+            if (!entry || !entry->running)
+                return;
+            entry->running = false;
+            --_running;
+            entry->finished = !(entry->preempted && error.code == 0);  // else back in line
+            entry->preempted = false;
+        }
+        schedule();
+    }
+
+
+    // Schedules the next end of a time slice, while the group is started. Must be called with
+    // the lock. (The timer doesn't retain me; my destructor stops it.)
+    void startTimeSliceTimer() {
+        if (_started && _options.timeSlice > 0)
+            _timeSliceTimer.fireAfter(_options.timeSlice, [this]() {timeSliceEnded();});
+    }
+
+
+    // Preempts continuous replicators that have used up their time slice, if others are
+    // waiting.
+    void timeSliceEnded() {
+        vector<Retained<CBLReplicator>> toStop;
+        {
+            lock_guard<mutex> lock(_mutex);
+            startTimeSliceTimer();
+            unsigned waiting = 0;
+            for (auto &entry : _entries) {
+                if (entry->waiting())
+                    ++waiting;
+            }
+            auto now = chrono::steady_clock::now();
+            auto timeSlice = chrono::duration<double>(_options.timeSlice);
+            for (auto &entry : _entries) {
+                if (toStop.size() >= waiting)
+                    break;
+                if (entry->running && !entry->preempted
+                        && entry->replicator->configuration()->continuous
+                        && now - entry->startTime >= timeSlice) {
+                    entry->preempted = true;
+                    toStop.push_back(entry->replicator);
+                }
+            }
+        }
+        for (auto &repl : toStop)
+            repl->stop();
+    }
+
+
+    CBLReplicatorGroupOptions const _options;
+    mutable mutex _mutex;
+    vector<unique_ptr<Entry>> _entries;
+    unsigned _running {0};                      // Number of running entries
+    uint64_t _turns {0};                        // Counter for Entry::turn
+    bool _started {false};
+    Retained<ListenerContext> const _listenerContext;
+    Timer _timeSliceTimer;                      // Fires at the end of each time slice
 };
 
 
@@ -202,6 +879,10 @@ CBLEndpoint* CBLEndpoint_NewWithURL(const char *url _cbl_nonnull) CBLAPI {
     return new CBLURLEndpoint(url);
 }
 
+CBLEndpoint* CBLEndpoint_NewWithLocalDB(CBLDatabase *db _cbl_nonnull) CBLAPI {
+    return new CBLLocalEndpoint(db);
+}
+
 void CBLEndpoint_Free(CBLEndpoint *endpoint) CBLAPI {
     delete endpoint;
 }
@@ -230,6 +911,72 @@ CBLReplicatorStatus CBLReplicator_Status(CBLReplicator* repl) CBLAPI {
     return repl->status();
 }
 
+CBLReplicatorStats CBLReplicator_Stats(const CBLReplicator* repl) CBLAPI {
+    return repl->stats();
+}
+
+int CBLReplicator_TestFilterExpression(FLString expression, FLDict parameters,
+                                       FLString docID, bool deleted, FLDict body,
+                                       CBLError *outError) CBLAPI
+{
+    auto expr = FilterExpression::compile(expression, parameters, internal(outError));
+    if (!expr)
+        return -1;
+    return expr->matches(docID, deleted, body);
+}
+
+void CBLReplicator_SimulateDocumentsEnded(CBLReplicator* repl, bool pushing,
+                                          unsigned numDocs, const char* const docIDs[]) CBLAPI
+{
+    repl->simulateDocumentsEnded(pushing, numDocs, docIDs);
+}
+
 void CBLReplicator_Start(CBLReplicator* repl) CBLAPI            {repl->start();}
 void CBLReplicator_Stop(CBLReplicator* repl) CBLAPI             {repl->stop();}
 void CBLReplicator_ResetCheckpoint(CBLReplicator* repl) CBLAPI  {repl->resetCheckpoint();}
+
+CBLListenerToken* CBLReplicator_AddChangeListener(CBLReplicator* repl,
+                                                  CBLReplicatorChangeListener listener,
+                                                  void *context) CBLAPI
+{
+    return repl->addChangeListener(listener, context);
+}
+
+CBLListenerToken* CBLReplicator_AddDocumentListener(CBLReplicator* repl,
+                                                    CBLReplicatedDocumentListener listener,
+                                                    void *context) CBLAPI
+{
+    return repl->addDocumentListener({0.0, 0}, listener, context);
+}
+
+CBLListenerToken* CBLReplicator_AddCoalescedDocumentListener(CBLReplicator* repl,
+                                                             const CBLChangeCoalescingOptions *options,
+                                                             CBLReplicatedDocumentListener listener,
+                                                             void *context) CBLAPI
+{
+    return repl->addDocumentListener(*options, listener, context);
+}
+
+
+CBLReplicatorGroup* CBLReplicatorGroup_New(const CBLReplicatorGroupOptions *options) CBLAPI {
+    return retain(new CBLReplicatorGroup(*options));
+}
+
+bool CBLReplicatorGroup_Add(CBLReplicatorGroup* group, CBLReplicator* repl, int priority) CBLAPI {
+    return group->add(repl, priority);
+}
+
+void CBLReplicatorGroup_Remove(CBLReplicatorGroup* group, CBLReplicator* repl) CBLAPI {
+    group->remove(repl);
+}
+
+void CBLReplicatorGroup_Start(CBLReplicatorGroup* group) CBLAPI     {group->start();}
+void CBLReplicatorGroup_Stop(CBLReplicatorGroup* group) CBLAPI      {group->stop();}
+
+unsigned CBLReplicatorGroup_ActiveCount(CBLReplicatorGroup* group) CBLAPI {
+    return group->activeCount();
+}
+
+unsigned CBLReplicatorGroup_WaitingCount(CBLReplicatorGroup* group) CBLAPI {
+    return group->waitingCount();
+}
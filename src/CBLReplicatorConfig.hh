@@ -19,17 +19,33 @@
 #pragma once
 
 #include "CBLReplicator.h"
+#include "CBLDatabase_Internal.hh"
 #include "Internal.hh"
 #include "c4.hh"
 #include "c4Replicator.h"
 #include "c4Private.h"
 #include "fleece/Fleece.hh"
 #include "fleece/Mutable.hh"
+#include <algorithm>
 #include <mutex>
 
 using namespace std;
 using namespace fleece;
 
+// Replicator options that aren't defined by every version of c4Replicator.h:
+#ifndef kC4ReplicatorCheckpointInterval
+#define kC4ReplicatorCheckpointInterval "checkpointInterval"
+#endif
+#ifndef kC4ReplicatorHeartbeatInterval
+#define kC4ReplicatorHeartbeatInterval  "heartbeat"
+#endif
+#ifndef kC4ReplicatorOptionProgressLevel
+#define kC4ReplicatorOptionProgressLevel "progress"
+#endif
+#ifndef kC4ReplicatorCompressionLevel
+#define kC4ReplicatorCompressionLevel   "BLIPCompressionLevel"
+#endif
+
 
 #pragma mark - ENDPOINT
 
@@ -63,6 +79,21 @@ namespace cbl_internal {
         alloc_slice _url;
         C4String _dbName = { };
     };
+
+
+    // Concrete Endpoint for another local database. (Local-to-local replication is only
+    // supported by Enterprise Edition builds of LiteCore; others fail when it starts.)
+    struct CBLLocalEndpoint : public CBLEndpoint {
+        CBLLocalEndpoint(CBLDatabase *db _cbl_nonnull)
+        :_db(db)
+        { }
+
+        bool valid() const override                             {return _db != nullptr;}
+        C4String remoteDatabaseName() const override            {return nullslice;}
+        virtual CBLDatabase* otherLocalDB() const override      {return _db;}
+
+        Retained<CBLDatabase> const _db;
+    };
 }
 
 
@@ -126,6 +157,11 @@ namespace cbl_internal {
             headers = FLDict_MutableCopy(headers, kFLDeepCopyImmutables);
             channels = FLArray_MutableCopy(channels, kFLDeepCopyImmutables);
             documentIDs = FLArray_MutableCopy(documentIDs, kFLDeepCopyImmutables);
+            filterParameters = FLDict_MutableCopy(filterParameters, kFLDeepCopyImmutables);
+            _pushFilterExpression = pushFilterExpression;
+            pushFilterExpression = _pushFilterExpression;
+            _pullFilterExpression = pullFilterExpression;
+            pullFilterExpression = _pullFilterExpression;
         }
 
         ~ReplicatorConfiguration() {
@@ -133,10 +169,14 @@ namespace cbl_internal {
             FLDict_Release(headers);
             FLArray_Release(channels);
             FLArray_Release(documentIDs);
+            FLDict_Release(filterParameters);
         }
 
         bool validate(CBLError *outError) const {
-            if (!database || !endpoint || replicatorType > kCBLReplicatorTypePull) {
+            if (!database || !endpoint || endpoint->otherLocalDB() == database
+                    || replicatorType > kCBLReplicatorTypePull
+                    || checkpointInterval < 0 || heartbeatInterval < 0
+                    || compressionLevel < -1 || compressionLevel > 9) {
                 c4error_return(LiteCoreDomain, kC4ErrorInvalidParameter,
                                "Invalid replicator config"_sl, internal(outError));
                 return false;
@@ -155,9 +195,18 @@ namespace cbl_internal {
             }
             if (authenticator)
                 authenticator->writeOptions(enc);
+            writeOptionalKey(enc, kC4ReplicatorCheckpointInterval,  checkpointInterval);
+            writeOptionalKey(enc, kC4ReplicatorHeartbeatInterval,   heartbeatInterval);
+            if (compressionLevel != 0) {
+                enc.writeKey(slice(kC4ReplicatorCompressionLevel));
+                enc.writeInt(max(compressionLevel, 0));
+            }
         }
 
         ReplicatorConfiguration(const ReplicatorConfiguration&) =delete;
         ReplicatorConfiguration& operator=(const ReplicatorConfiguration&) =delete;
+
+    private:
+        alloc_slice _pushFilterExpression, _pullFilterExpression;
     };
 }
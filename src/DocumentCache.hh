@@ -0,0 +1,81 @@
+//
+// DocumentCache.hh
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "CBLDocument.h"
+#include "c4.h"
+#include "fleece/slice.hh"
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+namespace cbl_internal {
+
+    /** An LRU cache of recently read C4Documents, keyed by docID, with a capacity in bytes.
+        Owned by CBLDatabase, and disabled (capacity 0) by default.
+        Entries are invalidated by a database observer, whose callback just sets a flag; the
+        changes are read, and the changed docs removed, by the next call to `get` or `put`.
+        Thread-safe. */
+    class DocumentCache {
+    public:
+        ~DocumentCache()                                {setCapacity(nullptr, 0);}
+
+        bool enabled() const        {return _capacity.load(std::memory_order_relaxed) > 0;}
+
+        /** Sets the capacity in bytes; 0 disables the cache. `db` is the connection to observe. */
+        void setCapacity(C4Database *db, size_t capacity);
+
+        /** Returns the cached C4Document with this ID (as a new reference), or null on a miss.
+            On a miss, `outToken` is set to a value that must be passed to `put`. */
+        C4Document* get(fleece::slice docID, uint64_t *outToken);
+
+        /** Adds a document that was read from the database after a miss. If the database has
+            changed since `get` returned `token`, it's not added, since it might be outdated. */
+        void put(C4Document* _cbl_nonnull, uint64_t token);
+
+        CBLDocumentCacheStats stats() const;
+
+    private:
+        void removeChanged();
+        void trim(size_t capacity);
+
+        struct Entry {
+            std::string docID;
+            C4Document* doc;
+            size_t size;
+        };
+        using LRUList = std::list<Entry>;
+
+        static constexpr size_t kEntryOverhead = 128;   // Approximate fixed size of an entry
+
+        mutable std::mutex _mutex;
+        LRUList _lru;                                               // Most recently used first
+        std::unordered_map<fleece::slice, LRUList::iterator> _map;  // Keys point into `_lru`
+        std::atomic<size_t> _capacity {0};
+        size_t _size {0};                                           // Total size of entries
+        uint64_t _hits {0}, _misses {0};
+
+        C4DatabaseObserver* _observer {nullptr};
+        std::atomic<bool> _changed {false};         // Set by the observer callback
+        std::atomic<uint64_t> _changeCount {0};     // Incremented by the observer callback
+    };
+
+}
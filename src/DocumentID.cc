@@ -0,0 +1,128 @@
+//
+// DocumentID.cc
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "DocumentID.hh"
+#include "Util.hh"
+#include "c4.h"
+#include <chrono>
+#include <cstring>
+
+using namespace std;
+using namespace fleece;
+
+
+namespace cbl_internal {
+
+    void DocumentID::assign(slice id) {
+        char *dst;
+        if (id.size <= kInlineCapacity) {
+            _heap.reset();
+            dst = _inline;
+        } else {
+            _heap.reset(new char[id.size + 1]);
+            dst = _heap.get();
+        }
+        if (id.size > 0)
+            memcpy(dst, id.buf, id.size);
+        dst[id.size] = '\0';
+        _size = uint32_t(id.size);
+    }
+
+
+    DocumentIDGenerator::DocumentIDGenerator()
+    :_random(random_device()())
+    { }
+
+
+    void DocumentIDGenerator::setStrategy(CBLDocumentIDStrategy strategy,
+                                          CBLDocumentIDGenerator callback,
+                                          void *context)
+    {
+        lock_guard<mutex> lock(_mutex);
+        _strategy = strategy;
+        _callback = callback;
+        _context = context;
+    }
+
+
+    void DocumentIDGenerator::generateRandom(DocumentID &docID) {
+        char buf[DocumentID::kInlineCapacity + 1];
+        docID.assign(slice(c4doc_generateID(buf, sizeof(buf))));
+    }
+
+
+    bool DocumentIDGenerator::generate(DocumentID &docID, C4Error *outError) {
+        char buf[kCBLMaxGeneratedDocIDLength + 1];
+        size_t size;
+        {
+            lock_guard<mutex> lock(_mutex);
+            switch (_strategy) {
+                case kCBLDocumentIDMonotonic:
+                    generateMonotonic(buf);
+                    size = 26;
+                    break;
+                case kCBLDocumentIDCustom:
+                    size = _callback ? _callback(_context, buf, kCBLMaxGeneratedDocIDLength) : 0;
+                    if (size == 0 || size > kCBLMaxGeneratedDocIDLength) {
+                        setError(outError, LiteCoreDomain, kC4ErrorBadDocID,
+                                 "Document ID generator failed"_sl);
+                        return false;
+                    }
+                    break;
+                default:
+                    size = 0;
+                    break;
+            }
+        }
+        if (size == 0)
+            generateRandom(docID);
+        else
+            docID.assign({buf, size});
+        return true;
+    }
+
+
+    // Writes a 26-character ULID: a 48-bit millisecond timestamp followed by 80 random bits,
+    // in Crockford's base 32, so that IDs sort in the order they were created. IDs generated
+    // in the same millisecond (or after the clock goes backwards) increment the random bits.
+    // Must be called with the mutex locked.
+    void DocumentIDGenerator::generateMonotonic(char *buf) {
+        static const char kDigits[] = "0123456789ABCDEFGHJKMNPQRSTVWXYZ";
+        auto now = chrono::duration_cast<chrono::milliseconds>(
+                                    chrono::system_clock::now().time_since_epoch()).count();
+        uint64_t time = uint64_t(now) & 0xFFFFFFFFFFFF;
+        if (time > _lastTime) {
+            _lastTime = time;
+            _lastHi = _random() & 0xFFFF;
+            _lastLo = _random();
+        } else if (++_lastLo == 0 && ++_lastHi > 0xFFFF) {
+            // The random bits overflowed, so borrow the next millisecond:
+            ++_lastTime;
+            _lastHi = 0;
+        }
+
+        // 128 bits = 48 bits of time + 16 + 64 random bits; encode 5 bits at a time:
+        uint64_t hi = (_lastTime << 16) | _lastHi, lo = _lastLo;
+        for (int i = 25; i >= 0; --i) {
+            buf[i] = kDigits[lo & 31];
+            lo = (lo >> 5) | (hi << 59);
+            hi >>= 5;
+        }
+    }
+
+}
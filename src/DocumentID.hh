@@ -0,0 +1,80 @@
+//
+// DocumentID.hh
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "CBLDocument.h"
+#include "c4Base.h"
+#include "fleece/slice.hh"
+#include <memory>
+#include <mutex>
+#include <random>
+
+
+namespace cbl_internal {
+
+    /** A document ID. IDs of typical length, including generated ones, are stored inline;
+        only unusually long ones are allocated on the heap. Empty until assigned. */
+    class DocumentID {
+    public:
+        DocumentID() =default;
+        explicit DocumentID(fleece::slice id)           {assign(id);}
+        DocumentID(const DocumentID&) =delete;
+        DocumentID& operator=(const DocumentID&) =delete;
+
+        void assign(fleece::slice);
+
+        bool empty() const                              {return _size == 0;}
+        const char* c_str() const                       {return _heap ? _heap.get() : _inline;}
+        operator fleece::slice() const                  {return {c_str(), _size};}
+
+        static constexpr size_t kInlineCapacity = 47;
+
+    private:
+        char                    _inline[kInlineCapacity + 1] {};
+        std::unique_ptr<char[]> _heap;
+        uint32_t                _size {0};
+    };
+
+
+    /** Assigns IDs to new documents according to a CBLDocumentIDStrategy. Owned by CBLDatabase.
+        Thread-safe. */
+    class DocumentIDGenerator {
+    public:
+        DocumentIDGenerator();
+
+        void setStrategy(CBLDocumentIDStrategy, CBLDocumentIDGenerator, void *context);
+
+        /** Assigns a new ID to `docID`. Fails only if a custom generator does. */
+        bool generate(DocumentID &docID, C4Error *outError);
+
+        /** Assigns a new random ID, as by c4doc_generateID. */
+        static void generateRandom(DocumentID &docID);
+
+    private:
+        void generateMonotonic(char *buf);
+
+        std::mutex              _mutex;
+        CBLDocumentIDStrategy   _strategy {kCBLDocumentIDRandom};
+        CBLDocumentIDGenerator  _callback {nullptr};
+        void*                   _context {nullptr};
+        std::mt19937_64         _random;
+        uint64_t                _lastTime {0};          // Timestamp of the last monotonic ID
+        uint64_t                _lastHi {0}, _lastLo {0}; // Its 80 random bits (16 + 64)
+    };
+
+}
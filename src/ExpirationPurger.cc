@@ -0,0 +1,151 @@
+//
+// ExpirationPurger.cc
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ExpirationPurger.hh"
+#include "c4.hh"
+#include "c4Query.h"
+#include <chrono>
+#include <string>
+
+using namespace std;
+using namespace fleece;
+
+
+namespace cbl_internal {
+
+    // How long to wait before trying again, after purging fails.
+    static constexpr double kRetryInterval = 10.0;
+
+
+    ExpirationPurger::ExpirationPurger(C4Database *connection, const CBLAutoPurgeOptions &options)
+    :_connection(connection)
+    ,_batchSize(options.batchSize ? options.batchSize : 1000)
+    ,_pauseInterval(options.pauseInterval > 0 ? options.pauseInterval : 0.05)
+    {
+        _thread = thread([this]() { run(); });
+    }
+
+
+    ExpirationPurger::~ExpirationPurger() {
+        {
+            lock_guard<mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _cond.notify_all();
+        _thread.join();
+        c4db_close(_connection, nullptr);
+        c4db_release(_connection);
+    }
+
+
+    void ExpirationPurger::expirationChanged(time_t expiration) {
+        {
+            lock_guard<mutex> lock(_mutex);
+            if (expiration <= 0 || (_nextWake > 0 && expiration >= _nextWake))
+                return;     // The thread will wake up in time anyway
+            _woken = true;
+        }
+        _cond.notify_all();
+    }
+
+
+    void ExpirationPurger::run() {
+        unique_lock<mutex> lock(_mutex);
+        while (!_stopping) {
+            lock.unlock();
+            time_t next = c4db_nextDocExpiration(_connection);
+            time_t now = time(nullptr);
+            if (next > 0 && next <= now) {
+                purgeExpired(now);
+                lock.lock();
+                continue;
+            }
+
+            lock.lock();
+            _nextWake = next;
+            auto awake = [this] {return _stopping || _woken;};
+            if (next > 0)
+                _cond.wait_until(lock, chrono::system_clock::from_time_t(next), awake);
+            else
+                _cond.wait(lock, awake);
+            _woken = false;
+            _nextWake = 0;
+        }
+    }
+
+
+    // Purges all docs that have expired by `now`, a batch at a time.
+    void ExpirationPurger::purgeExpired(time_t now) {
+        string json = "{\"WHAT\": [[\"._id\"]], \"WHERE\": [\"<=\", [\"._expiration\"], "
+                      + to_string(now) + "], \"LIMIT\": " + to_string(_batchSize) + "}";
+        C4Error error;
+        c4::ref<C4Query> query = c4query_new2(_connection, kC4JSONQuery, slice(json),
+                                              nullptr, &error);
+        for (bool first = true; query; first = false) {
+            int64_t purged = purgeBatch(query, &error);
+            if (purged < 0) {
+                C4LogToAt(kC4DatabaseLog, kC4LogWarning,
+                          "Purging expired docs got error %d/%d", error.domain, error.code);
+                pause(kRetryInterval);
+                return;
+            } else if (purged == 0 && first) {
+                break;      // Query didn't find what c4db_nextDocExpiration did; fall back
+            } else if (purged < int64_t(_batchSize) || !pause(_pauseInterval)) {
+                return;
+            }
+        }
+
+        // If the query couldn't be used, purge them all in one transaction:
+        if (c4db_purgeExpiredDocs(_connection, &error) < 0) {
+            C4LogToAt(kC4DatabaseLog, kC4LogWarning,
+                      "Purging expired docs got error %d/%d", error.domain, error.code);
+            pause(kRetryInterval);
+        }
+    }
+
+
+    // Purges up to one batch of expired docs in a transaction; returns the number purged.
+    int64_t ExpirationPurger::purgeBatch(C4Query *query, C4Error *outError) {
+        c4::Transaction t(_connection);
+        if (!t.begin(outError))
+            return -1;
+        c4::ref<C4QueryEnumerator> e = c4query_run(query, nullptr, nullslice, outError);
+        if (!e)
+            return -1;
+        int64_t purged = 0;
+        *outError = {};
+        while (c4queryenum_next(e, outError)) {
+            slice docID = FLValue_AsString(FLArrayIterator_GetValueAt(&e->columns, 0));
+            if (!c4db_purgeDoc(_connection, docID, outError))
+                return -1;
+            ++purged;
+        }
+        if (outError->code != 0 || !t.commit(outError))
+            return -1;
+        return purged;
+    }
+
+
+    // Waits for `seconds`, unless stopped first. Returns false if stopped.
+    bool ExpirationPurger::pause(double seconds) {
+        unique_lock<mutex> lock(_mutex);
+        _cond.wait_for(lock, chrono::duration<double>(seconds), [this] {return _stopping;});
+        return !_stopping;
+    }
+
+}
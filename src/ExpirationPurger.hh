@@ -0,0 +1,63 @@
+//
+// ExpirationPurger.hh
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "CBLDatabase.h"
+#include "c4.h"
+#include <condition_variable>
+#include <ctime>
+#include <mutex>
+#include <thread>
+
+
+namespace cbl_internal {
+
+    /** Purges expired documents on a background thread, using its own connection to the
+        database. It sleeps until the next document expires, then purges the expired docs in
+        batches, each in its own transaction, pausing between batches to let other writers in.
+        Owned by CBLDatabase. */
+    class ExpirationPurger {
+    public:
+        /** Starts purging. Takes ownership of `connection`. */
+        ExpirationPurger(C4Database *connection, const CBLAutoPurgeOptions&);
+
+        /** Stops purging, waiting for a batch in progress to finish, and closes the connection. */
+        ~ExpirationPurger();
+
+        /** Tells the purger that a document's expiration time has been set. */
+        void expirationChanged(time_t expiration);
+
+    private:
+        void run();
+        void purgeExpired(time_t now);
+        int64_t purgeBatch(C4Query*, C4Error*);
+        bool pause(double seconds);
+
+        C4Database* const _connection;
+        unsigned const _batchSize;
+        double const _pauseInterval;
+
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        time_t _nextWake {0};           // When the thread will next wake up; 0 if never
+        bool _woken {false};            // Set by expirationChanged to make it wake early
+        bool _stopping {false};
+        std::thread _thread;
+    };
+
+}
@@ -0,0 +1,340 @@
+//
+// FilterExpression.cc
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "FilterExpression.hh"
+#include "Util.hh"
+#include <climits>
+
+using namespace std;
+using namespace fleece;
+
+
+namespace cbl_internal {
+
+    namespace {
+        struct OperatorInfo {
+            const char *name;
+            uint8_t     op;
+            unsigned    minArgs, maxArgs;
+        };
+
+        // The `op` values match FilterExpression::Op, starting at Equal.
+        const OperatorInfo kOperators[] = {
+            {"=",       0, 2, 2},
+            {"!=",      1, 2, 2},
+            {"<",       2, 2, 2},
+            {"<=",      3, 2, 2},
+            {">",       4, 2, 2},
+            {">=",      5, 2, 2},
+            {"AND",     6, 1, UINT_MAX},
+            {"OR",      7, 1, UINT_MAX},
+            {"NOT",     8, 1, 1},
+            {"EXISTS",  9, 1, 1},
+            {"IN",      10, 2, 2},
+        };
+    }
+
+
+    FilterExpression::Scalar::Scalar(Value v)
+    :type(v.type())
+    {
+        switch (type) {
+            case kFLBoolean:    boolean = v.asBool(); break;
+            case kFLNumber:     number = v.asDouble(); break;
+            case kFLString:     str = v.asString(); break;
+            case kFLData:       str = v.asData(); break;
+            case kFLArray:
+            case kFLDict:       value = v; break;
+            default:            break;
+        }
+    }
+
+
+    bool FilterExpression::Scalar::truthy() const {
+        switch (type) {
+            case kFLUndefined:
+            case kFLNull:       return false;
+            case kFLBoolean:    return boolean;
+            case kFLNumber:     return number != 0;
+            default:            return true;
+        }
+    }
+
+
+#pragma mark - COMPILING:
+
+
+    unique_ptr<FilterExpression> FilterExpression::compile(slice json,
+                                                           Dict parameters,
+                                                           C4Error *outError)
+    {
+        unique_ptr<FilterExpression> expr(new FilterExpression);
+        expr->_doc = Doc::fromJSON(json);
+        if (!expr->_doc) {
+            setError(outError, FleeceDomain, kFLJSONError,
+                     "Invalid JSON in replication filter expression"_sl);
+            return nullptr;
+        }
+        if (parameters)
+            expr->_parameters = parameters.mutableCopy(kFLDeepCopyImmutables);
+        string error;
+        if (!expr->compileNode(expr->_doc.root(), expr->_root, error)) {
+            error = "Invalid replication filter expression: " + error;
+            setError(outError, LiteCoreDomain, kC4ErrorInvalidQuery, slice(error));
+            return nullptr;
+        }
+        return expr;
+    }
+
+
+    bool FilterExpression::compileLiteral(Value v, Node &node, string &error) const {
+        Array array = v.asArray();
+        if (array) {
+            node.op = Op::ArrayLiteral;
+            for (Array::iterator i(array); i; ++i) {
+                node.operands.emplace_back();
+                if (!compileLiteral(i.value(), node.operands.back(), error))
+                    return false;
+            }
+        } else if (v.type() == kFLDict) {
+            error = "dictionary literals are not supported";
+            return false;
+        } else {
+            node.op = Op::Literal;
+            node.literal = Scalar(v);
+        }
+        return true;
+    }
+
+
+    bool FilterExpression::compileNode(Value v, Node &node, string &error) const {
+        Array array = v.asArray();
+        if (!array)
+            return compileLiteral(v, node, error);
+
+        slice opName = array[0].asString();
+        if (opName.size == 0) {
+            error = "an operation must start with a non-empty string";
+            return false;
+        }
+        Array::iterator args(array);
+        ++args;
+        unsigned nArgs = array.count() - 1;
+
+        if (opName[0] == '.') {
+            // Property:
+            if (nArgs > 0 || opName.size < 2) {
+                error = "invalid property " + string(opName);
+                return false;
+            }
+            if (opName == "._id"_sl) {
+                node.op = Op::DocID;
+            } else if (opName == "._deleted"_sl) {
+                node.op = Op::Deleted;
+            } else {
+                node.op = Op::Property;
+                string path(opName.from(1));
+                size_t start = 0, dot;
+                do {
+                    dot = path.find('.', start);
+                    string key = path.substr(start, dot - start);
+                    if (key.empty()) {
+                        error = "invalid property " + string(opName);
+                        return false;
+                    }
+                    node.path.push_back(key);
+                    start = dot + 1;
+                } while (dot != string::npos);
+            }
+            return true;
+
+        } else if (opName[0] == '$') {
+            // Parameter; substitute its value now:
+            Value param = _parameters ? _parameters.get(opName.from(1)) : Value();
+            if (nArgs > 0 || !param) {
+                error = "no value for parameter " + string(opName);
+                return false;
+            }
+            return compileLiteral(param, node, error);
+
+        } else if (opName == "[]"_sl) {
+            node.op = Op::ArrayLiteral;
+            for (; args; ++args) {
+                node.operands.emplace_back();
+                if (!compileNode(args.value(), node.operands.back(), error))
+                    return false;
+            }
+            return true;
+        }
+
+        // Operator:
+        for (auto &info : kOperators) {
+            if (opName.caseEquivalent(slice(info.name))) {
+                if (nArgs < info.minArgs || nArgs > info.maxArgs) {
+                    error = "wrong number of arguments to " + string(opName);
+                    return false;
+                }
+                node.op = Op(uint8_t(Op::Equal) + info.op);
+                for (; args; ++args) {
+                    node.operands.emplace_back();
+                    if (!compileNode(args.value(), node.operands.back(), error))
+                        return false;
+                }
+                if (node.op == Op::In && node.operands[1].op != Op::ArrayLiteral) {
+                    error = "the second argument to IN must be an array";
+                    return false;
+                }
+                return true;
+            }
+        }
+        error = "unsupported operator " + string(opName);
+        return false;
+    }
+
+
+#pragma mark - EVALUATING:
+
+
+    bool FilterExpression::matches(slice docID, bool deleted, Dict body) const {
+        Context ctx {docID, deleted, body};
+        return test(_root, ctx);
+    }
+
+
+    FilterExpression::Scalar FilterExpression::evaluate(const Node &node, const Context &ctx) {
+        switch (node.op) {
+            case Op::Literal:
+                return node.literal;
+            case Op::Property: {
+                Value v = ctx.body;
+                for (auto &key : node.path) {
+                    v = v.asDict()[slice(key)];
+                    if (!v)
+                        break;
+                }
+                return Scalar(v);
+            }
+            case Op::DocID: {
+                Scalar s;
+                s.type = kFLString;
+                s.str = ctx.docID;
+                return s;
+            }
+            case Op::ArrayLiteral: {
+                Scalar s;
+                s.type = kFLArray;      // Only meaningful as the argument to IN
+                return s;
+            }
+            default: {
+                Scalar s;
+                s.type = kFLBoolean;
+                s.boolean = test(node, ctx);
+                return s;
+            }
+        }
+    }
+
+
+    // Compares two scalars of the same type; sets `comparable` to false if they can't be.
+    int FilterExpression::compare(const Scalar &a, const Scalar &b, bool &comparable) {
+        comparable = (a.type == b.type);
+        if (!comparable)
+            return 0;
+        switch (a.type) {
+            case kFLNull:
+                return 0;
+            case kFLBoolean:
+                return int(a.boolean) - int(b.boolean);
+            case kFLNumber:
+                return (a.number < b.number) ? -1 : (a.number > b.number);
+            case kFLString:
+            case kFLData:
+                return a.str.compare(b.str);
+            case kFLArray:
+            case kFLDict:
+                comparable = a.value && b.value;
+                return (comparable && a.value.isEqual(b.value)) ? 0 : 1;
+            default:
+                comparable = false;
+                return 0;
+        }
+    }
+
+
+    bool FilterExpression::test(const Node &node, const Context &ctx) {
+        bool comparable;
+        switch (node.op) {
+            case Op::Deleted:
+                return ctx.deleted;
+            case Op::Equal:
+            case Op::NotEqual: {
+                int cmp = compare(evaluate(node.operands[0], ctx),
+                                  evaluate(node.operands[1], ctx), comparable);
+                if (!comparable)
+                    return false;
+                return (cmp == 0) == (node.op == Op::Equal);
+            }
+            case Op::Less:
+            case Op::LessOrEqual:
+            case Op::Greater:
+            case Op::GreaterOrEqual: {
+                Scalar a = evaluate(node.operands[0], ctx), b = evaluate(node.operands[1], ctx);
+                if (a.type != kFLNumber && a.type != kFLString)
+                    return false;
+                int cmp = compare(a, b, comparable);
+                if (!comparable)
+                    return false;
+                switch (node.op) {
+                    case Op::Less:          return cmp < 0;
+                    case Op::LessOrEqual:   return cmp <= 0;
+                    case Op::Greater:       return cmp > 0;
+                    default:                return cmp >= 0;
+                }
+            }
+            case Op::And:
+                for (auto &operand : node.operands) {
+                    if (!test(operand, ctx))
+                        return false;
+                }
+                return true;
+            case Op::Or:
+                for (auto &operand : node.operands) {
+                    if (test(operand, ctx))
+                        return true;
+                }
+                return false;
+            case Op::Not:
+                return !test(node.operands[0], ctx);
+            case Op::Exists: {
+                FLValueType type = evaluate(node.operands[0], ctx).type;
+                return type != kFLUndefined;
+            }
+            case Op::In: {
+                Scalar item = evaluate(node.operands[0], ctx);
+                for (auto &element : node.operands[1].operands) {
+                    if (compare(item, evaluate(element, ctx), comparable) == 0 && comparable)
+                        return true;
+                }
+                return false;
+            }
+            default:
+                return evaluate(node, ctx).truthy();
+        }
+    }
+
+}
@@ -0,0 +1,98 @@
+//
+// FilterExpression.hh
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "CBLBase.h"
+#include "c4Base.h"
+#include "fleece/Fleece.hh"
+#include "fleece/Mutable.hh"
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace cbl_internal {
+
+    /** A predicate over a document body, written in the JSON query schema, e.g.
+        `["AND", ["=", [".type"], "order"], ["=", [".region"], ["$region"]]]`.
+        It's compiled once and then evaluated directly against Fleece data, so it can be used
+        as a replication filter without calling back into the application.
+
+        Supported: literals (string, number, boolean, null), `["[]", ...]` array literals,
+        properties (`[".a.b"]`), parameters (`["$name"]`), the metadata properties `["._id"]`
+        and `["._deleted"]`, and the operators `=`, `!=`, `<`, `<=`, `>`, `>=`, `AND`, `OR`,
+        `NOT`, `EXISTS` and `IN`. */
+    class FilterExpression {
+    public:
+        /** Parses and compiles a JSON expression. Parameter references are resolved from
+            `parameters` at compile time. Returns null on error. */
+        static std::unique_ptr<FilterExpression> compile(fleece::slice json,
+                                                         fleece::Dict parameters,
+                                                         C4Error *outError);
+
+        /** Returns true if a document matches the expression. */
+        bool matches(fleece::slice docID, bool deleted, fleece::Dict body) const;
+
+    private:
+        enum class Op : uint8_t {
+            Literal, ArrayLiteral, Property, DocID, Deleted,
+            Equal, NotEqual, Less, LessOrEqual, Greater, GreaterOrEqual,
+            And, Or, Not, Exists, In
+        };
+
+        // An evaluated operand. Strings point into the body, the expression, or the docID.
+        struct Scalar {
+            FLValueType     type {kFLUndefined};
+            bool            boolean {false};
+            double          number {0};
+            fleece::slice   str;
+            fleece::Value   value;          // for arrays and dicts
+
+            Scalar() =default;
+            explicit Scalar(fleece::Value);
+            bool truthy() const;
+        };
+
+        struct Node {
+            Op                          op {Op::Literal};
+            Scalar                      literal;        // Literal
+            std::vector<std::string>    path;           // Property
+            std::vector<Node>           operands;       // everything else
+        };
+
+        struct Context {
+            fleece::slice   docID;
+            bool            deleted;
+            fleece::Dict    body;
+        };
+
+        FilterExpression() =default;
+
+        bool compileNode(fleece::Value, Node&, std::string &error) const;
+        bool compileLiteral(fleece::Value, Node&, std::string &error) const;
+
+        static Scalar evaluate(const Node&, const Context&);
+        static bool test(const Node&, const Context&);
+        static int compare(const Scalar&, const Scalar&, bool &comparable);
+
+        fleece::Doc                 _doc;           // Parsed JSON; owns the literals
+        fleece::MutableDict         _parameters;    // Copy of the parameters; owns their values
+        Node                        _root;
+    };
+
+}
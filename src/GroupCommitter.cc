@@ -0,0 +1,155 @@
+//
+// GroupCommitter.cc
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "GroupCommitter.hh"
+#include "CBLDocument_Internal.hh"
+#include "c4.hh"
+
+using namespace std;
+using namespace fleece;
+
+
+namespace cbl_internal {
+
+    static constexpr double kDefaultMaxDelay = 0.005;
+    static constexpr unsigned kDefaultMaxDocs = 1000;
+
+    thread_local bool GroupCommitter::sOnWriterThread = false;
+
+
+    GroupCommitter::GroupCommitter(CBLDatabase *db, const CBLGroupCommitOptions &options)
+    :_db(db)
+    ,_maxDelay(chrono::duration_cast<Clock::duration>(chrono::duration<double>(
+                                options.maxDelay > 0 ? options.maxDelay : kDefaultMaxDelay)))
+    ,_maxDocs(options.maxDocs ? options.maxDocs : kDefaultMaxDocs)
+    {
+        _thread = thread([this]() { run(); });
+    }
+
+
+    GroupCommitter::~GroupCommitter() {
+        {
+            lock_guard<mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _cond.notify_all();
+        _thread.join();
+    }
+
+
+    bool GroupCommitter::enqueue(CBLDocument *doc,
+                                 CBLConcurrencyControl concurrency,
+                                 Completion completion)
+    {
+        bool wake;
+        {
+            lock_guard<mutex> lock(_mutex);
+            if (_stopping)
+                return false;
+            if (_queue.empty())
+                _firstQueued = Clock::now();
+            _queue.push_back({doc, concurrency, move(completion)});
+            wake = (_queue.size() == 1 || _queue.size() >= _maxDocs);
+        }
+        if (wake)
+            _cond.notify_all();
+        return true;
+    }
+
+
+    void GroupCommitter::run() {
+        sOnWriterThread = true;
+        unique_lock<mutex> lock(_mutex);
+        while (true) {
+            _cond.wait(lock, [this] {return _stopping || !_queue.empty();});
+            if (_queue.empty())
+                break;      // Stopping, and nothing left to commit
+            _cond.wait_until(lock, _firstQueued + _maxDelay, [this] {
+                return _stopping || _queue.size() >= _maxDocs;
+            });
+            vector<Request> group;
+            swap(group, _queue);
+            lock.unlock();
+            commit(group);
+            lock.lock();
+        }
+    }
+
+
+    // Saves a group of docs in one transaction. A conflict only fails that doc; after any
+    // other error the transaction is aborted and the docs are saved one at a time instead,
+    // so that only the doc that caused it fails.
+    void GroupCommitter::commit(vector<Request> &group) {
+        vector<RetainedConst<CBLDocument>> saved(group.size());
+        vector<C4Error> errors(group.size());
+        // Saving a doc updates its C4Document in place, so if the transaction is aborted, the
+        // docs saved are left with a revision that was rolled back; remember their real ones:
+        vector<alloc_slice> staleRevIDs(group.size());
+        C4Error error;
+        bool ok;
+        {
+            c4::Transaction t(internal(_db));
+            ok = t.begin(&error);
+            if (ok) {
+                Encoder enc(c4db_getSharedFleeceEncoder(internal(_db)));
+                for (size_t i = 0; i < group.size(); ++i) {
+                    C4Document *c4doc = group[i].doc->_c4doc;
+                    alloc_slice revID(c4doc ? slice(c4doc->revID) : nullslice);
+                    saved[i] = group[i].doc->saveInTransaction(_db, false, group[i].concurrency,
+                                                               enc, &errors[i]);
+                    if (saved[i] && c4doc)
+                        staleRevIDs[i] = revID;
+                    if (!saved[i] && !(errors[i] == C4Error{LiteCoreDomain, kC4ErrorConflict})) {
+                        error = errors[i];
+                        ok = false;
+                        break;
+                    }
+                }
+                enc.detach();
+                ok = ok && _db->timedCommit([&]{return t.commit(&error);});
+            }
+        }
+        if (!ok) {
+            if (group.size() > 1)
+                return commitEach(group, staleRevIDs);
+            group[0].completion(nullptr, error);
+            return;
+        }
+
+        uint64_t nSaved = 0;
+        for (size_t i = 0; i < group.size(); ++i) {
+            if (saved[i])
+                ++nSaved;
+            group[i].completion(saved[i].get(), saved[i] ? C4Error{} : errors[i]);
+        }
+        DatabaseMetrics::add(_db->metrics.documentsWritten, nSaved);
+    }
+
+
+    void GroupCommitter::commitEach(vector<Request> &group,
+                                    const vector<alloc_slice> &staleRevIDs)
+    {
+        for (size_t i = 0; i < group.size(); ++i) {
+            C4Error error {};
+            auto saved = group[i].doc->save(_db, false, group[i].concurrency, &error,
+                                            staleRevIDs[i]);
+            group[i].completion(saved.get(), error);
+        }
+    }
+
+}
@@ -0,0 +1,82 @@
+//
+// GroupCommitter.hh
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "CBLDocument.h"
+#include "c4Base.h"
+#include "RefCounted.hh"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace cbl_internal {
+
+    /** Saves documents queued by multiple threads in groups, each in one transaction, on a
+        background thread; see CBLDatabase_SetGroupCommit. A group is committed once it has
+        `maxDocs` documents, or when its first document has waited `maxDelay`.
+        Owned by CBLDatabase, and uses its connection. */
+    class GroupCommitter {
+    public:
+        /** Called after a queued document is saved (with the saved doc) or fails. */
+        using Completion = std::function<void(const CBLDocument *savedDoc, C4Error error)>;
+
+        GroupCommitter(CBLDatabase* _cbl_nonnull, const CBLGroupCommitOptions&);
+
+        /** Commits the queued saves, then stops the writer thread. */
+        ~GroupCommitter();
+
+        /** Queues a save. Returns false if the committer is stopping. */
+        bool enqueue(CBLDocument* _cbl_nonnull, CBLConcurrencyControl, Completion);
+
+        /** True if called (e.g. from a Completion) on any GroupCommitter's writer thread,
+            where waiting for a queued save would deadlock. */
+        static bool onWriterThread()                {return sOnWriterThread;}
+
+    private:
+        struct Request {
+            fleece::Retained<CBLDocument>   doc;
+            CBLConcurrencyControl           concurrency;
+            Completion                      completion;
+        };
+        using Clock = std::chrono::steady_clock;
+
+        static thread_local bool sOnWriterThread;
+
+        void run();
+        void commit(std::vector<Request> &group);
+        void commitEach(std::vector<Request> &group,
+                        const std::vector<fleece::alloc_slice> &staleRevIDs);
+
+        CBLDatabase* const          _db;
+        Clock::duration const       _maxDelay;
+        size_t const                _maxDocs;
+
+        std::mutex                  _mutex;
+        std::condition_variable     _cond;
+        std::vector<Request>        _queue;
+        Clock::time_point           _firstQueued;       // When the oldest queued save arrived
+        bool                        _stopping {false};
+        std::thread                 _thread;
+    };
+
+}
@@ -18,6 +18,9 @@
 
 #include "Listener.hh"
 #include "CBLDatabase.h"
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
 
 using namespace std;
 
@@ -27,63 +30,243 @@ void CBLListenerToken::remove() {
     assert(oldOwner);
     _callback = nullptr;
     _owner = nullptr;
+    removed();
     oldOwner->remove(this);
 }
 
 
+#pragma mark - NOTIFICATION RING:
+
+
+NotificationRing::NotificationRing(size_t capacity)
+:_cells(new Cell[capacity])
+,_mask(capacity - 1)
+{
+    assert(capacity >= 2 && (capacity & _mask) == 0);
+    for (size_t i = 0; i < capacity; ++i)
+        _cells[i].sequence.store(i, memory_order_relaxed);
+}
+
+
+bool NotificationRing::push(const NotificationRecord &record) {
+    Cell *cell;
+    size_t pos = _enqueuePos.load(memory_order_relaxed);
+    while (true) {
+        cell = &_cells[pos & _mask];
+        size_t seq = cell->sequence.load(memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (_enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return false;       // full
+        } else {
+            pos = _enqueuePos.load(memory_order_relaxed);
+        }
+    }
+    cell->record = record;
+    cell->sequence.store(pos + 1, memory_order_release);
+    return true;
+}
+
+
+bool NotificationRing::pop(NotificationRecord &record) {
+    Cell *cell;
+    size_t pos = _dequeuePos.load(memory_order_relaxed);
+    while (true) {
+        cell = &_cells[pos & _mask];
+        size_t seq = cell->sequence.load(memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (_dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return false;       // empty
+        } else {
+            pos = _dequeuePos.load(memory_order_relaxed);
+        }
+    }
+    record = cell->record;
+    cell->sequence.store(pos + _mask + 1, memory_order_release);
+    return true;
+}
+
+
+bool NotificationRing::empty() const {
+    return _dequeuePos.load(memory_order_acquire) >= _enqueuePos.load(memory_order_acquire);
+}
+
+
+#pragma mark - NOTIFICATION QUEUE:
+
+
 NotificationQueue::NotificationQueue(CBLDatabase *database _cbl_nonnull)
 :_database(database)
-,_state(State())
+,_ring(kRingCapacity)
+,_overflow(Overflow())
 { }
 
+
+NotificationQueue::~NotificationQueue() {
+    // Release the targets of notifications that were never sent:
+    NotificationRecord record;
+    while (_ring.pop(record)) {
+        if (record.target)
+            fleece::release(record.target);
+    }
+}
+
+
 void NotificationQueue::setCallback(CBLNotificationsReadyCallback callback, void *context) {
-    auto pending = _state.use<Notifications>([&](State &state) {
-        state.callback = callback;
-        state.context = context;
-        return callback ? nullptr : move(state.queue);
-    });
-    call(pending);
+    _context.store(context);
+    _callback.store(callback);
+    if (!callback)
+        notifyAll();                            // send anything that was queued
 }
 
 
 void NotificationQueue::add(Notification notification) {
-    bool notifyNow = false;
-    CBLNotificationsReadyCallback readyCallback = nullptr;
-    void* readyContext;
-
-    _state.use([&](State &state) {
-        if (state.callback) {
-            bool first = !state.queue;
-            if (first)
-                state.queue.reset( new vector<Notification> );
-            state.queue->push_back(notification);
-            if (first) {
-                readyCallback = state.callback;
-                readyContext = state.context;
-            }
-        } else {
-            notifyNow = true;
-        }
+    uint64_t sequence = _added.fetch_add(1, memory_order_relaxed);
+    if (!_callback.load()) {
+        notification();                         // immediate notification
+        _called.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    _overflow.use([&](Overflow &overflow) {
+        overflow.push_back({sequence, move(notification)});
+        ++_overflowCount;
     });
+    becameReady();
+}
 
-    if (notifyNow)
-        notification();                         // immediate notification
-    else if (readyCallback)
-        readyCallback(readyContext, _database); // notify that notifications are queued
+
+void NotificationQueue::add(NotificationRecord::Function fn, fleece::RefCounted *target) {
+    uint64_t sequence = _added.fetch_add(1, memory_order_relaxed);
+    if (!_callback.load()) {
+        fn(_database, target);                  // immediate notification
+        _called.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    if (target)
+        fleece::retain(target);
+    if (!_ring.push({fn, target, sequence})) {
+        // Ring is full, so fall back to the overflow queue:
+        fleece::Retained<fleece::RefCounted> retainedTarget(target);
+        if (target)
+            fleece::release(target);
+        CBLDatabase *db = _database;
+        _overflow.use([&](Overflow &overflow) {
+            overflow.push_back({sequence, [=]() {fn(db, retainedTarget);}});
+            ++_overflowCount;
+        });
+    }
+    becameReady();
 }
 
 
-void NotificationQueue::notifyAll() {
-    auto queue = _state.use<Notifications>([&](State &state) {
-        return move(state.queue);
-    });
-    call(queue);
+// Tells the client that notifications are available, unless it's already been told.
+void NotificationQueue::becameReady() {
+    if (!_readyPending.exchange(true)) {
+        CBLNotificationsReadyCallback readyCallback = _callback.load();
+        if (readyCallback)
+            readyCallback(_context.load(), _database);
+    }
 }
 
 
-void NotificationQueue::call(const Notifications &queue) {
-    if (queue) {
-        for (Notification &n : *queue)
-            n();
+bool NotificationQueue::empty() const {
+    return _ring.empty() && _overflowCount.load() == 0;
+}
+
+
+bool NotificationQueue::notify(unsigned maxCount) {
+    unsigned sent = 0;
+    while (true) {
+        sent += callInOrder(maxCount - sent);
+        if (!empty()) {
+            if (sent >= maxCount)
+                return true;
+            continue;
+        }
+        // Queue is empty, so the client should be told about the next notification. But one
+        // may have been added just before the flag was cleared, without telling the client:
+        _readyPending.store(false);
+        if (empty() || _readyPending.exchange(true))
+            return false;
+        if (sent >= maxCount)
+            return true;
     }
 }
+
+
+// Calls up to `maxCount` notifications, merging the ring and the overflow queue by sequence.
+// The overflow entries are taken before the ring is read, and again whenever there are more,
+// so any record added before one of them is already visible in the ring by then.
+unsigned NotificationQueue::callInOrder(unsigned maxCount) {
+    if (maxCount == 0)
+        return 0;
+    Overflow overflow;
+    takeOverflow(overflow);
+    unsigned n = 0;
+    auto callOverflowBefore = [&](uint64_t sequence) {
+        while (n < maxCount && !overflow.empty() && overflow.front().sequence < sequence) {
+            Notification notification = move(overflow.front().notification);
+            overflow.pop_front();
+            notification();
+            ++n;
+        }
+    };
+
+    NotificationRecord record;
+    while (n < maxCount && _ring.pop(record)) {
+        takeOverflow(overflow);
+        callOverflowBefore(record.sequence);
+        if (n >= maxCount) {
+            // Out of calls; put the record back, in order, with the remaining overflow:
+            fleece::Retained<fleece::RefCounted> target(record.target);
+            if (record.target)
+                fleece::release(record.target);
+            auto fn = record.function;
+            CBLDatabase *db = _database;
+            auto pos = find_if(overflow.begin(), overflow.end(),
+                               [&](const QueuedNotification &q) {
+                                   return q.sequence > record.sequence;
+                               });
+            overflow.insert(pos, {record.sequence, [=]() {fn(db, target);}});
+            break;
+        }
+        record.function(_database, record.target);
+        if (record.target)
+            fleece::release(record.target);
+        ++n;
+    }
+    callOverflowBefore(UINT64_MAX);
+    putBackOverflow(overflow);
+    _called.fetch_add(n, memory_order_relaxed);
+    return n;
+}
+
+
+// Moves the overflow queue's entries to the end of `into`.
+void NotificationQueue::takeOverflow(Overflow &into) {
+    if (_overflowCount.load() == 0)
+        return;
+    _overflow.use([&](Overflow &overflow) {
+        _overflowCount -= overflow.size();
+        into.insert(into.end(), make_move_iterator(overflow.begin()),
+                                make_move_iterator(overflow.end()));
+        overflow.clear();
+    });
+}
+
+
+// Puts entries that weren't called back at the front of the overflow queue.
+void NotificationQueue::putBackOverflow(Overflow &from) {
+    if (from.empty())
+        return;
+    _overflow.use([&](Overflow &overflow) {
+        overflow.insert(overflow.begin(), make_move_iterator(from.begin()),
+                                          make_move_iterator(from.end()));
+        _overflowCount += from.size();
+    });
+}
@@ -21,6 +21,9 @@
 #include "Internal.hh"
 #include <access_lock.hh>
 #include <atomic>
+#include <climits>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -49,6 +52,10 @@ public:
     void remove();
 
 protected:
+    /** Called by `remove`, after the callback is cleared. Subclasses override it to cancel
+        pending deliveries. */
+    virtual void removed()      { }
+
     std::atomic<const void*> _callback;          // Really a C fn pointer
     void* _context;
     cbl_internal::ListenersBase* _owner {nullptr};
@@ -80,12 +87,14 @@ namespace cbl_internal {
     /** Manages a set of CBLListenerTokens. */
     class ListenersBase {
     public:
+        virtual ~ListenersBase() = default;
+
         void add(CBLListenerToken* t _cbl_nonnull) {
             _tokens.emplace_back(t);
             t->addedTo(this);
         }
 
-        void remove(CBLListenerToken* t _cbl_nonnull) {
+        virtual void remove(CBLListenerToken* t _cbl_nonnull) {
             for (auto i = _tokens.begin(); i != _tokens.end(); ++i) {
                 if (i->get() == t) {
                     _tokens.erase(i);
@@ -140,10 +149,54 @@ namespace cbl_internal {
     using Notification = std::function<void()>;
 
 
-    /** Manages a queue of pending calls to listeners. Owned by CBLDatabase. */
+    /** A compact notification: a function to call with the database, and an optional object,
+        which is retained while the notification is queued. Queueing one doesn't allocate. */
+    struct NotificationRecord {
+        using Function = void (*)(CBLDatabase* _cbl_nonnull, fleece::RefCounted*);
+
+        Function function;
+        fleece::RefCounted* target;
+        uint64_t sequence;              // Position in the NotificationQueue's order
+    };
+
+
+    /** A fixed-capacity lock-free queue of NotificationRecords, safe for any number of producer
+        and consumer threads. (This is Dmitry Vyukov's bounded MPMC queue algorithm.) */
+    class NotificationRing {
+    public:
+        explicit NotificationRing(size_t capacity);     // capacity must be a power of 2
+
+        /** Adds a record; returns false if the ring is full. */
+        bool push(const NotificationRecord&);
+
+        /** Removes the oldest record; returns false if the ring is empty. */
+        bool pop(NotificationRecord&);
+
+        /** Returns true if the ring is empty; may be out of date by the time it returns. */
+        bool empty() const;
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            NotificationRecord record;
+        };
+
+        std::unique_ptr<Cell[]> const _cells;
+        size_t const _mask;
+        alignas(64) std::atomic<size_t> _enqueuePos {0};
+        alignas(64) std::atomic<size_t> _dequeuePos {0};
+    };
+
+
+    /** Manages a queue of pending calls to listeners. Owned by CBLDatabase.
+        NotificationRecords go into a lock-free ring buffer; other notifications, and records
+        that don't fit in the ring, go into a mutex-protected overflow queue. Every notification
+        gets a sequence number when it's added, and the two are merged by it, so notifications
+        are called in the order they were added. */
     class NotificationQueue {
     public:
         NotificationQueue(CBLDatabase* _cbl_nonnull);
+        ~NotificationQueue();
 
         /** Sets or clears the client callback. */
         void setCallback(CBLNotificationsReadyCallback callback, void *context);
@@ -153,23 +206,43 @@ namespace cbl_internal {
             If there is no callback, it calls the notification directly. */
         void add(Notification);
 
+        /** Same as the above, but takes a compact record, which is queued without allocating
+            or locking. `target` (which may be null) is passed to the function. */
+        void add(NotificationRecord::Function, fleece::RefCounted *target);
+
         /** Calls all queued notifications and clears the queue. */
-        void notifyAll();
+        void notifyAll()                        {(void)notify(UINT_MAX);}
+
+        /** Calls up to `maxCount` queued notifications. Returns true if more remain. */
+        bool notify(unsigned maxCount);
 
+        /** The number of notifications added, and called, so far. */
+        uint64_t addedCount() const             {return _added.load(std::memory_order_relaxed);}
+        uint64_t calledCount() const            {return _called.load(std::memory_order_relaxed);}
 
     private:
-        using Notifications = std::unique_ptr<std::vector<Notification>>;
-
-        void call(const Notifications&);
-        
-        struct State {
-            CBLNotificationsReadyCallback callback {nullptr};
-            void* context;
-            Notifications queue;
+        static constexpr size_t kRingCapacity = 256;
+
+        struct QueuedNotification {
+            uint64_t sequence;
+            Notification notification;
         };
+        using Overflow = std::deque<QueuedNotification>;
+
+        void becameReady();
+        unsigned callInOrder(unsigned maxCount);
+        void takeOverflow(Overflow &into);
+        void putBackOverflow(Overflow &from);
+        bool empty() const;
 
         CBLDatabase* const _database;
-        litecore::access_lock<State> _state;
+        std::atomic<CBLNotificationsReadyCallback> _callback {nullptr};
+        std::atomic<void*> _context {nullptr};
+        std::atomic<bool> _readyPending {false};    // True if client's been told, but not drained
+        NotificationRing _ring;
+        std::atomic<size_t> _overflowCount {0};
+        litecore::access_lock<Overflow> _overflow;
+        std::atomic<uint64_t> _added {0}, _called {0};
     };
 
 }
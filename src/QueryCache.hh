@@ -0,0 +1,73 @@
+//
+// QueryCache.hh
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "CBLQuery.h"
+#include "c4Query.h"
+#include "fleece/slice.hh"
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+namespace cbl_internal {
+
+    /** An LRU cache of compiled C4Query objects that aren't currently in use, keyed by query
+        language and source text. Owned by CBLDatabase.
+        A CBLQuery checks a C4Query out of the cache when it's created, and puts it back when
+        it's freed, so a C4Query is never shared by two CBLQuery objects at once.
+        Thread-safe. */
+    class QueryCache {
+    public:
+        static constexpr unsigned kDefaultCapacity = 50;
+
+        ~QueryCache()                                   {clear();}
+
+        /** Returns the cache key for a query. */
+        static std::string key(CBLQueryLanguage, const char *queryString _cbl_nonnull);
+
+        /** Removes and returns the C4Query with the given key, or returns null on a miss.
+            The caller is responsible for releasing the returned query. */
+        C4Query* take(fleece::slice key);
+
+        /** Adds an unused C4Query to the cache, taking over the caller's reference.
+            If the cache is full, the least recently used query is released. */
+        void put(const std::string &key, C4Query* _cbl_nonnull);
+
+        void setCapacity(unsigned capacity);
+
+        CBLQueryCacheStats stats() const;
+
+        /** Releases all cached queries. */
+        void clear();
+
+    private:
+        void trim(unsigned capacity);
+
+        using Entry = std::pair<std::string, C4Query*>;
+        using LRUList = std::list<Entry>;
+
+        mutable std::mutex _mutex;
+        LRUList _lru;                                               // Most recently used first
+        std::unordered_map<fleece::slice, LRUList::iterator> _map;  // Keys point into `_lru`
+        unsigned _capacity {kDefaultCapacity};
+        uint64_t _hits {0}, _misses {0};
+    };
+
+}
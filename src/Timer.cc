@@ -0,0 +1,135 @@
+//
+// Timer.cc
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Timer.hh"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+
+namespace cbl_internal {
+
+    // The thread that fires all Timers, in order of their deadlines. It's started when the first
+    // Timer is scheduled, and never destroyed, so it lives as long as the process.
+    class TimerThread {
+    public:
+        static TimerThread& shared() {
+            static TimerThread* sThread = new TimerThread;
+            return *sThread;
+        }
+
+        void schedule(Timer *timer, Timer::clock::time_point when, Timer::Callback callback) {
+            Timer::Callback oldCallback;        // destroyed after unlocking
+            {
+                lock_guard<mutex> lock(_mutex);
+                if (_thread == thread::id()) {
+                    thread t([this]() { run(); });
+                    _thread = t.get_id();
+                    t.detach();
+                }
+                unschedule(timer, oldCallback);
+                timer->_callback = move(callback);
+                timer->_entry = _schedule.emplace(when, timer);
+                timer->_scheduled = true;
+                if (timer->_entry != _schedule.begin())
+                    return;                     // The thread's wakeup time hasn't changed
+            }
+            _cond.notify_one();
+        }
+
+        void stop(Timer *timer) {
+            Timer::Callback oldCallback;        // destroyed after unlocking
+            unique_lock<mutex> lock(_mutex);
+            unschedule(timer, oldCallback);
+            if (_thread != this_thread::get_id())
+                _idle.wait(lock, [&] {return _firing != timer;});
+        }
+
+        bool scheduled(const Timer *timer) {
+            lock_guard<mutex> lock(_mutex);
+            return timer->_scheduled;
+        }
+
+    private:
+        TimerThread() = default;
+
+        // Removes a timer from the schedule. Must be called with the mutex locked.
+        void unschedule(Timer *timer, Timer::Callback &oldCallback) {
+            if (timer->_scheduled) {
+                _schedule.erase(timer->_entry);
+                timer->_scheduled = false;
+                oldCallback = move(timer->_callback);
+            }
+        }
+
+        void run() {
+            unique_lock<mutex> lock(_mutex);
+            while (true) {
+                if (_schedule.empty()) {
+                    _cond.wait(lock);
+                    continue;
+                }
+                auto next = _schedule.begin();
+                if (next->first > Timer::clock::now()) {
+                    _cond.wait_until(lock, next->first);
+                    continue;
+                }
+                Timer *timer = next->second;
+                _schedule.erase(next);
+                timer->_scheduled = false;
+                Timer::Callback callback = move(timer->_callback);
+                _firing = timer;
+                lock.unlock();
+
+                callback();
+
+                lock.lock();
+                _firing = nullptr;
+                _idle.notify_all();
+                lock.unlock();
+                callback = nullptr;     // Release its captures outside the lock
+                lock.lock();
+            }
+        }
+
+        mutex _mutex;
+        condition_variable _cond;       // Signaled when the earliest deadline changes
+        condition_variable _idle;       // Signaled when a callback returns
+        Timer::Schedule _schedule;
+        Timer* _firing {nullptr};       // The Timer whose callback is running
+        thread::id _thread;             // The thread that runs callbacks, once started
+    };
+
+
+    void Timer::fireAt(clock::time_point when, Callback callback) {
+        TimerThread::shared().schedule(this, when, move(callback));
+    }
+
+
+    void Timer::stop() {
+        TimerThread::shared().stop(this);
+    }
+
+
+    bool Timer::scheduled() const {
+        return TimerThread::shared().scheduled(this);
+    }
+
+}
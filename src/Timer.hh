@@ -0,0 +1,70 @@
+//
+// Timer.hh
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include <chrono>
+#include <functional>
+#include <map>
+
+
+namespace cbl_internal {
+
+    /** A cancellable deadline. All Timers share one background thread, which calls each one's
+        callback when its time comes. A Timer fires at most once per call to `fireAt`; calling
+        `fireAt` again before then reschedules it, replacing the callback.
+        Any references the callback captures are released when it's been called, or when the
+        timer is rescheduled or stopped. */
+    class Timer {
+    public:
+        using clock = std::chrono::steady_clock;
+        using Callback = std::function<void()>;
+
+        Timer() = default;
+        ~Timer()                                {stop();}
+
+        /** Schedules the callback to be called at time `when`. */
+        void fireAt(clock::time_point when, Callback);
+
+        /** Schedules the callback to be called after `seconds`. */
+        void fireAfter(double seconds, Callback callback) {
+            fireAt(clock::now() + std::chrono::duration_cast<clock::duration>(
+                                        std::chrono::duration<double>(seconds)),
+                   std::move(callback));
+        }
+
+        /** Cancels the timer. If its callback is running on another thread, waits for it to
+            return, so it's safe to destroy the callback's target afterwards. */
+        void stop();
+
+        /** True if the timer is waiting to fire. */
+        bool scheduled() const;
+
+    private:
+        friend class TimerThread;
+        using Schedule = std::multimap<clock::time_point, Timer*>;
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        // These are guarded by the TimerThread's mutex:
+        Callback _callback;
+        Schedule::iterator _entry;
+        bool _scheduled {false};
+    };
+
+}
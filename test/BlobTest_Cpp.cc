@@ -19,6 +19,8 @@
 #include "CBLTest.hh"
 #include "fleece/Fleece.hh"
 #include "fleece/Mutable.hh"
+#include <cerrno>
+#include <cstdio>
 #include <string>
 
 #include "cbl++/CouchbaseLite.hh"
@@ -123,3 +125,82 @@ TEST_CASE_METHOD(CBLTest_Cpp, "C++ Blob in mutable doc") {
     REQUIRE(blob);
     CHECK((FLDict)blob.properties() == (FLDict)props);
 }
+
+
+TEST_CASE_METHOD(CBLTest, "Blob from file") {
+    // Write a file a few chunks long, so the copy takes several reads:
+    string path = kDatabaseDir + "/blob_source.bin";
+    string contents;
+    for (int i = 0; contents.size() < 600000; ++i)
+        contents += to_string(i) + " ";
+    FILE *f = fopen(path.c_str(), "wb");
+    REQUIRE(f);
+    REQUIRE(fwrite(contents.data(), 1, contents.size(), f) == contents.size());
+    fclose(f);
+
+    CBLError error;
+    CBLBlob *blob = CBLBlob_CreateWithFile(db, "application/octet-stream", path.c_str(), &error);
+    REQUIRE(blob);
+    CHECK(CBLBlob_Length(blob) == contents.size());
+
+    CBLDocument *doc = CBLDocument_New("blobbo");
+    FLMutableDict props = CBLDocument_MutableProperties(doc);
+    FLMutableDict_SetBlob(props, "file"_sl, blob);
+    const CBLDocument *saved = CBLDatabase_SaveDocument(db, doc,
+                                                        kCBLConcurrencyControlFailOnConflict,
+                                                        &error);
+    REQUIRE(saved);
+    CBLDocument_Release(saved);
+    CBLDocument_Release(doc);
+    CBLBlob_Release(blob);
+
+    saved = CBLDatabase_GetDocument(db, "blobbo");
+    REQUIRE(saved);
+    const CBLBlob *loaded = FLValue_GetBlob(FLDict_Get(CBLDocument_Properties(saved), "file"_sl));
+    REQUIRE(loaded);
+    FLSliceResult data = CBLBlob_LoadContent(loaded, &error);
+    CHECK(slice(data) == slice(contents));
+    FLSliceResult_Release(data);
+    CBLDocument_Release(saved);
+
+    blob = CBLBlob_CreateWithFile(db, nullptr, (kDatabaseDir + "/no_such_file").c_str(), &error);
+    CHECK(!blob);
+    CHECK(error.domain == CBLPOSIXDomain);
+    CHECK(error.code == ENOENT);
+    remove(path.c_str());
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Map blob content") {
+    CBLBlob *blob = CBLBlob_CreateWithData(kBlobContentType, kBlobContents);
+    const void *data;
+    size_t length;
+    CBLError error;
+
+    // An unsaved blob can't be mapped; its content is copied instead:
+    CBLBlobMapping *mapping = CBLBlob_MapContent(blob, &data, &length, &error);
+    REQUIRE(mapping);
+    CHECK(slice(data, length) == kBlobContents);
+    CBLBlobMapping_Release(mapping);
+
+    CBLDocument *doc = CBLDocument_New("blobbo");
+    FLMutableDict_SetBlob(CBLDocument_MutableProperties(doc), "picture"_sl, blob);
+    const CBLDocument *saved = CBLDatabase_SaveDocument(db, doc,
+                                                        kCBLConcurrencyControlFailOnConflict,
+                                                        &error);
+    REQUIRE(saved);
+    CBLDocument_Release(saved);
+    CBLDocument_Release(doc);
+    CBLBlob_Release(blob);
+
+    saved = CBLDatabase_GetDocument(db, "blobbo");
+    REQUIRE(saved);
+    const CBLBlob *loaded = FLValue_GetBlob(FLDict_Get(CBLDocument_Properties(saved), "picture"_sl));
+    REQUIRE(loaded);
+    mapping = CBLBlob_MapContent(loaded, &data, &length, &error);
+    REQUIRE(mapping);
+    CHECK(slice(data, length) == kBlobContents);
+    CBLDocument_Release(saved);
+    CHECK(slice(data, length) == kBlobContents);    // Still valid after the doc is released
+    CBLBlobMapping_Release(mapping);
+}
@@ -19,7 +19,16 @@
 #include "CBLTest.hh"
 #include "fleece/Fleece.hh"
 #include "fleece/Mutable.hh"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 using namespace std;
 using namespace fleece;
@@ -90,6 +99,93 @@ TEST_CASE_METHOD(CBLTest, "Save Document With Property") {
 }
 
 
+TEST_CASE_METHOD(CBLTest, "Database Metrics") {
+    CBLDatabaseMetrics before = CBLDatabase_GetMetrics(db);
+
+    CBLError error;
+    CBLDocument* doc = CBLDocument_New("foo");
+    const CBLDocument *saved = CBLDatabase_SaveDocument(db, doc, kCBLConcurrencyControlFailOnConflict, &error);
+    REQUIRE(saved);
+    CBLDocument_Release(saved);
+    CBLDocument_Release(doc);
+    const CBLDocument *read = CBLDatabase_GetDocument(db, "foo");
+    REQUIRE(read);
+    CBLDocument_Release(read);
+    CHECK(CBLDatabase_GetDocument(db, "missing") == nullptr);
+
+    CBLDatabaseMetrics after = CBLDatabase_GetMetrics(db);
+    CHECK(after.documentsWritten == before.documentsWritten + 1);
+    CHECK(after.documentsRead == before.documentsRead + 1);
+    CHECK(after.commits == before.commits + 1);
+    uint64_t histogramTotal = 0;
+    for (unsigned i = 0; i < kCBLCommitLatencyBuckets; ++i)
+        histogramTotal += after.commitLatency[i];
+    CHECK(histogramTotal == after.commits);
+
+    // A batch counts as one commit:
+    REQUIRE(CBLDatabase_BeginBatch(db, &error));
+    for (int i = 0; i < 3; ++i) {
+        doc = CBLDocument_New(nullptr);
+        saved = CBLDatabase_SaveDocument(db, doc, kCBLConcurrencyControlFailOnConflict, &error);
+        REQUIRE(saved);
+        CBLDocument_Release(saved);
+        CBLDocument_Release(doc);
+    }
+    REQUIRE(CBLDatabase_EndBatch(db, &error));
+    CBLDatabaseMetrics afterBatch = CBLDatabase_GetMetrics(db);
+    CHECK(afterBatch.documentsWritten == after.documentsWritten + 3);
+    CHECK(afterBatch.commits == after.commits + 1);
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Save Multiple Documents") {
+    // Pre-existing doc "doc1" will cause a conflict when saving a new doc with the same ID:
+    CBLDocument* existing = CBLDocument_New("doc1");
+    CBLError error;
+    const CBLDocument *saved = CBLDatabase_SaveDocument(db, existing, kCBLConcurrencyControlFailOnConflict, &error);
+    REQUIRE(saved);
+    CBLDocument_Release(saved);
+    CBLDocument_Release(existing);
+
+    static const unsigned kNumDocs = 3;
+    CBLDocument* docs[kNumDocs];
+    for (unsigned i = 0; i < kNumDocs; ++i) {
+        string docID = "doc" + to_string(i);
+        docs[i] = CBLDocument_New(docID.c_str());
+        MutableDict props = CBLDocument_MutableProperties(docs[i]);
+        props["n"_sl] = int(i);
+    }
+    const CBLDocument* results[kNumDocs];
+    CHECK(CBLDatabase_SaveDocuments(db, docs, kNumDocs, kCBLConcurrencyControlFailOnConflict,
+                                    results, &error) == 2);
+    CHECK(results[0] != nullptr);
+    CHECK(results[1] == nullptr);        // conflict
+    CHECK(results[2] != nullptr);
+    CHECK(string(CBLDocument_PropertiesAsJSON(results[2])) == "{\"n\":2}");
+    CHECK(CBLDatabase_Count(db) == 3);
+
+    for (unsigned i = 0; i < kNumDocs; ++i) {
+        CBLDocument_Release(results[i]);
+        CBLDocument_Release(docs[i]);
+    }
+
+    // Read them back, along with a nonexistent doc:
+    const char* docIDs[4] = {"doc2", "nope", "doc0", "doc1"};
+    const CBLDocument* readDocs[4];
+    CHECK(CBLDatabase_GetDocuments(db, docIDs, 4, readDocs) == 3);
+    REQUIRE(readDocs[0]);
+    CHECK(string(CBLDocument_ID(readDocs[0])) == "doc2");
+    CHECK(string(CBLDocument_PropertiesAsJSON(readDocs[0])) == "{\"n\":2}");
+    CHECK(readDocs[1] == nullptr);
+    REQUIRE(readDocs[2]);
+    CHECK(string(CBLDocument_ID(readDocs[2])) == "doc0");
+    REQUIRE(readDocs[3]);
+    CHECK(string(CBLDocument_PropertiesAsJSON(readDocs[3])) == "{}");
+    for (unsigned i = 0; i < 4; ++i)
+        CBLDocument_Release(readDocs[i]);
+}
+
+
 static void createDocument(CBLDatabase *db, const char *docID,
                            const char *property, const char *value)
 {
@@ -210,3 +306,874 @@ TEST_CASE_METHOD(CBLTest, "Scheduled database notifications") {
     CBLListener_Remove(fooToken);
     CBLListener_Remove(barToken);
 }
+
+
+static vector<string> coalescedDocIDs;
+static int coalescedCalls = 0;
+static uint64_t rangeFirst = 0, rangeLast = 0;
+static unsigned rangeCount = 0;
+
+static void coalescedListener(void *context, const CBLDatabase *db, unsigned nDocs, const char** docIDs) {
+    ++coalescedCalls;
+    for (unsigned i = 0; i < nDocs; ++i)
+        coalescedDocIDs.push_back(docIDs[i]);
+}
+
+static void rangeListener(void *context, const CBLDatabase *db,
+                          uint64_t firstSeq, uint64_t lastSeq, unsigned nChanges)
+{
+    rangeFirst = firstSeq;
+    rangeLast = lastSeq;
+    rangeCount += nChanges;
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Coalesced database notifications") {
+    coalescedDocIDs.clear();
+    coalescedCalls = 0;
+    rangeFirst = rangeLast = rangeCount = 0;
+    notificationsReadyCalls = 0;
+    CBLChangeCoalescingOptions options = {0.0, 2};
+    auto token = CBLDatabase_AddCoalescedChangeListener(db, &options, coalescedListener, this);
+    auto rangeToken = CBLDatabase_AddChangeRangeListener(db, &options, rangeListener, this);
+    CBLDatabase_BufferNotifications(db, notificationsReady, this);
+
+    createDocument(db, "foo", "greeting", "Howdy!");
+    createDocument(db, "bar", "greeting", "yo.");
+    createDocument(db, "baz", "greeting", "hi");
+    CHECK(notificationsReadyCalls == 1);
+    CHECK(coalescedCalls == 0);
+
+    // All three changes are delivered at once, but no more than `maxChanges` docIDs per call:
+    CBLDatabase_SendNotifications(db);
+    CHECK(coalescedCalls == 2);
+    CHECK(coalescedDocIDs == (vector<string>{"foo", "bar", "baz"}));
+    CHECK(rangeFirst == 1);
+    CHECK(rangeLast == 3);
+    CHECK(rangeCount == 3);
+
+    CBLDatabase_SendNotifications(db);
+    CHECK(coalescedCalls == 2);
+
+    CBLListener_Remove(token);
+    CBLListener_Remove(rangeToken);
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Coalesced database notifications with interval") {
+    rangeFirst = rangeLast = rangeCount = 0;
+    CBLChangeCoalescingOptions options = {0.5, 0};
+    auto rangeToken = CBLDatabase_AddChangeRangeListener(db, &options, rangeListener, this);
+    // (The ready-callback runs on the timer's thread, so it mustn't use CHECK.)
+    CBLDatabase_BufferNotifications(db, [](void*, CBLDatabase*) { }, nullptr);
+
+    createDocument(db, "foo", "greeting", "Howdy!");
+    createDocument(db, "bar", "greeting", "yo.");
+    CBLDatabase_SendNotifications(db);
+    CHECK(rangeCount == 0);            // the interval hasn't ended yet
+
+    // Wait for the timer to queue the notification:
+    for (int i = 0; i < 100 && rangeCount == 0; ++i) {
+        this_thread::sleep_for(chrono::milliseconds(20));
+        CBLDatabase_SendNotifications(db);
+    }
+    CHECK(rangeCount == 2);
+    CHECK(rangeFirst == 1);
+    CHECK(rangeLast == 2);
+
+    CBLListener_Remove(rangeToken);
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Removing a coalesced listener cancels its delivery") {
+    rangeFirst = rangeLast = rangeCount = 0;
+    CBLChangeCoalescingOptions options = {0.2, 0};
+    auto rangeToken = CBLDatabase_AddChangeRangeListener(db, &options, rangeListener, this);
+    CBLDatabase_BufferNotifications(db, [](void*, CBLDatabase*) { }, nullptr);
+
+    createDocument(db, "foo", "greeting", "Howdy!");
+    CBLListener_Remove(rangeToken);     // before the interval ends
+
+    this_thread::sleep_for(chrono::milliseconds(400));
+    CBLDatabase_SendNotifications(db);
+    CHECK(rangeCount == 0);
+}
+
+
+static vector<string> changedDocIDs;
+
+static void recordingDocListener(void *context, const CBLDatabase *db, const char *docID) {
+    changedDocIDs.push_back(docID);
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Many document listeners") {
+    changedDocIDs.clear();
+    vector<CBLListenerToken*> tokens;
+    for (int i = 0; i < 100; ++i) {
+        string docID = "doc" + to_string(i);
+        tokens.push_back(CBLDatabase_AddDocumentChangeListener(db, docID.c_str(),
+                                                               recordingDocListener, this));
+    }
+    // A second listener on the same document:
+    auto extraToken = CBLDatabase_AddDocumentChangeListener(db, "doc7", recordingDocListener, this);
+
+    CBLError error;
+    REQUIRE(CBLDatabase_BeginBatch(db, &error));
+    createDocument(db, "doc7", "greeting", "hi");
+    createDocument(db, "doc42", "greeting", "hi");
+    createDocument(db, "unwatched", "greeting", "hi");
+    REQUIRE(CBLDatabase_EndBatch(db, &error));
+    CHECK(changedDocIDs == (vector<string>{"doc7", "doc7", "doc42"}));
+
+    CBLListener_Remove(tokens[7]);
+    changedDocIDs.clear();
+    createDocument(db, "doc7", "greeting", "bye");
+    CHECK(changedDocIDs == (vector<string>{"doc7"}));
+
+    CBLListener_Remove(extraToken);
+    changedDocIDs.clear();
+    createDocument(db, "doc7", "greeting", "bye!");
+    CHECK(changedDocIDs.empty());
+
+    for (int i = 0; i < 100; ++i) {
+        if (i != 7)
+            CBLListener_Remove(tokens[i]);
+    }
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Bounded database notifications") {
+    dbListenerCalls = fooListenerCalls = 0;
+    notificationsReadyCalls = 0;
+    auto token = CBLDatabase_AddChangeListener(db, dbListener, this);
+    auto docToken = CBLDatabase_AddDocumentChangeListener(db, "foo", fooListener, this);
+    CBLDatabase_BufferNotifications(db, notificationsReady, this);
+
+    createDocument(db, "foo", "greeting", "Howdy!");
+    CHECK(notificationsReadyCalls == 1);
+
+    // There are two notifications pending, one per listener; send them one at a time:
+    CHECK(CBLDatabase_SendNotificationsBounded(db, 1));
+    CHECK(dbListenerCalls + fooListenerCalls == 1);
+    CHECK(!CBLDatabase_SendNotificationsBounded(db, 1));
+    CHECK(dbListenerCalls == 1);
+    CHECK(fooListenerCalls == 1);
+    CHECK(!CBLDatabase_SendNotificationsBounded(db, 1));
+
+    // Once the queue's been drained, the ready-callback is called again:
+    createDocument(db, "foo", "greeting", "Bonjour!");
+    CHECK(notificationsReadyCalls == 2);
+    CHECK(!CBLDatabase_SendNotificationsBounded(db, 10));
+    CHECK(dbListenerCalls == 2);
+    CHECK(fooListenerCalls == 2);
+
+    CBLListener_Remove(token);
+    CBLListener_Remove(docToken);
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Buffered notifications are sent in order") {
+    struct State {
+        atomic<int> readyCalls {0};
+        vector<string> calls;
+    } state;
+    auto token = CBLDatabase_AddChangeListener(db, [](void *context, const CBLDatabase*,
+                                                      unsigned nDocs, const char **docIDs) {
+        ((State*)context)->calls.push_back(string("changed ") + docIDs[0]);
+    }, &state);
+    CBLDatabase_BufferNotifications(db, [](void *context, CBLDatabase*) {
+        ++((State*)context)->readyCalls;
+    }, &state);
+
+    // An async completion is queued before a change notification, so it must be called first,
+    // even though the two go into different internal queues:
+    CBLDatabase_GetDocumentAsync(db, "foo", [](void *context, const CBLDocument*) {
+        ((State*)context)->calls.push_back("got foo");
+    }, &state);
+    for (int i = 0; i < 500 && state.readyCalls == 0; ++i)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    REQUIRE(state.readyCalls == 1);
+    createDocument(db, "foo", "greeting", "Howdy!");
+
+    CBLDatabase_SendNotifications(db);
+    CHECK(state.calls == (vector<string>{"got foo", "changed foo"}));
+    CBLListener_Remove(token);
+}
+
+
+struct ExportState {
+    mutex lock;
+    string output;
+    unsigned chunks = 0;
+};
+
+static bool exportSink(void *context, unsigned worker, FLSlice chunk) {
+    auto state = (ExportState*)context;
+    lock_guard<mutex> lock(state->lock);
+    state->output.append((const char*)chunk.buf, chunk.size);
+    ++state->chunks;
+    return true;
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Export database") {
+    CBLError error;
+    REQUIRE(CBLDatabase_BeginBatch(db, &error));
+    for (int i = 0; i < 1000; ++i)
+        createDocument(db, ("doc" + to_string(i)).c_str(), "n", to_string(i).c_str());
+    REQUIRE(CBLDatabase_EndBatch(db, &error));
+
+    ExportState state;
+    CBLExportOptions options = {};
+    options.format = kCBLExportNDJSON;
+    options.threads = 4;
+    options.chunkSize = 4096;
+    REQUIRE(CBLDatabase_Export(db, &options, exportSink, nullptr, &state, &error));
+    CHECK(state.chunks > 4);
+
+    set<string> docIDs;
+    size_t start = 0, end;
+    while ((end = state.output.find('\n', start)) != string::npos) {
+        Doc line = Doc::fromJSON(slice(&state.output[start], end - start));
+        Dict body = line.root().asDict();
+        REQUIRE(body);
+        string docID = string(body["_id"].asString());
+        CHECK(string(body["n"].asString()) == docID.substr(3));
+        docIDs.insert(docID);
+        start = end + 1;
+    }
+    CHECK(start == state.output.size());
+    CHECK(docIDs.size() == 1000);
+}
+
+
+struct ImportState {
+    string input;
+    size_t pos = 0;
+    vector<uint64_t> progress;
+};
+
+static bool importReader(void *context, FLSlice *outChunk) {
+    // Returns a few bytes at a time, so lines are split between chunks:
+    auto state = (ImportState*)context;
+    size_t n = min(state->input.size() - state->pos, size_t(7));
+    *outChunk = {state->input.data() + state->pos, n};
+    state->pos += n;
+    return true;
+}
+
+static bool importProgress(void *context, uint64_t docsImported) {
+    ((ImportState*)context)->progress.push_back(docsImported);
+    return true;
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Import database") {
+    createDocument(db, "existing", "greeting", "hi");
+
+    ImportState state;
+    state.input = "{\"_id\":\"doc1\",\"n\":1}\n"
+                  "{\"_id\":\"doc2\"}\r\n"
+                  "\n"
+                  "{\"n\":3,\"_id\":\"doc3\"}\n"
+                  "{\"_id\":\"doc\\u0034\",\"n\":4}\n"
+                  "{\"_id\":\"existing\",\"greeting\":\"bye\"}\n"
+                  "{\"n\":6}";
+    CBLImportOptions options = {};
+    options.format = kCBLExportNDJSON;
+    options.batchSize = 2;
+    options.progress = importProgress;
+    uint64_t count;
+    CBLError error;
+    REQUIRE(CBLDatabase_Import(db, &options, importReader, &state, &count, &error));
+    CHECK(count == 6);
+    CHECK(state.progress == (vector<uint64_t>{2, 4, 6}));
+    CHECK(CBLDatabase_Count(db) == 6);
+
+    const char* docIDs[] = {"doc1", "doc2", "doc3", "doc4"};
+    for (int i = 0; i < 4; ++i) {
+        const CBLDocument *doc = CBLDatabase_GetDocument(db, docIDs[i]);
+        REQUIRE(doc);
+        Dict props = CBLDocument_Properties(doc);
+        CHECK(!props["_id"]);
+        if (i != 1)
+            CHECK(props["n"].asInt() == i + 1);
+        CBLDocument_Release(doc);
+    }
+    const CBLDocument *doc = CBLDatabase_GetDocument(db, "existing");
+    REQUIRE(doc);
+    CHECK(Dict(CBLDocument_Properties(doc))["greeting"].asString() == "bye"_sl);
+    CBLDocument_Release(doc);
+
+    state.input = "{\"_id\":\"bad\",\"n\":}\n";
+    state.pos = 0;
+    CHECK(!CBLDatabase_Import(db, &options, importReader, &state, &count, &error));
+    CHECK(error.domain == CBLFleeceDomain);
+    CHECK(count == 0);
+}
+
+
+static atomic<int> sCompactionsFinished;
+
+static void compactionCallback(void *context, CBLCompaction *compaction,
+                               CBLCompactionStage stage, int64_t bytesReclaimed,
+                               const CBLError *error)
+{
+    if (stage == kCBLCompactionFinished && !error)
+        ++sCompactionsFinished;
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Background compaction") {
+    CBLError error;
+    REQUIRE(CBLDatabase_BeginBatch(db, &error));
+    for (int i = 0; i < 100; ++i)
+        createDocument(db, ("doc" + to_string(i)).c_str(), "greeting", "hi");
+    REQUIRE(CBLDatabase_EndBatch(db, &error));
+
+    CBLCompaction *compaction = CBLDatabase_CompactAsync(db, nullptr, nullptr, &error);
+    REQUIRE(compaction);
+    int64_t bytesReclaimed = -1;
+    CHECK(CBLCompaction_Wait(compaction, &bytesReclaimed, &error));
+    CHECK(bytesReclaimed >= 0);
+    CHECK(CBLCompaction_Stage(compaction) == kCBLCompactionFinished);
+    CBLCompaction_Release(compaction);
+
+    // A compaction waits for an open batch, so it can be cancelled before it starts:
+    REQUIRE(CBLDatabase_BeginBatch(db, &error));
+    compaction = CBLDatabase_CompactAsync(db, nullptr, nullptr, &error);
+    REQUIRE(compaction);
+    this_thread::sleep_for(chrono::milliseconds(50));
+    CHECK(CBLCompaction_Stage(compaction) == kCBLCompactionWaiting);
+    CBLCompaction_Cancel(compaction);
+    REQUIRE(CBLDatabase_EndBatch(db, &error));
+    CHECK(!CBLCompaction_Wait(compaction, nullptr, &error));
+    CHECK(error.domain == CBLPOSIXDomain);
+    CHECK(error.code == ECANCELED);
+    CBLCompaction_Release(compaction);
+
+    // Closing the database waits for a compaction to finish (or cancels it if it's waiting):
+    compaction = CBLDatabase_CompactAsync(db, nullptr, nullptr, &error);
+    REQUIRE(compaction);
+    REQUIRE(CBLDatabase_Close(db, &error));
+    CHECK(CBLCompaction_Stage(compaction) == kCBLCompactionFinished);
+    CBLCompaction_Release(compaction);
+
+    // ...and a closed database can't start one:
+    error = {};
+    CHECK(!CBLDatabase_CompactAsync(db, nullptr, nullptr, &error));
+    CHECK(error.domain == CBLDomain);
+    CHECK(error.code == CBLErrorNotOpen);
+    CBLDatabase_Release(db);
+    db = nullptr;
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Auto-compaction") {
+    sCompactionsFinished = 0;
+    CBLAutoCompactionOptions options = {};
+    options.growthRatio = 0.01;
+    options.minGrowth = 1;
+    options.checkInterval = 0.001;
+    CBLDatabase_SetAutoCompaction(db, &options, compactionCallback, nullptr);
+
+    for (int i = 0; i < 100 && sCompactionsFinished == 0; ++i) {
+        createDocument(db, ("doc" + to_string(i)).c_str(), "greeting", string(1000, 'x').c_str());
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    for (int i = 0; i < 500 && sCompactionsFinished == 0; ++i)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    CHECK(sCompactionsFinished > 0);
+
+    CBLDatabase_SetAutoCompaction(db, nullptr, nullptr, nullptr);
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Auto-purge expired documents") {
+    CBLError error;
+    CBLAutoPurgeOptions options = {};
+    options.batchSize = 2;
+    options.pauseInterval = 0.001;
+    REQUIRE(CBLDatabase_SetAutoPurge(db, &options, &error));
+
+    createDocument(db, "keeper", "greeting", "hi");
+    REQUIRE(CBLDatabase_SetDocumentExpiration(db, "keeper", time(nullptr) + 3600, &error));
+
+    // Expirations set during a batch are picked up when it ends:
+    REQUIRE(CBLDatabase_BeginBatch(db, &error));
+    for (int i = 0; i < 5; ++i) {
+        string docID = "doc" + to_string(i);
+        createDocument(db, docID.c_str(), "greeting", "hi");
+        REQUIRE(CBLDatabase_SetDocumentExpiration(db, docID.c_str(), time(nullptr) - 1, &error));
+    }
+    REQUIRE(CBLDatabase_EndBatch(db, &error));
+
+    for (int i = 0; i < 500 && CBLDatabase_Count(db) > 1; ++i)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    CHECK(CBLDatabase_Count(db) == 1);
+    CHECK(CBLDatabase_NextDocExpiration(db) > time(nullptr));
+
+    REQUIRE(CBLDatabase_SetAutoPurge(db, nullptr, &error));
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Update document with patch") {
+    CBLError error;
+    string json = string(R"({"count": 0, "name": "Bob", "big": ")") + string(10000, 'x')
+                + R"(", "address": {"city": "Oakland", "zip": "94610"}})";
+    Doc original = Doc::fromJSON(json);
+    const CBLDocument *saved = CBLDatabase_UpdateDocument(db, "patched", original.root().asDict(),
+                                                          kCBLConcurrencyControlFailOnConflict,
+                                                          &error);
+    REQUIRE(saved);
+    CBLDocument_Release(saved);
+
+    MutableDict patch = MutableDict::newDict();
+    for (int i = 1; i <= 20; ++i) {
+        patch["count"] = i;
+        saved = CBLDatabase_UpdateDocument(db, "patched", patch,
+                                           kCBLConcurrencyControlLastWriteWins, &error);
+        REQUIRE(saved);
+        CHECK(Dict(CBLDocument_Properties(saved))["count"].asInt() == i);
+        CBLDocument_Release(saved);
+    }
+
+    Doc nested = Doc::fromJSON(R"({"name": null, "address": {"zip": "94611"},
+                                   "tags": {"new": true, "old": null}})");
+    saved = CBLDatabase_UpdateDocument(db, "patched", nested.root().asDict(),
+                                       kCBLConcurrencyControlFailOnConflict, &error);
+    REQUIRE(saved);
+    CBLDocument_Release(saved);
+
+    const CBLDocument *doc = CBLDatabase_GetDocument(db, "patched");
+    REQUIRE(doc);
+    Dict props = CBLDocument_Properties(doc);
+    CHECK(props["count"].asInt() == 20);
+    CHECK(!props["name"]);
+    CHECK(props["big"].asString().size == 10000);
+    CHECK(props["address"].toJSONString() == R"({"city":"Oakland","zip":"94611"})");
+    CHECK(props["tags"].toJSONString() == R"({"new":true})");
+    CHECK(props.count() == 4);
+
+    // Mutable copies share unchanged values, but changes aren't shared:
+    CBLDocument *copy1 = CBLDocument_MutableCopy(doc);
+    MutableDict address = MutableDict(CBLDocument_MutableProperties(copy1)).getMutableDict("address"_sl);
+    address["city"] = "Berkeley";
+    CBLDocument *copy2 = CBLDocument_MutableCopy(copy1);
+    MutableDict(CBLDocument_MutableProperties(copy2)).getMutableDict("address"_sl)["zip"] = "94703";
+    CHECK(address.toJSONString() == R"({"city":"Berkeley","zip":"94611"})");
+    saved = CBLDatabase_SaveDocument(db, copy2, kCBLConcurrencyControlFailOnConflict, &error);
+    REQUIRE(saved);
+    CHECK(Dict(CBLDocument_Properties(saved)).toJSONString()
+          == string(R"({"address":{"city":"Berkeley","zip":"94703"},"big":")") + string(10000, 'x')
+             + R"(","count":20,"tags":{"new":true}})");
+    CBLDocument_Release(saved);
+    CBLDocument_Release(copy2);
+    CBLDocument_Release(copy1);
+    CBLDocument_Release(doc);
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Document cache") {
+    CBLDatabase_SetDocumentCacheCapacity(db, 100000);
+    createDocument(db, "hot", "greeting", "hi");
+
+    auto greeting = [&](const char *docID) -> string {
+        const CBLDocument *doc = CBLDatabase_GetDocument(db, docID);
+        if (!doc)
+            return "";
+        string result(Dict(CBLDocument_Properties(doc))["greeting"].asString());
+        CBLDocument_Release(doc);
+        return result;
+    };
+
+    CHECK(greeting("hot") == "hi");
+    CHECK(greeting("hot") == "hi");
+    CHECK(greeting("hot") == "hi");
+    CBLDocumentCacheStats stats = CBLDatabase_DocumentCacheStats(db);
+    CHECK(stats.misses == 1);
+    CHECK(stats.hits == 2);
+    CHECK(stats.count == 1);
+    CHECK(stats.capacity == 100000);
+
+    // A change made through this connection invalidates the entry:
+    createDocument(db, "hot", "greeting", "hello");
+    CHECK(greeting("hot") == "hello");
+    CHECK(CBLDatabase_DocumentCacheStats(db).misses == 2);
+
+    // So does a change made through another connection:
+    CBLError error;
+    CBLDatabase *otherDB = CBLDatabase_Open(kDatabaseName, &kDatabaseConfiguration, &error);
+    REQUIRE(otherDB);
+    createDocument(otherDB, "hot", "greeting", "howdy");
+    CHECK(greeting("hot") == "howdy");
+    CHECK(CBLDatabase_Close(otherDB, &error));
+    CBLDatabase_Release(otherDB);
+
+    // A mutable document can also come from the cache:
+    CBLDocument *mutableDoc = CBLDatabase_GetMutableDocument(db, "hot");
+    REQUIRE(mutableDoc);
+    CHECK(CBLDatabase_DocumentCacheStats(db).hits == 3);
+    const CBLDocument *cachedDoc = CBLDatabase_GetDocument(db, "hot");
+    MutableDict props = CBLDocument_MutableProperties(mutableDoc);
+    props["greeting"] = "hiya";
+    const CBLDocument *savedDoc = CBLDatabase_SaveDocument(db, mutableDoc,
+                                                           kCBLConcurrencyControlFailOnConflict,
+                                                           &error);
+    REQUIRE(savedDoc);
+    CBLDocument_Release(savedDoc);
+    CBLDocument_Release(mutableDoc);
+    // Saving didn't change the revision that other instances share:
+    CHECK(Dict(CBLDocument_Properties(cachedDoc))["greeting"].asString() == "howdy"_sl);
+    CBLDocument_Release(cachedDoc);
+    CHECK(greeting("hot") == "hiya");
+
+    // Shrinking the cache evicts documents:
+    CHECK(greeting("missing") == "");
+    CBLDatabase_SetDocumentCacheCapacity(db, 10);
+    stats = CBLDatabase_DocumentCacheStats(db);
+    CHECK(stats.count == 0);
+    CHECK(stats.size == 0);
+    CBLDatabase_SetDocumentCacheCapacity(db, 0);
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Document ID strategies") {
+    CBLError error;
+    auto saveNew = [&]() -> string {
+        CBLDocument *doc = CBLDocument_New(nullptr);
+        const CBLDocument *saved = CBLDatabase_SaveDocument(db, doc,
+                                                            kCBLConcurrencyControlFailOnConflict,
+                                                            &error);
+        string docID;
+        if (saved) {
+            docID = CBLDocument_ID(saved);
+            CHECK(docID == CBLDocument_ID(doc));
+            CBLDocument_Release(saved);
+        }
+        CBLDocument_Release(doc);
+        return docID;
+    };
+
+    // Default random IDs:
+    string randomID = saveNew();
+    CHECK(randomID.size() == 23);
+    CHECK(randomID[0] == '-');
+
+    // An unsaved doc gets a random ID when it's asked for, which it keeps when saved:
+    CBLDatabase_SetDocumentIDStrategy(db, kCBLDocumentIDMonotonic, nullptr, nullptr);
+    CBLDocument *doc = CBLDocument_New(nullptr);
+    string earlyID = CBLDocument_ID(doc);
+    CHECK(earlyID.size() == 23);
+    const CBLDocument *saved = CBLDatabase_SaveDocument(db, doc,
+                                                        kCBLConcurrencyControlFailOnConflict,
+                                                        &error);
+    REQUIRE(saved);
+    CHECK(string(CBLDocument_ID(saved)) == earlyID);
+    CBLDocument_Release(saved);
+    CBLDocument_Release(doc);
+
+    // Monotonic IDs:
+    string lastID;
+    for (int i = 0; i < 100; ++i) {
+        string docID = saveNew();
+        CHECK(docID.size() == 26);
+        CHECK(docID > lastID);
+        lastID = docID;
+    }
+
+    // Custom IDs:
+    unsigned counter = 0;
+    CBLDatabase_SetDocumentIDStrategy(db, kCBLDocumentIDCustom,
+                                      [](void *context, char *buf, size_t bufSize) -> size_t {
+        auto &n = *(unsigned*)context;
+        if (n == 2)
+            return 0;
+        return snprintf(buf, bufSize, "doc-%u", ++n);
+    }, &counter);
+    CHECK(saveNew() == "doc-1");
+    CHECK(saveNew() == "doc-2");
+    CHECK(saveNew() == "");
+    CHECK(error.domain == CBLDomain);
+    CHECK(error.code == CBLErrorBadDocID);
+    CHECK(CBLDatabase_Count(db) == 104);
+
+    // Imported docs without an `_id` use the strategy too, and fail if the generator does:
+    ImportState state;
+    state.input = "{\"n\":1}\n";
+    CBLImportOptions options = {};
+    options.format = kCBLExportNDJSON;
+    uint64_t count;
+    CHECK(!CBLDatabase_Import(db, &options, importReader, &state, &count, &error));
+    CHECK(error.domain == CBLDomain);
+    CHECK(error.code == CBLErrorBadDocID);
+    CHECK(count == 0);
+
+    counter = 10;
+    state.input = "{\"n\":1}\n{\"n\":2}\n";
+    state.pos = 0;
+    REQUIRE(CBLDatabase_Import(db, &options, importReader, &state, &count, &error));
+    CHECK(count == 2);
+    for (const char *docID : {"doc-11", "doc-12"}) {
+        const CBLDocument *imported = CBLDatabase_GetDocument(db, docID);
+        REQUIRE(imported);
+        CBLDocument_Release(imported);
+    }
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Document arena") {
+    CBLError error;
+    const CBLDocument *survivor = nullptr;
+    CBLArena *arena = CBLArena_Begin(4096);
+    for (int i = 0; i < 1000; ++i) {
+        CBLDocument *doc = CBLDocument_New(nullptr);
+        FLMutableDict_SetInt(CBLDocument_MutableProperties(doc), "n"_sl, i);
+        const CBLDocument *saved = CBLDatabase_SaveDocument(db, doc,
+                                                            kCBLConcurrencyControlFailOnConflict,
+                                                            &error);
+        REQUIRE(saved);
+        if (i == 500)
+            survivor = saved;
+        else
+            CBLDocument_Release(saved);
+        CBLDocument_Release(doc);
+    }
+
+    // Nested arena:
+    CBLArena *inner = CBLArena_Begin(0);
+    CBLDocument *doc = CBLDocument_New("inner");
+    CBLArena_End(inner);
+    CBLDocument_Release(doc);
+
+    CBLArena_End(arena);
+    CHECK(CBLDatabase_Count(db) == 1000);
+
+    // A document allocated in the arena outlives it:
+    REQUIRE(survivor);
+    CHECK(Dict(CBLDocument_Properties(survivor))["n"].asInt() == 500);
+    CBLDocument_Release(survivor);
+
+    // Documents created after the arena ends come from the heap:
+    doc = CBLDocument_New("after");
+    CHECK(string(CBLDocument_ID(doc)) == "after");
+    CBLDocument_Release(doc);
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Group commit") {
+    CBLGroupCommitOptions options = {0.05, 200};
+    CBLDatabase_SetGroupCommit(db, &options);
+    CBLDatabaseMetrics before = CBLDatabase_GetMetrics(db);
+
+    // Several threads saving at once share commits:
+    static constexpr unsigned kThreads = 4, kDocsPerThread = 100;
+    atomic<unsigned> failures {0};
+    vector<thread> threads;
+    for (unsigned t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t]{
+            for (unsigned i = 0; i < kDocsPerThread; ++i) {
+                string docID = "doc-" + to_string(t) + "-" + to_string(i);
+                CBLDocument *doc = CBLDocument_New(docID.c_str());
+                FLMutableDict_SetInt(CBLDocument_MutableProperties(doc), "n"_sl, i);
+                CBLError error;
+                const CBLDocument *saved = CBLDatabase_SaveDocument(db, doc,
+                                                        kCBLConcurrencyControlFailOnConflict,
+                                                        &error);
+                if (!saved || CBLDocument_Sequence(saved) == 0)
+                    ++failures;
+                CBLDocument_Release(saved);
+                CBLDocument_Release(doc);
+            }
+        });
+    }
+    for (auto &th : threads)
+        th.join();
+    CHECK(failures == 0);
+    CHECK(CBLDatabase_Count(db) == kThreads * kDocsPerThread);
+    CBLDatabaseMetrics after = CBLDatabase_GetMetrics(db);
+    CHECK(after.documentsWritten - before.documentsWritten == kThreads * kDocsPerThread);
+    CHECK(after.commits - before.commits < kThreads * kDocsPerThread);
+
+    // A queued save reports a conflict to its callback:
+    struct Result {
+        mutex m;
+        unsigned called = 0;
+        unsigned saved = 0;
+        int errorCode = 0;
+    } result;
+    auto completion = [](void *context, const CBLDocument *savedDoc, const CBLError *error) {
+        auto r = (Result*)context;
+        lock_guard<mutex> lock(r->m);
+        ++r->called;
+        if (savedDoc)
+            ++r->saved;
+        else
+            r->errorCode = error->code;
+    };
+    CBLDocument *doc = CBLDocument_New("queued");
+    CBLDatabase_QueueSaveDocument(db, doc, kCBLConcurrencyControlFailOnConflict,
+                                  completion, &result);
+    CBLDocument *conflicting = CBLDocument_New("doc-0-0");
+    CBLDatabase_QueueSaveDocument(db, conflicting, kCBLConcurrencyControlFailOnConflict,
+                                  completion, &result);
+
+    // Disabling group commit commits the queue first:
+    CBLDatabase_SetGroupCommit(db, nullptr);
+    {
+        lock_guard<mutex> lock(result.m);
+        CHECK(result.called == 2);
+        CHECK(result.saved == 1);
+        CHECK(result.errorCode == CBLErrorConflict);
+    }
+    const CBLDocument *queued = CBLDatabase_GetDocument(db, "queued");
+    CHECK(queued);
+    CBLDocument_Release(queued);
+
+    // With group commit off, the callback is called immediately:
+    CBLDocument_Release(doc);
+    doc = CBLDocument_New("immediate");
+    CBLDatabase_QueueSaveDocument(db, doc, kCBLConcurrencyControlFailOnConflict,
+                                  completion, &result);
+    CHECK(result.called == 3);
+    CBLDocument_Release(doc);
+    CBLDocument_Release(conflicting);
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Async save, get and query") {
+    SECTION("Without group commit") { }
+    SECTION("With group commit") {
+        // (The get and query still have to wait for the save to be committed)
+        CBLGroupCommitOptions options = {0.05, 200};
+        CBLDatabase_SetGroupCommit(db, &options);
+    }
+
+    atomic<int> readyCalls {0};
+    CBLDatabase_BufferNotifications(db, [](void *context, CBLDatabase*) {
+        ++*(atomic<int>*)context;
+    }, &readyCalls);
+
+    // The completions are only called by CBLDatabase_SendNotifications, on this thread:
+    struct Results {
+        int saved = 0;
+        string gotID;
+        bool gotMissing = false;
+        int rows = -1;
+    } results;
+
+    CBLDocument *doc = CBLDocument_New("async");
+    FLMutableDict_SetInt(CBLDocument_MutableProperties(doc), "n"_sl, 17);
+    CBLDatabase_SaveDocumentAsync(db, doc, kCBLConcurrencyControlFailOnConflict,
+                                  [](void *context, const CBLDocument *saved,
+                                     const CBLError *error) {
+        if (saved && !error)
+            ++((Results*)context)->saved;
+    }, &results);
+    CBLDocument_Release(doc);
+
+    // Async calls run in order, so these see the saved doc:
+    CBLDatabase_GetDocumentAsync(db, "async", [](void *context, const CBLDocument *doc) {
+        if (doc)
+            ((Results*)context)->gotID = CBLDocument_ID(doc);
+    }, &results);
+    CBLDatabase_GetDocumentAsync(db, "missing", [](void *context, const CBLDocument *doc) {
+        ((Results*)context)->gotMissing = (doc == nullptr);
+    }, &results);
+
+    CBLError error;
+    CBLQuery *query = CBLQuery_New(db, kCBLN1QLLanguage, "SELECT n FROM _", nullptr, &error);
+    REQUIRE(query);
+    CBLQuery_ExecuteAsync(query, [](void *context, CBLQuery*, CBLResultSet *rs,
+                                    const CBLError*) {
+        int rows = 0;
+        while (rs && CBLResultSet_Next(rs))
+            ++rows;
+        ((Results*)context)->rows = rows;
+    }, &results);
+    CBLQuery_Release(query);
+
+    for (int i = 0; i < 500 && readyCalls == 0; ++i)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    CHECK(readyCalls > 0);
+    CHECK(results.saved == 0);
+
+    for (int i = 0; i < 500 && results.rows < 0; ++i) {
+        CBLDatabase_SendNotifications(db);
+        if (results.rows < 0)
+            this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    CHECK(results.saved == 1);
+    CHECK(results.gotID == "async");
+    CHECK(results.gotMissing);
+    CHECK(results.rows == 1);
+}
+
+
+TEST_CASE_METHOD(CBLTest, "Lazy and parallel open") {
+    CBLError error;
+    CBLDocument *doc = CBLDocument_New("lazy");
+    const CBLDocument *saved = CBLDatabase_SaveDocument(db, doc,
+                                                        kCBLConcurrencyControlFailOnConflict, &error);
+    REQUIRE(saved);
+    CBLDocument_Release(saved);
+
+    // A lazily-opened database is opened by the first call that needs it:
+    CBLDatabaseConfiguration config = kDatabaseConfiguration;
+    config.flags = kCBLDatabase_Lazy;
+    CBLDatabase *lazy = CBLDatabase_Open(kDatabaseName, &config, &error);
+    REQUIRE(lazy);
+    CHECK(string(CBLDatabase_Path(lazy)) == string(CBLDatabase_Path(db)));
+    CHECK(CBLDatabase_Count(lazy) == 1);
+    CHECK(CBLDatabase_EnsureOpen(lazy, &error));
+    CHECK(CBLDatabase_Close(lazy, &error));
+    CBLDatabase_Release(lazy);
+
+    // One that's closed without being used is never opened:
+    lazy = CBLDatabase_Open(kDatabaseName, &config, &error);
+    REQUIRE(lazy);
+    CHECK(CBLDatabase_Close(lazy, &error));
+    CHECK(!CBLDatabase_EnsureOpen(lazy, &error));
+    CHECK(error.domain == CBLDomain);
+    CHECK(error.code == CBLErrorNotOpen);
+
+    // and calls that need it fail, or return nothing:
+    CHECK(CBLDatabase_Count(lazy) == 0);
+    CHECK(CBLDatabase_GetDocument(lazy, "lazy") == nullptr);
+    error = {};
+    CHECK(!CBLDatabase_SaveDocument(lazy, doc, kCBLConcurrencyControlFailOnConflict, &error));
+    CHECK(error.domain == CBLDomain);
+    CHECK(error.code == CBLErrorNotOpen);
+    CBLDocument_Release(doc);
+    CBLDatabase_Release(lazy);
+
+    // Without kCBLDatabase_Create, a missing database still fails up front:
+    CHECK(!CBLDatabase_Open("CBLtest_missing", &config, &error));
+    CHECK(error.domain == CBLDomain);
+    CHECK(error.code == CBLErrorNotFound);
+
+    // Open several databases in parallel, one of which doesn't exist:
+    const char* names[] = {"CBLtest_many_0", "CBLtest_many_1", "CBLtest_many_2",
+                           "CBLtest_many_missing"};
+    const size_t kCount = sizeof(names) / sizeof(names[0]);
+    for (auto name : names)
+        CBL_DeleteDatabase(name, kDatabaseDir.c_str(), &error);
+    for (size_t i = 0; i < kCount - 1; ++i) {
+        CBLDatabase *created = CBLDatabase_Open(names[i], &kDatabaseConfiguration, &error);
+        REQUIRE(created);
+        CBLDatabase_Release(created);
+    }
+    config.flags = kCBLDatabase_Lazy;               // (ignored by OpenMany)
+    CBLDatabase* dbs[kCount];
+    CBLError errors[kCount] = {};
+    CHECK(CBLDatabase_OpenMany(names, kCount, &config, 2, dbs, errors) == kCount - 1);
+    for (size_t i = 0; i < kCount - 1; ++i) {
+        REQUIRE(dbs[i]);
+        CHECK(string(CBLDatabase_Name(dbs[i])) == names[i]);
+        CHECK(CBLDatabase_Delete(dbs[i], &error));
+        CBLDatabase_Release(dbs[i]);
+    }
+    CHECK(dbs[kCount - 1] == nullptr);
+    CHECK(errors[kCount - 1].code == CBLErrorNotFound);
+}
@@ -19,6 +19,7 @@
 #include "CBLTest.hh"
 #include "fleece/Fleece.hh"
 #include "fleece/Mutable.hh"
+#include <future>
 #include <string>
 
 #include "cbl++/CouchbaseLite.hh"
@@ -84,6 +85,23 @@ TEST_CASE_METHOD(CBLTest_Cpp, "C++ Save Document With Property") {
 }
 
 
+TEST_CASE_METHOD(CBLTest_Cpp, "C++ Document Properties Without Document") {
+    MutableDocument doc("foo");
+    doc["greeting"] = "Howdy!";
+    db.saveDocument(doc);
+
+    int calls = 0;
+    CHECK(db.withDocumentProperties("foo", [&](const char *docID, Dict props) {
+        ++calls;
+        CHECK(string(docID) == "foo");
+        CHECK(props["greeting"].asString() == "Howdy!"_sl);
+    }));
+    CHECK(calls == 1);
+    CHECK(!db.withDocumentProperties("bar", [&](const char *docID, Dict props) {++calls;}));
+    CHECK(calls == 1);
+}
+
+
 static void createDocument(Database db, const char *docID,
                            const char *property, const char *value)
 {
@@ -170,3 +188,74 @@ TEST_CASE_METHOD(CBLTest_Cpp, "C++ Scheduled database notifications") {
     CHECK(fooListenerCalls == 1);
     CHECK(barListenerCalls == 1);
 }
+
+
+TEST_CASE_METHOD(CBLTest_Cpp, "C++ Query") {
+    createDocument(db, "doc1", "name", "Alice");
+    createDocument(db, "doc2", "name", "Bob");
+    createDocument(db, "doc3", "name", "Carol");
+
+    Query query(db, kCBLN1QLLanguage, "SELECT name, meta().id AS id FROM _ ORDER BY name");
+    CHECK(query.columnCount() == 2);
+    CHECK(query.columnName(0) == "name"_sl);
+    CHECK((query.columnNames() == vector<string>{"name", "id"}));
+
+    Column idCol = query.column("id");
+    CHECK(idCol.index == 1);
+    CHECK_THROWS_AS(query.column("age"), std::invalid_argument);
+
+    vector<string> names, ids;
+    ResultSet results = query.execute();
+    for (const Result &result : results) {
+        names.push_back(result[0].asString().asString());
+        ids.push_back(result[idCol].asString().asString());
+        CHECK(result["id"].asString() == result[idCol].asString());
+    }
+    CHECK((names == vector<string>{"Alice", "Bob", "Carol"}));
+    CHECK((ids == vector<string>{"doc1", "doc2", "doc3"}));
+    CHECK_THROWS_AS(results.begin(), std::logic_error);
+
+    // Moving a wrapper transfers its reference:
+    Query moved = std::move(query);
+    CHECK(moved);
+    CHECK(!query);
+    query = std::move(moved);
+    CHECK(query);
+    CHECK(!moved);
+    unsigned count = 0;
+    for (auto &result : query.execute()) {
+        CHECK(result[idCol]);
+        ++count;
+    }
+    CHECK(count == 3);
+}
+
+
+TEST_CASE_METHOD(CBLTest_Cpp, "C++ Async") {
+    MutableDocument doc("async");
+    doc["greeting"] = "hi";
+    promise<string> saved;
+    db.saveDocumentAsync(doc, kCBLConcurrencyControlFailOnConflict,
+                         [&](Document savedDoc, const CBLError *error) {
+        saved.set_value(savedDoc && !error ? savedDoc.id() : "");
+    });
+    CHECK(saved.get_future().get() == "async");
+
+    promise<string> got;
+    db.getDocumentAsync("async", [&](Document gotDoc) {
+        got.set_value(gotDoc ? gotDoc["greeting"].asString().asString() : "");
+    });
+    CHECK(got.get_future().get() == "hi");
+
+    Query query(db, kCBLN1QLLanguage, "SELECT greeting FROM _");
+    promise<vector<string>> rows;
+    query.executeAsync([&](ResultSet results, const CBLError *error) {
+        vector<string> greetings;
+        if (!error) {
+            for (const Result &result : results)
+                greetings.push_back(result[0].asString().asString());
+        }
+        rows.set_value(greetings);
+    });
+    CHECK((rows.get_future().get() == vector<string>{"hi"}));
+}
@@ -0,0 +1,109 @@
+//
+// LogTest.cc
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "CBLTest.hh"
+#include "CBLLog.h"
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+struct LoggedMessage {
+    CBLLogLevel level;
+    CBLLogDomain domain;
+    string message;
+};
+
+static mutex sLogMutex;
+static vector<LoggedMessage> sLogged;
+
+static void logCallback(CBLLogLevel level, CBLLogDomain domain, const char *message) {
+    lock_guard<mutex> lock(sLogMutex);
+    sLogged.push_back({level, domain, message});
+}
+
+static bool fileExists(const string &path) {
+    FILE *f = fopen(path.c_str(), "r");
+    if (f)
+        fclose(f);
+    return f != nullptr;
+}
+
+
+TEST_CASE("Log Callback") {
+    sLogged.clear();
+    CBLLog_SetCallback(logCallback);
+    CHECK(CBLLog_Callback() == logCallback);
+
+    CBL_Log(kCBLLogDomainQuery, CBLLogWarning, "Hello %s #%d", "log", 42);
+    CBL_Log(kCBLLogDomainQuery, CBLLogDebug, "Nobody sees this");     // below the domain level
+    CBLLog_Flush();
+
+    {
+        lock_guard<mutex> lock(sLogMutex);
+        bool found = false;
+        for (auto &logged : sLogged) {
+            CHECK(logged.message != "Nobody sees this");
+            if (logged.message == "Hello log #42") {
+                found = true;
+                CHECK(logged.level == CBLLogWarning);
+                CHECK(logged.domain == kCBLLogDomainQuery);
+            }
+        }
+        CHECK(found);
+    }
+
+    // Long messages don't fit in the formatting buffer:
+    string longString(2000, 'x');
+    CBL_Log(kCBLLogDomainDatabase, CBLLogWarning, "%s", longString.c_str());
+    CBLLog_Flush();
+    {
+        lock_guard<mutex> lock(sLogMutex);
+        REQUIRE(!sLogged.empty());
+        CHECK(sLogged.back().message == longString);
+    }
+
+    CBLLog_SetCallback(nullptr);
+}
+
+
+TEST_CASE("Log File Rotation") {
+    string dir = CBLTest::kDatabaseDir;
+    for (int gen = 0; gen <= 2; ++gen)
+        remove((dir + (gen ? "/cbl." + to_string(gen) : "/cbl") + ".log").c_str());
+
+    CBLLogFileConfiguration config = {dir.c_str(), 2, 1000, true};
+    CBLLog_SetFileConfig(config);
+    REQUIRE(CBLLog_FileConfig() != nullptr);
+    CHECK(string(CBLLog_FileConfig()->directory) == dir);
+
+    for (int i = 0; i < 100; ++i)
+        CBL_Log(kCBLLogDomainDatabase, CBLLogWarning, "Log file test message #%d", i);
+    CBLLog_Flush();
+    CHECK(fileExists(dir + "/cbl.log"));
+    CHECK(fileExists(dir + "/cbl.1.log"));
+    CHECK(fileExists(dir + "/cbl.2.log"));
+    CHECK(!fileExists(dir + "/cbl.3.log"));
+
+    CBLLogFileConfiguration off = {nullptr, 0, 0, false};
+    CBLLog_SetFileConfig(off);
+    CHECK(CBLLog_FileConfig() == nullptr);
+}
@@ -0,0 +1,555 @@
+//
+// QueryTest.cc
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "CBLTest.hh"
+#include "fleece/Fleece.hh"
+#include "fleece/Mutable.hh"
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace fleece;
+
+
+class QueryTest : public CBLTest {
+public:
+    static const int kNumDocs = 10;
+
+    QueryTest() {
+        CBLError error;
+        REQUIRE(CBLDatabase_BeginBatch(db, &error));
+        for (int i = 0; i < kNumDocs; ++i) {
+            string docID = "doc" + to_string(i);
+            CBLDocument* doc = CBLDocument_New(docID.c_str());
+            MutableDict props = CBLDocument_MutableProperties(doc);
+            props["n"_sl] = i;
+            props["name"_sl] = docID;
+            const CBLDocument *saved = CBLDatabase_SaveDocument(db, doc, kCBLConcurrencyControlFailOnConflict, &error);
+            REQUIRE(saved);
+            CBLDocument_Release(saved);
+            CBLDocument_Release(doc);
+        }
+        REQUIRE(CBLDatabase_EndBatch(db, &error));
+    }
+
+    CBLQuery* newQuery(const char *json5) {
+        CBLError error;
+        CBLQuery *query = CBLQuery_New(db, kCBLJSONLanguage, json5, nullptr, &error);
+        REQUIRE(query);
+        return query;
+    }
+};
+
+
+TEST_CASE_METHOD(QueryTest, "Query Result Batches") {
+    CBLQuery *query = newQuery("{WHAT: [['.n'], ['.name'], ['.nope']], ORDER_BY: [['.n']]}");
+    CHECK(CBLQuery_ColumnCount(query) == 3);
+    CBLError error;
+    CBLResultSet *rs = CBLQuery_Execute(query, &error);
+    REQUIRE(rs);
+    CHECK(CBLResultSet_GetQuery(rs) == query);
+
+    bool columnMajor = false;
+    SECTION("Row-major") {
+        columnMajor = false;
+    }
+    SECTION("Column-major") {
+        columnMajor = true;
+    }
+
+    static const unsigned kBatchSize = 4;
+    FLValue cells[kBatchSize * 3];
+    int expected = 0;
+    unsigned nRows;
+    while ((nRows = CBLResultSet_NextBatch(rs, kBatchSize, columnMajor, cells)) > 0) {
+        CHECK(nRows == min(kBatchSize, unsigned(kNumDocs - expected)));
+        for (unsigned row = 0; row < nRows; ++row, ++expected) {
+            auto cell = [&](unsigned col) {
+                return Value(cells[columnMajor ? (col * kBatchSize + row) : (row * 3 + col)]);
+            };
+            CHECK(cell(0).asInt() == expected);
+            CHECK(cell(1).asString().asString() == "doc" + to_string(expected));
+            CHECK(!cell(2));
+        }
+    }
+    CHECK(expected == kNumDocs);
+
+    CBLResultSet_Release(rs);
+    CBLQuery_Release(query);
+}
+
+
+static bool appendJSON(void *context, FLSlice chunk) {
+    auto chunks = (vector<string>*)context;
+    chunks->push_back(slice(chunk).asString());
+    return chunks->size() < 3;
+}
+
+
+TEST_CASE_METHOD(QueryTest, "Query Results As JSON Stream") {
+    CBLQuery *query = newQuery("{WHAT: [['.n'], ['.name'], ['.nope']], ORDER_BY: [['.n']]}");
+    CBLError error;
+    vector<string> chunks;
+
+    SECTION("Arrays") {
+        CHECK(CBLQuery_ExecuteToJSONStream(query, appendJSON, &chunks, nullptr, &error) == kNumDocs);
+        REQUIRE(chunks.size() == 1);
+        string expected;
+        for (int i = 0; i < kNumDocs; ++i)
+            expected += "[" + to_string(i) + ",\"doc" + to_string(i) + "\",null]\n";
+        CHECK(chunks[0] == expected);
+    }
+    SECTION("Objects") {
+        CBLJSONStreamOptions options = {kCBLJSONRowObjects, 0};
+        CHECK(CBLQuery_ExecuteToJSONStream(query, appendJSON, &chunks, &options, &error) == kNumDocs);
+        REQUIRE(chunks.size() == 1);
+        CHECK(chunks[0].substr(0, 23) == "{\"n\":0,\"name\":\"doc0\"}\n{");
+    }
+    SECTION("Small chunks") {
+        // Each row is ~16 bytes, so this puts two rows in each chunk; the callback stops
+        // the query after the third chunk:
+        CBLJSONStreamOptions options = {kCBLJSONRowArrays, 20};
+        CHECK(CBLQuery_ExecuteToJSONStream(query, appendJSON, &chunks, &options, &error) == 4);
+        REQUIRE(chunks.size() == 3);
+        CHECK(chunks[0] == "[0,\"doc0\",null]\n[1,\"doc1\",null]\n");
+        CHECK(chunks[2] == "[4,\"doc4\",null]\n[5,\"doc5\",null]\n");
+    }
+
+    CBLQuery_Release(query);
+}
+
+
+TEST_CASE_METHOD(QueryTest, "Query Cache") {
+    static const char* kQuery = "{WHAT: [['.name']], WHERE: ['=', ['.n'], ['$N']]}";
+    CBLQueryCacheStats stats = CBLDatabase_QueryCacheStats(db);
+    CHECK(stats.count == 0);
+    CHECK(stats.capacity > 0);
+    uint64_t misses = stats.misses, hits = stats.hits;
+
+    CBLQuery *query = newQuery(kQuery);
+    MutableDict params = MutableDict::newDict();
+    params["N"_sl] = 3;
+    CBLQuery_SetParameters(query, params);
+    CBLQuery_Release(query);
+
+    stats = CBLDatabase_QueryCacheStats(db);
+    CHECK(stats.misses == misses + 1);
+    CHECK(stats.hits == hits);
+    CHECK(stats.count == 1);
+
+    // Creating the same query again reuses the compiled query, without its parameters:
+    query = newQuery(kQuery);
+    stats = CBLDatabase_QueryCacheStats(db);
+    CHECK(stats.hits == hits + 1);
+    CHECK(stats.count == 0);
+    CHECK(CBLQuery_Parameters(query) == nullptr);
+
+    // A second query with the same text doesn't share the first one's compiled query:
+    CBLQuery *query2 = newQuery(kQuery);
+    CHECK(CBLDatabase_QueryCacheStats(db).misses == misses + 2);
+
+    params["N"_sl] = 7;
+    CBLQuery_SetParameters(query2, params);
+    CBLError error;
+    CBLResultSet *rs = CBLQuery_Execute(query2, &error);
+    REQUIRE(rs);
+    REQUIRE(CBLResultSet_Next(rs));
+    CHECK(Value(CBLResultSet_ValueAtIndex(rs, 0)).asString() == "doc7"_sl);
+    CBLResultSet_Release(rs);
+
+    CBLQuery_Release(query);
+    CBLQuery_Release(query2);
+    CHECK(CBLDatabase_QueryCacheStats(db).count == 1);
+
+    CBLDatabase_SetQueryCacheCapacity(db, 0);
+    stats = CBLDatabase_QueryCacheStats(db);
+    CHECK(stats.count == 0);
+    CHECK(stats.capacity == 0);
+}
+
+
+TEST_CASE_METHOD(QueryTest, "Query Parameter Setters") {
+    CBLQuery *query = newQuery("{WHAT: [['.name']], WHERE: ['AND', ['>=', ['.n'], ['$MIN']],"
+                                                              "['<', ['.n'], ['$MAX']]]}");
+    CBLQuery_SetParameterInt(query, "MIN", 2);
+    CBLQuery_SetParameterDouble(query, "MAX", 4.5);
+    CHECK(Dict(CBLQuery_Parameters(query)).toJSONString() == "{\"MAX\":4.5,\"MIN\":2}");
+
+    auto countResults = [](CBLResultSet *rs) {
+        REQUIRE(rs);
+        int n = 0;
+        while (CBLResultSet_Next(rs))
+            ++n;
+        CBLResultSet_Release(rs);
+        return n;
+    };
+
+    CBLError error;
+    CHECK(countResults(CBLQuery_Execute(query, &error)) == 3);
+
+    // Changing one parameter keeps the other:
+    CBLQuery_SetParameterInt(query, "MIN", 4);
+    CHECK(countResults(CBLQuery_Execute(query, &error)) == 1);
+
+    // One-shot parameters don't replace the stored ones:
+    MutableDict params = MutableDict::newDict();
+    params["MIN"_sl] = 0;
+    params["MAX"_sl] = 10;
+    CHECK(countResults(CBLQuery_ExecuteWithParameters(query, params, &error)) == kNumDocs);
+    CHECK(Dict(CBLQuery_Parameters(query)).toJSONString() == "{\"MAX\":4.5,\"MIN\":4}");
+
+    // Setting all the parameters discards individually-set ones:
+    CHECK(CBLQuery_SetParametersAsJSON(query, "{MIN: 8, MAX: 100}"));
+    CHECK(countResults(CBLQuery_Execute(query, &error)) == 2);
+    CBLQuery_SetParameterString(query, "MAX", "zzz"_sl);
+    CHECK(Dict(CBLQuery_Parameters(query)).toJSONString() == "{\"MAX\":\"zzz\",\"MIN\":8}");
+
+    // Invalid JSON is rejected, and the parameters are left alone:
+    CHECK(!CBLQuery_SetParametersAsJSON(query, "{MIN: 8, MAX:"));
+    CHECK(Dict(CBLQuery_Parameters(query)).toJSONString() == "{\"MAX\":\"zzz\",\"MIN\":8}");
+
+    CBLQuery_Release(query);
+}
+
+
+struct DiffRecord {
+    int calls = 0;
+    unsigned oldRowCount, newRowCount;
+    vector<unsigned> removed, inserted, changed;
+};
+
+static void diffListener(void *context, CBLQuery*, CBLResultSet*, const CBLQueryDiff *diff) {
+    auto d = (DiffRecord*)context;
+    ++d->calls;
+    d->oldRowCount = diff->oldRowCount;
+    d->newRowCount = diff->newRowCount;
+    d->removed.assign(diff->removed, diff->removed + diff->removedCount);
+    d->inserted.assign(diff->inserted, diff->inserted + diff->insertedCount);
+    d->changed.assign(diff->changed, diff->changed + diff->changedCount);
+}
+
+
+TEST_CASE_METHOD(QueryTest, "Query Diff Listener") {
+    CBLQuery *query = newQuery("{WHAT: [['._id'], ['.name']], ORDER_BY: [['.n']]}");
+    CBLDatabase_BufferNotifications(db, [](void*, CBLDatabase*) { }, nullptr);
+    DiffRecord diff;
+    auto token = CBLQuery_AddDiffListener(query, 0, diffListener, &diff);
+
+    auto waitForCall = [&](int calls) {
+        for (int i = 0; i < 500 && diff.calls < calls; ++i) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+            CBLDatabase_SendNotifications(db);
+        }
+        REQUIRE(diff.calls == calls);
+    };
+
+    // Initial results: everything is inserted
+    waitForCall(1);
+    CHECK(diff.oldRowCount == 0);
+    CHECK(diff.newRowCount == kNumDocs);
+    CHECK(diff.inserted.size() == kNumDocs);
+    CHECK(diff.removed.empty());
+    CHECK(diff.changed.empty());
+
+    // Change one row's value:
+    CBLError error;
+    CBLDocument *doc = CBLDatabase_GetMutableDocument(db, "doc3");
+    REQUIRE(doc);
+    MutableDict(CBLDocument_MutableProperties(doc))["name"_sl] = "three";
+    const CBLDocument *saved = CBLDatabase_SaveDocument(db, doc, kCBLConcurrencyControlFailOnConflict, &error);
+    REQUIRE(saved);
+    CBLDocument_Release(saved);
+    CBLDocument_Release(doc);
+
+    waitForCall(2);
+    CHECK(diff.oldRowCount == kNumDocs);
+    CHECK(diff.newRowCount == kNumDocs);
+    CHECK(diff.removed.empty());
+    CHECK(diff.inserted.empty());
+    CHECK(diff.changed == vector<unsigned>{3});
+
+    // Move a row, and remove another:
+    REQUIRE(CBLDatabase_BeginBatch(db, &error));
+    doc = CBLDatabase_GetMutableDocument(db, "doc1");
+    REQUIRE(doc);
+    MutableDict(CBLDocument_MutableProperties(doc))["n"_sl] = 100;
+    saved = CBLDatabase_SaveDocument(db, doc, kCBLConcurrencyControlFailOnConflict, &error);
+    REQUIRE(saved);
+    CBLDocument_Release(saved);
+    CBLDocument_Release(doc);
+    REQUIRE(CBLDatabase_PurgeDocumentByID(db, "doc5", &error));
+    REQUIRE(CBLDatabase_EndBatch(db, &error));
+
+    waitForCall(3);
+    CHECK(diff.newRowCount == kNumDocs - 1);
+    CHECK(diff.removed == (vector<unsigned>{1, 5}));
+    CHECK(diff.inserted == vector<unsigned>{kNumDocs - 2});
+    CHECK(diff.changed.empty());
+
+    CBLListener_Remove(token);
+    CBLQuery_Release(query);
+}
+
+
+TEST_CASE_METHOD(QueryTest, "Low-Priority Query Listener") {
+    CBLQuery *query = newQuery("{WHAT: [['.name']], ORDER_BY: [['.n']]}");
+    CBLDatabase_BufferNotifications(db, [](void*, CBLDatabase*) { }, nullptr);
+    int calls = 0;
+    CBLQueryListenerOptions options = {};
+    options.priority = kCBLQueryPriorityLow;
+    auto token = CBLQuery_AddChangeListenerWithOptions(query, [](void *context, CBLQuery*) {
+        ++*(int*)context;
+    }, &calls, &options);
+
+    auto waitForCalls = [&](int n, int maxTries) {
+        for (int i = 0; i < maxTries && calls < n; ++i) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+            CBLDatabase_SendNotifications(db);
+        }
+    };
+    waitForCalls(1, 500);
+    REQUIRE(calls == 1);
+
+    // Change the results, then open a batch before the query re-runs:
+    CBLError error;
+    REQUIRE(CBLDatabase_PurgeDocumentByID(db, "doc5", &error));
+    REQUIRE(CBLDatabase_BeginBatch(db, &error));
+    waitForCalls(2, 150);
+    CHECK(calls == 1);          // notification was deferred
+
+    REQUIRE(CBLDatabase_EndBatch(db, &error));
+    waitForCalls(2, 500);
+    CHECK(calls == 2);
+
+    CBLListener_Remove(token);
+    CBLQuery_Release(query);
+}
+
+
+TEST_CASE_METHOD(QueryTest, "Query Listener Interval") {
+    CBLQuery *query = newQuery("{WHAT: [['.name']], ORDER_BY: [['.n']]}");
+    CBLDatabase_BufferNotifications(db, [](void*, CBLDatabase*) { }, nullptr);
+    int calls = 0;
+    CBLQueryListenerOptions options = {};
+    options.minInterval = 0.3;
+    auto token = CBLQuery_AddChangeListenerWithOptions(query, [](void *context, CBLQuery*) {
+        ++*(int*)context;
+    }, &calls, &options);
+
+    auto waitForCalls = [&](int n, int maxTries) {
+        for (int i = 0; i < maxTries && calls < n; ++i) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+            CBLDatabase_SendNotifications(db);
+        }
+    };
+    waitForCalls(1, 500);
+    REQUIRE(calls == 1);
+    auto firstCall = chrono::steady_clock::now();
+
+    // A change soon after is held back until the interval has passed:
+    CBLError error;
+    REQUIRE(CBLDatabase_PurgeDocumentByID(db, "doc5", &error));
+    waitForCalls(2, 500);
+    CHECK(calls == 2);
+    CHECK(chrono::steady_clock::now() - firstCall >= chrono::milliseconds(250));
+
+    CBLListener_Remove(token);
+    CBLQuery_Release(query);
+}
+
+
+TEST_CASE_METHOD(QueryTest, "Database Connection Pool") {
+    CBLError error;
+    CBLDatabasePool *pool = CBLDatabasePool_New(db, 2, &error);
+    REQUIRE(pool);
+
+    CBLDatabase *conn[2];
+    for (int i = 0; i < 2; ++i) {
+        conn[i] = CBLDatabasePool_Acquire(pool, &error);
+        REQUIRE(conn[i]);
+    }
+    CHECK(conn[0] != conn[1]);
+    CHECK(CBLDatabasePool_TryAcquire(pool, &error) == nullptr);
+    CHECK(error.code == 0);
+
+    // Pooled connections can run queries in parallel:
+    vector<thread> threads;
+    int counts[2] = {};
+    for (int i = 0; i < 2; ++i) {
+        threads.emplace_back([&, i] {
+            CBLError err;
+            CBLQuery *query = CBLQuery_New(conn[i], kCBLJSONLanguage, "{WHAT: [['.name']]}",
+                                           nullptr, &err);
+            if (!query)
+                return;
+            CBLResultSet *rs = CBLQuery_Execute(query, &err);
+            while (rs && CBLResultSet_Next(rs))
+                ++counts[i];
+            CBLResultSet_Release(rs);
+            CBLQuery_Release(query);
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    CHECK(counts[0] == kNumDocs);
+    CHECK(counts[1] == kNumDocs);
+
+    // ...and read documents, but not write them:
+    const CBLDocument *doc = CBLDatabase_GetDocument(conn[0], "doc1");
+    REQUIRE(doc);
+    CBLDocument_Release(doc);
+    CBLDocument *newDoc = CBLDocument_New("newDoc");
+    CHECK(!CBLDatabase_SaveDocument(conn[0], newDoc, kCBLConcurrencyControlLastWriteWins, &error));
+    CBLDocument_Release(newDoc);
+
+    // A returned connection is reused:
+    CBLDatabasePool_Return(pool, conn[1]);
+    CBLDatabase *again = CBLDatabasePool_TryAcquire(pool, &error);
+    CHECK(again == conn[1]);
+    CBLDatabasePool_Return(pool, again);
+    CBLDatabasePool_Return(pool, conn[0]);
+    CBLDatabasePool_Release(pool);
+}
+
+
+TEST_CASE_METHOD(QueryTest, "Create Indexes Asynchronously") {
+    CBLDatabase_BufferNotifications(db, [](void*, CBLDatabase*) { }, nullptr);
+    CBLNamedIndexSpec specs[2] = {
+        {"byN",    {kCBLValueIndex, "[[\".n\"]]"}},
+        {"byName", {kCBLFullTextIndex, "[[\".name\"]]", true}},
+    };
+    struct Progress {
+        vector<unsigned> completed;
+        bool finished = false;
+        int errorCode = -1;
+    } progress;
+    CBLError error;
+    CBLIndexBuild *build = CBLDatabase_CreateIndexesAsync(db, specs, 2,
+                [](void *context, CBLIndexBuild*, unsigned completed, unsigned total,
+                   bool finished, const CBLError *err) {
+        auto p = (Progress*)context;
+        p->completed.push_back(completed);
+        p->finished = finished;
+        p->errorCode = err ? err->code : 0;
+    }, &progress, &error);
+    REQUIRE(build);
+
+    CHECK(CBLIndexBuild_Wait(build, &error));
+    unsigned total;
+    CHECK(CBLIndexBuild_Progress(build, &total) == 2);
+    CHECK(total == 2);
+
+    CBLDatabase_SendNotifications(db);
+    CHECK(progress.completed == (vector<unsigned>{1, 2}));
+    CHECK(progress.finished);
+    CHECK(progress.errorCode == 0);
+    CBLIndexBuild_Release(build);
+
+    FLMutableArray names = CBLDatabase_IndexNames(db);
+    CHECK(Array(names).toJSONString() == "[\"byN\",\"byName\"]");
+    FLMutableArray_Release(names);
+
+    // Starting the same build again is quick, since the indexes already exist:
+    build = CBLDatabase_CreateIndexesAsync(db, specs, 2, nullptr, nullptr, &error);
+    REQUIRE(build);
+    CHECK(CBLIndexBuild_Wait(build, &error));
+    CBLIndexBuild_Release(build);
+}
+
+
+TEST_CASE_METHOD(QueryTest, "Closing Database Cancels Index Build") {
+    vector<string> names;
+    for (int i = 0; i < 20; ++i)
+        names.push_back("index" + to_string(i));
+    vector<CBLNamedIndexSpec> specs;
+    for (auto &name : names)
+        specs.push_back({name.c_str(), {kCBLValueIndex, "[[\".name\"]]"}});
+    CBLError error;
+    CBLIndexBuild *build = CBLDatabase_CreateIndexesAsync(db, specs.data(), unsigned(specs.size()),
+                                                          nullptr, nullptr, &error);
+    REQUIRE(build);
+
+    // Closing cancels the build, and waits for its thread to exit:
+    REQUIRE(CBLDatabase_Close(db, &error));
+    unsigned total;
+    unsigned completed = CBLIndexBuild_Progress(build, &total);
+    if (CBLIndexBuild_Wait(build, &error)) {
+        CHECK(completed == total);
+    } else {
+        CHECK(error.domain == CBLPOSIXDomain);
+        CHECK(error.code == ECANCELED);
+    }
+    CBLIndexBuild_Release(build);
+
+    // No more builds can be started:
+    CHECK(!CBLDatabase_CreateIndexesAsync(db, specs.data(), 1, nullptr, nullptr, &error));
+    CBLDatabase_Release(db);
+    db = nullptr;
+}
+
+
+TEST_CASE_METHOD(QueryTest, "Query Stats") {
+    CBLQuery *query = newQuery("{WHAT: [['.name']], WHERE: ['>', ['.n'], 4]}");
+    CBLQueryStats stats = CBLQuery_GetStats(query);
+    CHECK(stats.executionCount == 0);
+    CHECK(stats.fullScan);
+    CHECK(!stats.usesIndex);
+
+    CBLQuery_SetStatsEnabled(query, true);
+    CBLError error;
+    for (int i = 0; i < 3; ++i) {
+        CBLResultSet *rs = CBLQuery_Execute(query, &error);
+        REQUIRE(rs);
+        CBLResultSet_Release(rs);
+    }
+    stats = CBLQuery_GetStats(query);
+    CHECK(stats.executionCount == 3);
+    CHECK(stats.lastRowCount == 5);
+    CHECK(stats.totalRowCount == 15);
+    CHECK(stats.maxExecutionTime >= stats.lastExecutionTime);
+    CHECK(stats.totalExecutionTime >= stats.maxExecutionTime);
+
+    // With an index, the query no longer scans the whole database:
+    CBLIndexSpec index = {kCBLValueIndex, "[[\".n\"]]"};
+    REQUIRE(CBLDatabase_CreateIndex(db, "byN", index, &error));
+    CBLQuery_Release(query);
+    query = newQuery("{WHAT: [['.name']], WHERE: ['>', ['.n'], 4]}");
+    stats = CBLQuery_GetStats(query);
+    CHECK(stats.usesIndex);
+    CHECK(!stats.fullScan);
+
+    // Slow-query callback, with a threshold every query exceeds:
+    struct Slow {CBLQuery *query = nullptr; uint64_t rows = 0;} slow;
+    CBLDatabase_SetSlowQueryCallback(db, 1e-9, [](void *context, CBLQuery *q, double time,
+                                                  uint64_t rowCount) {
+        auto s = (Slow*)context;
+        s->query = q;
+        s->rows = rowCount;
+    }, &slow);
+    CBLResultSet *rs = CBLQuery_Execute(query, &error);
+    REQUIRE(rs);
+    CBLResultSet_Release(rs);
+    CHECK(slow.query == query);
+    CHECK(slow.rows == 5);
+    CBLDatabase_SetSlowQueryCallback(db, 0, nullptr, nullptr);
+
+    CBLQuery_Release(query);
+}
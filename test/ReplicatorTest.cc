@@ -0,0 +1,350 @@
+//
+// ReplicatorTest.cc
+//
+// Copyright © 2019 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "CBLTest.hh"
+#include "CBLReplicator.h"
+#include "../src/CBLPrivate.h"
+#include "fleece/Fleece.hh"
+#include "fleece/Mutable.hh"
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <thread>
+
+using namespace std;
+using namespace fleece;
+
+
+class ReplicatorTest : public CBLTest {
+public:
+    ReplicatorTest() {
+        endpoint = CBLEndpoint_NewWithURL("ws://localhost:4984/scratch");
+        config.database = db;
+        config.endpoint = endpoint;
+        config.replicatorType = kCBLReplicatorTypePush;
+    }
+
+    ~ReplicatorTest() {
+        CBLReplicator_Release(repl);
+        CBLEndpoint_Free(endpoint);
+    }
+
+    CBLEndpoint *endpoint;
+    CBLReplicatorConfiguration config = {};
+    CBLReplicator *repl = nullptr;
+};
+
+
+TEST_CASE_METHOD(ReplicatorTest, "Replication Filter Expression") {
+    MutableDict params = MutableDict::newDict();
+    params["region"] = "west";
+    config.filterParameters = params;
+    CBLError error;
+
+    SECTION("Valid") {
+        config.pushFilterExpression =
+            "[\"AND\", [\"=\", [\".type\"], \"order\"], [\"=\", [\".region\"], [\"$region\"]]]"_sl;
+        repl = CBLReplicator_New(&config, &error);
+        CHECK(repl);
+    }
+    SECTION("Invalid JSON") {
+        config.pushFilterExpression = "[\"=\", [\".type\"]"_sl;
+        repl = CBLReplicator_New(&config, &error);
+        CHECK(!repl);
+        CHECK(error.domain == CBLFleeceDomain);
+    }
+    SECTION("Unknown operator") {
+        config.pullFilterExpression = "[\"LIKE\", [\".type\"], \"ord%\"]"_sl;
+        repl = CBLReplicator_New(&config, &error);
+        CHECK(!repl);
+        CHECK(error.domain == CBLDomain);
+        CHECK(error.code == CBLErrorInvalidQuery);
+    }
+    SECTION("Missing parameter") {
+        config.pushFilterExpression = "[\"=\", [\".region\"], [\"$country\"]]"_sl;
+        repl = CBLReplicator_New(&config, &error);
+        CHECK(!repl);
+        CHECK(error.code == CBLErrorInvalidQuery);
+    }
+}
+
+
+TEST_CASE_METHOD(ReplicatorTest, "Replication Filter Expression Matching") {
+    MutableDict params = MutableDict::newDict();
+    params["region"] = "west";
+    params["other"] = "east";
+    Doc doc = Doc::fromJSON(R"({"type": "order", "region": "west", "total": 42,
+                                "customer": {"name": "Zed"}})"_sl);
+    Dict body = doc.root().asDict();
+    REQUIRE(body);
+
+    auto matches = [&](const char *expression) {
+        CBLError error = {};
+        int result = CBLReplicator_TestFilterExpression(slice(expression), params,
+                                                        "doc1"_sl, false, body, &error);
+        CHECK((result < 0) == (error.code != 0));
+        return result;
+    };
+
+    // Comparisons:
+    CHECK(matches(R"(["=", [".type"], "order"])") == 1);
+    CHECK(matches(R"(["=", [".type"], "invoice"])") == 0);
+    CHECK(matches(R"(["!=", [".total"], 42])") == 0);
+    CHECK(matches(R"([">", [".total"], 40])") == 1);
+    CHECK(matches(R"(["<", [".total"], 40])") == 0);
+    CHECK(matches(R"([">=", [".total"], 42])") == 1);
+    CHECK(matches(R"(["=", [".customer.name"], "Zed"])") == 1);
+    CHECK(matches(R"(["=", ["._id"], "doc1"])") == 1);
+    CHECK(matches(R"(["IN", [".region"], ["[]", "east", "west"]])") == 1);
+    CHECK(matches(R"(["IN", [".region"], ["[]", "north", "south"]])") == 0);
+
+    // Parameters:
+    CHECK(matches(R"(["=", [".region"], ["$region"]])") == 1);
+    CHECK(matches(R"(["=", [".region"], ["$other"]])") == 0);
+
+    // Missing properties don't compare equal, unequal, or ordered to anything:
+    CHECK(matches(R"(["=", [".missing"], "x"])") == 0);
+    CHECK(matches(R"(["!=", [".missing"], "x"])") == 0);
+    CHECK(matches(R"(["<", [".missing"], 5])") == 0);
+    CHECK(matches(R"(["=", [".customer.missing"], "Zed"])") == 0);
+    CHECK(matches(R"(["EXISTS", [".missing"]])") == 0);
+    CHECK(matches(R"(["NOT", ["EXISTS", [".missing"]]])") == 1);
+
+    // AND and OR:
+    CHECK(matches(R"(["AND", ["=", [".type"], "order"], ["=", [".region"], ["$region"]]])") == 1);
+    CHECK(matches(R"(["AND", ["=", [".type"], "order"], ["=", [".region"], "east"]])") == 0);
+    CHECK(matches(R"(["OR", ["=", [".type"], "invoice"], [">", [".total"], 10]])") == 1);
+    CHECK(matches(R"(["OR", ["=", [".type"], "invoice"], ["<", [".total"], 10]])") == 0);
+
+    // Deleted documents:
+    CBLError error;
+    CHECK(CBLReplicator_TestFilterExpression(R"(["._deleted"])"_sl, params, "doc1"_sl,
+                                             true, body, &error) == 1);
+
+    // Invalid expressions:
+    CHECK(matches(R"(["", [".type"]])") == -1);
+    CHECK(matches(R"(["=", [".type"]])") == -1);
+    CHECK(matches(R"(["=", [".type"], ["$country"]])") == -1);
+}
+
+
+TEST_CASE_METHOD(ReplicatorTest, "Replicator Listeners") {
+    CBLError error;
+    repl = CBLReplicator_New(&config, &error);
+    REQUIRE(repl);
+
+    auto statusListener = [](void *context, CBLReplicator*, const CBLReplicatorStatus*) { };
+    auto docListener = [](void *context, CBLReplicator*, bool isPush,
+                          unsigned numDocuments, const CBLReplicatedDocument *documents) { };
+    CBLChangeCoalescingOptions options = {0.5, 1000};
+    CBLListenerToken *t1 = CBLReplicator_AddChangeListener(repl, statusListener, nullptr);
+    CBLListenerToken *t2 = CBLReplicator_AddDocumentListener(repl, docListener, nullptr);
+    CBLListenerToken *t3 = CBLReplicator_AddCoalescedDocumentListener(repl, &options,
+                                                                       docListener, nullptr);
+    CHECK(t1);
+    CHECK(t2);
+    CHECK(t3);
+    CBLListener_Remove(t2);
+    CBLListener_Remove(t1);
+    CBLListener_Remove(t3);
+}
+
+
+// Records the batches delivered to a replicated-document listener.
+struct DocBatches {
+    vector<vector<string>> batches;
+    bool allPushed {true};
+
+    static void listener(void *context, CBLReplicator*, bool isPush,
+                         unsigned numDocuments, const CBLReplicatedDocument *documents)
+    {
+        auto self = (DocBatches*)context;
+        vector<string> batch;
+        for (unsigned i = 0; i < numDocuments; ++i)
+            batch.push_back(documents[i].ID);
+        self->batches.push_back(batch);
+        self->allPushed = self->allPushed && isPush;
+    }
+};
+
+
+TEST_CASE_METHOD(ReplicatorTest, "Coalesced Document Listener") {
+    CBLError error;
+    repl = CBLReplicator_New(&config, &error);
+    REQUIRE(repl);
+    DocBatches docs;
+    const char* const ids[] = {"a", "b", "c", "d"};
+
+    SECTION("Flushed at maxChanges") {
+        CBLChangeCoalescingOptions options = {10.0, 3};
+        auto token = CBLReplicator_AddCoalescedDocumentListener(repl, &options,
+                                                                 DocBatches::listener, &docs);
+        CBLReplicator_SimulateDocumentsEnded(repl, true, 2, &ids[0]);
+        CHECK(docs.batches.empty());
+        CBLReplicator_SimulateDocumentsEnded(repl, true, 2, &ids[2]);
+        CHECK(docs.batches == (vector<vector<string>>{{"a", "b", "c"}, {"d"}}));
+        CHECK(docs.allPushed);
+        CBLListener_Remove(token);      // (cancels the 10-second timer)
+    }
+    SECTION("Flushed after interval") {
+        CBLChangeCoalescingOptions options = {0.2, 0};
+        auto token = CBLReplicator_AddCoalescedDocumentListener(repl, &options,
+                                                                 DocBatches::listener, &docs);
+        // (Buffered, so the listener is called on this thread, not the timer's.)
+        CBLDatabase_BufferNotifications(db, [](void*, CBLDatabase*) { }, nullptr);
+        CBLReplicator_SimulateDocumentsEnded(repl, true, 1, &ids[0]);
+        CBLReplicator_SimulateDocumentsEnded(repl, true, 2, &ids[1]);
+        CBLDatabase_SendNotifications(db);
+        CHECK(docs.batches.empty());        // the interval hasn't ended yet
+        for (int i = 0; i < 100 && docs.batches.empty(); ++i) {
+            this_thread::sleep_for(chrono::milliseconds(20));
+            CBLDatabase_SendNotifications(db);
+        }
+        CHECK(docs.batches == (vector<vector<string>>{{"a", "b", "c"}}));
+        CHECK(docs.allPushed);
+        CBLListener_Remove(token);
+    }
+}
+
+
+TEST_CASE_METHOD(ReplicatorTest, "Replicator Stats") {
+    CBLError error;
+    repl = CBLReplicator_New(&config, &error);
+    REQUIRE(repl);
+    CBLReplicatorStats stats = CBLReplicator_Stats(repl);
+    CHECK(stats.activity == kCBLReplicatorStopped);
+    CHECK(stats.documentsPushed == 0);
+    CHECK(stats.documentsPulled == 0);
+    CHECK(stats.filterCalls == 0);
+    CHECK(stats.filterTime == 0.0);
+    CHECK(CBLReplicator_Status(repl).activity == kCBLReplicatorStopped);
+}
+
+
+TEST_CASE_METHOD(ReplicatorTest, "Replicator Group") {
+    CBLError error;
+    repl = CBLReplicator_New(&config, &error);
+    REQUIRE(repl);
+
+    CBLReplicatorGroupOptions options = {4, 10.0};
+    CBLReplicatorGroup *group = CBLReplicatorGroup_New(&options);
+    CHECK(CBLReplicatorGroup_Add(group, repl, 0));
+    CHECK(!CBLReplicatorGroup_Add(group, repl, 1));
+    CHECK(CBLReplicatorGroup_ActiveCount(group) == 0);
+    CHECK(CBLReplicatorGroup_WaitingCount(group) == 1);
+    CBLReplicatorGroup_Remove(group, repl);
+    CHECK(CBLReplicatorGroup_WaitingCount(group) == 0);
+    CBLReplicatorGroup_Release(group);
+}
+
+
+TEST_CASE_METHOD(ReplicatorTest, "Replicator Group Scheduling") {
+    // (There's no server, so the replicators just keep trying to connect.)
+    config.continuous = true;
+    CBLError error;
+    repl = CBLReplicator_New(&config, &error);
+    REQUIRE(repl);
+    CBLReplicator *repl2 = CBLReplicator_New(&config, &error);
+    REQUIRE(repl2);
+
+    auto isRunning = [](CBLReplicator *r) {
+        return CBLReplicator_Status(r).activity != kCBLReplicatorStopped;
+    };
+    auto waitFor = [](function<bool()> condition) {
+        for (int i = 0; i < 250 && !condition(); ++i)
+            this_thread::sleep_for(chrono::milliseconds(20));
+        return condition();
+    };
+
+    CBLReplicatorGroupOptions options = {1, 0.3};
+    CBLReplicatorGroup *group = CBLReplicatorGroup_New(&options);
+    CHECK(CBLReplicatorGroup_Add(group, repl, 0));
+    CHECK(CBLReplicatorGroup_Add(group, repl2, 5));
+    CHECK(CBLReplicatorGroup_ActiveCount(group) == 0);     // not started yet
+    CHECK(CBLReplicatorGroup_WaitingCount(group) == 2);
+
+    // Only one may run at a time, and the higher-priority one goes first:
+    CBLReplicatorGroup_Start(group);
+    CHECK(CBLReplicatorGroup_ActiveCount(group) == 1);
+    CHECK(CBLReplicatorGroup_WaitingCount(group) == 1);
+    CHECK(isRunning(repl2));
+    CHECK(!isRunning(repl));
+
+    // When its time slice ends, it's stopped so the other one can run:
+    CHECK(waitFor([&] {return isRunning(repl) && !isRunning(repl2);}));
+    CHECK(CBLReplicatorGroup_ActiveCount(group) == 1);
+
+    CBLReplicatorGroup_Stop(group);
+    CHECK(waitFor([&] {return CBLReplicatorGroup_ActiveCount(group) == 0;}));
+    CHECK(waitFor([&] {return !isRunning(repl) && !isRunning(repl2);}));
+    CBLReplicatorGroup_Release(group);
+    CBLReplicator_Release(repl2);
+}
+
+
+#ifdef COUCHBASE_ENTERPRISE
+TEST_CASE_METHOD(ReplicatorTest, "Local-To-Local Replication") {
+    CBLError error;
+    CBL_DeleteDatabase("CBLtest_target", kDatabaseConfiguration.directory, &error);
+    CBLDatabase *target = CBLDatabase_Open("CBLtest_target", &kDatabaseConfiguration, &error);
+    REQUIRE(target);
+
+    for (int i = 0; i < 10; ++i) {
+        char docID[20];
+        sprintf(docID, "doc-%03d", i);
+        CBLDocument *doc = CBLDocument_New(docID);
+        MutableDict props = CBLDocument_MutableProperties(doc);
+        props["n"] = i;
+        const CBLDocument *saved = CBLDatabase_SaveDocument(db, doc,
+                                                            kCBLConcurrencyControlFailOnConflict,
+                                                            &error);
+        REQUIRE(saved);
+        CBLDocument_Release(saved);
+        CBLDocument_Release(doc);
+    }
+
+    CBLEndpoint_Free(endpoint);
+    endpoint = CBLEndpoint_NewWithLocalDB(target);
+    config.endpoint = endpoint;
+
+    SECTION("Same database") {
+        CBLEndpoint_Free(endpoint);
+        endpoint = CBLEndpoint_NewWithLocalDB(db);
+        config.endpoint = endpoint;
+        CHECK(!CBLReplicator_New(&config, &error));
+    }
+    SECTION("Push") {
+        repl = CBLReplicator_New(&config, &error);
+        REQUIRE(repl);
+        CBLReplicator_Start(repl);
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+        do {
+            this_thread::sleep_for(chrono::milliseconds(50));
+        } while (CBLReplicator_Status(repl).activity != kCBLReplicatorStopped
+                    && chrono::steady_clock::now() < deadline);
+        CBLReplicatorStatus status = CBLReplicator_Status(repl);
+        CHECK(status.activity == kCBLReplicatorStopped);
+        CHECK(status.error.code == 0);
+        CHECK(CBLDatabase_Count(target) == 10);
+        CHECK(CBLReplicator_Stats(repl).documentsPushed == 10);
+    }
+
+    CBLDatabase_Delete(target, &error);
+    CBLDatabase_Release(target);
+}
+#endif